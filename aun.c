@@ -31,6 +31,7 @@
  */ 
 
 #include <sys/types.h>
+#include <sys/select.h>
 #include <sys/socket.h>
 #include <sys/time.h>
 
@@ -45,38 +46,175 @@
 #include <stdlib.h>
 #include <string.h>
 #include <syslog.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "aun.h"
 #include "extern.h"
 #include "version.h"
 
-static void aun_ack(int sock, struct aun_packet *pkt, struct sockaddr_in *from,
-    int);
+static void aun_ack(struct aun_packet *pkt, struct sockaddr_in *from, int);
+static void aun_immediate(struct aun_packet *, struct sockaddr_in *);
+static void udp_open(const struct sockaddr_in *);
+static ssize_t udp_send(const void *, size_t, const struct sockaddr_in *);
+static ssize_t udp_recv(void *, size_t, int, struct sockaddr_in *, long);
+static int udp_wait(int, int);
+static uint64_t udp_clock(void);
 
-int sock;
+static int sock;
 unsigned char buf[65536];
 int default_timeout = 100000;
+int default_retries = 50;
+char *aun_listen_addr = NULL;	/* set by conf_lex.l */
 
 union internal_addr {
     struct aun_srcaddr srcaddr;
     struct in_addr sin_addr;
 };
 
+const struct aun_net aun_udp = {
+    udp_open,
+    udp_send,
+    udp_recv,
+    udp_wait,
+    udp_clock,
+};
+
+const struct aun_net *aun_net = &aun_udp;
+
+/*
+ * The UDP socket that both transports normally use (see struct
+ * aun_net).
+ */
 static void
-aun_setup(void)
+udp_open(const struct sockaddr_in *name)
 {
-    struct sockaddr_in name;
 
     sock = socket(AF_INET, SOCK_DGRAM, 0);
     if (sock < 0)
         err(1, "socket");
+    if (bind(sock, (const struct sockaddr *)name, sizeof(*name)))
+        err(1, "bind");
+}
+
+static ssize_t
+udp_send(const void *data, size_t len, const struct sockaddr_in *to)
+{
+
+    return sendto(sock, data, len, 0, (const struct sockaddr *)to,
+        sizeof(*to));
+}
+
+/*
+ * Empty datagrams are thrown away, so that 0 only ever means that
+ * nothing came.
+ */
+static ssize_t
+udp_recv(void *data, size_t len, int flags, struct sockaddr_in *from,
+    long usec)
+{
+    socklen_t fromlen;
+    struct timeval timeout;
+    fd_set r;
+    ssize_t n;
+
+    for (;;) {
+        if (usec >= 0) {
+            FD_ZERO(&r);
+            FD_SET(sock, &r);
+            timeout.tv_sec = usec / 1000000;
+            timeout.tv_usec = usec % 1000000;
+            if (select(sock + 1, &r, NULL, NULL, &timeout) <= 0)
+                return 0;
+            flags |= MSG_DONTWAIT;
+        }
+        fromlen = sizeof(*from);
+        n = recvfrom(sock, data, len, flags, (struct sockaddr *)from,
+            &fromlen);
+        if (n != 0)
+            return n;
+        if (flags & MSG_PEEK)
+            recvfrom(sock, data, len, MSG_DONTWAIT, NULL, NULL);
+    }
+}
+
+/*
+ * Wait up to secs seconds for a packet to turn up, or for fd (if not
+ * -1) to become readable.  Returns -1 on error, otherwise whether a
+ * packet turned up.
+ */
+static int
+udp_wait(int secs, int fd)
+{
+    fd_set r;
+    struct timeval timeout;
+    int n;
+
+    FD_ZERO(&r);
+    FD_SET(sock, &r);
+    if (fd != -1)
+        FD_SET(fd, &r);
+    timeout.tv_sec = secs;
+    timeout.tv_usec = 0;
+    n = select((fd > sock ? fd : sock) + 1, &r, NULL, NULL, &timeout);
+    if (n <= 0)
+        return n;
+    return FD_ISSET(sock, &r);
+}
+
+static uint64_t
+udp_clock(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void
+aun_setup(void)
+{
+    struct sockaddr_in name;
+
     memset(&name, 0, sizeof(name));
     name.sin_family = AF_INET;
-    name.sin_addr.s_addr = INADDR_ANY;
+    if (aun_listen_addr == NULL)
+        name.sin_addr.s_addr = INADDR_ANY;
+    else if (inet_aton(aun_listen_addr, &name.sin_addr) == 0)
+        errx(1, "bad listen address %s", aun_listen_addr);
     name.sin_port = htons(PORT_AUN);
-    if (bind(sock, (struct sockaddr*)&name, sizeof(name)))
-        err(1, "bind");
+    aun_net->open(&name);
+}
+
+/*
+ * Deal with an immediate operation, or the reply to one of ours.
+ */
+static void
+aun_immediate(struct aun_packet *pkt, struct sockaddr_in *from)
+{
+    union internal_addr replyfrom;
+
+    switch (pkt->type) {
+    case AUN_TYPE_IMMEDIATE:
+        if (pkt->flag == 8) {
+            /* Echo request? */
+            pkt->type = AUN_TYPE_IMM_REPLY;
+            pkt->data[0] = AUND_MACHINE_PEEK_LO;
+            pkt->data[1] = AUND_MACHINE_PEEK_HI;
+            pkt->data[2] = AUND_VERSION_MINOR;
+            pkt->data[3] = AUND_VERSION_MAJOR;
+            if (aun_net->send(pkt, 12, from) == -1) {
+                err(1, "sendto(echo reply)");
+            }
+            if (debug) printf(" (echo request)");
+        }
+        break;
+    case AUN_TYPE_IMM_REPLY:
+        memset(&replyfrom, 0, sizeof(replyfrom));
+        replyfrom.sin_addr = from->sin_addr;
+        fs_probe_reply(&replyfrom.srcaddr);
+        break;
+    }
 }
 
 static struct aun_packet *
@@ -88,10 +226,13 @@ aun_recv(ssize_t *outsize, struct aun_srcaddr *vfrom, int want_port)
     struct sockaddr_in from;
 
     while (1) {
-        socklen_t fromlen = sizeof(from);
         int i;
-        msgsize = recvfrom(sock, pkt, sizeof(buf), 0,
-                (struct sockaddr *)&from, &fromlen);
+        msgsize = aun_net->recv(pkt, sizeof(buf), 0, &from, -1);
+        if (msgsize == 0) {
+            /* Only aundsim's network goes quiet for good. */
+            errno = ETIMEDOUT;
+            return NULL;
+        }
         if (msgsize == -1)
             err(1, "recvfrom");
         if (0) {
@@ -105,21 +246,8 @@ aun_recv(ssize_t *outsize, struct aun_srcaddr *vfrom, int want_port)
         from.sin_port = htons(PORT_AUN);
         switch (pkt->type) {
         case AUN_TYPE_IMMEDIATE:
-            if (pkt->flag == 8) {
-                /* Echo request? */
-                pkt->type = AUN_TYPE_IMM_REPLY;
-                pkt->data[0] = AUND_MACHINE_PEEK_LO;
-                pkt->data[1] = AUND_MACHINE_PEEK_HI;
-                pkt->data[2] = AUND_VERSION_MINOR;
-                pkt->data[3] = AUND_VERSION_MAJOR;
-                if (sendto(sock, buf, 12, 0,
-                            (struct sockaddr*)&from,
-                            sizeof(from))
-                        == -1) {
-                    err(1, "sendto(echo reply)");
-                }
-                if (debug) printf(" (echo request)");
-            }
+        case AUN_TYPE_IMM_REPLY:
+            aun_immediate(pkt, &from);
             break;
         case AUN_TYPE_UNICAST:
         case AUN_TYPE_BROADCAST:
@@ -127,22 +255,52 @@ aun_recv(ssize_t *outsize, struct aun_srcaddr *vfrom, int want_port)
                 (afrom->sin_addr.s_addr == htons(INADDR_ANY) ||
                  from.sin_addr.s_addr == afrom->sin_addr.s_addr)) {
                 if (pkt->type == AUN_TYPE_UNICAST)
-                    aun_ack(sock, pkt, &from, AUN_TYPE_ACK);
+                    aun_ack(pkt, &from, AUN_TYPE_ACK);
                 /* Real packet; return it. */
+                aun_stats.rx_packets++;
+                aun_stats.rx_bytes += msgsize;
                 *outsize = msgsize;
                 afrom->sin_addr = from.sin_addr;
+                capture_packet(pkt, msgsize, vfrom, false);
                 return pkt;
             } else {
                 if (pkt->type == AUN_TYPE_UNICAST)
-                    aun_ack(sock, pkt, &from, AUN_TYPE_REJ);
+                    aun_ack(pkt, &from, AUN_TYPE_REJ);
             }
             break;
         }
     }
 }
 
+/*
+ * Wait up to secs seconds for a packet to turn up, or for fd (if not
+ * -1) to become readable.  Returns zero if no packet turned up.
+ * Immediate operations and stray acknowledgements are dealt with
+ * here, since aun_recv would block waiting for something more.
+ */
+static int
+aun_wait(int secs, int fd)
+{
+    struct aun_packet *pkt = (struct aun_packet *)buf;
+    struct sockaddr_in from;
+    int n;
+
+    if ((n = aun_net->wait(secs, fd)) <= 0)
+        return n;
+    for (;;) {
+        if (aun_net->recv(buf, sizeof(buf), MSG_PEEK, &from, 0) <= 0)
+            return 0;
+        if (pkt->type == AUN_TYPE_UNICAST || pkt->type == AUN_TYPE_BROADCAST)
+            return 1;
+        if (aun_net->recv(buf, sizeof(buf), 0, &from, 0) <= 0)
+            return 0;
+        from.sin_port = htons(PORT_AUN);
+        aun_immediate(pkt, &from);
+    }
+}
+
 static void
-aun_ack(int sock, struct aun_packet *pkt, struct sockaddr_in *from, int type)
+aun_ack(struct aun_packet *pkt, struct sockaddr_in *from, int type)
 {
     struct aun_packet ack; /* No data */
     int i;
@@ -151,8 +309,7 @@ aun_ack(int sock, struct aun_packet *pkt, struct sockaddr_in *from, int type)
     ack.flag = 0;
     ack.retrans = 0;
     for (i=0; i < 4; i++) ack.seq[i] = pkt->seq[i];
-    if (sendto(sock, &ack, sizeof(ack), 0,
-        (struct sockaddr *)from, sizeof(*from)) == -1) {
+    if (aun_net->send(&ack, sizeof(ack), from) == -1) {
         err(1, "sendto (ack)");
     }
 }
@@ -164,12 +321,11 @@ aun_xmit(struct aun_packet *pkt, size_t len, struct aun_srcaddr *vto)
     struct aun_packet buf;
     union internal_addr *ato = (union internal_addr *)vto;
     struct sockaddr_in from, to;
-    socklen_t fromlen;
+    uint64_t now, deadline;
     int i;
     ssize_t retval;
     int count;
 
-    fromlen = sizeof(from);
     pkt->retrans = 0;
     pkt->seq[0] = (sequence & 0x000000ff);
     pkt->seq[1] = (sequence & 0x0000ff00) >> 8;
@@ -186,44 +342,38 @@ aun_xmit(struct aun_packet *pkt, size_t len, struct aun_srcaddr *vto)
         }
         printf(" to UDP port %hu\n", ntohs(to.sin_port));
     }
-    count = 50;
+    aun_stats.tx_packets++;
+    aun_stats.tx_bytes += len;
+    capture_packet(pkt, len, vto, true);
+    count = default_retries;
     while (count--) {
-        retval = sendto(sock, pkt, len, 0, (struct sockaddr *)&to,
-            sizeof(to));
+        retval = aun_net->send(pkt, len, &to);
         /* Grotty hack to see if it works */
         if (retval < 0) return retval;
         if (pkt->type == AUN_TYPE_UNICAST) {
-            int nready;
-            fd_set fdset;
-            struct timeval timeout;
-
-            timeout.tv_sec = 0;
-            timeout.tv_usec = default_timeout;
-            FD_ZERO(&fdset);
-            FD_SET(sock, &fdset);
-            do {
-                nready = select(FD_SETSIZE, &fdset, NULL, NULL,
-                    &timeout);
-                if (FD_ISSET(sock, &fdset)) {
-                    recvfrom(sock, &buf, sizeof(buf), 0,
-                        (struct sockaddr *)&from, &fromlen);
-                    /*
-                     * Is this an ack of the right
-                     * packet?
-                     */
-                    if (from.sin_addr.s_addr ==
-                        to.sin_addr.s_addr &&
-                        buf.type == AUN_TYPE_ACK &&
-                        memcmp(&(buf.seq),
-                          &(pkt->seq), 4) == 0)
-                        return retval;
-                }
-            } while (nready > 0);
+            deadline = aun_net->clock() + default_timeout;
+            while ((now = aun_net->clock()) < deadline &&
+                aun_net->recv(&buf, sizeof(buf), 0, &from,
+                    deadline - now) > 0) {
+                /*
+                 * Is this an ack of the right
+                 * packet?
+                 */
+                if (from.sin_addr.s_addr ==
+                    to.sin_addr.s_addr &&
+                    buf.type == AUN_TYPE_ACK &&
+                    memcmp(&(buf.seq),
+                      &(pkt->seq), 4) == 0)
+                    return retval;
+            }
             /* Timeout.  Retransmit. */
+            if (count > 0)
+                aun_stats.retransmits++;
         } else {
             return retval;
         }
     }
+    aun_stats.timeouts++;
     errno = ETIMEDOUT;
     return -1;
 }
@@ -235,6 +385,21 @@ aun_ntoa(struct aun_srcaddr *vfrom)
     return inet_ntoa(afrom->sin_addr);
 }
 
+/*
+ * Send a machine type peek to a station, to see if it's still there.
+ * Any reply is passed to fs_probe_reply by aun_recv.
+ */
+static int
+aun_probe(struct aun_srcaddr *vto)
+{
+    struct aun_packet pkt;
+
+    memset(&pkt, 0, sizeof(pkt));
+    pkt.type = AUN_TYPE_IMMEDIATE;
+    pkt.flag = 8;
+    return aun_xmit(&pkt, sizeof(pkt), vto) == -1 ? -1 : 0;
+}
+
 static void
 aun_get_stn(struct aun_srcaddr *vfrom, uint8_t *out)
 {
@@ -252,7 +417,9 @@ const struct aun_funcs aun = {
     AUN_MAX_BLOCK,
     aun_setup,
     aun_recv,
+        aun_wait,
         aun_xmit,
         aun_ntoa,
         aun_get_stn,
+        aun_probe,
 };
@@ -49,17 +49,17 @@
 
 #define EC_PORT_FS 0x99
 
-extern const struct aun_funcs aun, beebem;
-
 int debug = 0;
 int foreground = 0;
 int using_syslog = 1;
 char *beebem_cfg_file = NULL;
 const struct aun_funcs *aunfuncs = &aun;
+struct aun_stats aun_stats;
 char *progname;
 int default_fsstation = 254;
 
 volatile int painful_death = 0;
+volatile int reload_pending = 0;
 
 static void sig_init(void);
 static void sigcatcher(int);
@@ -156,6 +156,7 @@ main(int argc, char *argv[])
     if (debug) setlinebuf(stdout);
 
     aunfuncs->setup();
+    capture_open();
 
     /*
      * We'll use relative pathnames for all our file accesses,
@@ -189,8 +190,18 @@ main(int argc, char *argv[])
         struct aun_packet *pkt;
         struct aun_srcaddr from;
 
+        /*
+         * Give the file server a chance to do housekeeping at
+         * least once a second, even if nobody's talking to us.
+         */
+        fs_periodic();
+        capture_flush();
+        if (aunfuncs->wait(1, fs_wait_fd()) <= 0)
+            continue;
         memset(&from, 0, sizeof(from)); /* all hosts */
         pkt = aunfuncs->recv(&msgsize, &from, EC_PORT_FS);
+        if (pkt == NULL)
+            continue;	/* BeebEm scout with no payload */
 
         switch (pkt->dest_port) {
         case EC_PORT_FS:
@@ -215,11 +226,16 @@ sig_init(void)
     sigemptyset(&(sa.sa_mask));
     sa.sa_flags = 0;
     sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGHUP, &sa, NULL);
 }
 
 static void
 sigcatcher(int s)
 {
 
-    painful_death = 1;
+    if (s == SIGHUP)
+        reload_pending = 1;
+    else
+        painful_death = 1;
 }
@@ -0,0 +1,650 @@
+/*-
+ * Copyright (c) 2010 Simon Tatham
+ * Copyright (c) 2010 Ben Harris
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/*
+ * aundbench - time the file server's name translation, listing and
+ * encoding code in isolation.
+ *
+ * Each benchmark calls one function over and over, with no network and
+ * no clients, and reports the time per call in nanoseconds.  Those
+ * that depend on what's in a directory run over generated directories
+ * of several sizes, made afresh under a temporary directory, with a
+ * mix of plain, typed (",xxx"), dot-stuffed, over-long and
+ * typemapped names, and .Acorn metadata on some.  Every benchmark is
+ * run until it has taken long enough to time well, and then several
+ * times more; the fastest and the median are reported, since the
+ * fastest is the least disturbed by whatever else the machine was
+ * doing.
+ */
+
+#if HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <fts.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "extern.h"
+#include "fileserver.h"
+#include "fs_internal.h"
+
+#define BENCH_RUNS	5
+#define BENCH_MINTIME	20	/* ms each run should take */
+#define BENCH_EXAMINE	20	/* Entries in each EXAMINE reply */
+#define BENCH_MAXDIRS	8
+#define BENCH_EXAMINE_ALL_32 0x100	/* EC_FS_EXAMINE_ALL for EXAMINE_32 */
+
+struct bench_dir {
+    int size;
+    char name[16];		/* "d1000" */
+    char exact[32];		/* An entry, as a client would name it */
+    char missing[32];		/* A name that matches nothing */
+    struct fs_client client;	/* Holds the listing */
+    FTSENT **ents;		/* Entries EXAMINE would show */
+    char **names;		/* Their names before acornifying */
+    int nents;
+    char **all;			/* Every name, including hidden ones */
+    int nall;
+};
+
+struct bench {
+    const char *name;
+    bool perdir;		/* Run over each directory */
+    void (*fn)(struct bench_dir *, unsigned long);
+};
+
+/* What aund.c provides in aund */
+int debug = 0;
+int using_syslog = 0;
+char *beebem_cfg_file = NULL;
+struct aun_stats aun_stats;
+int default_fsstation = 254;
+volatile int reload_pending = 0;
+const struct aun_funcs *aunfuncs = &aun;
+
+static char *progname;
+static struct fs_context bench_c;
+static struct ec_fs_req bench_req;
+static struct fs_client bench_client;
+static char bench_buf[1024];
+static unsigned long bench_mintime = BENCH_MINTIME * 1000000UL;
+static int bench_runs = BENCH_RUNS;
+static volatile unsigned long bench_sink;
+static char bench_tmp[1024];		/* Where the directories are */
+
+static void usage(void);
+static double bench_clock(void);
+static void bench_trans_simple(struct bench_dir *, unsigned long);
+static void bench_unhat(struct bench_dir *, unsigned long);
+static void bench_wcmatch(struct bench_dir *, unsigned long);
+static void bench_hidden(struct bench_dir *, unsigned long);
+static void bench_acornify(struct bench_dir *, unsigned long);
+static void bench_unixify_hit(struct bench_dir *, unsigned long);
+static void bench_unixify_miss(struct bench_dir *, unsigned long);
+static void bench_unixify_scan(struct bench_dir *, unsigned long);
+static void bench_examine_read(struct bench_dir *, unsigned long);
+static void bench_guess_type(struct bench_dir *, unsigned long);
+static void bench_get_meta(struct bench_dir *, unsigned long);
+static void bench_examine(struct bench_dir *, unsigned long, int);
+static void bench_examine_all(struct bench_dir *, unsigned long);
+static void bench_examine_all_32(struct bench_dir *, unsigned long);
+static void bench_examine_name(struct bench_dir *, unsigned long);
+static void bench_examine_shorttxt(struct bench_dir *, unsigned long);
+static void bench_examine_longtxt(struct bench_dir *, unsigned long);
+static void bench_restore(struct bench_dir *);
+static double bench_time(const struct bench *, struct bench_dir *,
+    unsigned long);
+static void bench_run(const struct bench *, struct bench_dir *);
+static int bench_cmp(const void *, const void *);
+static void bench_mkdir(struct bench_dir *, int);
+static void bench_list(struct bench_dir *);
+static void bench_rmtree(void);
+
+static const struct bench benches[] = {
+    { "trans_simple",		false,	bench_trans_simple },
+    { "unhat",			false,	bench_unhat },
+    { "wcmatch",		false,	bench_wcmatch },
+    { "hidden_name",		true,	bench_hidden },
+    { "acornify_name",		true,	bench_acornify },
+    { "unixify_cached",		true,	bench_unixify_hit },
+    { "unixify_uncached",	true,	bench_unixify_miss },
+    { "unixify_scan",		true,	bench_unixify_scan },
+    { "examine_read",		true,	bench_examine_read },
+    { "guess_type",		true,	bench_guess_type },
+    { "get_meta",		true,	bench_get_meta },
+    { "examine_all",		true,	bench_examine_all },
+    { "examine_all_32",		true,	bench_examine_all_32 },
+    { "examine_name",		true,	bench_examine_name },
+    { "examine_shorttxt",	true,	bench_examine_shorttxt },
+    { "examine_longtxt",	true,	bench_examine_longtxt },
+};
+
+static void
+usage(void)
+{
+
+    fprintf(stderr, "usage: %s [-c config] [-d dir] [-n sizes] [-r runs] "
+        "[-t ms]\n\t[benchmark ...]\n", progname);
+    exit(EXIT_FAILURE);
+}
+
+/* In ns */
+static double
+bench_clock(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void
+bench_trans_simple(struct bench_dir *d, unsigned long n)
+{
+
+    while (n--)
+        fs_trans_simple(bench_buf, "Users.fred.Docs/Letters.^.!Boot.x/y");
+}
+
+static void
+bench_unhat(struct bench_dir *d, unsigned long n)
+{
+    static const char path[] = "./Users/fred/^/jim/Docs/^/^/Letters/x/^";
+
+    while (n--) {
+        memcpy(bench_buf, path, sizeof(path));
+        fs_unhat_path(bench_buf);
+    }
+}
+
+static void
+bench_wcmatch(struct bench_dir *d, unsigned long n)
+{
+    static char *const wc[] = { "file0001", "F*9", "*e0*4?", "Te?t*" };
+    static char *const file[] = { "File00017", "Text00099", "Prog00044",
+        "Basic0008" };
+    unsigned long i;
+
+    for (i = 0; i < n; i++)
+        bench_sink += wcmatch(wc[i & 3], file[(i >> 2) & 3], 9);
+}
+
+static void
+bench_hidden(struct bench_dir *d, unsigned long n)
+{
+    unsigned long i;
+
+    for (i = 0; i < n; i++)
+        bench_sink += fs_hidden_name(d->all[i % d->nall]);
+}
+
+static void
+bench_acornify(struct bench_dir *d, unsigned long n)
+{
+    unsigned long i;
+
+    for (i = 0; i < n; i++) {
+        strcpy(bench_buf, d->all[i % d->nall]);
+        fs_acornify_name(bench_buf);
+    }
+}
+
+/* The same name, over and over, as the path cache likes best */
+static void
+bench_unixify_hit(struct bench_dir *d, unsigned long n)
+{
+
+    while (n--) {
+        fs_arena_reset(bench_c.arena);
+        fs_unixify_path(&bench_c, d->exact);
+    }
+}
+
+/* With the cache out of date, the components have to be looked up */
+static void
+bench_unixify_miss(struct bench_dir *d, unsigned long n)
+{
+
+    while (n--) {
+        fs_arena_reset(bench_c.arena);
+        fs_pathcache_invalidate(NULL);
+        fs_unixify_path(&bench_c, d->exact);
+    }
+}
+
+/* A name that isn't there means reading the whole directory */
+static void
+bench_unixify_scan(struct bench_dir *d, unsigned long n)
+{
+
+    while (n--) {
+        fs_arena_reset(bench_c.arena);
+        fs_pathcache_invalidate(NULL);
+        fs_unixify_path(&bench_c, d->missing);
+    }
+}
+
+/* Listing a directory afresh */
+static void
+bench_examine_read(struct bench_dir *d, unsigned long n)
+{
+
+    bench_c.client = &bench_client;	/* Leave d's listing alone */
+    while (n--) {
+        bench_client.dir_cache.start = -1;	/* Make it read again */
+        if (fs_examine_read(&bench_c, d->name, 0) == -1)
+            err(1, "%s", d->name);
+    }
+}
+
+static void
+bench_guess_type(struct bench_dir *d, unsigned long n)
+{
+    struct fs_ent e;
+    unsigned long i;
+
+    for (i = 0; i < n; i++) {
+        fs_ent_from_fts(&e, d->ents[i % d->nents]);
+        bench_sink += fs_guess_type(&e);
+    }
+}
+
+static void
+bench_get_meta(struct bench_dir *d, unsigned long n)
+{
+    struct ec_fs_meta meta;
+    struct fs_ent e;
+    unsigned long i;
+
+    for (i = 0; i < n; i++) {
+        fs_ent_from_fts(&e, d->ents[i % d->nents]);
+        fs_get_meta(&e, &meta);
+    }
+}
+
+/*
+ * Encode n entries, BENCH_EXAMINE to a reply, as fs_examine() would.
+ * The builders acornify names in place, so each name is put back
+ * first; that's part of what's timed.
+ */
+static void
+bench_examine(struct bench_dir *d, unsigned long n, int arg)
+{
+    struct ec_fs_reply_examine *reply = NULL;
+    size_t reply_size = 0;
+    FTSENT *ent;
+    unsigned long i;
+    int k;
+
+    for (i = 0; i < n; i++) {
+        if (i % BENCH_EXAMINE == 0) {
+            fs_arena_reset(bench_c.arena);
+            reply_size = sizeof(*reply) + 1;
+            reply = fs_alloc(&bench_c, reply_size);
+        }
+        k = i % d->nents;
+        ent = d->ents[k];
+        strcpy(ent->fts_name, d->names[k]);
+        switch (arg) {
+        case EC_FS_EXAMINE_ALL:
+            fs_examine_all(&bench_c, ent, &reply, &reply_size);
+            break;
+        case BENCH_EXAMINE_ALL_32:
+            fs_examine_all_32(&bench_c, ent,
+                (struct ec_fs_reply_examine_32 **)&reply, &reply_size);
+            break;
+        case EC_FS_EXAMINE_NAME:
+            fs_examine_name(&bench_c, ent, &reply, &reply_size);
+            break;
+        case EC_FS_EXAMINE_SHORTTXT:
+            fs_examine_shorttxt(&bench_c, ent, &reply, &reply_size);
+            break;
+        case EC_FS_EXAMINE_LONGTXT:
+            fs_examine_longtxt(&bench_c, ent, &reply, &reply_size);
+            break;
+        }
+    }
+}
+
+static void
+bench_examine_all(struct bench_dir *d, unsigned long n)
+{
+
+    bench_examine(d, n, EC_FS_EXAMINE_ALL);
+}
+
+static void
+bench_examine_all_32(struct bench_dir *d, unsigned long n)
+{
+
+    bench_examine(d, n, BENCH_EXAMINE_ALL_32);
+}
+
+static void
+bench_examine_name(struct bench_dir *d, unsigned long n)
+{
+
+    bench_examine(d, n, EC_FS_EXAMINE_NAME);
+}
+
+static void
+bench_examine_shorttxt(struct bench_dir *d, unsigned long n)
+{
+
+    bench_examine(d, n, EC_FS_EXAMINE_SHORTTXT);
+}
+
+static void
+bench_examine_longtxt(struct bench_dir *d, unsigned long n)
+{
+
+    bench_examine(d, n, EC_FS_EXAMINE_LONGTXT);
+}
+
+/* Undo the builders' acornifying */
+static void
+bench_restore(struct bench_dir *d)
+{
+    int i;
+
+    for (i = 0; d != NULL && i < d->nents; i++)
+        strcpy(d->ents[i]->fts_name, d->names[i]);
+}
+
+/* How long n calls take, in ns */
+static double
+bench_time(const struct bench *b, struct bench_dir *d, unsigned long n)
+{
+    double t;
+
+    bench_c.client = d != NULL ? &d->client : &bench_client;
+    t = bench_clock();
+    b->fn(d, n);
+    t = bench_clock() - t;
+    bench_restore(d);
+    fs_arena_reset(bench_c.arena);
+    return t;
+}
+
+static int
+bench_cmp(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+/*
+ * Find how many calls take bench_mintime, and time that many
+ * bench_runs times.
+ */
+static void
+bench_run(const struct bench *b, struct bench_dir *d)
+{
+    double t, times[64];
+    unsigned long n;
+    int i;
+
+    for (n = 1; (t = bench_time(b, d, n)) < bench_mintime / 8; n *= 2)
+        ;
+    n = n * (bench_mintime / t) + 1;
+    for (i = 0; i < bench_runs; i++)
+        times[i] = bench_time(b, d, n) / n;
+    qsort(times, bench_runs, sizeof(times[0]), bench_cmp);
+    if (d != NULL)
+        printf("%-18s %8d %11.1f %11.1f\n", b->name, d->size, times[0],
+            times[bench_runs / 2]);
+    else
+        printf("%-18s %8s %11.1f %11.1f\n", b->name, "-", times[0],
+            times[bench_runs / 2]);
+    fflush(stdout);
+}
+
+/*
+ * Make a directory of size entries.  Names go round a cycle of kinds,
+ * so that every directory has the same mix.
+ */
+static void
+bench_mkdir(struct bench_dir *d, int size)
+{
+    static const unsigned char png[] = { 0x89, 'P', 'N', 'G', '\r', '\n' };
+    struct ec_fs_meta meta;
+    struct fs_ent e;
+    char path[64], *leaf;
+    int i, fd;
+
+    d->size = size;
+    snprintf(d->name, sizeof(d->name), "d%d", size);
+    if (mkdir(d->name, 0777) == -1)
+        err(1, "%s", d->name);
+    for (i = 0; i < size; i++) {
+        leaf = path + snprintf(path, sizeof(path), "%s/", d->name);
+        switch (i % 8) {
+        case 0: sprintf(leaf, "File%05d", i); break;
+        case 1: sprintf(leaf, "Text%05d,fff", i); break;
+        case 2: sprintf(leaf, "n%05d.txt", i); break;
+        case 3: sprintf(leaf, "...Dot%05d", i); break;
+        case 4: sprintf(leaf, "Prog%05d.c", i); break;
+        case 5: sprintf(leaf, "Bas%05d,ffb", i); break;
+        case 6: sprintf(leaf, "LongName%08d", i); break;	/* Hidden */
+        case 7: sprintf(leaf, "Data%05d", i); break;
+        }
+        if ((fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0666)) == -1)
+            err(1, "%s", path);
+        if (i % 8 == 0 && i % 16 != 0) {
+            if (write(fd, png, sizeof(png)) == -1)
+                err(1, "%s", path);
+        } else if (write(fd, "Hello\n", 6) == -1)
+            err(1, "%s", path);
+        close(fd);
+        if (i % 16 == 0) {
+            /* Load and exec addresses, as for a BASIC program */
+            if (fs_ent_stat(&e, NULL, path) == -1)
+                err(1, "%s", path);
+            fs_write_val(meta.load_addr, 0xfffffb00 | i % 0xff, 4);
+            fs_write_val(meta.exec_addr, 0x8023, 4);
+            if (!fs_set_meta(&e, &meta))
+                err(1, "%s: fs_set_meta", path);
+        }
+    }
+    fs_metacache_flush(true);
+    snprintf(d->exact, sizeof(d->exact), "$.%s.File%05d", d->name,
+        size > 8 ? 8 : 0);
+    snprintf(d->missing, sizeof(d->missing), "$.%s.NoSuchFile", d->name);
+    bench_list(d);
+}
+
+/* Read the directory as fs_examine() would, and keep what it shows */
+static void
+bench_list(struct bench_dir *d)
+{
+    struct fs_context c;
+    FTSENT *ent;
+    int n = 0;
+
+    memset(&c, 0, sizeof(c));
+    c.client = &d->client;
+    if (fs_examine_read(&c, d->name, 0) == -1)
+        err(1, "%s", d->name);
+    for (ent = d->client.dir_cache.f; ent != NULL; ent = ent->fts_link)
+        n++;
+    d->ents = calloc(n, sizeof(*d->ents));
+    d->names = calloc(n, sizeof(*d->names));
+    d->all = calloc(n, sizeof(*d->all));
+    if (d->ents == NULL || d->names == NULL || d->all == NULL)
+        err(1, "calloc");
+    for (ent = d->client.dir_cache.f; ent != NULL; ent = ent->fts_link) {
+        if ((d->all[d->nall++] = strdup(ent->fts_name)) == NULL)
+            err(1, "strdup");
+        if (ent->fts_info == FTS_ERR || ent->fts_info == FTS_NS ||
+            fs_hidden_name(ent->fts_name))
+            continue;
+        d->ents[d->nents] = ent;
+        d->names[d->nents++] = d->all[d->nall - 1];
+    }
+    if (d->nents == 0)
+        errx(1, "%s: nothing to show", d->name);
+}
+
+/* Called at exit, to tidy up even after an error */
+static void
+bench_rmtree(void)
+{
+    char *argv[2];
+    FTS *ftsp;
+    FTSENT *ent;
+
+    if (chdir("/") == -1)
+        return;
+    argv[0] = bench_tmp;
+    argv[1] = NULL;
+    if ((ftsp = fts_open(argv, FTS_PHYSICAL, NULL)) == NULL) {
+        warn("%s", bench_tmp);
+        return;
+    }
+    while ((ent = fts_read(ftsp)) != NULL) {
+        switch (ent->fts_info) {
+        case FTS_DP:
+            if (rmdir(ent->fts_accpath) == -1)
+                warn("%s", ent->fts_path);
+            break;
+        case FTS_D:
+            break;
+        default:
+            if (unlink(ent->fts_accpath) == -1)
+                warn("%s", ent->fts_path);
+        }
+    }
+    fts_close(ftsp);
+}
+
+int
+main(int argc, char *argv[])
+{
+    char const *conffile = "/etc/aund.conf";
+    char *sizes = "10,1000,50000", *p, *end;
+    const char *tmpdir;
+    struct bench_dir dirs[BENCH_MAXDIRS];
+    const struct bench *b;
+    int c, i, j, ndirs = 0, size;
+    bool any;
+
+    progname = argv[0];
+    if ((tmpdir = getenv("TMPDIR")) == NULL)
+        tmpdir = "/tmp";
+    while ((c = getopt(argc, argv, "c:d:n:r:t:")) != -1) {
+        switch (c) {
+        case 'c':
+            conffile = optarg;
+            break;
+        case 'd':
+            tmpdir = optarg;
+            break;
+        case 'n':
+            sizes = optarg;
+            break;
+        case 'r':
+            bench_runs = atoi(optarg);
+            if (bench_runs < 1 || bench_runs > 64)
+                errx(1, "bad number of runs");
+            break;
+        case 't':
+            bench_mintime = strtoul(optarg, &end, 10) * 1000000UL;
+            if (*end != '\0' || bench_mintime == 0)
+                errx(1, "bad time");
+            break;
+        default:
+            usage();
+        }
+    }
+    argc -= optind;
+    argv += optind;
+
+    conf_init(conffile);
+    fs_typemap_compile();
+    using_syslog = 0;
+    debug = 0;
+
+    snprintf(bench_tmp, sizeof(bench_tmp), "%s/aundbench.XXXXXX", tmpdir);
+    if (mkdtemp(bench_tmp) == NULL)
+        err(1, "%s", bench_tmp);
+    atexit(bench_rmtree);
+    if (chdir(bench_tmp) == -1)
+        err(1, "%s", bench_tmp);
+    root = bench_tmp;
+    memset(dirs, 0, sizeof(dirs));
+    for (p = sizes; *p != '\0'; p = *end ? end + 1 : end) {
+        size = strtol(p, &end, 10);
+        if ((*end != '\0' && *end != ',') || size < 1 ||
+            ndirs == BENCH_MAXDIRS)
+            errx(1, "bad sizes %s", sizes);
+        fprintf(stderr, "%s: making %d entries\n", progname, size);
+        bench_mkdir(&dirs[ndirs++], size);
+    }
+
+    bench_req.function = EC_FS_FUNC_EXAMINE;
+    bench_c.req = &bench_req;
+    bench_c.arena = fs_arena_get();
+    bench_client.infoformat = default_infoformat;
+    for (i = 0; i < ndirs; i++)
+        dirs[i].client.infoformat = default_infoformat;
+
+    printf("%-18s %8s %11s %11s\n", "benchmark", "entries", "ns/op",
+        "median");
+    for (b = benches; b < benches + sizeof(benches) / sizeof(*b); b++) {
+        any = argc == 0;
+        for (j = 0; j < argc; j++)
+            if (strncmp(b->name, argv[j], strlen(argv[j])) == 0)
+                any = true;
+        if (!any)
+            continue;
+        if (!b->perdir)
+            bench_run(b, NULL);
+        else
+            for (i = 0; i < ndirs; i++)
+                bench_run(b, &dirs[i]);
+    }
+
+    for (i = 0; i < ndirs; i++)
+        if (dirs[i].client.dir_cache.ftsp != NULL)
+            fts_close(dirs[i].client.dir_cache.ftsp);
+    if (bench_client.dir_cache.ftsp != NULL)
+        fts_close(bench_client.dir_cache.ftsp);
+    return 0;
+}
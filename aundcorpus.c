@@ -0,0 +1,578 @@
+/*-
+ * Copyright (c) 2010 Simon Tatham
+ * Copyright (c) 2010 Ben Harris
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/*
+ * aundcorpus - make a tree for aund to serve, shaped like a real one,
+ * for benchmarking.
+ *
+ * The tree has a URD for each of a number of users, grouped as
+ * group/user the way pw_add_user() lays them out, a deep library
+ * tree, and some directories of thousands of files.  Names are a mix
+ * of plain ones, ",xxx" typed ones, Unix ones with extensions,
+ * dot-stuffed ones and ones too long to show, and some plain files
+ * have load and execute addresses in .Acorn symlinks.  Sizes are
+ * drawn from a configurable distribution.  Everything, including
+ * contents and dates, comes from one seeded random number generator,
+ * so the same options always make the same tree.
+ */
+
+#if HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define CORPUS_NAMELEN	10		/* Longest name aund will show */
+#define CORPUS_BUCKETS	16
+#define CORPUS_BUFSIZE	65536
+#define CORPUS_EPOCH	946684800	/* Dates start at 2000-01-01 */
+#define CORPUS_YEARS	20
+#define CORPUS_RISCOS_EPOCH 2208988800ULL /* 1900-01-01 to 1970-01-01 */
+
+struct corpus_bucket {
+    unsigned long max;		/* Sizes are up to this... */
+    unsigned long min;		/* ...and more than the last bucket's */
+    int weight;
+};
+
+static const char *const corpus_words[] = {
+    "Letter", "Report", "Notes", "Essay", "Sprite", "Drawing", "Data",
+    "Prog", "Music", "Game", "Picture", "Chart", "Sheet", "Index",
+    "Manual", "Story", "Poem", "Map", "Budget", "Minutes",
+};
+static const char *const corpus_dirwords[] = {
+    "Docs", "Work", "Projects", "Archive", "Apps", "Fonts", "Modules",
+    "Misc", "Source", "Backup", "Images", "Sounds", "Old", "Topics",
+};
+static const char *const corpus_types[] = {
+    "fff", "ffb", "ff9", "ffa", "ff8", "aff", "ddc", "fea", "feb",
+    "fec", "ffd", "fe6",
+};
+static const char *const corpus_exts[] = {
+    ".txt", ".c", ".h", ".bas", ".png", ".gif", ".zip", ".htm", ".csv",
+    ".pdf", ".mk", ".tar",
+};
+static const char *const corpus_magic[] = {
+    "\x89PNG", "GIF8", "\xff\xd8\xff\xe0", "%PDF", "PK\x03\x04",
+    "\x1f\x8b\x08\x00",
+};
+
+#define NELEM(a) (sizeof(a) / sizeof((a)[0]))
+
+static char *progname;
+static bool verbose = false;
+static uint64_t corpus_rand = 88172645463325252ULL;
+static struct corpus_bucket corpus_sizes[CORPUS_BUCKETS];
+static int corpus_nsizes, corpus_total;
+static unsigned char corpus_buf[CORPUS_BUFSIZE];
+static int corpus_files = 40;	/* Average files per directory */
+static int corpus_metapct = 25;
+static unsigned long corpus_ndirs, corpus_nfiles, corpus_nmeta;
+static unsigned long long corpus_nbytes;
+
+static void usage(void);
+static uint64_t corpus_random(void);
+static unsigned long corpus_below(unsigned long);
+static unsigned long corpus_parse_size(char *);
+static void corpus_parse_sizes(char *);
+static unsigned long corpus_size(void);
+static time_t corpus_date(void);
+static void corpus_time(int, const char *, time_t);
+static void corpus_ltime(int, const char *, const char *, time_t);
+static void corpus_dirtime(int, const char *, time_t);
+static void corpus_meta(int, const char *, const char *, time_t);
+static void corpus_file(int, const char *, unsigned);
+static int corpus_mkdir(int, const char *, const char *, char *, size_t);
+static void corpus_fill(int, const char *, int);
+static void corpus_tree(int, const char *, int, int, bool);
+
+static void
+usage(void)
+{
+
+    fprintf(stderr,
+        "usage: %s [-v] [-B dirs[,files]] [-f files] [-g groups]\n"
+        "\t[-l depth[,width]] [-m percent] [-p pwfile] [-s seed]\n"
+        "\t[-u users] [-z size=weight,...] root\n", progname);
+    exit(EXIT_FAILURE);
+}
+
+/* xorshift64* */
+static uint64_t
+corpus_random(void)
+{
+
+    corpus_rand ^= corpus_rand >> 12;
+    corpus_rand ^= corpus_rand << 25;
+    corpus_rand ^= corpus_rand >> 27;
+    return corpus_rand * 2685821657736338717ULL;
+}
+
+static unsigned long
+corpus_below(unsigned long n)
+{
+
+    return n == 0 ? 0 : corpus_random() % n;
+}
+
+/*
+ * Parse a size in bytes, with an optional "k" or "m" multiplier.
+ */
+static unsigned long
+corpus_parse_size(char *arg)
+{
+    unsigned long n;
+    char *end;
+
+    n = strtoul(arg, &end, 10);
+    if (*end == 'k' || *end == 'K') {
+        n *= 1024;
+        end++;
+    } else if (*end == 'm' || *end == 'M') {
+        n *= 1024 * 1024;
+        end++;
+    }
+    if (*arg == '\0' || *end != '\0' || n > 0x7fffffff)
+        errx(1, "bad size %s", arg);
+    return n;
+}
+
+/*
+ * Parse a size distribution like "256=30,4k=40,32k=25,256k=5": each
+ * entry is the weight given to sizes up to its own and above the
+ * previous one's, which it must be more than.  Sizes are uniform
+ * within each range.
+ */
+static void
+corpus_parse_sizes(char *arg)
+{
+    char *item, *eq, *end;
+    unsigned long last = 0;
+    long n;
+
+    corpus_nsizes = corpus_total = 0;
+    for (item = strtok(arg, ","); item != NULL; item = strtok(NULL, ",")) {
+        if ((eq = strchr(item, '=')) == NULL)
+            errx(1, "bad size entry %s", item);
+        *eq++ = '\0';
+        if (corpus_nsizes == CORPUS_BUCKETS)
+            errx(1, "too many sizes");
+        corpus_sizes[corpus_nsizes].max = corpus_parse_size(item);
+        if (corpus_nsizes > 0 && corpus_sizes[corpus_nsizes].max <= last)
+            errx(1, "sizes must increase");
+        n = strtol(eq, &end, 10);
+        if (*eq == '\0' || *end != '\0' || n < 0 || n > 1000000)
+            errx(1, "bad weight for %s", item);
+        corpus_sizes[corpus_nsizes].min =
+            corpus_nsizes == 0 ? 0 : last + 1;
+        corpus_sizes[corpus_nsizes].weight = n;
+        last = corpus_sizes[corpus_nsizes].max;
+        corpus_total += n;
+        corpus_nsizes++;
+    }
+    if (corpus_total == 0)
+        errx(1, "no sizes");
+}
+
+static unsigned long
+corpus_size(void)
+{
+    struct corpus_bucket *b;
+    unsigned long pick;
+
+    pick = corpus_below(corpus_total);
+    for (b = corpus_sizes; pick >= (unsigned long)b->weight; b++)
+        pick -= b->weight;
+    return b->min + corpus_below(b->max - b->min + 1);
+}
+
+static time_t
+corpus_date(void)
+{
+
+    return CORPUS_EPOCH + corpus_below(CORPUS_YEARS * 365 * 86400UL);
+}
+
+static void
+corpus_time(int fd, const char *path, time_t t)
+{
+    struct timespec ts[2];
+
+    ts[0].tv_sec = ts[1].tv_sec = t;
+    ts[0].tv_nsec = ts[1].tv_nsec = 0;
+    if (futimens(fd, ts) == -1)
+        warn("%s: futimens", path);
+}
+
+/*
+ * Date name in dirfd without following it, so that .Acorn symlinks
+ * get dates of their own.  It's no matter if name isn't there.
+ */
+static void
+corpus_ltime(int dirfd, const char *path, const char *name, time_t t)
+{
+    struct timespec ts[2];
+
+    ts[0].tv_sec = ts[1].tv_sec = t;
+    ts[0].tv_nsec = ts[1].tv_nsec = 0;
+    if (utimensat(dirfd, name, ts, AT_SYMLINK_NOFOLLOW) == -1 &&
+        errno != ENOENT)
+        warn("%s/%s: utimensat", path, name);
+}
+
+/*
+ * Date a finished directory, and its .Acorn directory if it has one.
+ */
+static void
+corpus_dirtime(int dirfd, const char *path, time_t t)
+{
+
+    corpus_ltime(dirfd, path, ".Acorn", t);
+    corpus_time(dirfd, path, t);
+}
+
+/*
+ * Give a file load and execute addresses in a .Acorn symlink, as
+ * meta_symlink.c would.  Most are a file type and date stamp matching
+ * the file's own date; the rest are real addresses.
+ */
+static void
+corpus_meta(int dirfd, const char *path, const char *name, time_t t)
+{
+    char metapath[PATH_MAX], rawinfo[40];
+    unsigned long load, exec;
+    uint64_t stamp;
+
+    if (corpus_below(4) != 0) {
+        stamp = ((uint64_t)t + CORPUS_RISCOS_EPOCH) * 100;
+        load = 0xfff00000 |
+            strtoul(corpus_types[corpus_below(NELEM(corpus_types))],
+            NULL, 16) << 8 | (unsigned long)(stamp >> 32 & 0xff);
+        exec = (unsigned long)(stamp & 0xffffffff);
+    } else {
+        load = 0x1900 + corpus_below(0x100) * 0x100;
+        exec = load + corpus_below(0x100);
+    }
+    if (mkdirat(dirfd, ".Acorn", 0777) == -1 && errno != EEXIST) {
+        warn("%s/.Acorn: mkdir", path);
+        return;
+    }
+    snprintf(metapath, sizeof(metapath), ".Acorn/%s", name);
+    snprintf(rawinfo, sizeof(rawinfo), "%08lX %08lX", load, exec);
+    if (symlinkat(rawinfo, dirfd, metapath) == -1) {
+        warn("%s/%s: symlink", path, metapath);
+        return;
+    }
+    corpus_ltime(dirfd, path, metapath, t);
+    corpus_nmeta++;
+}
+
+/*
+ * Make the i'th file in a directory.  Including i in the name keeps
+ * names in the directory distinct, even ignoring case.
+ */
+static void
+corpus_file(int dirfd, const char *path, unsigned i)
+{
+    char name[64], num[16];
+    const char *word, *ext;
+    unsigned long size, off, n;
+    time_t t;
+    int fd, kind, room;
+    bool plain = false;
+    ssize_t w;
+
+    word = corpus_words[corpus_below(NELEM(corpus_words))];
+    snprintf(num, sizeof(num), "%u", i);
+    room = CORPUS_NAMELEN - (int)strlen(num);
+    kind = corpus_below(100);
+    if (kind < 35) {
+        snprintf(name, sizeof(name), "%.*s%s", room, word, num);
+        plain = true;
+    } else if (kind < 60) {
+        snprintf(name, sizeof(name), "%.*s%s,%s", room, word, num,
+            corpus_types[corpus_below(NELEM(corpus_types))]);
+    } else if (kind < 80) {
+        ext = corpus_exts[corpus_below(NELEM(corpus_exts))];
+        room -= strlen(ext);
+        snprintf(name, sizeof(name), "%.*s%s%s",
+            room > 1 ? room : 1, word, num, ext);
+        /* Unix users are more likely to use lower case. */
+        if (corpus_below(2))
+            name[0] |= 0x20;
+    } else if (kind < 90) {
+        /* Acorn names starting with '/' */
+        snprintf(name, sizeof(name), "...%.*s%s", room - 1, word, num);
+    } else {
+        /* Too long to show; aund hides these. */
+        snprintf(name, sizeof(name), "%sBackup%06u", word, i);
+    }
+
+    size = corpus_size();
+    t = corpus_date();
+    fd = openat(dirfd, name, O_WRONLY | O_CREAT | O_EXCL, 0666);
+    if (fd == -1) {
+        warn("%s/%s: open", path, name);
+        return;
+    }
+    /*
+     * Untyped files without metadata sometimes start with a magic
+     * number, for the typemap to find.
+     */
+    off = corpus_below(CORPUS_BUFSIZE);
+    if (plain && corpus_below(100) < corpus_metapct)
+        corpus_meta(dirfd, path, name, t);
+    else if (plain && size >= 4 && corpus_below(3) == 0) {
+        if (write(fd, corpus_magic[corpus_below(NELEM(corpus_magic))], 4)
+            != 4) {
+            warn("%s/%s: write", path, name);
+            close(fd);
+            return;
+        }
+        size -= 4;
+        corpus_nbytes += 4;
+    }
+    while (size > 0) {
+        n = CORPUS_BUFSIZE - off;
+        if (n > size)
+            n = size;
+        if ((w = write(fd, corpus_buf + off, n)) == -1) {
+            warn("%s/%s: write", path, name);
+            break;
+        }
+        size -= w;
+        corpus_nbytes += w;
+        off = (off + w) % CORPUS_BUFSIZE;
+    }
+    corpus_time(fd, name, t);
+    close(fd);
+    corpus_nfiles++;
+}
+
+/*
+ * Make a directory and open it, putting its path in buf.  Returns the
+ * new directory's descriptor.
+ */
+static int
+corpus_mkdir(int dirfd, const char *path, const char *name,
+    char *buf, size_t len)
+{
+    int fd;
+
+    if ((size_t)snprintf(buf, len, "%s/%s", path, name) >= len)
+        errx(1, "%s/%s: path too long", path, name);
+    if (mkdirat(dirfd, name, 0777) == -1)
+        err(1, "%s: mkdir", buf);
+    if ((fd = openat(dirfd, name, O_RDONLY | O_DIRECTORY)) == -1)
+        err(1, "%s: open", buf);
+    if (verbose)
+        printf("%s\n", buf);
+    corpus_ndirs++;
+    return fd;
+}
+
+static void
+corpus_fill(int dirfd, const char *path, int nfiles)
+{
+    int i;
+
+    for (i = 0; i < nfiles; i++)
+        corpus_file(dirfd, path, i);
+}
+
+/*
+ * Fill a directory with files, and width sub-directories (or up to
+ * width, unless exact) filled in the same way, depth levels deep.
+ * The directory's date is set once its contents are finished.
+ */
+static void
+corpus_tree(int dirfd, const char *path, int depth, int width, bool exact)
+{
+    char subpath[PATH_MAX], name[32], num[16];
+    int nfiles, ndirs, i, fd;
+    time_t t;
+
+    nfiles = corpus_files / 2 + corpus_below(corpus_files + 1);
+    ndirs = depth <= 0 ? 0 : exact ? width : corpus_below(width + 1);
+    t = corpus_date();
+    corpus_fill(dirfd, path, nfiles);
+    for (i = 0; i < ndirs; i++) {
+        snprintf(num, sizeof(num), "%d", nfiles + i);
+        snprintf(name, sizeof(name), "%.*s%s",
+            CORPUS_NAMELEN - (int)strlen(num),
+            corpus_dirwords[corpus_below(NELEM(corpus_dirwords))], num);
+        fd = corpus_mkdir(dirfd, path, name, subpath, sizeof(subpath));
+        corpus_tree(fd, subpath, depth - 1, width, exact);
+        close(fd);
+    }
+    corpus_dirtime(dirfd, path, t);
+}
+
+int
+main(int argc, char *argv[])
+{
+    char defsizes[] = "256=30,4k=40,32k=25,256k=5";
+    char path[PATH_MAX], subpath[PATH_MAX], name[32];
+    char *end, *pwname = NULL;
+    FILE *pwfp = NULL;
+    uint64_t seed = 0;
+    int c, i, g, u, rootfd, fd, gfd;
+    int groups = 4, users = 8, depth = 6, width = 2;
+    int nbig = 1, bigfiles = 5000;
+    size_t j;
+
+    progname = argv[0];
+    corpus_parse_sizes(defsizes);
+    while ((c = getopt(argc, argv, "B:f:g:l:m:p:s:u:vz:")) != -1) {
+        switch (c) {
+        case 'B':
+            nbig = strtol(optarg, &end, 10);
+            if (*end == ',')
+                bigfiles = strtol(end + 1, &end, 10);
+            if (*optarg == '\0' || *end != '\0' || nbig < 0 ||
+                bigfiles < 0)
+                errx(1, "bad big directories");
+            break;
+        case 'f':
+            corpus_files = strtol(optarg, &end, 10);
+            if (*optarg == '\0' || *end != '\0' || corpus_files < 0)
+                errx(1, "bad number of files");
+            break;
+        case 'g':
+            groups = strtol(optarg, &end, 10);
+            if (*optarg == '\0' || *end != '\0' || groups < 0 ||
+                groups > 999)
+                errx(1, "bad number of groups");
+            break;
+        case 'l':
+            depth = strtol(optarg, &end, 10);
+            if (*end == ',')
+                width = strtol(end + 1, &end, 10);
+            if (*optarg == '\0' || *end != '\0' || depth < 0 ||
+                width < 0)
+                errx(1, "bad library shape");
+            break;
+        case 'm':
+            corpus_metapct = strtol(optarg, &end, 10);
+            if (*optarg == '\0' || *end != '\0' || corpus_metapct < 0 ||
+                corpus_metapct > 100)
+                errx(1, "bad metadata percentage");
+            break;
+        case 'p':
+            pwname = optarg;
+            break;
+        case 's':
+            seed = strtoull(optarg, &end, 0);
+            if (*end != '\0')
+                errx(1, "bad seed");
+            break;
+        case 'u':
+            users = strtol(optarg, &end, 10);
+            if (*optarg == '\0' || *end != '\0' || users < 0 ||
+                users > 999)
+                errx(1, "bad number of users");
+            break;
+        case 'v':
+            verbose = true;
+            break;
+        case 'z':
+            corpus_parse_sizes(optarg);
+            break;
+        default:
+            usage();
+        }
+    }
+    argc -= optind;
+    argv += optind;
+    if (argc != 1)
+        usage();
+
+    corpus_rand ^= seed * 0x9e3779b97f4a7c15ULL;
+    for (j = 0; j < CORPUS_BUFSIZE; j++)
+        corpus_buf[j] = (unsigned char)(corpus_random() >> 56);
+    if (pwname != NULL && (pwfp = fopen(pwname, "w")) == NULL)
+        err(1, "%s", pwname);
+
+    /* Start afresh, so there's nothing left from another seed. */
+    if (mkdir(argv[0], 0777) == -1)
+        err(1, "%s: mkdir", argv[0]);
+    if ((rootfd = open(argv[0], O_RDONLY | O_DIRECTORY)) == -1)
+        err(1, "%s: open", argv[0]);
+    snprintf(path, sizeof(path), "%s", argv[0]);
+    corpus_ndirs++;
+
+    fd = corpus_mkdir(rootfd, path, "Library", subpath, sizeof(subpath));
+    corpus_tree(fd, subpath, depth, width, true);
+    close(fd);
+
+    for (i = 0; i < nbig; i++) {
+        snprintf(name, sizeof(name), "Big%d", i + 1);
+        fd = corpus_mkdir(rootfd, path, name, subpath, sizeof(subpath));
+        corpus_fill(fd, subpath, bigfiles);
+        corpus_dirtime(fd, subpath, corpus_date());
+        close(fd);
+    }
+
+    /* URDs, as pw_add_user makes them for "group.user". */
+    for (g = 0; g < groups; g++) {
+        snprintf(name, sizeof(name), "Group%d", g + 1);
+        gfd = corpus_mkdir(rootfd, path, name, path, sizeof(path));
+        for (u = 0; u < users; u++) {
+            snprintf(name, sizeof(name), "User%d", u + 1);
+            fd = corpus_mkdir(gfd, path, name, subpath, sizeof(subpath));
+            corpus_tree(fd, subpath, 2, 3, false);
+            close(fd);
+            if (pwfp != NULL)
+                fprintf(pwfp, "Group%d.%s::./Group%d/%s::0\n",
+                    g + 1, name, g + 1, name);
+        }
+        corpus_time(gfd, path, corpus_date());
+        close(gfd);
+        snprintf(path, sizeof(path), "%s", argv[0]);
+    }
+    corpus_time(rootfd, path, corpus_date());
+    close(rootfd);
+    if (pwfp != NULL && fclose(pwfp) == EOF)
+        err(1, "%s", pwname);
+
+    printf("%lu directories, %lu files (%llu bytes), %lu with metadata\n",
+        corpus_ndirs, corpus_nfiles, corpus_nbytes, corpus_nmeta);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,1123 @@
+/*-
+ * Copyright (c) 2010 Simon Tatham
+ * Copyright (c) 2010 Ben Harris
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/*
+ * aundload - make a crowd of stations for aund to serve, and see how
+ * it copes.
+ *
+ * Each station is a child process with a UDP socket of its own, on an
+ * address of its own, so that aund sees as many stations as there are
+ * children.  A station logs on, saves a file and opens it, and then
+ * makes requests picked at random from the mix until its time or
+ * count is up.  Each request is timed from its first packet going out
+ * to the last packet of its reply coming back, data transfers
+ * included, and the times go into a log-linear histogram per
+ * operation, like aund's own statistics.  The children leave their
+ * results in shared memory for the parent to add up and print.
+ *
+ * Stations speak AUN, or with -b the encapsulation BeebEm uses, with
+ * the station end of the handshakes that aun.c and beebem.c do the
+ * server end of.
+ */
+
+#if HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <err.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "aun.h"
+#include "fs_hist.h"
+#include "fs_proto.h"
+
+#define LOAD_REPLY_PORT	0x90
+#define LOAD_ACK_PORT	0x91	/* For the ACKs between SAVE blocks */
+#define LOAD_DATA_PORT	0x92	/* For LOAD data */
+
+#define LOAD_TRIES	50	/* Sends before giving up, as aund does */
+#define LOAD_RETRY_MS	100	/* Wait for an acknowledgement */
+#define LOAD_REPLY_MS	10000	/* Wait for a reply */
+#define LOAD_PENDING	8	/* Packets kept while waiting for an ACK */
+#define LOAD_EXAMINE	20	/* Entries asked for by EXAMINE */
+
+enum load_op {
+    LOAD_OP_IAM,
+    LOAD_OP_EXAMINE,
+    LOAD_OP_INFO,
+    LOAD_OP_LOAD,
+    LOAD_OP_SAVE,
+    LOAD_OP_OPEN,
+    LOAD_OP_BGET,
+    LOAD_OP_BPUT,
+    LOAD_OP_MAX
+};
+
+static const char *const load_opnames[LOAD_OP_MAX] = {
+    [LOAD_OP_IAM] = "iam",
+    [LOAD_OP_EXAMINE] = "examine",
+    [LOAD_OP_INFO] = "info",
+    [LOAD_OP_LOAD] = "load",
+    [LOAD_OP_SAVE] = "save",
+    [LOAD_OP_OPEN] = "open",
+    [LOAD_OP_BGET] = "bget",
+    [LOAD_OP_BPUT] = "bput",
+};
+
+/* How often each operation is picked, out of the total */
+static int load_mix[LOAD_OP_MAX] = {
+    [LOAD_OP_IAM] = 2,
+    [LOAD_OP_EXAMINE] = 30,
+    [LOAD_OP_INFO] = 20,
+    [LOAD_OP_LOAD] = 15,
+    [LOAD_OP_SAVE] = 5,
+    [LOAD_OP_OPEN] = 8,
+    [LOAD_OP_BGET] = 10,
+    [LOAD_OP_BPUT] = 10,
+};
+
+/* What each station leaves for the parent */
+struct load_result {
+    struct fs_hist hist[LOAD_OP_MAX];
+    uint64_t retransmits;
+    uint64_t timeouts;
+    bool failed;	/* Couldn't get going at all */
+};
+
+struct load_station {
+    int sock;
+    struct sockaddr_in addr;	/* Ours */
+    struct sockaddr_in srv;
+    int ecaddr;			/* With BeebEm, network*256+station */
+    uint32_t seq;		/* Next AUN sequence number to send */
+    uint32_t lastseq;		/* Last one received, to spot repeats */
+    bool gotseq;
+    uint8_t urd, csd, lib;
+    uint8_t handle;		/* Open on name, for BGET and BPUT */
+    uint8_t byteseq;		/* Sequence bit for BGET and BPUT */
+    uint32_t rand;
+    char name[16];		/* The file this station uses */
+    unsigned char pending[LOAD_PENDING][AUN_MAX_BLOCK + 64];
+    ssize_t pendlen[LOAD_PENDING];
+    int npending;
+    unsigned char buf[65536];
+    struct load_result *res;
+};
+
+/* BeebEm's Econet configuration, as beebem.c reads it */
+struct load_ecstn {
+    int ecaddr;
+    struct sockaddr_in addr;
+};
+
+static char *progname;
+static bool load_beebem;
+static struct sockaddr_in load_srv;
+static int load_srvstn = 254;
+static struct load_ecstn *load_ecstns;
+static int load_necstns;
+static const char *load_user, *load_pass;
+static size_t load_filesize = 4096;
+static unsigned char *load_filedata;
+
+static void usage(void);
+static uint64_t load_now(void);
+static uint32_t load_random(struct load_station *);
+static void load_parse_mix(char *);
+static void load_read_cfg(const char *);
+static ssize_t load_read(struct load_station *, uint64_t);
+static void load_aun_ack(struct load_station *, const struct aun_packet *);
+static bool load_aun_other(struct load_station *, ssize_t);
+static int load_aun_send(struct load_station *, int, int, const void *,
+    size_t);
+static ssize_t load_aun_recv(struct load_station *, int, int *);
+static void load_beebem_ack(struct load_station *);
+static bool load_beebem_frame(struct load_station *, ssize_t);
+static int load_beebem_exchange(struct load_station *, const unsigned char *,
+    size_t);
+static int load_beebem_send(struct load_station *, int, int, const void *,
+    size_t);
+static ssize_t load_beebem_recv(struct load_station *, int, int *);
+static int load_send(struct load_station *, int, int, const void *, size_t);
+static ssize_t load_recv(struct load_station *, int, int *);
+static ssize_t load_request(struct load_station *, int, int, const void *,
+    size_t);
+static int load_iam(struct load_station *);
+static int load_examine(struct load_station *);
+static int load_info(struct load_station *);
+static int load_load(struct load_station *);
+static int load_save(struct load_station *);
+static int load_openfile(struct load_station *, uint8_t *);
+static int load_close(struct load_station *, uint8_t);
+static int load_open(struct load_station *);
+static int load_byte(struct load_station *, int);
+static int load_op(struct load_station *, enum load_op);
+static void load_station_run(struct load_station *, uint64_t,
+    unsigned long);
+static void load_print(const char *, const struct fs_hist *, double);
+
+static void
+usage(void)
+{
+
+    fprintf(stderr,
+        "usage: %s [-a address] [-b econet.cfg] [-c count] [-f filesize]\n"
+        "\t[-m mix] [-n stations] [-s server] [-t seconds] user [password]\n",
+        progname);
+    exit(EXIT_FAILURE);
+}
+
+static uint64_t
+load_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/*
+ * Each station has its own xorshift generator, seeded from its number,
+ * so that a run can be repeated.
+ */
+static uint32_t
+load_random(struct load_station *st)
+{
+    uint32_t x = st->rand;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return st->rand = x;
+}
+
+/*
+ * Parse a mix like "examine=40,load=10".  Operations not mentioned
+ * aren't done at all.
+ */
+static void
+load_parse_mix(char *arg)
+{
+    char *item, *eq, *end;
+    long n;
+    int i, total = 0;
+
+    memset(load_mix, 0, sizeof(load_mix));
+    for (item = strtok(arg, ","); item != NULL; item = strtok(NULL, ",")) {
+        if ((eq = strchr(item, '=')) == NULL)
+            errx(1, "bad mix entry %s", item);
+        *eq++ = '\0';
+        for (i = 0; i < LOAD_OP_MAX; i++)
+            if (strcasecmp(item, load_opnames[i]) == 0)
+                break;
+        if (i == LOAD_OP_MAX)
+            errx(1, "unknown operation %s", item);
+        n = strtol(eq, &end, 10);
+        if (*eq == '\0' || *end != '\0' || n < 0 || n > 1000000)
+            errx(1, "bad weight for %s", item);
+        load_mix[i] = n;
+        total += n;
+    }
+    if (total == 0)
+        errx(1, "nothing in the mix");
+}
+
+/*
+ * Read a BeebEm Econet configuration file: lines of network, station,
+ * IP address and UDP port.
+ */
+static void
+load_read_cfg(const char *file)
+{
+    FILE *fp;
+    char line[512];
+    char addr[64];
+    int lineno = 0, net, stn, port, alloc = 0;
+    struct load_ecstn *e;
+
+    if ((fp = fopen(file, "r")) == NULL)
+        err(1, "%s", file);
+    while (lineno++, fgets(line, sizeof(line), fp) != NULL) {
+        if (sscanf(line, " %1[#]", addr) == 1 ||
+            sscanf(line, " %1s", addr) != 1)
+            continue;
+        if (sscanf(line, "%d %d %63s %d", &net, &stn, addr, &port) != 4 ||
+            net < 0 || net > 255 || stn < 0 || stn > 255 || port <= 0 ||
+            port > 65535)
+            errx(1, "%s:%d: malformed config line", file, lineno);
+        if (load_necstns == alloc) {
+            alloc = alloc ? alloc * 2 : 64;
+            load_ecstns = realloc(load_ecstns,
+                alloc * sizeof(*load_ecstns));
+            if (load_ecstns == NULL)
+                err(1, "realloc");
+        }
+        e = &load_ecstns[load_necstns++];
+        e->ecaddr = net * 256 + stn;
+        memset(&e->addr, 0, sizeof(e->addr));
+        e->addr.sin_family = AF_INET;
+        if (inet_aton(addr, &e->addr.sin_addr) == 0)
+            errx(1, "%s:%d: bad address %s", file, lineno, addr);
+        e->addr.sin_port = htons(port);
+    }
+    fclose(fp);
+}
+
+/*
+ * Wait until the deadline for a datagram.  Returns its length, or zero
+ * if none came.
+ */
+static ssize_t
+load_read(struct load_station *st, uint64_t deadline)
+{
+    struct pollfd pfd;
+    struct sockaddr_in from;
+    socklen_t fromlen;
+    ssize_t n;
+    uint64_t now;
+
+    for (;;) {
+        now = load_now();
+        if (now >= deadline)
+            return 0;
+        pfd.fd = st->sock;
+        pfd.events = POLLIN;
+        n = poll(&pfd, 1, (deadline - now + 999) / 1000);
+        if (n < 0 && errno != EINTR)
+            err(1, "poll");
+        if (n <= 0)
+            continue;
+        fromlen = sizeof(from);
+        n = recvfrom(st->sock, st->buf, sizeof(st->buf), 0,
+            (struct sockaddr *)&from, &fromlen);
+        if (n < 0) {
+            if (errno == EINTR || errno == ECONNREFUSED)
+                continue;
+            err(1, "recvfrom");
+        }
+        if (from.sin_addr.s_addr != st->srv.sin_addr.s_addr)
+            continue;
+        return n;
+    }
+}
+
+static void
+load_aun_ack(struct load_station *st, const struct aun_packet *pkt)
+{
+    struct aun_packet ack;
+
+    memset(&ack, 0, sizeof(ack));
+    ack.type = AUN_TYPE_ACK;
+    memcpy(ack.seq, pkt->seq, sizeof(ack.seq));
+    if (sendto(st->sock, &ack, sizeof(ack), 0,
+        (struct sockaddr *)&st->srv, sizeof(st->srv)) == -1)
+        err(1, "sendto (ack)");
+}
+
+/*
+ * Deal with a packet that isn't the ACK we're waiting for.  Data is
+ * acknowledged, and returns true unless it's a repeat of the last lot;
+ * machine type peeks (from aund's idleprobe) are answered.
+ */
+static bool
+load_aun_other(struct load_station *st, ssize_t n)
+{
+    struct aun_packet *pkt = (struct aun_packet *)st->buf;
+    uint32_t seq;
+
+    if (n < (ssize_t)sizeof(*pkt))
+        return false;
+    switch (pkt->type) {
+    case AUN_TYPE_UNICAST:
+        load_aun_ack(st, pkt);
+        seq = pkt->seq[0] | pkt->seq[1] << 8 | pkt->seq[2] << 16 |
+            (uint32_t)pkt->seq[3] << 24;
+        if (st->gotseq && seq == st->lastseq)
+            return false;
+        st->lastseq = seq;
+        st->gotseq = true;
+        return true;
+    case AUN_TYPE_IMMEDIATE:
+        if (pkt->flag == 8 && n >= (ssize_t)sizeof(*pkt) + 4) {
+            pkt->type = AUN_TYPE_IMM_REPLY;
+            pkt->data[0] = 0;	/* Not a real machine */
+            pkt->data[1] = 0;
+            pkt->data[2] = 0;
+            pkt->data[3] = 0;
+            sendto(st->sock, pkt, sizeof(*pkt) + 4, 0,
+                (struct sockaddr *)&st->srv, sizeof(st->srv));
+        }
+        break;
+    }
+    return false;
+}
+
+/*
+ * Send a packet and wait for aund to acknowledge it, sending it again
+ * every LOAD_RETRY_MS.  Data that turns up in the meantime is kept for
+ * load_aun_recv().
+ */
+static int
+load_aun_send(struct load_station *st, int port, int flag, const void *data,
+    size_t len)
+{
+    unsigned char pbuf[sizeof(struct aun_packet) + AUN_MAX_BLOCK + 64];
+    struct aun_packet *pkt = (struct aun_packet *)pbuf, *in;
+    uint64_t deadline;
+    ssize_t n;
+    int tries;
+
+    if (len > sizeof(pbuf) - sizeof(*pkt))
+        errx(1, "packet too big");
+    pkt->type = AUN_TYPE_UNICAST;
+    pkt->dest_port = port;
+    pkt->flag = flag;
+    pkt->retrans = 0;
+    pkt->seq[0] = st->seq;
+    pkt->seq[1] = st->seq >> 8;
+    pkt->seq[2] = st->seq >> 16;
+    pkt->seq[3] = st->seq >> 24;
+    st->seq += 4;
+    memcpy(pkt->data, data, len);
+    for (tries = 0; tries < LOAD_TRIES; tries++) {
+        if (tries > 0)
+            st->res->retransmits++;
+        if (sendto(st->sock, pkt, sizeof(*pkt) + len, 0,
+            (struct sockaddr *)&st->srv, sizeof(st->srv)) == -1)
+            err(1, "sendto");
+        deadline = load_now() + LOAD_RETRY_MS * 1000;
+        while ((n = load_read(st, deadline)) > 0) {
+            in = (struct aun_packet *)st->buf;
+            /*
+             * aund rejects what it isn't listening for, such as
+             * a request while another station is saving, so a
+             * rejection just means trying again later.
+             */
+            if (n >= (ssize_t)sizeof(*in) &&
+                (in->type == AUN_TYPE_ACK || in->type == AUN_TYPE_REJ) &&
+                memcmp(in->seq, pkt->seq, sizeof(in->seq)) == 0) {
+                if (in->type == AUN_TYPE_ACK)
+                    return 0;
+                continue;
+            }
+            if (load_aun_other(st, n) && st->npending < LOAD_PENDING &&
+                n <= (ssize_t)sizeof(st->pending[0])) {
+                memcpy(st->pending[st->npending], st->buf, n);
+                st->pendlen[st->npending++] = n;
+            }
+        }
+    }
+    st->res->timeouts++;
+    return -1;
+}
+
+/*
+ * Wait for data on port, or on LOAD_REPLY_PORT, which is where an error
+ * turns up if aund gives up on a transfer part way.  Returns the length
+ * of the data, which is left at the start of st->buf, and sets *gotport
+ * to the port it came on.
+ */
+static ssize_t
+load_aun_recv(struct load_station *st, int port, int *gotport)
+{
+    struct aun_packet *pkt = (struct aun_packet *)st->buf;
+    uint64_t deadline = load_now() + LOAD_REPLY_MS * 1000;
+    ssize_t n;
+    int i;
+
+    for (;;) {
+        if (st->npending > 0) {
+            n = st->pendlen[0];
+            memcpy(st->buf, st->pending[0], n);
+            st->npending--;
+            for (i = 0; i < st->npending; i++) {
+                memcpy(st->pending[i], st->pending[i + 1],
+                    st->pendlen[i + 1]);
+                st->pendlen[i] = st->pendlen[i + 1];
+            }
+        } else {
+            if ((n = load_read(st, deadline)) == 0)
+                break;
+            if (!load_aun_other(st, n))
+                continue;
+        }
+        if (pkt->dest_port == port || pkt->dest_port == LOAD_REPLY_PORT) {
+            *gotport = pkt->dest_port;
+            n -= sizeof(*pkt);
+            memmove(st->buf, pkt->data, n);
+            return n;
+        }
+    }
+    st->res->timeouts++;
+    return -1;
+}
+
+/*
+ * Acknowledge the BeebEm frame in st->buf.
+ */
+static void
+load_beebem_ack(struct load_station *st)
+{
+    unsigned char ack[4];
+
+    ack[0] = st->buf[2];
+    ack[1] = st->buf[3];
+    ack[2] = st->ecaddr & 0xff;
+    ack[3] = st->ecaddr >> 8;
+    if (sendto(st->sock, ack, sizeof(ack), 0,
+        (struct sockaddr *)&st->srv, sizeof(st->srv)) == -1)
+        err(1, "sendto (ack)");
+}
+
+/*
+ * Is st->buf a frame from the file server to us?  aund sends every
+ * frame to every station it knows of, as if on a real Econet.
+ */
+static bool
+load_beebem_frame(struct load_station *st, ssize_t n)
+{
+
+    return n >= 4 && st->buf[0] + 256 * st->buf[1] == st->ecaddr &&
+        st->buf[2] + 256 * st->buf[3] == load_srvstn;
+}
+
+/*
+ * Send a frame, and wait for the file server to acknowledge it.
+ */
+static int
+load_beebem_exchange(struct load_station *st, const unsigned char *frame,
+    size_t len)
+{
+    uint64_t deadline;
+    ssize_t n;
+    int tries;
+
+    for (tries = 0; tries < LOAD_TRIES; tries++) {
+        if (tries > 0)
+            st->res->retransmits++;
+        if (sendto(st->sock, frame, len, 0,
+            (struct sockaddr *)&st->srv, sizeof(st->srv)) == -1)
+            err(1, "sendto");
+        deadline = load_now() + LOAD_RETRY_MS * 1000;
+        while ((n = load_read(st, deadline)) > 0)
+            if (n == 4 && load_beebem_frame(st, n))
+                return 0;
+    }
+    st->res->timeouts++;
+    return -1;
+}
+
+/*
+ * The four-way handshake: scout, ACK, data, ACK.
+ */
+static int
+load_beebem_send(struct load_station *st, int port, int flag,
+    const void *data, size_t len)
+{
+    unsigned char frame[4 + AUN_MAX_BLOCK];
+
+    if (len > AUN_MAX_BLOCK)
+        errx(1, "packet too big");
+    frame[0] = load_srvstn & 0xff;
+    frame[1] = load_srvstn >> 8;
+    frame[2] = st->ecaddr & 0xff;
+    frame[3] = st->ecaddr >> 8;
+    frame[4] = 0x80 | flag;
+    frame[5] = port;
+    if (load_beebem_exchange(st, frame, 6) == -1)
+        return -1;
+    memcpy(frame + 4, data, len);
+    return load_beebem_exchange(st, frame, len + 4);
+}
+
+/*
+ * As load_aun_recv(): acknowledge a scout from the file server, and
+ * then the data that follows it.  A scout for a port we're not waiting
+ * for is acknowledged all the same, and its data thrown away.
+ *
+ * aund sends a scout or data again if it misses our acknowledgement,
+ * and frames carry nothing to say which they are, so a copy of the
+ * scout while waiting for data is taken to be a repeat, as is data
+ * while waiting for a scout; both are acknowledged again.
+ */
+static ssize_t
+load_beebem_recv(struct load_station *st, int port, int *gotport)
+{
+    uint64_t deadline = load_now() + LOAD_REPLY_MS * 1000;
+    int scoutport = -1, ctrl = 0;
+    ssize_t n;
+
+    while ((n = load_read(st, deadline)) > 0) {
+        if (!load_beebem_frame(st, n))
+            continue;
+        if (n == 6 && (st->buf[4] & 0x80) && st->buf[5] != 0 &&
+            (scoutport == -1 ||
+             (st->buf[4] == ctrl && st->buf[5] == scoutport))) {
+            ctrl = st->buf[4];
+            scoutport = st->buf[5];
+            load_beebem_ack(st);
+            continue;
+        }
+        if (n > 4)
+            load_beebem_ack(st);
+        if (scoutport == -1)
+            continue;
+        if (scoutport == port || scoutport == LOAD_REPLY_PORT) {
+            *gotport = scoutport;
+            n -= 4;
+            memmove(st->buf, st->buf + 4, n);
+            return n;
+        }
+        scoutport = -1;
+    }
+    st->res->timeouts++;
+    return -1;
+}
+
+static int
+load_send(struct load_station *st, int port, int flag, const void *data,
+    size_t len)
+{
+
+    if (load_beebem)
+        return load_beebem_send(st, port, flag, data, len);
+    return load_aun_send(st, port, flag, data, len);
+}
+
+static ssize_t
+load_recv(struct load_station *st, int port, int *gotport)
+{
+
+    if (load_beebem)
+        return load_beebem_recv(st, port, gotport);
+    return load_aun_recv(st, port, gotport);
+}
+
+/*
+ * Send a request to the file server and wait for the reply, which is
+ * left in st->buf.  The urd argument goes in the URD slot, which some
+ * requests use for a port number instead.
+ */
+static ssize_t
+load_request(struct load_station *st, int func, int urd, const void *args,
+    size_t len)
+{
+    unsigned char req[AUN_MAX_BLOCK];
+    int gotport;
+    ssize_t n;
+
+    req[0] = LOAD_REPLY_PORT;
+    req[1] = func;
+    req[2] = urd;
+    req[3] = st->csd;
+    req[4] = st->lib;
+    memcpy(req + 5, args, len);
+    if (load_send(st, EC_PORT_FS, 0, req, len + 5) == -1)
+        return -1;
+    n = load_recv(st, LOAD_REPLY_PORT, &gotport);
+    return n < 2 ? -1 : n;
+}
+
+/*
+ * The operations.  Each returns 0 if it worked, 1 if aund replied with
+ * an error, and -1 if it didn't reply at all.
+ */
+static int
+load_iam(struct load_station *st)
+{
+    char cmd[256];
+    int len;
+
+    len = snprintf(cmd, sizeof(cmd), "I AM %s%s%s\r", load_user,
+        load_pass ? " " : "", load_pass ? load_pass : "");
+    if (len >= (int)sizeof(cmd))
+        errx(1, "user name too long");
+    if (load_request(st, EC_FS_FUNC_CLI, st->urd, cmd, len) == -1)
+        return -1;
+    if (st->buf[1] != 0)
+        return 1;
+    if (st->buf[0] != EC_FS_CC_LOGON)
+        return 1;
+    st->urd = st->buf[2];
+    st->csd = st->buf[3];
+    st->lib = st->buf[4];
+    st->handle = 0;
+    return 0;
+}
+
+static int
+load_examine(struct load_station *st)
+{
+    unsigned char args[4];
+
+    args[0] = EC_FS_EXAMINE_ALL;
+    args[1] = 0;
+    args[2] = LOAD_EXAMINE;
+    args[3] = '\r';
+    if (load_request(st, EC_FS_FUNC_EXAMINE, st->urd, args, 4) == -1)
+        return -1;
+    return st->buf[1] != 0;
+}
+
+static int
+load_info(struct load_station *st)
+{
+    char args[sizeof(st->name) + 2];
+    int len;
+
+    len = snprintf(args, sizeof(args), "%c%s\r", EC_FS_GET_INFO_META,
+        st->name);
+    if (load_request(st, EC_FS_FUNC_GET_INFO, st->urd, args, len) == -1)
+        return -1;
+    return st->buf[1] != 0;
+}
+
+/*
+ * LOAD: the first reply gives the size, the data follows on
+ * LOAD_DATA_PORT in as many packets as it takes, and then a second
+ * reply says that's all.
+ */
+static int
+load_load(struct load_station *st)
+{
+    char args[sizeof(st->name) + 1];
+    size_t size, got;
+    ssize_t n;
+    int len, gotport;
+
+    len = snprintf(args, sizeof(args), "%s\r", st->name);
+    if ((n = load_request(st, EC_FS_FUNC_LOAD, LOAD_DATA_PORT, args,
+        len)) == -1)
+        return -1;
+    if (st->buf[1] != 0)
+        return 1;
+    if (n < (ssize_t)offsetof(struct ec_fs_reply_load1, access) -
+        (ssize_t)sizeof(struct aun_packet))
+        return 1;
+    size = st->buf[10] | st->buf[11] << 8 | st->buf[12] << 16;
+    for (got = 0; got < size; got += n) {
+        if ((n = load_recv(st, LOAD_DATA_PORT, &gotport)) == -1)
+            return -1;
+        if (gotport == LOAD_REPLY_PORT)
+            return n < 2 || st->buf[1] != 0;
+    }
+    if ((n = load_recv(st, LOAD_REPLY_PORT, &gotport)) < 2)
+        return -1;
+    return st->buf[1] != 0;
+}
+
+/*
+ * SAVE: the first reply gives the port and block size to send the data
+ * with, and aund acknowledges each block but the last on
+ * LOAD_ACK_PORT, and then replies once more when it has it all.
+ */
+static int
+load_save(struct load_station *st)
+{
+    unsigned char args[8 + 3 + sizeof(st->name) + 1];
+    size_t block, done, this;
+    ssize_t n;
+    int len, port, gotport;
+
+    memset(args, 0, 8);
+    args[0] = 0x00;	/* Load address &FFFF1900 */
+    args[1] = 0x19;
+    args[2] = args[3] = 0xff;
+    args[4] = 0x23;	/* Execution address &FFFF8023 */
+    args[5] = 0x80;
+    args[6] = args[7] = 0xff;
+    args[8] = load_filesize;
+    args[9] = load_filesize >> 8;
+    args[10] = load_filesize >> 16;
+    len = 11 + snprintf((char *)args + 11, sizeof(args) - 11, "%s\r",
+        st->name);
+    if (load_request(st, EC_FS_FUNC_SAVE, LOAD_ACK_PORT, args, len) == -1)
+        return -1;
+    if (st->buf[1] != 0)
+        return 1;
+    port = st->buf[2];
+    block = st->buf[3] | st->buf[4] << 8;
+    if (block == 0)
+        return 1;
+    for (done = 0; done < load_filesize; done += this) {
+        this = load_filesize - done < block ? load_filesize - done : block;
+        if (load_send(st, port, 0, load_filedata + done, this) == -1)
+            return -1;
+        if (done + this == load_filesize)
+            break;
+        if ((n = load_recv(st, LOAD_ACK_PORT, &gotport)) == -1)
+            return -1;
+        if (gotport == LOAD_REPLY_PORT)
+            return n < 2 || st->buf[1] != 0;
+    }
+    if ((n = load_recv(st, LOAD_REPLY_PORT, &gotport)) < 2)
+        return -1;
+    return st->buf[1] != 0;
+}
+
+static int
+load_openfile(struct load_station *st, uint8_t *handle)
+{
+    char args[sizeof(st->name) + 3];
+    int len;
+
+    len = snprintf(args, sizeof(args), "%c%c%s\r", 1, 0, st->name);
+    if (load_request(st, EC_FS_FUNC_OPEN, st->urd, args, len) == -1)
+        return -1;
+    if (st->buf[1] != 0)
+        return 1;
+    *handle = st->buf[2];
+    return 0;
+}
+
+static int
+load_close(struct load_station *st, uint8_t handle)
+{
+
+    if (load_request(st, EC_FS_FUNC_CLOSE, st->urd, &handle, 1) == -1)
+        return -1;
+    return st->buf[1] != 0;
+}
+
+/*
+ * The file can only be open once for update, so this closes the
+ * station's handle on it and opens it again.
+ */
+static int
+load_open(struct load_station *st)
+{
+    int r;
+
+    if (st->handle != 0) {
+        r = load_close(st, st->handle);
+        st->handle = 0;
+        if (r != 0)
+            return r;
+    }
+    return load_openfile(st, &st->handle);
+}
+
+/*
+ * BGET and BPUT have a short header, and a sequence bit in the flag
+ * byte which goes back and forth so that aund can tell a new request
+ * from a repeat.
+ */
+static int
+load_byte(struct load_station *st, int func)
+{
+    unsigned char req[4];
+    int gotport;
+    ssize_t n;
+
+    if (st->handle == 0)
+        return 1;
+    req[0] = LOAD_REPLY_PORT;
+    req[1] = func;
+    req[2] = st->handle;
+    req[3] = load_random(st);
+    st->byteseq ^= 1;
+    if (load_send(st, EC_PORT_FS, st->byteseq, req,
+        func == EC_FS_FUNC_PUTBYTE ? 4 : 3) == -1)
+        return -1;
+    if ((n = load_recv(st, LOAD_REPLY_PORT, &gotport)) < 2)
+        return -1;
+    return st->buf[1] != 0;
+}
+
+static int
+load_op(struct load_station *st, enum load_op op)
+{
+
+    switch (op) {
+    case LOAD_OP_IAM:
+        return load_iam(st);
+    case LOAD_OP_EXAMINE:
+        return load_examine(st);
+    case LOAD_OP_INFO:
+        return load_info(st);
+    case LOAD_OP_LOAD:
+        return load_load(st);
+    case LOAD_OP_SAVE:
+        return load_save(st);
+    case LOAD_OP_OPEN:
+        return load_open(st);
+    case LOAD_OP_BGET:
+        return load_byte(st, EC_FS_FUNC_GETBYTE);
+    case LOAD_OP_BPUT:
+        return load_byte(st, EC_FS_FUNC_PUTBYTE);
+    default:
+        return -1;
+    }
+}
+
+/*
+ * Log on, make the station's file and open it, and then make requests
+ * until the deadline or count is reached.  *I AM logs off first, which
+ * closes the file, so it's opened again after.
+ */
+static void
+load_station_run(struct load_station *st, uint64_t deadline,
+    unsigned long count)
+{
+    uint64_t t0, t1;
+    unsigned long done;
+    uint32_t pick;
+    int total = 0, r, i;
+
+    for (i = 0; i < LOAD_OP_MAX; i++)
+        total += load_mix[i];
+    t0 = load_now();
+    r = load_iam(st);
+    fs_hist_add(&st->res->hist[LOAD_OP_IAM], load_now() - t0, r != 0);
+    if (r != 0) {
+        st->res->failed = true;
+        return;
+    }
+    t0 = load_now();
+    r = load_save(st);
+    fs_hist_add(&st->res->hist[LOAD_OP_SAVE], load_now() - t0, r != 0);
+    load_openfile(st, &st->handle);
+    for (done = 0; count == 0 || done < count; done++) {
+        if (count == 0 && load_now() >= deadline)
+            break;
+        pick = load_random(st) % total;
+        for (i = 0; pick >= (uint32_t)load_mix[i]; i++)
+            pick -= load_mix[i];
+        t0 = load_now();
+        r = load_op(st, i);
+        t1 = load_now();
+        fs_hist_add(&st->res->hist[i], t1 - t0, r != 0);
+        if (i == LOAD_OP_IAM && r == 0)
+            load_openfile(st, &st->handle);
+    }
+    if (st->handle != 0)
+        load_close(st, st->handle);
+}
+
+static void
+load_print(const char *name, const struct fs_hist *h, double secs)
+{
+
+    printf("%-8s %8llu %6llu %9.1f %8.2f %8.2f %8.2f %8.2f %8.2f\n", name,
+        (unsigned long long)h->count, (unsigned long long)h->errors,
+        secs > 0 ? h->count / secs : 0.0,
+        h->count ? h->usec / 1000.0 / h->count : 0.0,
+        fs_hist_quantile(h, 500) / 1000.0, fs_hist_quantile(h, 900) / 1000.0,
+        fs_hist_quantile(h, 990) / 1000.0, h->max / 1000.0);
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct load_station *st;
+    struct load_result *res;
+    struct fs_hist total, all;
+    struct in_addr first;
+    const char *cfgfile = NULL, *server = NULL;
+    uint64_t t0, deadline;
+    unsigned long count = 0, retransmits = 0, timeouts = 0;
+    double secs = 10, elapsed;
+    int nstations = 4, failed = 0, status, c, i, j;
+    size_t k;
+    pid_t pid;
+    char *end;
+
+    progname = argv[0];
+    inet_aton("127.0.1.1", &first);
+    memset(&load_srv, 0, sizeof(load_srv));
+    load_srv.sin_family = AF_INET;
+    load_srv.sin_port = htons(PORT_AUN);
+    while ((c = getopt(argc, argv, "a:b:c:f:m:n:s:t:")) != -1) {
+        switch (c) {
+        case 'a':
+            if (inet_aton(optarg, &first) == 0)
+                errx(1, "bad address %s", optarg);
+            break;
+        case 'b':
+            cfgfile = optarg;
+            break;
+        case 'c':
+            count = strtoul(optarg, &end, 10);
+            if (*optarg == '\0' || *end != '\0' || count == 0)
+                errx(1, "bad count");
+            break;
+        case 'f':
+            load_filesize = strtoul(optarg, &end, 10);
+            if (*optarg == '\0' || *end != '\0' ||
+                load_filesize > 0xffffff)
+                errx(1, "bad file size");
+            break;
+        case 'm':
+            load_parse_mix(optarg);
+            break;
+        case 'n':
+            nstations = atoi(optarg);
+            if (nstations <= 0)
+                errx(1, "bad number of stations");
+            break;
+        case 's':
+            server = optarg;
+            break;
+        case 't':
+            secs = strtod(optarg, &end);
+            if (*optarg == '\0' || *end != '\0' || secs <= 0)
+                errx(1, "bad time");
+            break;
+        default:
+            usage();
+        }
+    }
+    argc -= optind;
+    argv += optind;
+    if (argc < 1 || argc > 2)
+        usage();
+    load_user = argv[0];
+    load_pass = argc > 1 ? argv[1] : NULL;
+
+    if (cfgfile == NULL) {
+        if (inet_aton(server ? server : "127.0.0.1", &load_srv.sin_addr) == 0)
+            errx(1, "bad server address %s", server);
+    } else {
+        if (server != NULL) {
+            load_srvstn = strtol(server, &end, 10);
+            if (*server == '\0' || *end != '\0' || load_srvstn <= 0 ||
+                load_srvstn > 255)
+                errx(1, "bad server station %s", server);
+        }
+        load_beebem = true;
+        load_read_cfg(cfgfile);
+        for (i = 0; i < load_necstns; i++)
+            if (load_ecstns[i].ecaddr == load_srvstn)
+                break;
+        if (i == load_necstns)
+            errx(1, "file server %d.%d not listed in %s",
+                load_srvstn >> 8, load_srvstn & 0xff, cfgfile);
+        load_srv = load_ecstns[i].addr;
+        if (load_necstns - 1 < nstations)
+            errx(1, "%s lists only %d stations besides the file server",
+                cfgfile, load_necstns - 1);
+    }
+
+    if ((load_filedata = malloc(load_filesize + 1)) == NULL)
+        err(1, "malloc");
+    for (k = 0; k < load_filesize; k++)
+        load_filedata[k] = k * 7 + (k >> 8);
+    res = mmap(NULL, nstations * sizeof(*res), PROT_READ | PROT_WRITE,
+        MAP_ANON | MAP_SHARED, -1, 0);
+    if (res == MAP_FAILED)
+        err(1, "mmap");
+    memset(res, 0, nstations * sizeof(*res));
+    fflush(stdout);
+
+    t0 = load_now();
+    deadline = t0 + (uint64_t)(secs * 1000000);
+    for (i = j = 0; i < nstations; i++) {
+        if ((st = calloc(1, sizeof(*st))) == NULL)
+            err(1, "calloc");
+        st->res = &res[i];
+        st->srv = load_srv;
+        st->seq = 2;
+        st->rand = 2463534242U + i;
+        snprintf(st->name, sizeof(st->name), "Load%04d", i % 10000);
+        memset(&st->addr, 0, sizeof(st->addr));
+        st->addr.sin_family = AF_INET;
+        if (load_beebem) {
+            if (load_ecstns[j].ecaddr == load_srvstn)
+                j++;
+            st->ecaddr = load_ecstns[j].ecaddr;
+            st->addr = load_ecstns[j++].addr;
+        } else {
+            st->addr.sin_addr.s_addr = htonl(ntohl(first.s_addr) + i);
+            st->addr.sin_port = htons(PORT_AUN);
+        }
+        if ((st->sock = socket(AF_INET, SOCK_DGRAM, 0)) < 0)
+            err(1, "socket");
+        if (bind(st->sock, (struct sockaddr *)&st->addr,
+            sizeof(st->addr)) == -1)
+            err(1, "bind %s:%d", inet_ntoa(st->addr.sin_addr),
+                ntohs(st->addr.sin_port));
+        switch (pid = fork()) {
+        case -1:
+            err(1, "fork");
+        case 0:
+            load_station_run(st, deadline, count);
+            _exit(0);
+        }
+        close(st->sock);
+        free(st);
+    }
+    while (wait(&status) > 0)
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            failed++;
+    elapsed = (load_now() - t0) / 1e6;
+
+    memset(&all, 0, sizeof(all));
+    for (i = 0; i < nstations; i++) {
+        if (res[i].failed)
+            failed++;
+        retransmits += res[i].retransmits;
+        timeouts += res[i].timeouts;
+        for (j = 0; j < LOAD_OP_MAX; j++)
+            fs_hist_merge(&all, &res[i].hist[j]);
+    }
+    printf("%d %s stations, %llu requests in %.3f s, %.0f requests/s\n",
+        nstations, load_beebem ? "BeebEm" : "AUN",
+        (unsigned long long)all.count, elapsed,
+        elapsed > 0 ? all.count / elapsed : 0.0);
+    printf("%lu retransmitted, %lu timed out, %d stations failed\n",
+        retransmits, timeouts, failed);
+    printf("%-8s %8s %6s %9s %8s %8s %8s %8s %8s\n", "op", "count",
+        "errors", "per sec", "mean ms", "p50", "p90", "p99", "max");
+    for (j = 0; j < LOAD_OP_MAX; j++) {
+        memset(&total, 0, sizeof(total));
+        for (i = 0; i < nstations; i++)
+            fs_hist_merge(&total, &res[i].hist[j]);
+        if (total.count > 0)
+            load_print(load_opnames[j], &total, elapsed);
+    }
+    load_print("total", &all, elapsed);
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,307 @@
+/*-
+ * Copyright (c) 2010 Simon Tatham
+ * Copyright (c) 1998, 2010 Ben Harris
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/*
+ * aundmeta - convert a tree served by aund between the two ways of
+ * storing Acorn metadata (.Acorn symlinks and extended attributes).
+ * aund must not be running on the tree at the time.
+ */
+
+#if HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#if HAVE_SYS_XATTR_H
+#include <sys/xattr.h>
+#endif
+
+#include <dirent.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <fts.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define META_XATTR_NAME "user.acorn.meta"
+
+#if !HAVE_SYS_XATTR_H
+#define getxattr(path, name, value, size) (errno = ENOTSUP, -1)
+#define setxattr(path, name, value, size, flags) (errno = ENOTSUP, -1)
+#define removexattr(path, name) (errno = ENOTSUP, -1)
+#elif defined(__APPLE__)
+#define getxattr(path, name, value, size) \
+	getxattr(path, name, value, size, 0, 0)
+#define setxattr(path, name, value, size, flags) \
+	setxattr(path, name, value, size, 0, flags)
+#define removexattr(path, name) removexattr(path, name, 0)
+#endif
+
+static char *progname;
+static bool to_xattr;
+static bool dryrun = false;
+static bool verbose = false;
+
+static void usage(void);
+static bool meta_normalise(char *, int);
+static int convert_file(int, const char *, const char *);
+static int convert_dir(const char *);
+
+static void
+usage(void)
+{
+
+    fprintf(stderr, "usage: %s [-nv] [-j jobs] -t symlink|xattr root\n",
+        progname);
+    exit(EXIT_FAILURE);
+}
+
+/*
+ * Turn metadata in either of the formats aund has used for symlinks
+ * into "LLLLLLLL EEEEEEEE".  The buffer must have room for 18 bytes.
+ */
+static bool
+meta_normalise(char *rawinfo, int len)
+{
+    unsigned long load = 0, exec = 0;
+    int i;
+
+    rawinfo[len] = '\0';
+    if (len == 23) {
+        /* Old format: eight little-endian bytes. */
+        for (i = 0; i < 4; i++) {
+            load |= strtoul(rawinfo+i*3, NULL, 16) << (i * 8);
+            exec |= strtoul(rawinfo+12+i*3, NULL, 16) << (i * 8);
+        }
+    } else if (len == 17) {
+        load = strtoul(rawinfo, NULL, 16);
+        exec = strtoul(rawinfo + 9, NULL, 16);
+    } else
+        return false;
+    sprintf(rawinfo, "%08lX %08lX", load & 0xffffffff, exec & 0xffffffff);
+    return true;
+}
+
+/*
+ * Convert the metadata for one file.  dirfd is the directory it's
+ * in, path is its full path and name its leaf name.  Returns 1 if
+ * there was anything to convert, 0 if not, and -1 on failure.
+ */
+static int
+convert_file(int dirfd, const char *path, const char *name)
+{
+    char metapath[NAME_MAX + 8], rawinfo[24];
+    ssize_t len;
+
+    snprintf(metapath, sizeof(metapath), ".Acorn/%s", name);
+    if (to_xattr) {
+        len = readlinkat(dirfd, metapath, rawinfo, 23);
+        if (len == -1)
+            return 0;
+        if (!meta_normalise(rawinfo, len)) {
+            warnx("%s: unrecognised metadata", path);
+            return -1;
+        }
+        if (verbose) printf("%s: %s\n", path, rawinfo);
+        if (dryrun)
+            return 1;
+        if (setxattr(path, META_XATTR_NAME, rawinfo, 17, 0) == -1) {
+            warn("%s: setxattr", path);
+            return -1;
+        }
+        if (unlinkat(dirfd, metapath, 0) == -1) {
+            warn("%s: unlink", metapath);
+            return -1;
+        }
+    } else {
+        len = getxattr(path, META_XATTR_NAME, rawinfo, 23);
+        if (len == -1)
+            return 0;
+        if (!meta_normalise(rawinfo, len)) {
+            warnx("%s: unrecognised metadata", path);
+            return -1;
+        }
+        if (verbose) printf("%s: %s\n", path, rawinfo);
+        if (dryrun)
+            return 1;
+        if (mkdirat(dirfd, ".Acorn", 0777) == -1 && errno != EEXIST) {
+            warn("%s: mkdir .Acorn", path);
+            return -1;
+        }
+        if ((unlinkat(dirfd, metapath, 0) == -1 && errno != ENOENT) ||
+            symlinkat(rawinfo, dirfd, metapath) == -1) {
+            warn("%s: symlink", path);
+            return -1;
+        }
+        if (removexattr(path, META_XATTR_NAME) == -1) {
+            warn("%s: removexattr", path);
+            return -1;
+        }
+    }
+    return 1;
+}
+
+/*
+ * Convert everything in one directory.  Returns the number of
+ * failures.
+ */
+static int
+convert_dir(const char *dir)
+{
+    DIR *dp;
+    struct dirent *de;
+    char *path;
+    int dirfd, nfail = 0;
+
+    if ((dirfd = open(dir, O_RDONLY | O_DIRECTORY)) == -1 ||
+        (dp = fdopendir(dirfd)) == NULL) {
+        warn("%s", dir);
+        if (dirfd != -1)
+            close(dirfd);
+        return 1;
+    }
+    while ((de = readdir(dp)) != NULL) {
+        if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, "..") ||
+            !strcmp(de->d_name, ".Acorn"))
+            continue;
+        if ((path = malloc(strlen(dir) + strlen(de->d_name) + 2)) == NULL)
+            err(1, "malloc");
+        sprintf(path, "%s/%s", dir, de->d_name);
+        if (convert_file(dirfd, path, de->d_name) == -1)
+            nfail++;
+        free(path);
+    }
+    /* Only succeeds if we've emptied it. */
+    if (to_xattr && !dryrun)
+        unlinkat(dirfd, ".Acorn", AT_REMOVEDIR);
+    closedir(dp);
+    return nfail;
+}
+
+int
+main(int argc, char *argv[])
+{
+    char *path_argv[2];
+    char **dirs = NULL;
+    size_t ndirs = 0, maxdirs = 0, i;
+    FTS *ftsp;
+    FTSENT *f;
+    pid_t pid;
+    int c, jobs = 1, job, status, nfail;
+    bool got_format = false;
+
+    progname = argv[0];
+    while ((c = getopt(argc, argv, "j:nt:v")) != -1) {
+        switch (c) {
+        case 'j':
+            jobs = atoi(optarg);
+            if (jobs < 1)
+                usage();
+            break;
+        case 'n':
+            dryrun = true;
+            break;
+        case 't':
+            if (!strcmp(optarg, "xattr"))
+                to_xattr = true;
+            else if (!strcmp(optarg, "symlink"))
+                to_xattr = false;
+            else
+                usage();
+            got_format = true;
+            break;
+        case 'v':
+            verbose = true;
+            break;
+        default:
+            usage();
+        }
+    }
+    argc -= optind;
+    argv += optind;
+    if (argc != 1 || !got_format)
+        usage();
+#if !HAVE_SYS_XATTR_H
+    errx(1, "extended attributes not supported on this system");
+#endif
+
+    /* Make a list of all the directories in the tree. */
+    path_argv[0] = argv[0];
+    path_argv[1] = NULL;
+    ftsp = fts_open(path_argv, FTS_PHYSICAL | FTS_NOCHDIR, NULL);
+    if (ftsp == NULL)
+        err(1, "%s", argv[0]);
+    while ((f = fts_read(ftsp)) != NULL) {
+        if (f->fts_info == FTS_DNR || f->fts_info == FTS_ERR)
+            warnx("%s: %s", f->fts_path, strerror(f->fts_errno));
+        if (f->fts_info != FTS_D)
+            continue;
+        if (!strcmp(f->fts_name, ".Acorn")) {
+            fts_set(ftsp, f, FTS_SKIP);
+            continue;
+        }
+        if (ndirs == maxdirs) {
+            maxdirs = maxdirs ? maxdirs * 2 : 64;
+            dirs = realloc(dirs, maxdirs * sizeof(*dirs));
+            if (dirs == NULL)
+                err(1, "realloc");
+        }
+        if ((dirs[ndirs++] = strdup(f->fts_path)) == NULL)
+            err(1, "strdup");
+    }
+    fts_close(ftsp);
+
+    /*
+     * Share the directories out between the jobs.  Each directory
+     * is converted by exactly one job, so they don't interfere.
+     */
+    fflush(stdout);
+    for (job = 0; job < jobs; job++) {
+        pid = fork();
+        if (pid == -1)
+            err(1, "fork");
+        if (pid == 0) {
+            nfail = 0;
+            for (i = job; i < ndirs; i += jobs)
+                nfail += convert_dir(dirs[i]);
+            fflush(stdout);
+            _exit(nfail ? EXIT_FAILURE : EXIT_SUCCESS);
+        }
+    }
+    nfail = 0;
+    while (wait(&status) != -1)
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS)
+            nfail++;
+    return nfail ? EXIT_FAILURE : EXIT_SUCCESS;
+}
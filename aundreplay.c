@@ -0,0 +1,393 @@
+/*-
+ * Copyright (c) 2010 Simon Tatham
+ * Copyright (c) 2010 Ben Harris
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/*
+ * aundreplay - feed a capture written by aund (see capture.c) back
+ * into the file server, as fast as it will go.
+ *
+ * The file server runs here in-process, configured as aund would be,
+ * with a transport that takes the packets stations sent from the
+ * capture and throws away what the file server sends.  Requests go in
+ * in the order they were captured, and the data for a SAVE or PUTBYTES
+ * is handed over when the file server asks for it.  Run it against a
+ * copy of the tree the capture was made on, since it will change it.
+ */
+
+#if HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <sys/types.h>
+#include <sys/select.h>
+#include <sys/time.h>
+
+#include <err.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "aun.h"
+#include "extern.h"
+#include "fileserver.h"
+#include "capture.h"
+
+#define REPLAY_REPORT	4096
+
+struct replay_pkt {
+    struct aun_srcaddr from;
+    const unsigned char *data;	/* An AUN frame */
+    size_t len;
+    bool used;
+};
+
+/* What aund.c provides in aund */
+int debug = 0;
+int using_syslog = 0;
+char *beebem_cfg_file = NULL;
+struct aun_stats aun_stats;
+int default_fsstation = 254;
+volatile int reload_pending = 0;
+
+static char *progname;
+static struct replay_pkt *replay_pkts;
+static size_t replay_npkts, replay_next, replay_sent;
+static unsigned char replay_buf[65536];
+
+static void usage(void);
+static uint32_t replay_swap32(uint32_t, bool);
+static void replay_load(const char *);
+static void replay_setup(void);
+static struct aun_packet *replay_recv(ssize_t *, struct aun_srcaddr *, int);
+static int replay_wait(int, int);
+static ssize_t replay_xmit(struct aun_packet *, size_t, struct aun_srcaddr *);
+static char *replay_ntoa(struct aun_srcaddr *);
+static void replay_get_stn(struct aun_srcaddr *, uint8_t *);
+static void replay_settle(void);
+static void replay_print(const char *, size_t);
+
+static struct aun_funcs replay = {
+    AUN_MAX_BLOCK,
+    replay_setup,
+    replay_recv,
+    replay_wait,
+    replay_xmit,
+    replay_ntoa,
+    replay_get_stn,
+    NULL,
+};
+
+const struct aun_funcs *aunfuncs = &replay;
+
+static void
+usage(void)
+{
+
+    fprintf(stderr,
+        "usage: %s [-d] [-b blocksize] [-c config] [-r root] capture\n",
+        progname);
+    exit(EXIT_FAILURE);
+}
+
+static uint32_t
+replay_swap32(uint32_t v, bool swap)
+{
+
+    if (!swap)
+        return v;
+    return v >> 24 | (v >> 8 & 0xff00) | (v << 8 & 0xff0000) | v << 24;
+}
+
+/*
+ * Read a capture, and keep the packets that stations sent to us, which
+ * are the ones addressed to 0.0.0.0.
+ */
+static void
+replay_load(const char *file)
+{
+    struct capture_file_hdr h;
+    struct capture_rec_hdr r;
+    struct replay_pkt *p;
+    unsigned char *data;
+    size_t size = 0, alloc = 0, ihl, len;
+    bool swap;
+    FILE *f;
+
+    if ((f = fopen(file, "r")) == NULL)
+        err(1, "%s", file);
+    if (fread(&h, sizeof(h), 1, f) != 1)
+        errx(1, "%s: not a capture file", file);
+    if (h.magic != CAPTURE_MAGIC &&
+        h.magic != replay_swap32(CAPTURE_MAGIC, true))
+        errx(1, "%s: not a capture file", file);
+    swap = h.magic != CAPTURE_MAGIC;
+    if (replay_swap32(h.linktype, swap) != CAPTURE_LINKTYPE_RAW)
+        errx(1, "%s: not raw IP", file);
+    while (fread(&r, sizeof(r), 1, f) == 1) {
+        len = replay_swap32(r.incl_len, swap);
+        if (len > CAPTURE_SNAPLEN)
+            errx(1, "%s: corrupt record", file);
+        if ((data = malloc(len ? len : 1)) == NULL)
+            errx(1, "out of memory");
+        if (len > 0 && fread(data, len, 1, f) != 1)
+            errx(1, "%s: truncated", file);
+        if (len < CAPTURE_IPHDR || data[0] >> 4 != 4 || data[9] != 17 ||
+            (ihl = (data[0] & 15) * 4) + CAPTURE_UDPHDR +
+            sizeof(struct aun_packet) > len ||
+            memcmp(data + 16, "\0\0\0\0", 4) != 0) {
+            free(data);
+            continue;
+        }
+        if (size == alloc) {
+            alloc = alloc ? alloc * 2 : 1024;
+            if ((p = realloc(replay_pkts, alloc * sizeof(*p))) == NULL)
+                errx(1, "out of memory");
+            replay_pkts = p;
+        }
+        p = &replay_pkts[size++];
+        memset(&p->from, 0, sizeof(p->from));
+        memcpy(p->from.bytes, data + 12, 4);
+        p->data = data + ihl + CAPTURE_UDPHDR;
+        p->len = len - ihl - CAPTURE_UDPHDR;
+        p->used = false;
+    }
+    if (ferror(f))
+        err(1, "%s", file);
+    fclose(f);
+    replay_npkts = size;
+}
+
+static void
+replay_setup(void)
+{
+
+}
+
+/*
+ * Hand over the next packet for port want_port.  If from is set, it
+ * must be from there too, and it mustn't be beyond that station's
+ * next request, which is as long as a station would wait; if there's
+ * no such packet we've timed out.  Packets passed over while waiting
+ * for a request are thrown away, as aund would reject them.
+ */
+static struct aun_packet *
+replay_recv(ssize_t *outsize, struct aun_srcaddr *from, int want_port)
+{
+    static const struct aun_srcaddr any;
+    struct replay_pkt *p;
+    const struct aun_packet *pkt;
+    bool anyone = memcmp(from, &any, sizeof(any)) == 0;
+    size_t i;
+
+    for (i = replay_next; i < replay_npkts; i++) {
+        p = &replay_pkts[i];
+        if (p->used)
+            continue;
+        pkt = (const struct aun_packet *)p->data;
+        if (anyone) {
+            p->used = true;
+            if (want_port != 0 && pkt->dest_port != want_port)
+                continue;
+        } else {
+            if (memcmp(&p->from, from, sizeof(*from)) != 0)
+                continue;
+            if (pkt->dest_port == EC_PORT_FS && want_port != EC_PORT_FS)
+                break;
+            if (want_port != 0 && pkt->dest_port != want_port)
+                continue;
+            p->used = true;
+        }
+        while (replay_next < replay_npkts && replay_pkts[replay_next].used)
+            replay_next++;
+        memcpy(replay_buf, p->data, p->len);
+        *outsize = p->len;
+        *from = p->from;
+        aun_stats.rx_packets++;
+        aun_stats.rx_bytes += p->len;
+        return (struct aun_packet *)replay_buf;
+    }
+    while (replay_next < replay_npkts && replay_pkts[replay_next].used)
+        replay_next++;
+    if (!anyone)
+        aun_stats.timeouts++;
+    errno = ETIMEDOUT;
+    return NULL;
+}
+
+static int
+replay_wait(int secs, int fd)
+{
+
+    return replay_next < replay_npkts;
+}
+
+static ssize_t
+replay_xmit(struct aun_packet *pkt, size_t len, struct aun_srcaddr *to)
+{
+
+    aun_stats.tx_packets++;
+    aun_stats.tx_bytes += len;
+    replay_sent++;
+    return len;
+}
+
+static char *
+replay_ntoa(struct aun_srcaddr *addr)
+{
+
+    return aun.ntoa(addr);
+}
+
+static void
+replay_get_stn(struct aun_srcaddr *addr, uint8_t *out)
+{
+
+    aun.get_stn(addr, out);
+}
+
+/*
+ * Let any requests put aside for a password check finish, as the
+ * station would have waited for its reply before going on.
+ */
+static void
+replay_settle(void)
+{
+    struct timeval timeout;
+    fd_set r;
+    int fd;
+
+    while (fs_deferred_pending()) {
+        if ((fd = fs_wait_fd()) != -1) {
+            FD_ZERO(&r);
+            FD_SET(fd, &r);
+            timeout.tv_sec = 1;
+            timeout.tv_usec = 0;
+            select(fd + 1, &r, NULL, NULL, &timeout);
+        }
+        fs_periodic();
+    }
+}
+
+/* Print a *STATS-style report, which has CRs for newlines */
+static void
+replay_print(const char *buf, size_t len)
+{
+    size_t i;
+
+    for (i = 0; i < len && buf[i] != '\x80'; i++)
+        putchar(buf[i] == '\r' ? '\n' : buf[i]);
+}
+
+int
+main(int argc, char *argv[])
+{
+    char const *conffile = "/etc/aund.conf";
+    char *newroot = NULL;
+    char report[REPLAY_REPORT];
+    struct aun_packet *pkt;
+    struct aun_srcaddr from;
+    struct timespec t0, t1, last;
+    unsigned long requests = 0;
+    ssize_t msgsize;
+    double secs;
+    int c;
+    bool set_debug = false;
+
+    progname = argv[0];
+    while ((c = getopt(argc, argv, "b:c:dr:")) != -1) {
+        switch (c) {
+        case 'b':
+            replay.max_block = atoi(optarg);
+            if (replay.max_block <= 0)
+                errx(1, "bad block size");
+            break;
+        case 'c':
+            conffile = optarg;
+            break;
+        case 'd':
+            set_debug = true;
+            break;
+        case 'r':
+            newroot = optarg;
+            break;
+        default:
+            usage();
+        }
+    }
+    argc -= optind;
+    argv += optind;
+    if (argc != 1)
+        usage();
+
+    replay_load(argv[0]);
+    conf_init(conffile);
+    if (newroot != NULL)
+        root = newroot;
+    beebem_cfg_file = NULL;
+    fs_init();
+    using_syslog = 0;
+    debug = set_debug;
+    if (debug) setlinebuf(stdout);
+    if (root == NULL)
+        errx(1, "no root configured");
+    if (chdir(root) < 0)
+        err(1, "%s: chdir", root);
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    last = t0;
+    for (;;) {
+        memset(&from, 0, sizeof(from));
+        if ((pkt = aunfuncs->recv(&msgsize, &from, EC_PORT_FS)) == NULL)
+            break;
+        if (debug) printf("\n\t(file server: ");
+        file_server(pkt, msgsize, &from);
+        if (debug) printf(")\n");
+        requests++;
+        replay_settle();
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        if (t1.tv_sec != last.tv_sec) {
+            fs_periodic();
+            last = t1;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+
+    printf("%lu requests in %.3f s, %.0f requests/s\n", requests, secs,
+        secs > 0 ? requests / secs : 0.0);
+    printf("%llu packets in, %lu out, %llu timed out\n",
+        (unsigned long long)aun_stats.rx_packets, (unsigned long)replay_sent,
+        (unsigned long long)aun_stats.timeouts);
+    replay_print(report, fs_stats_report(report, sizeof(report), false));
+    if (fs_cost_on)
+        replay_print(report, fs_cost_report(report, sizeof(report)));
+    return 0;
+}
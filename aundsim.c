@@ -0,0 +1,1345 @@
+/*-
+ * Copyright (c) 2010 Simon Tatham
+ * Copyright (c) 2010 Ben Harris
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/*
+ * aundsim - run the file server against simulated stations on a
+ * simulated network, in simulated time.
+ *
+ * The file server runs in-process, as in aundreplay, over the real
+ * aun.c or (with -b) beebem.c, with the timeout and retries options.
+ * What they see through struct aun_net is a simulated network whose
+ * clock only moves when they have to wait for something.  Stations
+ * follow a script, through links that lose, duplicate, delay and
+ * reorder packets as configured for each.
+ * Everything is driven from one queue of events in time order and one
+ * seeded random number generator, so a run can be repeated exactly,
+ * and minutes of retransmission take milliseconds.  Time spent in the
+ * file server itself counts as nothing.
+ */
+
+#if HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <sys/types.h>
+#include <sys/select.h>
+#include <sys/time.h>
+
+#include <ctype.h>
+#include <err.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "aun.h"
+#include "extern.h"
+#include "fileserver.h"
+#include "fs_proto.h"
+
+#define SIM_STATIONS	253
+#define SIM_FOREVER	UINT64_MAX
+#define SIM_CLIENT_WAIT	100000		/* Stations' wait for an ACK, in us */
+#define SIM_CLIENT_TRIES 50
+#define SIM_REPLY_WAIT	10000000	/* Stations' wait for a reply */
+#define SIM_SEEN	8		/* Sequence numbers a station remembers */
+#define SIM_EXAMINE	20
+#define SIM_PPM		1000000		/* Chances are in parts per million */
+
+#define SIM_REPLY_PORT	0x90
+#define SIM_ACK_PORT	0x91
+#define SIM_DATA_PORT	0x92
+
+/* Not AUN: a BeebEm scout frame, which asks to send to dest_port */
+#define SIM_TYPE_SCOUT	0x80
+
+/* Station n is at 1.0.0.n, as AUN would have station n */
+#define SIM_ADDR(n)	(0x01000000 | (n))
+
+enum sim_ev {
+    SIM_EV_SERVER,	/* A packet arriving at the file server */
+    SIM_EV_STATION,	/* A packet arriving at a station */
+    SIM_EV_TIMER	/* A station's timer going off */
+};
+
+struct sim_event {
+    uint64_t when;
+    uint64_t order;	/* Events at the same time happen in order made */
+    enum sim_ev kind;
+    int stn;			/* Index into sim_stns */
+    unsigned gen;	/* A timer is stale if the station's gen moved on */
+    size_t len;
+    unsigned char data[0];
+};
+
+struct sim_link {
+    uint32_t loss, dup, reorder;	/* Chances, in parts per million */
+    uint64_t delay, jitter;		/* In us */
+};
+
+enum sim_op {
+    SIM_OP_IAM,
+    SIM_OP_EXAMINE,
+    SIM_OP_INFO,
+    SIM_OP_LOAD,
+    SIM_OP_SAVE,
+    SIM_OP_OPEN,
+    SIM_OP_CLOSE,
+    SIM_OP_BGET,
+    SIM_OP_BPUT,
+    SIM_OP_CLI,
+    SIM_OP_SLEEP,
+    SIM_OP_MAX
+};
+
+static const char *const sim_opnames[SIM_OP_MAX] = {
+    [SIM_OP_IAM] = "iam",
+    [SIM_OP_EXAMINE] = "examine",
+    [SIM_OP_INFO] = "info",
+    [SIM_OP_LOAD] = "load",
+    [SIM_OP_SAVE] = "save",
+    [SIM_OP_OPEN] = "open",
+    [SIM_OP_CLOSE] = "close",
+    [SIM_OP_BGET] = "bget",
+    [SIM_OP_BPUT] = "bput",
+    [SIM_OP_CLI] = "cli",
+    [SIM_OP_SLEEP] = "sleep",
+};
+
+struct sim_step {
+    int first, last;		/* Stations it's for */
+    enum sim_op op;
+    char *arg;			/* Name, command or user, with @ in */
+    unsigned long num;		/* Size to SAVE, or ms to sleep */
+    unsigned long repeat;
+};
+
+struct sim_times {
+    uint64_t *usec;
+    size_t count, alloc;
+    unsigned long errors;
+};
+
+struct sim_station {
+    int num;
+    struct sim_link link;
+    size_t step;		/* Where in the script */
+    unsigned long rep;
+    enum { SIM_ST_IDLE, SIM_ST_SEND, SIM_ST_WAIT, SIM_ST_DONE } state;
+    int phase;			/* Of a LOAD or SAVE */
+    uint64_t started;		/* When the operation began */
+    unsigned gen;
+    unsigned char out[sizeof(struct aun_packet) + AUN_MAX_BLOCK + 8];
+    size_t outlen;		/* Packet waiting for an ACK */
+    bool scout;			/* Still to get the ACK for its scout */
+    int tries;
+    uint32_t seq;
+    uint32_t seen[SIM_SEEN];	/* Recent sequence numbers received */
+    int nseen;
+    int rxport;			/* With -b, port of the scout just ACKed */
+    int rxflag;
+    uint32_t rxseq;
+    int want;			/* Port waited on, besides the reply port */
+    uint8_t urd, csd, lib, handle, byteseq;
+    size_t size, done, block;
+    int dataport;
+    char arg[256];
+    uint64_t arrives[2];	/* Last arrival each way, to keep order */
+};
+
+/* What aund.c provides in aund */
+int debug = 0;
+int using_syslog = 0;
+char *beebem_cfg_file = NULL;
+struct aun_stats aun_stats;
+int default_fsstation = 254;
+volatile int reload_pending = 0;
+
+static char *progname;
+static bool sim_beebem;
+static uint64_t sim_now, sim_order, sim_rand = 88172645463325252ULL;
+static uint64_t sim_end;		/* When the last station finished */
+static struct sim_event **sim_heap;
+static size_t sim_nheap, sim_aheap;
+static struct sim_station *sim_stns;
+static int sim_nstns = 1;
+static struct sim_step *sim_steps;
+static size_t sim_nsteps;
+static struct sim_times sim_times[SIM_OP_MAX];
+static unsigned char *sim_savedata;
+static struct sim_event *sim_held;	/* Peeked at by the file server */
+static struct {
+    uint64_t packets, lost, duplicated, reordered;
+    uint64_t retransmits, gaveup;
+} sim_stats;
+
+static void usage(void);
+static uint64_t sim_random(void);
+static bool sim_chance(uint32_t);
+static bool sim_before(const struct sim_event *, const struct sim_event *);
+static void sim_push(struct sim_event *);
+static struct sim_event *sim_pop(uint64_t);
+static struct sim_event *sim_event(enum sim_ev, int, const void *, size_t,
+    uint64_t);
+static void sim_link_send(int, enum sim_ev, const void *, size_t);
+static void sim_reply(struct sim_station *, int, const struct aun_packet *);
+static void sim_frame(struct sim_station *, const struct aun_packet *, size_t,
+    bool);
+static bool sim_unframe(struct sim_station *, struct sim_event *,
+    struct aun_packet *, size_t *);
+static void sim_timer(struct sim_station *, uint64_t);
+static void sim_expand(struct sim_station *, const char *);
+static void sim_transmit(struct sim_station *);
+static void sim_send(struct sim_station *, int, int, const void *, size_t);
+static void sim_request(struct sim_station *, int, int, const void *, size_t);
+static void sim_finish(struct sim_station *, bool);
+static void sim_next(struct sim_station *);
+static void sim_begin(struct sim_station *, const struct sim_step *);
+static void sim_sent(struct sim_station *);
+static void sim_got(struct sim_station *, int, const unsigned char *, size_t);
+static void sim_station_event(struct sim_event *);
+static struct sim_station *sim_station(const struct sockaddr_in *);
+static void sim_net_open(const struct sockaddr_in *);
+static ssize_t sim_net_send(const void *, size_t, const struct sockaddr_in *);
+static ssize_t sim_net_recv(void *, size_t, int, struct sockaddr_in *, long);
+static int sim_net_wait(int, int);
+static uint64_t sim_net_clock(void);
+static void sim_beebem_cfg(void);
+static void sim_settle(void);
+static uint32_t sim_parse_chance(const char *, const char *);
+static uint64_t sim_parse_ms(const char *, const char *);
+static void sim_parse_who(char *, int *, int *, const char *, int);
+static void sim_load(const char *);
+static int sim_cmp(const void *, const void *);
+
+static const struct aun_net sim_net = {
+    sim_net_open,
+    sim_net_send,
+    sim_net_recv,
+    sim_net_wait,
+    sim_net_clock,
+};
+
+const struct aun_funcs *aunfuncs = &aun;
+
+static void
+usage(void)
+{
+
+    fprintf(stderr, "usage: %s [-bd] [-c config] [-R retries] [-r root] "
+        "[-s seed] [-T timeout]\n\tscript\n", progname);
+    exit(EXIT_FAILURE);
+}
+
+/* xorshift64* */
+static uint64_t
+sim_random(void)
+{
+
+    sim_rand ^= sim_rand >> 12;
+    sim_rand ^= sim_rand << 25;
+    sim_rand ^= sim_rand >> 27;
+    return sim_rand * 2685821657736338717ULL;
+}
+
+static bool
+sim_chance(uint32_t ppm)
+{
+
+    return ppm != 0 && sim_random() % SIM_PPM < ppm;
+}
+
+static bool
+sim_before(const struct sim_event *a, const struct sim_event *b)
+{
+
+    return a->when < b->when || (a->when == b->when && a->order < b->order);
+}
+
+static void
+sim_push(struct sim_event *ev)
+{
+    struct sim_event *t;
+    size_t i;
+
+    if (sim_nheap == sim_aheap) {
+        sim_aheap = sim_aheap ? sim_aheap * 2 : 256;
+        if ((sim_heap = realloc(sim_heap, sim_aheap * sizeof(*sim_heap))) ==
+            NULL)
+            err(1, "realloc");
+    }
+    i = sim_nheap++;
+    sim_heap[i] = ev;
+    while (i > 0 && sim_before(sim_heap[i], sim_heap[(i - 1) / 2])) {
+        t = sim_heap[i];
+        sim_heap[i] = sim_heap[(i - 1) / 2];
+        sim_heap[(i - 1) / 2] = t;
+        i = (i - 1) / 2;
+    }
+}
+
+/*
+ * Take the next event, if there's one by the deadline, and move the
+ * clock on to it.  Otherwise the clock moves on to the deadline, as if
+ * we'd waited that long, and NULL comes back.
+ */
+static struct sim_event *
+sim_pop(uint64_t deadline)
+{
+    struct sim_event *ev, *t;
+    size_t i, c;
+
+    if (sim_nheap == 0 || sim_heap[0]->when > deadline) {
+        if (deadline != SIM_FOREVER)
+            sim_now = deadline;
+        return NULL;
+    }
+    ev = sim_heap[0];
+    sim_heap[0] = sim_heap[--sim_nheap];
+    for (i = 0; (c = 2 * i + 1) < sim_nheap; i = c) {
+        if (c + 1 < sim_nheap && sim_before(sim_heap[c + 1], sim_heap[c]))
+            c++;
+        if (!sim_before(sim_heap[c], sim_heap[i]))
+            break;
+        t = sim_heap[i];
+        sim_heap[i] = sim_heap[c];
+        sim_heap[c] = t;
+    }
+    if (ev->when > sim_now)
+        sim_now = ev->when;
+    return ev;
+}
+
+static struct sim_event *
+sim_event(enum sim_ev kind, int stn, const void *data, size_t len,
+    uint64_t when)
+{
+    struct sim_event *ev;
+
+    if ((ev = malloc(sizeof(*ev) + len)) == NULL)
+        err(1, "malloc");
+    ev->when = when;
+    ev->order = sim_order++;
+    ev->kind = kind;
+    ev->stn = stn;
+    ev->gen = 0;
+    ev->len = len;
+    if (len != 0)
+        memcpy(ev->data, data, len);
+    return ev;
+}
+
+/*
+ * Put a packet on station stn's link, in the direction kind says.  It
+ * may be lost, or arrive twice, or be held up long enough for what's
+ * sent after it to get there first.  Otherwise packets arrive in the
+ * order they were sent, whatever the jitter.
+ */
+static void
+sim_link_send(int stn, enum sim_ev kind, const void *data, size_t len)
+{
+    const struct sim_link *l = &sim_stns[stn].link;
+    uint64_t *last = &sim_stns[stn].arrives[kind == SIM_EV_SERVER];
+    uint64_t when;
+    int copies, i;
+
+    sim_stats.packets++;
+    if (sim_chance(l->loss)) {
+        sim_stats.lost++;
+        return;
+    }
+    copies = 1;
+    if (sim_chance(l->dup)) {
+        sim_stats.duplicated++;
+        copies = 2;
+    }
+    for (i = 0; i < copies; i++) {
+        when = sim_now + l->delay;
+        if (l->jitter != 0)
+            when += sim_random() % (l->jitter + 1);
+        if (sim_chance(l->reorder)) {
+            sim_stats.reordered++;
+            when += 1 + sim_random() % (2 * l->delay + l->jitter + 1000);
+        } else {
+            if (when < *last)
+                when = *last;
+            *last = when;
+        }
+        sim_push(sim_event(kind, stn, data, len, when));
+    }
+}
+
+/*
+ * Acknowledge a packet, or a scout, that came to the station.
+ */
+static void
+sim_reply(struct sim_station *st, int type, const struct aun_packet *pkt)
+{
+    struct aun_packet ack;
+
+    memset(&ack, 0, sizeof(ack));
+    ack.type = type;
+    memcpy(ack.seq, pkt->seq, sizeof(ack.seq));
+    sim_frame(st, &ack, sizeof(ack), false);
+}
+
+/*
+ * Put a packet from the station on its link.  With -b it goes as the
+ * BeebEm frame it stands for: a scout if scout is set, an ACK, or the
+ * data.
+ */
+static void
+sim_frame(struct sim_station *st, const struct aun_packet *pkt, size_t len,
+    bool scout)
+{
+    unsigned char frame[sizeof(st->out)];
+    size_t n;
+
+    if (!sim_beebem) {
+        sim_link_send(st - sim_stns, SIM_EV_SERVER, pkt, len);
+        return;
+    }
+    frame[0] = our_econet_addr & 0xff;
+    frame[1] = our_econet_addr >> 8;
+    frame[2] = st->num;
+    frame[3] = 0;
+    if (scout) {
+        frame[4] = 0x80 | pkt->flag;
+        frame[5] = pkt->dest_port;
+        n = 6;
+    } else if (pkt->type == AUN_TYPE_ACK)
+        n = 4;
+    else {
+        n = 4 + len - sizeof(*pkt);
+        memcpy(frame + 4, pkt->data, len - sizeof(*pkt));
+    }
+    sim_link_send(st - sim_stns, SIM_EV_SERVER, frame, n);
+}
+
+/*
+ * With -b, turn a frame that came to the station back into a packet.
+ * Frames don't say what they are, so a six-byte one with the top bit
+ * of its control byte set is taken to be a scout, and anything else
+ * but an ACK is the data for the last scout.  Returns false if the
+ * station would ignore the frame.
+ */
+static bool
+sim_unframe(struct sim_station *st, struct sim_event *ev,
+    struct aun_packet *pkt, size_t *len)
+{
+    const unsigned char *frame = ev->data;
+    bool scout;
+
+    if (ev->len < 4)
+        return false;
+    memset(pkt, 0, sizeof(*pkt));
+    scout = ev->len == 6 && (frame[4] & 0x80);
+    if (ev->len == 4) {
+        pkt->type = AUN_TYPE_ACK;
+        memcpy(pkt->seq, ((struct aun_packet *)st->out)->seq, 4);
+        *len = sizeof(*pkt);
+    } else if (scout) {
+        pkt->type = SIM_TYPE_SCOUT;
+        pkt->dest_port = frame[5];
+        pkt->flag = frame[4] & 0x7f;
+        *len = sizeof(*pkt);
+        st->rxport = frame[5];
+        st->rxflag = pkt->flag;
+    } else if (st->rxport != -1) {
+        pkt->type = AUN_TYPE_UNICAST;
+        pkt->dest_port = st->rxport;
+        pkt->flag = st->rxflag;
+        st->rxseq++;
+        pkt->seq[0] = st->rxseq;
+        pkt->seq[1] = st->rxseq >> 8;
+        pkt->seq[2] = st->rxseq >> 16;
+        pkt->seq[3] = st->rxseq >> 24;
+        memcpy(pkt->data, frame + 4, ev->len - 4);
+        *len = sizeof(*pkt) + ev->len - 4;
+        st->rxport = -1;
+    } else
+        return false;
+    return true;
+}
+
+/*
+ * Set the station's timer, cancelling any it had.
+ */
+static void
+sim_timer(struct sim_station *st, uint64_t when)
+{
+    struct sim_event *ev;
+
+    ev = sim_event(SIM_EV_TIMER, st - sim_stns, NULL, 0, when);
+    ev->gen = ++st->gen;
+    sim_push(ev);
+}
+
+/* Copy a script argument, with @ standing for the station number */
+static void
+sim_expand(struct sim_station *st, const char *arg)
+{
+    size_t i = 0;
+
+    for (; *arg != '\0' && i < sizeof(st->arg) - 4; arg++) {
+        if (*arg == '@')
+            i += snprintf(st->arg + i, sizeof(st->arg) - i, "%d", st->num);
+        else
+            st->arg[i++] = *arg;
+    }
+    st->arg[i] = '\0';
+}
+
+/*
+ * Send the station's outgoing packet, or with -b its scout first, and
+ * wait for it to be acknowledged.
+ */
+static void
+sim_transmit(struct sim_station *st)
+{
+
+    st->tries++;
+    sim_frame(st, (struct aun_packet *)st->out, st->outlen, st->scout);
+    st->state = SIM_ST_SEND;
+    sim_timer(st, sim_now + SIM_CLIENT_WAIT);
+}
+
+static void
+sim_send(struct sim_station *st, int port, int flag, const void *data,
+    size_t len)
+{
+    struct aun_packet *pkt = (struct aun_packet *)st->out;
+
+    pkt->type = AUN_TYPE_UNICAST;
+    pkt->dest_port = port;
+    pkt->flag = flag;
+    pkt->retrans = 0;
+    pkt->seq[0] = st->seq;
+    pkt->seq[1] = st->seq >> 8;
+    pkt->seq[2] = st->seq >> 16;
+    pkt->seq[3] = st->seq >> 24;
+    st->seq += 4;
+    memcpy(pkt->data, data, len);
+    st->outlen = sizeof(*pkt) + len;
+    st->scout = sim_beebem;
+    st->tries = 0;
+    sim_transmit(st);
+}
+
+/*
+ * Send a request to the file server.  The urd argument goes in the URD
+ * slot, which LOAD and SAVE use for a port number instead.
+ */
+static void
+sim_request(struct sim_station *st, int func, int urd, const void *args,
+    size_t len)
+{
+    unsigned char req[AUN_MAX_BLOCK];
+
+    req[0] = SIM_REPLY_PORT;
+    req[1] = func;
+    req[2] = urd;
+    req[3] = st->csd;
+    req[4] = st->lib;
+    memcpy(req + 5, args, len);
+    st->want = SIM_REPLY_PORT;
+    sim_send(st, EC_PORT_FS, 0, req, len + 5);
+}
+
+/*
+ * The operation is over, one way or another: note how long it took,
+ * and go on to the next.
+ */
+static void
+sim_finish(struct sim_station *st, bool failed)
+{
+    struct sim_times *t = &sim_times[sim_steps[st->step].op];
+
+    if (t->count == t->alloc) {
+        t->alloc = t->alloc ? t->alloc * 2 : 256;
+        if ((t->usec = realloc(t->usec, t->alloc * sizeof(*t->usec))) ==
+            NULL)
+            err(1, "realloc");
+    }
+    t->usec[t->count++] = sim_now - st->started;
+    if (failed)
+        t->errors++;
+    st->gen++;
+    st->state = SIM_ST_IDLE;
+    st->rep++;
+    sim_next(st);
+}
+
+/*
+ * Start the next step of the script that's for this station.
+ */
+static void
+sim_next(struct sim_station *st)
+{
+    const struct sim_step *s;
+
+    for (; st->step < sim_nsteps; st->step++, st->rep = 0) {
+        s = &sim_steps[st->step];
+        if (st->num >= s->first && st->num <= s->last &&
+            st->rep < s->repeat) {
+            sim_begin(st, s);
+            return;
+        }
+    }
+    st->state = SIM_ST_DONE;
+    sim_end = sim_now;
+}
+
+static void
+sim_begin(struct sim_station *st, const struct sim_step *s)
+{
+    unsigned char args[sizeof(st->arg) + 16];
+    int len;
+
+    st->started = sim_now;
+    st->phase = 0;
+    sim_expand(st, s->arg ? s->arg : "");
+    switch (s->op) {
+    case SIM_OP_IAM:
+        len = snprintf((char *)args, sizeof(args), "I AM %s\r", st->arg);
+        sim_request(st, EC_FS_FUNC_CLI, st->urd, args, len);
+        break;
+    case SIM_OP_EXAMINE:
+        args[0] = EC_FS_EXAMINE_ALL;
+        args[1] = 0;
+        args[2] = SIM_EXAMINE;
+        len = 3 + snprintf((char *)args + 3, sizeof(args) - 3, "%s\r",
+            st->arg);
+        sim_request(st, EC_FS_FUNC_EXAMINE, st->urd, args, len);
+        break;
+    case SIM_OP_INFO:
+        args[0] = EC_FS_GET_INFO_META;
+        len = 1 + snprintf((char *)args + 1, sizeof(args) - 1, "%s\r",
+            st->arg);
+        sim_request(st, EC_FS_FUNC_GET_INFO, st->urd, args, len);
+        break;
+    case SIM_OP_LOAD:
+        len = snprintf((char *)args, sizeof(args), "%s\r", st->arg);
+        sim_request(st, EC_FS_FUNC_LOAD, SIM_DATA_PORT, args, len);
+        break;
+    case SIM_OP_SAVE:
+        memset(args, 0xff, 8);		/* Load and exec &FFFFFFFF */
+        st->size = s->num;
+        args[8] = st->size;
+        args[9] = st->size >> 8;
+        args[10] = st->size >> 16;
+        len = 11 + snprintf((char *)args + 11, sizeof(args) - 11, "%s\r",
+            st->arg);
+        sim_request(st, EC_FS_FUNC_SAVE, SIM_ACK_PORT, args, len);
+        break;
+    case SIM_OP_OPEN:
+        args[0] = 0;			/* Create it if need be */
+        args[1] = 0;			/* For update */
+        len = 2 + snprintf((char *)args + 2, sizeof(args) - 2, "%s\r",
+            st->arg);
+        sim_request(st, EC_FS_FUNC_OPEN, st->urd, args, len);
+        break;
+    case SIM_OP_CLOSE:
+        sim_request(st, EC_FS_FUNC_CLOSE, st->urd, &st->handle, 1);
+        break;
+    case SIM_OP_BGET:
+    case SIM_OP_BPUT:
+        /* Short header, and a sequence bit to spot repeats */
+        args[0] = SIM_REPLY_PORT;
+        args[1] = s->op == SIM_OP_BGET ? EC_FS_FUNC_GETBYTE :
+            EC_FS_FUNC_PUTBYTE;
+        args[2] = st->handle;
+        args[3] = st->rep;
+        st->byteseq ^= 1;
+        st->want = SIM_REPLY_PORT;
+        sim_send(st, EC_PORT_FS, st->byteseq, args,
+            s->op == SIM_OP_BGET ? 3 : 4);
+        break;
+    case SIM_OP_CLI:
+        len = snprintf((char *)args, sizeof(args), "%s\r", st->arg);
+        sim_request(st, EC_FS_FUNC_CLI, st->urd, args, len);
+        break;
+    case SIM_OP_SLEEP:
+        st->phase = 1;
+        sim_timer(st, sim_now + s->num * 1000);
+        break;
+    default:
+        break;
+    }
+}
+
+/*
+ * The station's packet has been acknowledged, so wait for what comes
+ * back.
+ */
+static void
+sim_sent(struct sim_station *st)
+{
+
+    st->state = SIM_ST_WAIT;
+    sim_timer(st, sim_now + SIM_REPLY_WAIT);
+}
+
+/*
+ * Data has come for the station on its reply port, or on the port it
+ * was waiting on besides.  LOAD and SAVE go through the same data port
+ * handshakes as with aundload.
+ */
+static void
+sim_got(struct sim_station *st, int port, const unsigned char *data,
+    size_t len)
+{
+    enum sim_op op = sim_steps[st->step].op;
+    size_t this;
+
+    if (port == SIM_REPLY_PORT) {
+        if (len < 2 || data[1] != 0) {
+            sim_finish(st, true);
+            return;
+        }
+        if (op == SIM_OP_LOAD && st->phase == 0 && len >= 13) {
+            st->size = data[10] | data[11] << 8 | data[12] << 16;
+            st->done = 0;
+            st->phase = st->size ? 1 : 2;
+            st->want = st->size ? SIM_DATA_PORT : SIM_REPLY_PORT;
+            sim_sent(st);
+            return;
+        }
+        if (op == SIM_OP_SAVE && st->phase == 0 && len >= 5) {
+            st->dataport = data[2];
+            st->block = data[3] | data[4] << 8;
+            st->done = 0;
+            st->phase = 1;
+            if (st->block == 0) {
+                sim_finish(st, true);
+                return;
+            }
+        } else {
+            switch (op) {
+            case SIM_OP_IAM:
+            case SIM_OP_CLI:
+                if (data[0] == EC_FS_CC_LOGON && len >= 5) {
+                    st->urd = data[2];
+                    st->csd = data[3];
+                    st->lib = data[4];
+                } else if (data[0] == EC_FS_CC_DIR && len >= 3)
+                    st->csd = data[2];
+                else if (data[0] == EC_FS_CC_LIB && len >= 3)
+                    st->lib = data[2];
+                break;
+            case SIM_OP_OPEN:
+                if (len >= 3)
+                    st->handle = data[2];
+                break;
+            case SIM_OP_CLOSE:
+                st->handle = 0;
+                break;
+            default:
+                break;
+            }
+            sim_finish(st, false);
+            return;
+        }
+    } else if (op == SIM_OP_LOAD) {
+        st->done += len;
+        if (st->done >= st->size) {
+            st->phase = 2;
+            st->want = SIM_REPLY_PORT;
+        }
+        sim_sent(st);
+        return;
+    }
+    /* SAVE: send a block, after the first reply or an ACK */
+    if (st->done >= st->size) {
+        st->want = SIM_REPLY_PORT;
+        sim_sent(st);
+        return;
+    }
+    this = st->size - st->done < st->block ? st->size - st->done : st->block;
+    st->want = st->done + this < st->size ? SIM_ACK_PORT : SIM_REPLY_PORT;
+    sim_send(st, st->dataport, 0, sim_savedata + st->done, this);
+    st->done += this;
+}
+
+static void
+sim_station_event(struct sim_event *ev)
+{
+    static unsigned char buf[sizeof(struct aun_packet) + 65536];
+    struct sim_station *st = &sim_stns[ev->stn];
+    struct aun_packet *pkt = (struct aun_packet *)ev->data;
+    size_t len = ev->len;
+    uint32_t seq;
+    int i;
+
+    if (ev->kind == SIM_EV_TIMER) {
+        if (ev->gen != st->gen)
+            return;
+        switch (st->state) {
+        case SIM_ST_SEND:
+            if (st->tries < SIM_CLIENT_TRIES) {
+                sim_stats.retransmits++;
+                /* With -b, the handshake starts again from the scout */
+                st->scout = sim_beebem;
+                sim_transmit(st);
+            } else {
+                sim_stats.gaveup++;
+                sim_finish(st, true);
+            }
+            break;
+        case SIM_ST_WAIT:
+            sim_stats.gaveup++;
+            sim_finish(st, true);
+            break;
+        case SIM_ST_IDLE:
+            if (st->phase == 1) {	/* Done sleeping */
+                st->phase = 0;
+                st->rep++;
+            }
+            sim_next(st);
+            break;
+        default:
+            break;
+        }
+        return;
+    }
+    if (sim_beebem) {
+        pkt = (struct aun_packet *)buf;
+        if (!sim_unframe(st, ev, pkt, &len))
+            return;
+    }
+    if (len < sizeof(*pkt))
+        return;
+    switch (pkt->type) {
+    case AUN_TYPE_ACK:
+        if (st->state != SIM_ST_SEND ||
+            memcmp(pkt->seq, ((struct aun_packet *)st->out)->seq, 4) != 0)
+            break;
+        if (st->scout) {
+            st->scout = false;
+            sim_transmit(st);
+        } else
+            sim_sent(st);
+        break;
+    case SIM_TYPE_SCOUT:
+        sim_reply(st, AUN_TYPE_ACK, pkt);
+        break;
+    case AUN_TYPE_UNICAST:
+        sim_reply(st, AUN_TYPE_ACK, pkt);
+        seq = pkt->seq[0] | pkt->seq[1] << 8 | pkt->seq[2] << 16 |
+            (uint32_t)pkt->seq[3] << 24;
+        for (i = 0; i < st->nseen; i++)
+            if (st->seen[i] == seq)
+                return;
+        st->seen[st->nseen < SIM_SEEN ? st->nseen++ : seq % SIM_SEEN] =
+            seq;
+        /*
+         * A reply can overtake the ACK for what it's a reply to,
+         * and says just as well that it got there.
+         */
+        if ((st->state == SIM_ST_SEND || st->state == SIM_ST_WAIT) &&
+            (pkt->dest_port == SIM_REPLY_PORT ||
+             pkt->dest_port == st->want))
+            sim_got(st, pkt->dest_port, pkt->data, len - sizeof(*pkt));
+        break;
+    }
+}
+
+static struct sim_station *
+sim_station(const struct sockaddr_in *addr)
+{
+    uint32_t a = ntohl(addr->sin_addr.s_addr);
+
+    if (a < SIM_ADDR(1) || a > SIM_ADDR(sim_nstns))
+        return NULL;
+    return &sim_stns[a - SIM_ADDR(1)];
+}
+
+/*
+ * struct aun_net, for aun.c and beebem.c.  There's no socket to open.
+ */
+static void
+sim_net_open(const struct sockaddr_in *bindto)
+{
+
+}
+
+/*
+ * With -b, frames go to every station, as on a real Econet, but a
+ * station only takes any notice of those addressed to it, so the rest
+ * aren't sent on.
+ */
+static ssize_t
+sim_net_send(const void *data, size_t len, const struct sockaddr_in *to)
+{
+    const unsigned char *frame = data;
+    struct sim_station *st;
+
+    if ((st = sim_station(to)) == NULL) {
+        errno = EHOSTUNREACH;
+        return -1;
+    }
+    if (sim_beebem && (len < 4 || frame[0] != st->num || frame[1] != 0))
+        return len;
+    sim_link_send(st - sim_stns, SIM_EV_STATION, data, len);
+    return len;
+}
+
+/*
+ * Stations get on with things while the file server waits.  If
+ * nothing is left to happen, waiting for ever comes to nothing too.
+ */
+static ssize_t
+sim_net_recv(void *data, size_t len, int flags, struct sockaddr_in *from,
+    long usec)
+{
+    struct sim_event *ev;
+    uint64_t deadline;
+
+    deadline = usec < 0 ? SIM_FOREVER : sim_now + usec;
+    while (sim_held == NULL) {
+        if ((ev = sim_pop(deadline)) == NULL)
+            return 0;
+        if (ev->kind == SIM_EV_SERVER)
+            sim_held = ev;
+        else {
+            sim_station_event(ev);
+            free(ev);
+        }
+    }
+    ev = sim_held;
+    if (len > ev->len)
+        len = ev->len;
+    memcpy(data, ev->data, len);
+    memset(from, 0, sizeof(*from));
+    from->sin_family = AF_INET;
+    from->sin_addr.s_addr = htonl(SIM_ADDR(sim_stns[ev->stn].num));
+    from->sin_port = htons(PORT_AUN);
+    if (!(flags & MSG_PEEK)) {
+        sim_held = NULL;
+        free(ev);
+    }
+    return len;
+}
+
+static int
+sim_net_wait(int secs, int fd)
+{
+    struct sockaddr_in from;
+    unsigned char c;
+
+    return sim_net_recv(&c, 1, MSG_PEEK, &from, secs * 1000000L) > 0;
+}
+
+static uint64_t
+sim_net_clock(void)
+{
+
+    return sim_now;
+}
+
+/*
+ * With -b, beebem.c wants a configuration file saying where each
+ * station is.  Station n on net 0 is where sim_station() expects.
+ */
+static void
+sim_beebem_cfg(void)
+{
+    static char file[] = "/tmp/aundsim.XXXXXX";
+    FILE *f;
+    int fd, i;
+
+    if ((fd = mkstemp(file)) == -1 || (f = fdopen(fd, "w")) == NULL)
+        err(1, "%s", file);
+    fprintf(f, "%d %d 127.0.0.1 %d\n", our_econet_addr >> 8,
+        our_econet_addr & 0xff, PORT_AUN);
+    for (i = 1; i <= sim_nstns; i++)
+        fprintf(f, "0 %d 1.0.0.%d %d\n", i, i, PORT_AUN);
+    if (fclose(f) == EOF)
+        err(1, "%s", file);
+    beebem_cfg_file = file;
+    aunfuncs->setup();
+    unlink(file);
+}
+
+/*
+ * Let any requests put aside for a password check finish, as in
+ * aundreplay.  Real time passes, but simulated time doesn't.
+ */
+static void
+sim_settle(void)
+{
+    struct timeval timeout;
+    fd_set r;
+    int fd;
+
+    while (fs_deferred_pending()) {
+        if ((fd = fs_wait_fd()) != -1) {
+            FD_ZERO(&r);
+            FD_SET(fd, &r);
+            timeout.tv_sec = 1;
+            timeout.tv_usec = 0;
+            select(fd + 1, &r, NULL, NULL, &timeout);
+        }
+        fs_periodic();
+    }
+}
+
+/* A percentage, to parts per million */
+static uint32_t
+sim_parse_chance(const char *s, const char *where)
+{
+    char *end;
+    double d;
+
+    d = strtod(s, &end);
+    if (*end != '\0' || d < 0 || d > 100)
+        errx(1, "%s: bad percentage %s", where, s);
+    return d * (SIM_PPM / 100);
+}
+
+/* Milliseconds, to us */
+static uint64_t
+sim_parse_ms(const char *s, const char *where)
+{
+    char *end;
+    double d;
+
+    d = strtod(s, &end);
+    if (*end != '\0' || d < 0)
+        errx(1, "%s: bad time %s", where, s);
+    return d * 1000;
+}
+
+/* "*", "n" or "n-m" */
+static void
+sim_parse_who(char *s, int *first, int *last, const char *file, int line)
+{
+    char *end;
+
+    if (strcmp(s, "*") == 0) {
+        *first = 1;
+        *last = SIM_STATIONS;
+        return;
+    }
+    *first = *last = strtol(s, &end, 10);
+    if (*end == '-')
+        *last = strtol(end + 1, &end, 10);
+    if (*end != '\0' || *first < 1 || *last < *first ||
+        *last > SIM_STATIONS)
+        errx(1, "%s:%d: bad stations %s", file, line, s);
+}
+
+/*
+ * Read the script.  Each line is "stations n", a "link" line setting
+ * up the links of some stations, or some stations and an operation for
+ * them, perhaps with a repeat count.
+ */
+static void
+sim_load(const char *file)
+{
+    FILE *f;
+    char buf[1024], where[64], args[sizeof(buf)];
+    char *words[32], *p;
+    struct sim_step *s;
+    struct sim_link *l;
+    int nwords, line = 0, first, last, i, j;
+    size_t alloc = 0, maxsave = 0;
+
+    if ((f = fopen(file, "r")) == NULL)
+        err(1, "%s", file);
+    while (fgets(buf, sizeof(buf), f) != NULL) {
+        line++;
+        snprintf(where, sizeof(where), "%s:%d", file, line);
+        if ((p = strchr(buf, '#')) != NULL)
+            *p = '\0';
+        nwords = 0;
+        for (p = strtok(buf, " \t\r\n"); p != NULL && nwords < 32;
+             p = strtok(NULL, " \t\r\n"))
+            words[nwords++] = p;
+        if (nwords == 0)
+            continue;
+        if (strcmp(words[0], "stations") == 0) {
+            if (nwords != 2 || (sim_nstns = atoi(words[1])) < 1 ||
+                sim_nstns > SIM_STATIONS)
+                errx(1, "%s: bad stations line", where);
+            continue;
+        }
+        if (nwords < 2)
+            errx(1, "%s: no operation", where);
+        if (strcmp(words[0], "link") == 0) {
+            sim_parse_who(words[1], &first, &last, file, line);
+            for (j = 2; j < nwords; j++) {
+                if ((p = strchr(words[j], '=')) == NULL)
+                    errx(1, "%s: bad link setting %s", where, words[j]);
+                *p++ = '\0';
+                for (i = first; i <= last; i++) {
+                    l = &sim_stns[i - 1].link;
+                    if (strcmp(words[j], "delay") == 0)
+                        l->delay = sim_parse_ms(p, where);
+                    else if (strcmp(words[j], "jitter") == 0)
+                        l->jitter = sim_parse_ms(p, where);
+                    else if (strcmp(words[j], "loss") == 0)
+                        l->loss = sim_parse_chance(p, where);
+                    else if (strcmp(words[j], "dup") == 0)
+                        l->dup = sim_parse_chance(p, where);
+                    else if (strcmp(words[j], "reorder") == 0)
+                        l->reorder = sim_parse_chance(p, where);
+                    else
+                        errx(1, "%s: unknown link setting %s", where,
+                            words[j]);
+                }
+            }
+            continue;
+        }
+        if (sim_nsteps == alloc) {
+            alloc = alloc ? alloc * 2 : 16;
+            if ((sim_steps = realloc(sim_steps, alloc * sizeof(*s))) ==
+                NULL)
+                err(1, "realloc");
+        }
+        s = &sim_steps[sim_nsteps++];
+        memset(s, 0, sizeof(*s));
+        sim_parse_who(words[0], &s->first, &s->last, file, line);
+        for (s->op = 0; s->op < SIM_OP_MAX; s->op++)
+            if (strcmp(words[1], sim_opnames[s->op]) == 0)
+                break;
+        if (s->op == SIM_OP_MAX)
+            errx(1, "%s: unknown operation %s", where, words[1]);
+        s->repeat = 1;
+        if (nwords > 2 && words[nwords - 1][0] == 'x' &&
+            isdigit((unsigned char)words[nwords - 1][1])) {
+            s->repeat = strtoul(words[nwords - 1] + 1, &p, 10);
+            if (*p != '\0')
+                errx(1, "%s: bad repeat count", where);
+            nwords--;
+        }
+        args[0] = '\0';
+        for (j = 2; j < nwords; j++) {
+            if (j > 2)
+                strcat(args, " ");
+            strcat(args, words[j]);
+        }
+        switch (s->op) {
+        case SIM_OP_INFO:
+        case SIM_OP_LOAD:
+        case SIM_OP_OPEN:
+        case SIM_OP_IAM:
+        case SIM_OP_CLI:
+            if (nwords < 3)
+                errx(1, "%s: %s needs an argument", where, words[1]);
+            break;
+        case SIM_OP_SAVE:
+            if (nwords != 4)
+                errx(1, "%s: usage: save name size", where);
+            s->num = strtoul(words[3], &p, 0);
+            if (*p != '\0' || s->num > 0xffffff)
+                errx(1, "%s: bad size %s", where, words[3]);
+            if (s->num > maxsave)
+                maxsave = s->num;
+            args[strlen(words[2])] = '\0';
+            break;
+        case SIM_OP_SLEEP:
+            if (nwords != 3)
+                errx(1, "%s: usage: sleep ms", where);
+            s->num = strtoul(words[2], &p, 10);
+            if (*p != '\0')
+                errx(1, "%s: bad time %s", where, words[2]);
+            break;
+        default:
+            break;
+        }
+        if ((s->arg = strdup(args)) == NULL)
+            err(1, "strdup");
+    }
+    if (ferror(f))
+        err(1, "%s", file);
+    fclose(f);
+
+    if ((sim_savedata = malloc(maxsave + 1)) == NULL)
+        err(1, "malloc");
+    for (i = 0; (size_t)i < maxsave; i++)
+        sim_savedata[i] = sim_random();
+}
+
+static int
+sim_cmp(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+int
+main(int argc, char *argv[])
+{
+    char const *conffile = "/etc/aund.conf";
+    char *newroot = NULL, *end;
+    struct aun_packet *pkt;
+    struct aun_srcaddr from;
+    struct timespec t0, t1;
+    struct sim_times *t;
+    unsigned long requests = 0, ops = 0, timeout = 0, retries = 0;
+    uint64_t seed = 0, sum;
+    ssize_t msgsize;
+    double secs;
+    int c, i;
+    bool set_debug = false;
+
+    progname = argv[0];
+    while ((c = getopt(argc, argv, "bc:dR:r:s:T:")) != -1) {
+        switch (c) {
+        case 'b':
+            sim_beebem = true;
+            break;
+        case 'c':
+            conffile = optarg;
+            break;
+        case 'd':
+            set_debug = true;
+            break;
+        case 'R':
+            retries = strtoul(optarg, &end, 0);
+            if (*end != '\0' || retries == 0)
+                errx(1, "bad retry count");
+            break;
+        case 'r':
+            newroot = optarg;
+            break;
+        case 's':
+            seed = strtoull(optarg, &end, 0);
+            if (*end != '\0')
+                errx(1, "bad seed");
+            break;
+        case 'T':
+            timeout = strtoul(optarg, &end, 0);
+            if (*end != '\0' || timeout == 0)
+                errx(1, "bad timeout");
+            break;
+        default:
+            usage();
+        }
+    }
+    argc -= optind;
+    argv += optind;
+    if (argc != 1)
+        usage();
+
+    /* xorshift mustn't start from zero */
+    sim_rand ^= seed * 0x9e3779b97f4a7c15ULL;
+    if (sim_rand == 0)
+        sim_rand = 1;
+    if ((sim_stns = calloc(SIM_STATIONS, sizeof(*sim_stns))) == NULL)
+        err(1, "calloc");
+    sim_load(argv[0]);
+    conf_init(conffile);
+    if (newroot != NULL)
+        root = newroot;
+    if (timeout != 0)
+        default_timeout = timeout;
+    if (retries != 0)
+        default_retries = retries;
+    beebem_cfg_file = NULL;
+    fs_init();
+    using_syslog = 0;
+    debug = set_debug;
+    if (debug) setlinebuf(stdout);
+    if (root == NULL)
+        errx(1, "no root configured");
+    if (chdir(root) < 0)
+        err(1, "%s: chdir", root);
+
+    aun_net = &sim_net;
+    if (sim_beebem) {
+        aunfuncs = &beebem;
+        sim_beebem_cfg();
+    } else
+        aunfuncs->setup();
+    for (i = 0; i < sim_nstns; i++) {
+        sim_stns[i].num = i + 1;
+        sim_stns[i].seq = 4 * (i + 1);
+        sim_stns[i].rxport = -1;
+        sim_timer(&sim_stns[i], 0);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (;;) {
+        memset(&from, 0, sizeof(from));
+        if ((pkt = aunfuncs->recv(&msgsize, &from, EC_PORT_FS)) == NULL) {
+            if (sim_nheap == 0 && sim_held == NULL)
+                break;
+            continue;
+        }
+        if (debug) printf("\n\t(%.6f: file server: ", sim_now / 1e6);
+        file_server(pkt, msgsize, &from);
+        if (debug) printf(")\n");
+        requests++;
+        sim_settle();
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+
+    for (i = 0; i < SIM_OP_MAX; i++)
+        if (i != SIM_OP_SLEEP)
+            ops += sim_times[i].count;
+    printf("%d stations, %lu operations, %lu requests in %.3f s simulated, "
+        "%.3f s real\n", sim_nstns, ops, requests, sim_end / 1e6, secs);
+    printf("network: %llu packets, %llu lost, %llu duplicated, "
+        "%llu reordered\n", (unsigned long long)sim_stats.packets,
+        (unsigned long long)sim_stats.lost,
+        (unsigned long long)sim_stats.duplicated,
+        (unsigned long long)sim_stats.reordered);
+    printf("server: %llu packets in, %llu out, %llu retransmitted, "
+        "%llu timed out\n", (unsigned long long)aun_stats.rx_packets,
+        (unsigned long long)aun_stats.tx_packets,
+        (unsigned long long)aun_stats.retransmits,
+        (unsigned long long)aun_stats.timeouts);
+    printf("stations: %llu retransmitted, %llu operations given up\n",
+        (unsigned long long)sim_stats.retransmits,
+        (unsigned long long)sim_stats.gaveup);
+    printf("\n%-8s %7s %7s %9s %9s %9s %9s %9s\n", "op", "count", "errors",
+        "mean ms", "p50", "p90", "p99", "max");
+    for (i = 0; i < SIM_OP_MAX; i++) {
+        t = &sim_times[i];
+        if (i == SIM_OP_SLEEP || t->count == 0)
+            continue;
+        qsort(t->usec, t->count, sizeof(*t->usec), sim_cmp);
+        for (sum = 0, c = 0; (size_t)c < t->count; c++)
+            sum += t->usec[c];
+        printf("%-8s %7lu %7lu %9.3f %9.3f %9.3f %9.3f %9.3f\n",
+            sim_opnames[i], (unsigned long)t->count, t->errors,
+            (double)sum / t->count / 1000,
+            t->usec[t->count / 2] / 1000.0,
+            t->usec[t->count * 9 / 10] / 1000.0,
+            t->usec[t->count * 99 / 100] / 1000.0,
+            t->usec[t->count - 1] / 1000.0);
+    }
+    return 0;
+}
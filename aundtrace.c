@@ -0,0 +1,227 @@
+/*-
+ * Copyright (c) 2010 Simon Tatham
+ * Copyright (c) 2010 Ben Harris
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/*
+ * aundtrace - decode the trace file written by aund, and choose what
+ * goes into it.
+ */
+
+#if HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <err.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "fs_proto.h"
+#include "fs_trace.h"
+
+#if defined(__GNUC__)
+#define BARRIER()	__sync_synchronize()
+#else
+#define BARRIER()	do { } while (0)
+#endif
+
+static char *progname;
+
+static const struct {
+    const char *name;
+    uint32_t bit;
+} cattab[] = FS_TRACE_CATEGORIES;
+
+static const char *const evnames[FS_TRACE_EV_MAX] = FS_TRACE_EVENT_NAMES;
+
+static const char *const funcnames[] = EC_FS_FUNC_NAMES;
+
+static void usage(void);
+static uint32_t parse_cats(char *);
+static void print_rec(const struct fs_trace_rec *);
+static uint64_t dump(volatile struct fs_trace_hdr *,
+    volatile struct fs_trace_rec *, uint64_t);
+
+static void
+usage(void)
+{
+
+    fprintf(stderr, "usage: %s [-f] [-e categories] tracefile\n",
+        progname);
+    exit(EXIT_FAILURE);
+}
+
+/*
+ * Turn a comma-separated list of category names into a mask.
+ */
+static uint32_t
+parse_cats(char *list)
+{
+    uint32_t mask = 0;
+    char *name;
+    int i;
+
+    while ((name = strsep(&list, ",")) != NULL) {
+        if (!strcasecmp(name, "none"))
+            continue;
+        for (i = 0; i < sizeof(cattab) / sizeof(cattab[0]); i++)
+            if (!strcasecmp(name, cattab[i].name))
+                break;
+        if (i == sizeof(cattab) / sizeof(cattab[0]))
+            errx(1, "unknown category: %s", name);
+        mask |= cattab[i].bit;
+    }
+    return mask;
+}
+
+static void
+print_rec(const struct fs_trace_rec *r)
+{
+    time_t t = r->usec / 1000000;
+    struct tm *tm = localtime(&t);
+    char when[32];
+
+    strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", tm);
+    printf("%s.%06u %3u.%-3u ", when, (unsigned)(r->usec % 1000000),
+        r->stn[1], r->stn[0]);
+    if (r->func < sizeof(funcnames) / sizeof(funcnames[0]) &&
+        funcnames[r->func] != NULL)
+        printf("%-13s ", funcnames[r->func]);
+    else
+        printf("func-%-8u ", r->func);
+    if (r->event < FS_TRACE_EV_MAX)
+        printf("%-10s", evnames[r->event]);
+    else
+        printf("event-%-4u", r->event);
+    printf(" h=%-3u bytes=%-6u result=%u\n", r->handle,
+        (unsigned)r->bytes, r->result);
+}
+
+/*
+ * Print the complete records from index from onwards, and return the
+ * index to start from next time.
+ */
+static uint64_t
+dump(volatile struct fs_trace_hdr *hdr, volatile struct fs_trace_rec *ring,
+    uint64_t from)
+{
+    struct fs_trace_rec r;
+    volatile struct fs_trace_rec *vr;
+    uint64_t head, i;
+
+    head = hdr->head;
+    BARRIER();
+    if (head < from)
+        from = 0;	/* aund has started again */
+    if (head - from > hdr->nrecs) {
+        printf("(%llu records lost)\n",
+            (unsigned long long)(head - from - hdr->nrecs));
+        from = head - hdr->nrecs;
+    }
+    for (i = from; i < head; i++) {
+        vr = &ring[i & (hdr->nrecs - 1)];
+        if (vr->seq != (uint32_t)(i + 1))
+            continue;
+        BARRIER();
+        r = *vr;
+        BARRIER();
+        if (vr->seq != (uint32_t)(i + 1))
+            continue;	/* Overwritten while we were reading it */
+        print_rec(&r);
+    }
+    return head;
+}
+
+int
+main(int argc, char *argv[])
+{
+    volatile struct fs_trace_hdr *hdr;
+    struct stat st;
+    uint64_t next;
+    uint32_t mask = 0;
+    void *p;
+    int c, fd;
+    bool follow = false, set_mask = false;
+
+    progname = argv[0];
+    while ((c = getopt(argc, argv, "e:f")) != -1) {
+        switch (c) {
+        case 'e':
+            mask = parse_cats(optarg);
+            set_mask = true;
+            break;
+        case 'f':
+            follow = true;
+            break;
+        default:
+            usage();
+        }
+    }
+    argc -= optind;
+    argv += optind;
+    if (argc != 1)
+        usage();
+
+    if ((fd = open(argv[0], set_mask ? O_RDWR : O_RDONLY)) == -1)
+        err(1, "%s", argv[0]);
+    if (fstat(fd, &st) == -1)
+        err(1, "%s: fstat", argv[0]);
+    if (st.st_size < sizeof(struct fs_trace_hdr))
+        errx(1, "%s: not a trace file", argv[0]);
+    p = mmap(NULL, st.st_size, PROT_READ | (set_mask ? PROT_WRITE : 0),
+        MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED)
+        err(1, "%s: mmap", argv[0]);
+    close(fd);
+    hdr = p;
+    if (memcmp((const void *)hdr->magic, FS_TRACE_MAGIC,
+            sizeof(hdr->magic)) != 0 ||
+        hdr->nrecs == 0 || (hdr->nrecs & (hdr->nrecs - 1)) != 0 ||
+        st.st_size < sizeof(struct fs_trace_hdr) +
+            (off_t)hdr->nrecs * sizeof(struct fs_trace_rec))
+        errx(1, "%s: not a trace file", argv[0]);
+
+    if (set_mask) {
+        hdr->mask = mask;
+        return EXIT_SUCCESS;
+    }
+    next = dump(hdr, (volatile struct fs_trace_rec *)(hdr + 1), 0);
+    while (follow) {
+        fflush(stdout);
+        usleep(200000);
+        next = dump(hdr, (volatile struct fs_trace_rec *)(hdr + 1), next);
+    }
+    return EXIT_SUCCESS;
+}
@@ -49,7 +49,6 @@
 #include <string.h>
 #include <syslog.h>
 #include <unistd.h>
-#include <fcntl.h>
 
 #include "aun.h"
 #include "extern.h"
@@ -61,9 +60,9 @@ struct econet_addr {
     uint8_t network;
 };
 
-static int sock;
 static unsigned char sbuf[65536];
 static unsigned char rbuf[65536];
+static unsigned char abuf[256];	/* Acknowledgements of what we send */
 static struct aun_packet *const rpkt = (struct aun_packet *)rbuf;
 
 /* Offset of packet payload in struct aun_packet:
@@ -96,7 +95,6 @@ beebem_setup(void)
     FILE *fp;
     char linebuf[512];
     int lineno;
-    int fl;
 
     /*
      * Start by reading the BeebEm Econet configuration file.
@@ -157,49 +155,33 @@ beebem_setup(void)
     /*
      * Now set up our UDP socket.
      */
-    sock = socket(AF_INET, SOCK_DGRAM, 0);
-    if (sock < 0)
-        err(1, "socket");
     memset(&name, 0, sizeof(name));
     name.sin_family = AF_INET;
     name.sin_addr = ec2ip[our_econet_addr].addr;
     name.sin_port = htons(ec2ip[our_econet_addr].port);
-    if (bind(sock, (struct sockaddr*)&name, sizeof(name)))
-        err(1, "bind");
-    if ((fl = fcntl(sock, F_GETFL)) < 0)
-        err(1, "fcntl(F_GETFL)");
-    if (fcntl(sock, F_SETFL, fl | O_NONBLOCK) < 0)
-        err(1, "fcntl(F_SETFL)");
+    aun_net->open(&name);
 }
 
-static ssize_t beebem_listen(unsigned *addr, int forever)
+/*
+ * Wait for a frame for us, and read it into frame.  Acknowledgements
+ * are read somewhere other than rbuf, which holds the request being
+ * served while its reply goes out.
+ */
+static ssize_t beebem_listen(unsigned *addr, int forever,
+    unsigned char *frame, size_t size)
 {
     ssize_t msgsize;
     struct sockaddr_in from;
     unsigned their_addr;
-    fd_set r;
-    struct timeval timeout;
 
     while (1) {
-        socklen_t fromlen = sizeof(from);
-        int i;
-
         /*
-         * We set the socket to nonblocking mode, and must
-         * therefore always select before we recvfrom. The
-         * timeout varies depending on 'forever'.
+         * The timeout varies depending on 'forever'.
          */
-        FD_ZERO(&r);
-        FD_SET(sock, &r);
-        timeout.tv_sec = 0;
-        timeout.tv_usec = 100000;   /* 100ms */
-        i = select(sock+1, &r, NULL, NULL, forever ? NULL : &timeout);
-        if (i == 0)
+        msgsize = aun_net->recv(frame, size, 0, &from,
+            forever ? -1 : 100000);   /* 100ms */
+        if (msgsize == 0)
             return 0;      /* nothing turned up */
-
-        msgsize = recvfrom(sock, rbuf + PKTOFF,
-                   sizeof(rbuf) - PKTOFF,
-                   0, (struct sockaddr *)&from, &fromlen);
         if (msgsize == -1)
             err(1, "recvfrom");
 
@@ -207,11 +189,11 @@ static ssize_t beebem_listen(unsigned *addr, int forever)
             continue;      /* not big enough for an Econet frame */
 
         /* Is it for us? */
-        if (256 * rbuf[PKTOFF+1] + rbuf[PKTOFF] != our_econet_addr)
+        if (256 * frame[1] + frame[0] != our_econet_addr)
             continue;
 
         /* Who's it from? */
-        their_addr = 256 * rbuf[PKTOFF+3] + rbuf[PKTOFF+2];
+        their_addr = 256 * frame[3] + frame[2];
 
         /*
          * Ingress-filter to see if it's _really_ from the
@@ -226,7 +208,7 @@ static ssize_t beebem_listen(unsigned *addr, int forever)
                     "(claimed to be %d.%d)\n",
                     inet_ntoa(from.sin_addr),
                     ntohs(from.sin_port),
-                    rbuf[PKTOFF+1], rbuf[PKTOFF]);
+                    frame[1], frame[0]);
             continue;
         }
 
@@ -254,8 +236,7 @@ static void beebem_send(const void *data, ssize_t len)
         to.sin_family = AF_INET;
         to.sin_addr = ec2ip[ecaddr].addr;
         to.sin_port = htons(ec2ip[ecaddr].port);
-        if (sendto(sock, data, len, 0,
-               (struct sockaddr*)&to, sizeof(to)) < 0) {
+        if (aun_net->send(data, len, &to) < 0) {
             // Restrict debug output for unknown errors
             if ((errno != EHOSTUNREACH)
                 && (errno != 64)
@@ -274,6 +255,17 @@ static void beebem_send(const void *data, ssize_t len)
     }
 }
 
+/*
+ * Wait up to secs seconds for a packet to turn up, or for fd (if not
+ * -1) to become readable.  Returns zero if no packet turned up.
+ */
+static int
+beebem_wait(int secs, int fd)
+{
+
+    return aun_net->wait(secs, fd);
+}
+
 static struct aun_packet *
 beebem_recv(ssize_t *outsize, struct aun_srcaddr *vfrom, int want_port)
 {
@@ -290,7 +282,7 @@ beebem_recv(ssize_t *outsize, struct aun_srcaddr *vfrom, int want_port)
      * it, so that a client that goes away in the middle of a
      * load or save doesn't lock everyone else out indefinitely.
      */
-    count = 50;
+    count = default_retries;
     forever = !(afrom->eaddr.network || afrom->eaddr.station);
     while (count > 0) {
         /*
@@ -298,8 +290,14 @@ beebem_recv(ssize_t *outsize, struct aun_srcaddr *vfrom, int want_port)
          * long, and the second payload byte should indicate
          * the destination port.
          */
-        msgsize = beebem_listen((unsigned int *)&scoutaddr, forever);
+        msgsize = beebem_listen((unsigned int *)&scoutaddr, forever,
+            rbuf + PKTOFF, sizeof(rbuf) - PKTOFF);
 
+        if (msgsize == 0 && forever) {
+            /* Only aundsim's network goes quiet for good. */
+            errno = ETIMEDOUT;
+            return NULL;
+        }
         if (msgsize == 0) {
             count--;
             continue;
@@ -366,10 +364,11 @@ beebem_recv(ssize_t *outsize, struct aun_srcaddr *vfrom, int want_port)
          * four-way handshake would tie up the bus for all
          * other stations until it had finished.)
          */
-        count = 50;
+        count = default_retries;
         do {
             beebem_send(ack, 4);
-            msgsize = beebem_listen((unsigned int *) &mainaddr, 0);
+            msgsize = beebem_listen((unsigned int *) &mainaddr, 0,
+                rbuf + PKTOFF, sizeof(rbuf) - PKTOFF);
             if (msgsize != 0) {
                 if (mainaddr != scoutaddr) {
                     if (debug)
@@ -410,9 +409,13 @@ beebem_recv(ssize_t *outsize, struct aun_srcaddr *vfrom, int want_port)
         memset(afrom, 0, sizeof(struct aun_srcaddr));
         afrom->eaddr.network = scoutaddr >> 8;
         afrom->eaddr.station = scoutaddr & 0xFF;
+        aun_stats.rx_packets++;
+        aun_stats.rx_bytes += *outsize;
+        capture_packet(rpkt, *outsize, vfrom, false);
         return rpkt;
     }
 
+    aun_stats.timeouts++;
     errno = ETIMEDOUT;
     return NULL;
 }
@@ -432,6 +435,9 @@ beebem_xmit(struct aun_packet *spkt, size_t len, struct aun_srcaddr *vto)
     }
 
     theiraddr = ato->eaddr.network * 256 + ato->eaddr.station;
+    aun_stats.tx_packets++;
+    aun_stats.tx_bytes += len;
+    capture_packet(spkt, len, vto, true);
 
     /*
      * Send the scout packet, and wait for an ACK.
@@ -442,10 +448,11 @@ beebem_xmit(struct aun_packet *spkt, size_t len, struct aun_srcaddr *vto)
     sbuf[3] = our_econet_addr >> 8;
     sbuf[4] = 0x80 | spkt->flag;
     sbuf[5] = spkt->dest_port;
-    count = 50;
+    count = default_retries;
     do {
         beebem_send(sbuf, 6);
-        msgsize = beebem_listen((unsigned int *)&ackaddr, 0);
+        msgsize = beebem_listen((unsigned int *)&ackaddr, 0,
+            abuf, sizeof(abuf));
         if (msgsize > 0) {
             /*
              * We expect the ACK to have come from the
@@ -460,12 +467,15 @@ beebem_xmit(struct aun_packet *spkt, size_t len, struct aun_srcaddr *vto)
             }
         }
         count--;
+        if (count > 0 && msgsize == 0)
+            aun_stats.retransmits++;
     } while (count > 0 && msgsize == 0);
 
     if (msgsize == 0) {
         if (debug)
             printf("scout ack never arrived from "
                 "%d.%d\n", theiraddr>>8, theiraddr&0xFF);
+        aun_stats.timeouts++;
         errno = ETIMEDOUT;
         return -1;
     }
@@ -488,10 +498,11 @@ beebem_xmit(struct aun_packet *spkt, size_t len, struct aun_srcaddr *vto)
     sbuf[3] = our_econet_addr >> 8;
     payloadlen = len - offsetof(struct aun_packet, data);
     memcpy(sbuf + 4, spkt->data, payloadlen);
-    count = 50;
+    count = default_retries;
     do {
         beebem_send(sbuf, payloadlen+4);
-        msgsize = beebem_listen((unsigned int *)&ackaddr, 0);
+        msgsize = beebem_listen((unsigned int *)&ackaddr, 0,
+            abuf, sizeof(abuf));
         if (msgsize > 0) {
             /*
              * The second ACK, just as above, should
@@ -506,12 +517,15 @@ beebem_xmit(struct aun_packet *spkt, size_t len, struct aun_srcaddr *vto)
             }
         }
         count--;
+        if (count > 0 && msgsize == 0)
+            aun_stats.retransmits++;
     } while (count > 0 && msgsize == 0);
 
     if (msgsize == 0) {
         if (debug)
             printf("payload ack never arrived from "
                 "%d.%d\n", theiraddr>>8, theiraddr&0xFF);
+        aun_stats.timeouts++;
         errno = ETIMEDOUT;
         return -1;
     }
@@ -549,7 +563,9 @@ const struct aun_funcs beebem = {
     512,
     beebem_setup,
     beebem_recv,
+    beebem_wait,
     beebem_xmit,
     beebem_ntoa,
     beebem_get_stn,
+    NULL,		/* Can't probe yet */
 };
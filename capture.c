@@ -0,0 +1,223 @@
+/*-
+ * Copyright (c) 2010 Simon Tatham
+ * Copyright (c) 2010 Ben Harris
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/*
+ * Traffic capture.
+ *
+ * If a capture file is configured, every packet the transport hands to
+ * the file server, and every packet the file server gives it to send,
+ * is written to the file in pcap format, as a UDP datagram between the
+ * station and aund on PORT_AUN.  tcpdump and Wireshark can read it,
+ * and aundreplay can feed it back into the file server.
+ *
+ * Whichever transport is in use, what's written is the AUN frame:
+ * acknowledgements, retransmissions and BeebEm's scout frames aren't
+ * written, and a BeebEm station net.stn appears as 1.0.net.stn, after
+ * the usual AUN convention.  aund's own address is written as 0.0.0.0,
+ * since it doesn't know which of its addresses the station used.
+ *
+ * The arguments to *I AM and *PASS are blanked out, so that passwords
+ * don't end up in the file.  Everything else does, so it's only
+ * readable by its owner.
+ */
+
+#if HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <sys/types.h>
+#include <sys/time.h>
+
+#include <err.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "aun.h"
+#include "extern.h"
+#include "fs_proto.h"
+#include "fileserver.h"
+#include "capture.h"
+
+char *capture_file;
+
+static FILE *capture_fp;
+
+static void capture_close(void);
+static void capture_put16(uint8_t *, unsigned);
+static const struct aun_packet *capture_hide(const struct aun_packet *,
+    size_t);
+
+static void
+capture_put16(uint8_t *p, unsigned v)
+{
+
+    p[0] = v >> 8;
+    p[1] = v;
+}
+
+/*
+ * Start the capture file, if one's configured.  Anything already in it
+ * is thrown away.
+ */
+void
+capture_open(void)
+{
+    struct capture_file_hdr h;
+    int fd;
+
+    if (capture_file == NULL)
+        return;
+    if ((fd = open(capture_file, O_WRONLY | O_CREAT | O_TRUNC, 0600)) == -1) {
+        warn("%s", capture_file);
+        return;
+    }
+    if ((capture_fp = fdopen(fd, "w")) == NULL) {
+        warn("%s", capture_file);
+        close(fd);
+        return;
+    }
+    memset(&h, 0, sizeof(h));
+    h.magic = CAPTURE_MAGIC;
+    h.version_major = 2;
+    h.version_minor = 4;
+    h.snaplen = CAPTURE_SNAPLEN;
+    h.linktype = CAPTURE_LINKTYPE_RAW;
+    if (fwrite(&h, sizeof(h), 1, capture_fp) != 1) {
+        warn("%s", capture_file);
+        fclose(capture_fp);
+        capture_fp = NULL;
+        return;
+    }
+    atexit(capture_close);
+}
+
+static void
+capture_close(void)
+{
+
+    if (capture_fp != NULL && fclose(capture_fp) == EOF)
+        warn("%s", capture_file);
+    capture_fp = NULL;
+}
+
+/*
+ * Push out what's been captured, so that it can be looked at while
+ * we're running.  Called from the main loop.
+ */
+void
+capture_flush(void)
+{
+
+    if (capture_fp != NULL)
+        fflush(capture_fp);
+}
+
+/*
+ * If pkt is a *I AM or *PASS command for the file server, return a
+ * copy of it with the arguments blanked out.  Otherwise return pkt.
+ */
+static const struct aun_packet *
+capture_hide(const struct aun_packet *pkt, size_t len)
+{
+    static uint8_t buf[CAPTURE_SNAPLEN];
+    const struct ec_fs_req *req = (const struct ec_fs_req *)pkt;
+    size_t i;
+    int keep;
+
+    if (len <= sizeof(*req) || pkt->type != AUN_TYPE_UNICAST ||
+        pkt->dest_port != EC_PORT_FS || req->function != EC_FS_FUNC_CLI)
+        return pkt;
+    if ((keep = fs_cli_secret(req->data, len - sizeof(*req))) == -1)
+        return pkt;
+    memcpy(buf, pkt, len);
+    for (i = sizeof(*req) + keep; i < len && buf[i] != '\r'; i++)
+        buf[i] = ' ';
+    return (const struct aun_packet *)buf;
+}
+
+/*
+ * Write a packet received from the station at addr, or, if out is
+ * set, one being sent to it.
+ */
+void
+capture_packet(const struct aun_packet *pkt, size_t len,
+    struct aun_srcaddr *addr, bool out)
+{
+    struct capture_rec_hdr r;
+    struct timeval tv;
+    uint8_t hdr[CAPTURE_IPHDR + CAPTURE_UDPHDR], stn[2];
+    uint8_t *ip = hdr, *udp = hdr + CAPTURE_IPHDR, *them;
+    uint32_t sum = 0;
+    int i;
+
+    if (capture_fp == NULL)
+        return;
+    if (len > CAPTURE_SNAPLEN - sizeof(hdr))
+        len = CAPTURE_SNAPLEN - sizeof(hdr);
+    if (!out)
+        pkt = capture_hide(pkt, len);
+    memset(hdr, 0, sizeof(hdr));
+    ip[0] = 0x45;			/* IPv4, 20 byte header */
+    capture_put16(ip + 2, sizeof(hdr) + len);
+    ip[8] = 64;				/* TTL */
+    ip[9] = 17;				/* UDP */
+    them = out ? ip + 16 : ip + 12;
+    if (aunfuncs == &beebem) {
+        aunfuncs->get_stn(addr, stn);
+        them[0] = 1;
+        them[1] = 0;
+        them[2] = stn[1];
+        them[3] = stn[0];
+    } else
+        memcpy(them, addr->bytes, 4);
+    for (i = 0; i < CAPTURE_IPHDR; i += 2)
+        sum += ip[i] << 8 | ip[i + 1];
+    while (sum >> 16)
+        sum = (sum & 0xffff) + (sum >> 16);
+    capture_put16(ip + 10, ~sum & 0xffff);
+    capture_put16(udp, PORT_AUN);
+    capture_put16(udp + 2, PORT_AUN);
+    capture_put16(udp + 4, CAPTURE_UDPHDR + len);
+    /* A UDP checksum of 0 means there isn't one. */
+
+    gettimeofday(&tv, NULL);
+    r.ts_sec = tv.tv_sec;
+    r.ts_usec = tv.tv_usec;
+    r.incl_len = r.orig_len = sizeof(hdr) + len;
+    if (fwrite(&r, sizeof(r), 1, capture_fp) != 1 ||
+        fwrite(hdr, sizeof(hdr), 1, capture_fp) != 1 ||
+        (len > 0 && fwrite(pkt, len, 1, capture_fp) != 1)) {
+        warn("%s", capture_file);
+        fclose(capture_fp);
+        capture_fp = NULL;
+    }
+}
@@ -0,0 +1,68 @@
+/*-
+ * Copyright (c) 2010 Simon Tatham
+ * Copyright (c) 2010 Ben Harris
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/*
+ * This is part of aund, an implementation of Acorn Universal
+ * Networking for Unix.
+ */
+/*
+ * capture.h - layout of the capture file shared by aund and aundreplay.
+ *
+ * It's an ordinary pcap file of raw IPv4 packets, so that tcpdump and
+ * Wireshark can read it.  Each packet is a UDP datagram to or from
+ * PORT_AUN holding one AUN frame; see capture.c.
+ */
+
+#ifndef _CAPTURE_H
+#define _CAPTURE_H
+
+#include <stdint.h>
+
+#define CAPTURE_MAGIC		0xa1b2c3d4	/* Microsecond timestamps */
+#define CAPTURE_LINKTYPE_RAW	101		/* Starts with an IP header */
+#define CAPTURE_SNAPLEN		65535
+#define CAPTURE_IPHDR		20
+#define CAPTURE_UDPHDR		8
+
+struct capture_file_hdr {
+	uint32_t magic;
+	uint16_t version_major;	/* 2 */
+	uint16_t version_minor;	/* 4 */
+	int32_t thiszone;
+	uint32_t sigfigs;
+	uint32_t snaplen;
+	uint32_t linktype;
+};
+
+struct capture_rec_hdr {
+	uint32_t ts_sec;
+	uint32_t ts_usec;
+	uint32_t incl_len;
+	uint32_t orig_len;
+};
+
+#endif
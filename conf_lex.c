@@ -383,8 +383,8 @@ static void yy_fatal_error (yyconst char msg[]  );
 	*yy_cp = '\0'; \
 	(yy_c_buf_p) = yy_cp;
 
-#define YY_NUM_RULES 33
-#define YY_END_OF_BUFFER 34
+#define YY_NUM_RULES 46
+#define YY_END_OF_BUFFER 47
 /* This struct is not used in this scanner,
    but its presence is necessary. */
 struct yy_trans_info
@@ -392,27 +392,36 @@ struct yy_trans_info
 	flex_int32_t yy_verify;
 	flex_int32_t yy_nxt;
 	};
-static yyconst flex_int16_t yy_accept[174] =
+static yyconst flex_int16_t yy_accept[256] =
     {   0,
         0,    0,    0,    0,    0,    0,    0,    0,    0,    0,
-       34,   32,    3,    2,   32,   32,   32,   32,   32,   32,
-       32,   32,   32,   32,   32,   32,   32,   32,   32,   32,
-       32,   32,   32,   32,   32,   32,   32,   32,   32,   32,
-       32,   32,   32,   32,   32,   32,    3,   32,    0,    2,
-       32,    0,   31,    1,   32,   32,   32,   32,   32,   32,
-       32,   32,   32,   32,   32,   32,   32,   32,   32,   32,
-       32,   32,   32,   32,   32,   32,   32,   32,   32,   32,
-       30,   32,   29,   32,   32,   31,   32,   32,   32,   32,
-        8,   32,   32,   32,   32,   32,   32,   32,    9,   32,
-
-       32,   32,   32,   24,   22,   23,   32,   26,   25,   32,
-       28,   32,   32,   32,   32,   32,   32,   32,   11,   32,
-        7,   32,   32,   32,   32,   32,   17,   18,   19,   21,
-       27,   32,   32,    5,   32,   32,   32,   32,   32,   32,
-       32,   32,   32,   32,   32,   13,   32,   32,   32,   32,
-       10,   32,    6,   32,   32,   32,   32,   15,   32,    8,
-       32,   12,    4,   20,   32,   32,   32,   14,   32,   32,
-       32,   16,    0
+       47,   45,    3,    2,   45,   45,   45,   45,   45,   45,
+       45,   45,   45,   45,   45,   45,   45,   45,   45,   45,
+       45,   45,   45,   45,   45,   45,   45,   45,   45,   45,
+       45,   45,   45,   45,   45,   45,   45,   45,   45,    3,
+       45,    0,    2,   45,    0,   44,    1,   45,   45,   45,
+       45,   45,   45,   45,   45,   45,   45,   45,   45,   45,
+       45,   45,   45,   45,   45,   45,   45,   45,   45,   45,
+       45,   45,   45,   45,   45,   45,   45,   45,   45,   45,
+       45,   45,   45,   43,   45,   42,   45,   45,   44,   45,
+
+       45,   45,   45,   45,   45,   45,   45,   45,    8,   45,
+       45,   45,   45,   45,   45,   45,   45,   45,   45,   45,
+       45,   45,    9,   45,   45,   45,   45,   45,   37,   35,
+       36,   45,   39,   38,   45,   41,   45,   43,   45,   42,
+        0,   45,   45,   45,   45,   45,   45,   45,   45,   45,
+       45,   45,   11,   45,   45,    7,   45,   45,   45,   45,
+       45,   45,   45,   45,   45,   29,   30,   31,   34,   40,
+       45,   42,   45,   45,   25,    5,   45,   45,   45,   45,
+       45,   45,   45,   45,   45,   45,   45,   45,   45,   45,
+       45,   22,   45,   45,   21,   45,   45,   33,   43,   13,
+
+       45,   45,   45,   45,   45,   45,   45,   45,   27,   45,
+       10,   45,   45,   45,   45,    6,   45,   45,   45,   26,
+       45,   45,   45,   45,   15,   45,    8,   45,   28,   45,
+       23,   45,   12,    4,   32,   20,   45,   45,   45,   45,
+       17,   45,   45,   14,   19,   45,   45,   45,   24,   45,
+       15,   45,   18,   16,    0
     } ;
 
 static yyconst flex_int32_t yy_ec[256] =
@@ -449,117 +458,175 @@ static yyconst flex_int32_t yy_ec[256] =
 
 static yyconst flex_int32_t yy_meta[30] =
     {   0,
-        1,    2,    3,    1,    1,    1,    1,    1,    1,    1,
+        1,    1,    1,    1,    1,    1,    1,    1,    1,    1,
         1,    1,    1,    1,    1,    1,    1,    1,    1,    1,
         1,    1,    1,    1,    1,    1,    1,    1,    1
     } ;
 
-static yyconst flex_int16_t yy_base[179] =
+static yyconst flex_int16_t yy_base[256] =
     {   0,
-        0,    0,   20,    0,   28,   29,   46,    0,   61,   77,
-      217,    0,  214,  218,   33,   57,  212,  201,  200,  187,
-      190,  193,  186,  180,  185,   24,   44,  182,  192,  195,
-      190,  173,  182,  184,  182,  181,  176,  183,  173,  178,
-      184,  170,   17,  167,  177,    0,  187,   61,  185,  218,
-       64,  182,  181,  218,  172,  174,  158,  168,  171,  154,
-      165,  156,  163,  151,  155,  151,  161,  158,  151,  146,
-      146,  150,  143,  142,  151,  146,  148,  151,  135,  141,
-        0,  145,    0,  131,  132,  151,  145,  127,  127,  130,
-      127,  143,  132,  122,  134,  127,  132,  131,    0,  134,
-
-      129,  121,  127,    0,    0,    0,  117,    0,    0,  120,
-        0,  112,  123,  122,  119,  124,   62,  123,    0,  112,
-        0,   61,  108,  107,  108,  100,    0,    0,    0,    0,
-        0,  113,  105,    0,   98,  109,   58,   98,  108,  104,
-      110,  103,   90,   96,   85,    0,   85,   75,   76,   68,
-        0,   75,    0,   69,   71,   67,   70,    0,   69,    0,
-       76,    0,    0,    0,   65,   76,   65,    0,   55,   66,
-       47,    0,  218,   47,  106,  109,  111,  114
+        1,    0,   21,    0,   30,    0,   47,    0,   41,    0,
+        1,   72,   32,  400,  101,  130,   33,   24,   30,   36,
+      148,   48,   37,   51,   42,   40,  148,  153,  147,   50,
+      120,  154,  156,  153,  138,  149,  153,  157,  158,  156,
+      165,  158,  165,  174,  162,  171,  162,  174,    0,    0,
+        0,  189,  400,    0,  218,  183,  400,  176,  168,  195,
+      211,  238,  224,  231,  237,  242,  227,  228,  241,  230,
+      235,  244,  237,  251,  236,  242,  254,  241,  253,  252,
+      253,  249,  246,  248,  254,  249,  250,  261,  258,  262,
+      267,  253,  261,    0,  267,    0,  255,  258,  279,    0,
+
+      275,  260,  261,  261,  262,  264,  278,  270,  269,  268,
+      286,  289,  280,  274,  273,  287,  273,  276,  284,  291,
+      294,  293,    0,  298,  291,  296,  290,  298,    0,    0,
+        0,  290,    0,    0,  295,    0,  289,    0,  302,    0,
+        0,  303,  290,  293,  304,  308,  312,  299,  317,  315,
+      313,  315,    0,  309,  312,    0,  324,  313,  308,  312,
+      313,  323,  317,  311,  330,    0,    0,    0,    0,    0,
+      329,    0,  323,  320,    0,    0,  330,  320,  323,  331,
+      335,  330,  327,  332,  345,  342,  343,  341,  349,  337,
+      336,    0,  346,  335,    0,  354,  345,    0,    0,    0,
+
+      352,  353,  350,  346,  349,  344,  347,  343,    0,  347,
+        0,  349,  354,  361,  368,    0,  352,  356,  354,    0,
+      355,  360,  373,  371,    0,  365,    0,  377,    0,  375,
+        0,  377,    0,    0,    0,    0,  368,  377,  369,  383,
+        0,  374,  381,    0,    0,  368,  370,  384,    0,  372,
+        0,  374,    0,    0,  400
     } ;
 
-static yyconst flex_int16_t yy_def[179] =
+static yyconst flex_int16_t yy_def[256] =
     {   0,
-      173,    1,    1,    3,    3,    3,    3,    7,    3,    3,
-      173,  174,  173,  173,  175,  176,  174,  174,  174,  174,
-      174,  174,  174,  174,  174,  174,  174,  174,  174,  174,
-      174,  174,  174,  174,  174,  174,  174,  174,  174,  174,
-      174,  174,  174,  174,  174,  174,  173,  175,  177,  173,
-      176,  178,  174,  173,  174,  174,  174,  174,  174,  174,
-      174,  174,  174,  174,  174,  174,  174,  174,  174,  174,
-      174,  174,  174,  174,  174,  174,  174,  174,  174,  174,
-      174,  174,  174,  174,  174,  173,  174,  174,  174,  174,
-      174,  174,  174,  174,  174,  174,  174,  174,  174,  174,
-
-      174,  174,  174,  174,  174,  174,  174,  174,  174,  174,
-      174,  174,  174,  174,  174,  174,  174,  174,  174,  174,
-      174,  174,  174,  174,  174,  174,  174,  174,  174,  174,
-      174,  174,  174,  174,  174,  174,  174,  174,  174,  174,
-      174,  174,  174,  174,  174,  174,  174,  174,  174,  174,
-      174,  174,  174,  174,  174,  174,  174,  174,  174,  174,
-      174,  174,  174,  174,  174,  174,  174,  174,  174,  174,
-      174,  174,    0,  173,  173,  173,  173,  173
+      255,    1,    1,    3,    3,    5,    3,    7,    3,    9,
+      255,  255,  255,  255,  255,  255,   12,   12,   12,   12,
+       12,   12,   12,   12,   12,   12,   12,   12,   12,   12,
+       12,   12,   12,   12,   12,   12,   12,   12,   12,   12,
+       12,   12,   12,   12,   12,   12,   12,   12,   12,   13,
+       15,   15,  255,   16,   16,   12,  255,   12,   12,   12,
+       12,   12,   12,   12,   12,   12,   12,   12,   12,   12,
+       12,   12,   12,   12,   12,   12,   12,   12,   12,   12,
+       12,   12,   12,   12,   12,   12,   12,   12,   12,   12,
+       12,   12,   12,   12,   12,   12,   12,   12,  255,   16,
+
+       12,   12,   12,   12,   12,   12,   12,   12,   12,   12,
+       12,   12,   12,   12,   12,   12,   12,   12,   12,   12,
+       12,   12,   12,   12,   12,   12,   12,   12,   12,   12,
+       12,   12,   12,   12,   12,   12,   12,   12,   12,   12,
+       55,   12,   12,   12,   12,   12,   12,   12,   12,   12,
+       12,   12,   12,   12,   12,   12,   12,   12,   12,   12,
+       12,   12,   12,   12,   12,   12,   12,   12,   12,   12,
+       12,   12,   12,   12,   12,   12,   12,   12,   12,   12,
+       12,   12,   12,   12,   12,   12,   12,   12,   12,   12,
+       12,   12,   12,   12,   12,   12,   12,   12,   12,   12,
+
+       12,   12,   12,   12,   12,   12,   12,   12,   12,   12,
+       12,   12,   12,   12,   12,   12,   12,   12,   12,   12,
+       12,   12,   12,   12,   12,   12,   12,   12,   12,   12,
+       12,   12,   12,   12,   12,   12,   12,   12,   12,   12,
+       12,   12,   12,   12,   12,   12,   12,   12,   12,   12,
+       12,   12,   12,   12,    0
     } ;
 
-static yyconst flex_int16_t yy_nxt[248] =
+static yyconst flex_int16_t yy_nxt[430] =
     {   0,
-       12,   13,   14,   15,   16,   12,   12,   17,   12,   18,
-       12,   19,   12,   20,   12,   12,   21,   12,   22,   12,
-       12,   23,   24,   25,   26,   27,   28,   12,   12,   12,
-       82,   12,   63,   12,   49,   50,   12,   83,   12,   29,
-       29,   12,   12,   12,   12,   12,   12,   46,   30,   30,
-       31,   31,   64,   32,   32,   33,   34,   35,   52,   36,
-       65,   53,   49,   50,   37,   52,  140,  136,   53,   38,
-       39,  172,   66,   40,   41,  137,  141,  148,  171,  149,
-      158,   42,   43,  170,  169,  168,   44,  167,  166,   45,
-       41,  165,  164,  163,  162,  161,  160,   42,   43,  159,
-
-      158,  157,   44,  156,  155,   45,   48,   48,   48,   51,
-       51,   49,   49,   49,   52,   52,  154,  153,  152,  141,
-      151,  150,  137,  147,  146,   81,  145,  144,  143,  142,
-      139,  138,  135,  134,  133,   83,  132,  131,  130,  129,
-      128,  127,  126,  125,  124,  123,  122,  121,  120,  119,
-      118,  117,  116,  115,  114,   52,   83,  113,   81,  112,
-      111,  110,  109,  108,  107,  106,  105,  104,  103,  102,
-      101,  100,   99,   98,   97,   96,   95,   94,   93,   92,
-       91,   90,   89,   88,   87,   51,   86,   50,   47,   85,
-       84,   81,   80,   79,   78,   77,   76,   75,   74,   73,
-
-       72,   71,   70,   69,   68,   67,   62,   61,   60,   59,
-       58,   57,   56,   55,   54,   47,  173,   11,  173,  173,
-      173,  173,  173,  173,  173,  173,  173,  173,  173,  173,
-      173,  173,  173,  173,  173,  173,  173,  173,  173,  173,
-      173,  173,  173,  173,  173,  173,  173
+      255,   12,   13,   14,   15,   16,   12,   12,   17,   12,
+       18,   19,   20,   12,   21,   12,   12,   22,   12,   23,
+       24,   12,   25,   26,   27,   28,   29,   30,   12,   12,
+       12,   12,   12,   50,   12,   57,   58,   12,   59,   12,
+       12,   31,   12,   12,   12,   12,   12,   12,   61,   32,
+       33,   60,   34,   66,   44,   35,   36,   37,   38,   64,
+       39,   45,   46,   67,   68,   40,   47,   69,   65,   48,
+       41,   42,   49,   79,   43,   49,   49,   49,   49,   49,
+       49,   49,   49,   49,   49,   49,   49,   49,   49,   49,
+       49,   49,   49,   49,   49,   49,   49,   49,   49,   49,
+
+       49,   51,   52,   53,   51,   51,   51,   51,   51,   51,
+       51,   51,   51,   51,   51,   51,   51,   51,   51,   51,
+       51,   51,   51,   51,   51,   51,   51,   51,   51,   51,
+       54,   55,   80,   54,   56,   54,   54,   54,   54,   54,
+       54,   54,   54,   54,   54,   54,   54,   54,   54,   54,
+       54,   54,   54,   54,   54,   54,   54,   54,   54,   62,
+       70,   72,   81,   76,   82,   83,   84,   85,   86,   71,
+       77,   73,   63,   87,   88,   78,   89,   90,   74,   91,
+       92,   75,   93,   94,   95,   97,   98,  100,  101,   52,
+      102,   96,   52,   52,   52,   52,   52,   52,   52,   52,
+
+       52,   52,   52,   52,   52,   52,   52,   52,   52,   52,
+       52,   52,   52,   52,   52,   52,   52,   52,   55,  103,
+      104,   55,   99,   55,   55,   55,   55,   55,   55,   55,
+       55,   55,   55,   55,   55,   55,   55,   55,   55,   55,
+       55,   55,   55,   55,   55,   55,   55,  105,  106,  107,
+      108,  109,  111,  112,  113,  114,  115,  116,  117,  118,
+      119,  120,  121,  122,  123,  124,  110,  125,  126,  127,
+      128,  129,  130,  131,  132,  133,  134,  135,  136,  137,
+      138,  139,  140,  141,  142,  143,  144,  145,  146,  147,
+      148,  149,  150,  151,  152,  153,  154,  155,  156,  157,
+
+      158,  159,  160,  161,  162,  163,  164,  165,  166,  167,
+      168,  169,  170,  171,  172,  173,  174,  175,  176,  177,
+      178,  179,  181,  183,  180,  184,  185,  186,  187,  188,
+      182,  190,  192,  193,  194,  195,  196,  197,  191,  189,
+      198,  199,  200,  201,  202,  203,  204,  205,  182,  206,
+      208,  207,  209,  210,  211,  212,  189,  213,  214,  215,
+      216,  217,  218,  219,  220,  221,  222,  223,  224,  225,
+      226,  227,  228,  229,  230,  231,  232,  233,  234,  235,
+      236,  237,  238,  239,  240,  241,  242,  243,  244,  245,
+      246,  247,  248,  249,  250,  251,  252,  253,  254,   11,
+
+      255,  255,  255,  255,  255,  255,  255,  255,  255,  255,
+      255,  255,  255,  255,  255,  255,  255,  255,  255,  255,
+      255,  255,  255,  255,  255,  255,  255,  255,  255
     } ;
 
-static yyconst flex_int16_t yy_chk[248] =
+static yyconst flex_int16_t yy_chk[430] =
     {   0,
+       11,    1,    1,    1,    1,    1,    1,    1,    1,    1,
         1,    1,    1,    1,    1,    1,    1,    1,    1,    1,
         1,    1,    1,    1,    1,    1,    1,    1,    1,    1,
-        1,    1,    1,    1,    1,    1,    1,    1,    1,    3,
-       43,    3,   26,    3,   15,   15,    3,   43,    3,    5,
-        6,    3,    3,    3,    3,    3,    3,  174,    5,    6,
-        5,    6,   26,    5,    6,    7,    7,    7,   16,    7,
-       27,   16,   48,   48,    7,   51,  122,  117,   51,    7,
-        7,  171,   27,    7,    9,  117,  122,  137,  170,  137,
-      169,    9,    9,  167,  166,  165,    9,  161,  159,    9,
-       10,  157,  156,  155,  154,  152,  150,   10,   10,  149,
-
-      148,  147,   10,  145,  144,   10,  175,  175,  175,  176,
-      176,  177,  177,  177,  178,  178,  143,  142,  141,  140,
-      139,  138,  136,  135,  133,  132,  126,  125,  124,  123,
-      120,  118,  116,  115,  114,  113,  112,  110,  107,  103,
-      102,  101,  100,   98,   97,   96,   95,   94,   93,   92,
-       91,   90,   89,   88,   87,   86,   85,   84,   82,   80,
-       79,   78,   77,   76,   75,   74,   73,   72,   71,   70,
-       69,   68,   67,   66,   65,   64,   63,   62,   61,   60,
-       59,   58,   57,   56,   55,   53,   52,   49,   47,   45,
-       44,   42,   41,   40,   39,   38,   37,   36,   35,   34,
-
-       33,   32,   31,   30,   29,   28,   25,   24,   23,   22,
-       21,   20,   19,   18,   17,   13,   11,  173,  173,  173,
-      173,  173,  173,  173,  173,  173,  173,  173,  173,  173,
-      173,  173,  173,  173,  173,  173,  173,  173,  173,  173,
-      173,  173,  173,  173,  173,  173,  173
+        3,    3,    3,   13,    3,   17,   18,    3,   19,    3,
+        3,    5,    3,    3,    3,    3,    3,    3,   20,    5,
+        5,   19,    5,   23,    9,    5,    7,    7,    7,   22,
+        7,    9,    9,   24,   25,    7,    9,   26,   22,    9,
+        7,    7,   12,   30,    7,   12,   12,   12,   12,   12,
+       12,   12,   12,   12,   12,   12,   12,   12,   12,   12,
+       12,   12,   12,   12,   12,   12,   12,   12,   12,   12,
+
+       12,   15,   15,   15,   15,   15,   15,   15,   15,   15,
+       15,   15,   15,   15,   15,   15,   15,   15,   15,   15,
+       15,   15,   15,   15,   15,   15,   15,   15,   15,   15,
+       16,   16,   31,   16,   16,   16,   16,   16,   16,   16,
+       16,   16,   16,   16,   16,   16,   16,   16,   16,   16,
+       16,   16,   16,   16,   16,   16,   16,   16,   16,   21,
+       27,   28,   32,   29,   33,   34,   35,   36,   37,   27,
+       29,   28,   21,   38,   39,   29,   40,   41,   28,   42,
+       43,   28,   44,   45,   46,   47,   48,   56,   58,   52,
+       59,   46,   52,   52,   52,   52,   52,   52,   52,   52,
+
+       52,   52,   52,   52,   52,   52,   52,   52,   52,   52,
+       52,   52,   52,   52,   52,   52,   52,   52,   55,   60,
+       61,   55,   55,   55,   55,   55,   55,   55,   55,   55,
+       55,   55,   55,   55,   55,   55,   55,   55,   55,   55,
+       55,   55,   55,   55,   55,   55,   55,   62,   63,   64,
+       65,   66,   67,   68,   69,   70,   71,   72,   73,   74,
+       75,   76,   77,   78,   79,   80,   66,   81,   82,   83,
+       84,   85,   86,   87,   88,   89,   90,   91,   92,   93,
+       95,   97,   98,   99,  101,  102,  103,  104,  105,  106,
+      107,  108,  109,  110,  111,  112,  113,  114,  115,  116,
+
+      117,  118,  119,  120,  121,  122,  124,  125,  126,  127,
+      128,  132,  135,  137,  139,  142,  143,  144,  145,  146,
+      147,  148,  149,  150,  148,  151,  152,  154,  155,  157,
+      149,  158,  159,  160,  161,  162,  163,  164,  158,  157,
+      165,  171,  173,  174,  177,  178,  179,  180,  181,  182,
+      183,  182,  184,  185,  186,  187,  188,  189,  190,  191,
+      193,  194,  196,  197,  201,  202,  203,  204,  205,  206,
+      207,  208,  210,  212,  213,  214,  215,  217,  218,  219,
+      221,  222,  223,  224,  226,  228,  230,  232,  237,  238,
+      239,  240,  242,  243,  246,  247,  248,  250,  252,  255,
+
+      255,  255,  255,  255,  255,  255,  255,  255,  255,  255,
+      255,  255,  255,  255,  255,  255,  255,  255,  255,  255,
+      255,  255,  255,  255,  255,  255,  255,  255,  255
     } ;
 
 static yy_state_type yy_last_accepting_state;
@@ -684,7 +751,20 @@ static void conf_cmd_typemap_name(union cfything *);
 static void conf_cmd_typemap_perm(union cfything *);
 static void conf_cmd_typemap_type(union cfything *);
 static void conf_cmd_typemap_default(union cfything *);
+static void conf_cmd_typemap_magic(union cfything *);
 static void conf_cmd_fsstation(union cfything *);
+static void conf_cmd_metadata(union cfything *);
+static void conf_cmd_idletimeout(union cfything *);
+static void conf_cmd_idleprobe(union cfything *);
+static void conf_cmd_fdbudget(union cfything *);
+static void conf_cmd_trace(union cfything *);
+static void conf_cmd_stats(union cfything *);
+static void conf_cmd_slowlog(union cfything *);
+static void conf_cmd_slowtrace(union cfything *);
+static void conf_cmd_costs(union cfything *);
+static void conf_cmd_capture(union cfything *);
+static void conf_cmd_listen(union cfything *);
+static void conf_cmd_retries(union cfything *);
 
 static void dequote(char *);
 
@@ -698,7 +778,7 @@ static int cfy_line;
 
 
 
-#line 702 "conf_lex.c"
+#line 782 "conf_lex.c"
 
 #define INITIAL 0
 #define BORING 1
@@ -884,12 +964,12 @@ YY_DECL
 	register char *yy_cp, *yy_bp;
 	register int yy_act;
     
-#line 129 "conf_lex.l"
+#line 142 "conf_lex.l"
 
 	if (start != -1) BEGIN(start);
 
  /* Backslash-escaped newline is completely ignored */
-#line 894 "conf_lex.c"
+#line 974 "conf_lex.c"
 
 	if ( !(yy_init) )
 		{
@@ -942,13 +1022,13 @@ yy_match:
 			while ( yy_chk[yy_base[yy_current_state] + yy_c] != yy_current_state )
 				{
 				yy_current_state = (int) yy_def[yy_current_state];
-				if ( yy_current_state >= 174 )
+				if ( yy_current_state >= 256 )
 					yy_c = yy_meta[(unsigned int) yy_c];
 				}
 			yy_current_state = yy_nxt[yy_base[yy_current_state] + (unsigned int) yy_c];
 			++yy_cp;
 			}
-		while ( yy_base[yy_current_state] != 218 );
+		while ( yy_base[yy_current_state] != 400 );
 
 yy_find_action:
 		yy_act = yy_accept[yy_current_state];
@@ -975,7 +1055,7 @@ do_action:	/* This label is used only to access EOF actions. */
 case 1:
 /* rule 1 can match eol */
 YY_RULE_SETUP
-#line 134 "conf_lex.l"
+#line 147 "conf_lex.l"
 cfy_line++;
 	YY_BREAK
 /* Newline, with optional comment before it. Ignored in INITIAL state;
@@ -984,13 +1064,13 @@ cfy_line++;
 case 2:
 /* rule 2 can match eol */
 YY_RULE_SETUP
-#line 139 "conf_lex.l"
+#line 152 "conf_lex.l"
 cfy_line++; if (YY_START != INITIAL) { BEGIN(INITIAL); return CF_NEWLINE; }
 	YY_BREAK
 /* Ignore whitespace except insofar as it splits words */
 case 3:
 YY_RULE_SETUP
-#line 142 "conf_lex.l"
+#line 155 "conf_lex.l"
 /* do nothing */
 	YY_BREAK
 /* In starting state, recognise main config keywords, return them as
@@ -999,155 +1079,220 @@ YY_RULE_SETUP
 
 case 4:
 YY_RULE_SETUP
-#line 148 "conf_lex.l"
+#line 161 "conf_lex.l"
 BEGIN(TYPEMAP);
 	YY_BREAK
 case 5:
 YY_RULE_SETUP
-#line 149 "conf_lex.l"
+#line 162 "conf_lex.l"
 BEGIN(BORING); thing->func.func = conf_cmd_debug; return CF_FUNC;
 	YY_BREAK
 case 6:
 YY_RULE_SETUP
-#line 150 "conf_lex.l"
+#line 163 "conf_lex.l"
 BEGIN(BORING); thing->func.func = conf_cmd_syslog; return CF_FUNC;
 	YY_BREAK
 case 7:
 YY_RULE_SETUP
-#line 151 "conf_lex.l"
+#line 164 "conf_lex.l"
 BEGIN(BORING); thing->func.func = conf_cmd_root; return CF_FUNC;
 	YY_BREAK
 case 8:
 YY_RULE_SETUP
-#line 152 "conf_lex.l"
+#line 165 "conf_lex.l"
 BEGIN(BORING); thing->func.func = conf_cmd_lib; return CF_FUNC;
 	YY_BREAK
 case 9:
 YY_RULE_SETUP
-#line 153 "conf_lex.l"
+#line 166 "conf_lex.l"
 BEGIN(BORING); thing->func.func = conf_cmd_urd; return CF_FUNC;
 	YY_BREAK
 case 10:
 YY_RULE_SETUP
-#line 154 "conf_lex.l"
+#line 167 "conf_lex.l"
 BEGIN(BORING); thing->func.func = conf_cmd_pwfile; return CF_FUNC;
 	YY_BREAK
 case 11:
 YY_RULE_SETUP
-#line 155 "conf_lex.l"
+#line 168 "conf_lex.l"
 BEGIN(BORING); thing->func.func = conf_cmd_opt4; return CF_FUNC;
 	YY_BREAK
 case 12:
 YY_RULE_SETUP
-#line 156 "conf_lex.l"
+#line 169 "conf_lex.l"
 BEGIN(BORING); thing->func.func = conf_cmd_timeout; return CF_FUNC;
 	YY_BREAK
 case 13:
 YY_RULE_SETUP
-#line 157 "conf_lex.l"
+#line 170 "conf_lex.l"
 BEGIN(BORING); thing->func.func = conf_cmd_beebem; return CF_FUNC;
 	YY_BREAK
 case 14:
 YY_RULE_SETUP
-#line 158 "conf_lex.l"
+#line 171 "conf_lex.l"
 BEGIN(BORING); thing->func.func = conf_cmd_fsstation; return CF_FUNC;
 	YY_BREAK
 case 15:
 YY_RULE_SETUP
-#line 159 "conf_lex.l"
+#line 172 "conf_lex.l"
 BEGIN(BORING); thing->func.func = conf_cmd_infofmt; return CF_FUNC;
 	YY_BREAK
 case 16:
 YY_RULE_SETUP
-#line 160 "conf_lex.l"
+#line 173 "conf_lex.l"
 BEGIN(BORING); thing->func.func = conf_cmd_safehandles; return CF_FUNC;
 	YY_BREAK
+case 17:
+YY_RULE_SETUP
+#line 174 "conf_lex.l"
+BEGIN(BORING); thing->func.func = conf_cmd_metadata; return CF_FUNC;
+	YY_BREAK
+case 18:
+YY_RULE_SETUP
+#line 175 "conf_lex.l"
+BEGIN(BORING); thing->func.func = conf_cmd_idletimeout; return CF_FUNC;
+	YY_BREAK
+case 19:
+YY_RULE_SETUP
+#line 176 "conf_lex.l"
+BEGIN(BORING); thing->func.func = conf_cmd_idleprobe; return CF_FUNC;
+	YY_BREAK
+case 20:
+YY_RULE_SETUP
+#line 177 "conf_lex.l"
+BEGIN(BORING); thing->func.func = conf_cmd_fdbudget; return CF_FUNC;
+	YY_BREAK
+case 21:
+YY_RULE_SETUP
+#line 178 "conf_lex.l"
+BEGIN(BORING); thing->func.func = conf_cmd_trace; return CF_FUNC;
+	YY_BREAK
+case 22:
+YY_RULE_SETUP
+#line 179 "conf_lex.l"
+BEGIN(BORING); thing->func.func = conf_cmd_stats; return CF_FUNC;
+	YY_BREAK
+case 23:
+YY_RULE_SETUP
+#line 180 "conf_lex.l"
+BEGIN(BORING); thing->func.func = conf_cmd_slowlog; return CF_FUNC;
+	YY_BREAK
+case 24:
+YY_RULE_SETUP
+#line 181 "conf_lex.l"
+BEGIN(BORING); thing->func.func = conf_cmd_slowtrace; return CF_FUNC;
+	YY_BREAK
+case 25:
+YY_RULE_SETUP
+#line 182 "conf_lex.l"
+BEGIN(BORING); thing->func.func = conf_cmd_costs; return CF_FUNC;
+	YY_BREAK
+case 26:
+YY_RULE_SETUP
+#line 183 "conf_lex.l"
+BEGIN(BORING); thing->func.func = conf_cmd_capture; return CF_FUNC;
+	YY_BREAK
+case 27:
+YY_RULE_SETUP
+#line 184 "conf_lex.l"
+BEGIN(BORING); thing->func.func = conf_cmd_listen; return CF_FUNC;
+	YY_BREAK
+case 28:
+YY_RULE_SETUP
+#line 185 "conf_lex.l"
+BEGIN(BORING); thing->func.func = conf_cmd_retries; return CF_FUNC;
+	YY_BREAK
 
 
-case 17:
+case 29:
 YY_RULE_SETUP
-#line 163 "conf_lex.l"
+#line 188 "conf_lex.l"
 BEGIN(BORING); thing->func.func = conf_cmd_typemap_name; return CF_FUNC;
 	YY_BREAK
-case 18:
+case 30:
 YY_RULE_SETUP
-#line 164 "conf_lex.l"
+#line 189 "conf_lex.l"
 BEGIN(BORING); thing->func.func = conf_cmd_typemap_perm; return CF_FUNC;
 	YY_BREAK
-case 19:
+case 31:
 YY_RULE_SETUP
-#line 165 "conf_lex.l"
+#line 190 "conf_lex.l"
 BEGIN(TYPEMAP_TYPE);
 	YY_BREAK
-case 20:
+case 32:
 YY_RULE_SETUP
-#line 166 "conf_lex.l"
+#line 191 "conf_lex.l"
 BEGIN(BORING); thing->func.func = conf_cmd_typemap_default; return CF_FUNC;
 	YY_BREAK
+case 33:
+YY_RULE_SETUP
+#line 192 "conf_lex.l"
+BEGIN(BORING); thing->func.func = conf_cmd_typemap_magic; return CF_FUNC;
+	YY_BREAK
 
 
-case 21:
+case 34:
 YY_RULE_SETUP
-#line 169 "conf_lex.l"
+#line 195 "conf_lex.l"
 BEGIN(BORING); thing->func.func = conf_cmd_typemap_type; thing->func.mode = S_IFIFO; return CF_FUNC;
 	YY_BREAK
-case 22:
+case 35:
 YY_RULE_SETUP
-#line 170 "conf_lex.l"
+#line 196 "conf_lex.l"
 BEGIN(BORING); thing->func.func = conf_cmd_typemap_type; thing->func.mode = S_IFCHR; return CF_FUNC;
 	YY_BREAK
-case 23:
+case 36:
 YY_RULE_SETUP
-#line 171 "conf_lex.l"
+#line 197 "conf_lex.l"
 BEGIN(BORING); thing->func.func = conf_cmd_typemap_type; thing->func.mode = S_IFDIR; return CF_FUNC;
 	YY_BREAK
-case 24:
+case 37:
 YY_RULE_SETUP
-#line 172 "conf_lex.l"
+#line 198 "conf_lex.l"
 BEGIN(BORING); thing->func.func = conf_cmd_typemap_type; thing->func.mode = S_IFBLK; return CF_FUNC;
 	YY_BREAK
-case 25:
+case 38:
 YY_RULE_SETUP
-#line 173 "conf_lex.l"
+#line 199 "conf_lex.l"
 BEGIN(BORING); thing->func.func = conf_cmd_typemap_type; thing->func.mode = S_IFREG; return CF_FUNC;
 	YY_BREAK
-case 26:
+case 39:
 YY_RULE_SETUP
-#line 174 "conf_lex.l"
+#line 200 "conf_lex.l"
 BEGIN(BORING); thing->func.func = conf_cmd_typemap_type; thing->func.mode = S_IFLNK; return CF_FUNC;
 	YY_BREAK
-case 27:
+case 40:
 YY_RULE_SETUP
-#line 175 "conf_lex.l"
+#line 201 "conf_lex.l"
 BEGIN(BORING); thing->func.func = conf_cmd_typemap_type; thing->func.mode = S_IFSOCK; return CF_FUNC;
 	YY_BREAK
-case 28:
+case 41:
 YY_RULE_SETUP
-#line 176 "conf_lex.l"
+#line 202 "conf_lex.l"
 BEGIN(BORING); thing->func.func = conf_cmd_typemap_type; thing->func.mode = S_IFWHT; return CF_FUNC;
 	YY_BREAK
 
 
-case 29:
+case 42:
 YY_RULE_SETUP
-#line 179 "conf_lex.l"
+#line 205 "conf_lex.l"
 *(int *)thing = 1; BEGIN(BORING); return CF_BOOLEAN;
 	YY_BREAK
-case 30:
+case 43:
 YY_RULE_SETUP
-#line 180 "conf_lex.l"
+#line 206 "conf_lex.l"
 *(int *)thing = 0; BEGIN(BORING); return CF_BOOLEAN;
 	YY_BREAK
 
 /* Any word without a specific meaning from context is returned as CF_WORD. */
-case 31:
+case 44:
 YY_RULE_SETUP
-#line 184 "conf_lex.l"
+#line 210 "conf_lex.l"
 dequote(cfytext); return CF_WORD; /* [deconfuse jed syntax highlighting: '] */
 	YY_BREAK
-case 32:
+case 45:
 YY_RULE_SETUP
-#line 185 "conf_lex.l"
+#line 211 "conf_lex.l"
 return CF_WORD;
 	YY_BREAK
 case YY_STATE_EOF(INITIAL):
@@ -1155,15 +1300,15 @@ case YY_STATE_EOF(BORING):
 case YY_STATE_EOF(TYPEMAP):
 case YY_STATE_EOF(TYPEMAP_TYPE):
 case YY_STATE_EOF(BOOLEAN):
-#line 186 "conf_lex.l"
+#line 212 "conf_lex.l"
 return CF_EOF;
 	YY_BREAK
-case 33:
+case 46:
 YY_RULE_SETUP
-#line 188 "conf_lex.l"
+#line 214 "conf_lex.l"
 ECHO;
 	YY_BREAK
-#line 1168 "conf_lex.c"
+#line 1313 "conf_lex.c"
 
 	case YY_END_OF_BUFFER:
 		{
@@ -1453,7 +1598,7 @@ static int yy_get_next_buffer (void)
 		while ( yy_chk[yy_base[yy_current_state] + yy_c] != yy_current_state )
 			{
 			yy_current_state = (int) yy_def[yy_current_state];
-			if ( yy_current_state >= 174 )
+			if ( yy_current_state >= 256 )
 				yy_c = yy_meta[(unsigned int) yy_c];
 			}
 		yy_current_state = yy_nxt[yy_base[yy_current_state] + (unsigned int) yy_c];
@@ -1481,11 +1626,11 @@ static int yy_get_next_buffer (void)
 	while ( yy_chk[yy_base[yy_current_state] + yy_c] != yy_current_state )
 		{
 		yy_current_state = (int) yy_def[yy_current_state];
-		if ( yy_current_state >= 174 )
+		if ( yy_current_state >= 256 )
 			yy_c = yy_meta[(unsigned int) yy_c];
 		}
 	yy_current_state = yy_nxt[yy_base[yy_current_state] + (unsigned int) yy_c];
-	yy_is_jam = (yy_current_state == 173);
+	yy_is_jam = (yy_current_state == 255);
 
 	return yy_is_jam ? 0 : yy_current_state;
 }
@@ -2158,7 +2303,7 @@ void cfyfree (void * ptr )
 
 #define YYTABLES_NAME "yytables"
 
-#line 188 "conf_lex.l"
+#line 214 "conf_lex.l"
 
 
 
@@ -2361,6 +2506,164 @@ conf_cmd_fsstation(union cfything *thing)
         errx(1, "Bad FS Station Number");
 }
 
+static void
+conf_cmd_metadata(union cfything *thing)
+{
+
+	if (cfylex(BORING, NULL) != CF_WORD)
+		errx(1, "no metadata format specified");
+	if (!strcasecmp(cfytext, "symlink") || !strcasecmp(cfytext, "symlinks"))
+		metafuncs = &meta_symlink;
+	else if (!strcasecmp(cfytext, "xattr")) {
+		if (meta_xattr.get == NULL)
+			errx(1, "xattr metadata not supported on this system");
+		metafuncs = &meta_xattr;
+	} else
+		errx(1, "unrecognised metadata format: '%s'", cfytext);
+}
+
+static void
+conf_cmd_idletimeout(union cfything *thing)
+{
+	char *endptr;
+
+	if (cfylex(BORING, NULL) != CF_WORD)
+		errx(1, "no idle timeout specified");
+	fs_idle_timeout = strtol(cfytext, &endptr, 0);
+	if (*endptr != '\0' || fs_idle_timeout < 0)
+		errx(1, "bad idle timeout");
+}
+
+static void
+conf_cmd_idleprobe(union cfything *xthing)
+{
+	union cfything thing;
+	if (cfylex(BOOLEAN, &thing) != CF_BOOLEAN)
+		errx(1, "no boolean for idleprobe");
+	fs_idle_probe = thing.boolean;
+}
+
+static void
+conf_cmd_fdbudget(union cfything *thing)
+{
+	char *endptr;
+
+	if (cfylex(BORING, NULL) != CF_WORD)
+		errx(1, "no descriptor budget specified");
+	fs_fd_budget = strtol(cfytext, &endptr, 0);
+	if (*endptr != '\0' || fs_fd_budget < 1)
+		errx(1, "bad descriptor budget");
+}
+
+static void
+conf_cmd_trace(union cfything *thing)
+{
+	uint32_t cats = 0, cat;
+
+	if (cfylex(BORING, NULL) != CF_WORD)
+		errx(1, "no trace file specified");
+	fs_trace_file = malloc(cfyleng + 1);
+	strcpy(fs_trace_file, cfytext);
+	while (cfylex(BORING, NULL) == CF_WORD) {
+		if ((cat = fs_trace_category(cfytext)) == 0)
+			errx(1, "unrecognised trace category: '%s'", cfytext);
+		cats |= cat;
+	}
+	if (cats != 0)
+		fs_trace_cats = cats;
+}
+
+static void
+conf_cmd_stats(union cfything *thing)
+{
+	char *endptr;
+
+	if (cfylex(BORING, NULL) != CF_WORD)
+		errx(1, "no stats file specified");
+	fs_stats_file = malloc(cfyleng + 1);
+	strcpy(fs_stats_file, cfytext);
+	if (cfylex(BORING, NULL) == CF_WORD) {
+		fs_stats_interval = strtol(cfytext, &endptr, 0);
+		if (*endptr != '\0' || fs_stats_interval < 1)
+			errx(1, "bad stats interval");
+	}
+}
+
+static void
+conf_cmd_slowlog(union cfything *thing)
+{
+	char *endptr;
+
+	if (cfylex(BORING, NULL) != CF_WORD)
+		errx(1, "no slow request threshold specified");
+	fs_slow_ms = strtol(cfytext, &endptr, 0);
+	if (*endptr != '\0' || fs_slow_ms < 0)
+		errx(1, "bad slow request threshold");
+	if (cfylex(BORING, NULL) == CF_WORD) {
+		fs_slow_rate = strtol(cfytext, &endptr, 0);
+		if (*endptr != '\0' || fs_slow_rate < 1)
+			errx(1, "bad slow request log rate");
+	}
+}
+
+static void
+conf_cmd_slowtrace(union cfything *thing)
+{
+	char *endptr;
+
+	if (cfylex(BORING, NULL) != CF_WORD)
+		errx(1, "no slow trace file specified");
+	fs_slow_trace_file = malloc(cfyleng + 1);
+	strcpy(fs_slow_trace_file, cfytext);
+	if (cfylex(BORING, NULL) == CF_WORD) {
+		fs_slow_trace_ms = strtol(cfytext, &endptr, 0);
+		if (*endptr != '\0' || fs_slow_trace_ms < 0)
+			errx(1, "bad slow trace threshold");
+	}
+}
+
+static void
+conf_cmd_costs(union cfything *thing)
+{
+
+	if (cfylex(BORING, NULL) != CF_WORD)
+		errx(1, "no costs file specified");
+	fs_cost_file = malloc(cfyleng + 1);
+	strcpy(fs_cost_file, cfytext);
+}
+
+static void
+conf_cmd_capture(union cfything *thing)
+{
+
+	if (cfylex(BORING, NULL) != CF_WORD)
+		errx(1, "no capture file specified");
+	capture_file = malloc(cfyleng + 1);
+	strcpy(capture_file, cfytext);
+}
+
+static void
+conf_cmd_listen(union cfything *thing)
+{
+
+	if (cfylex(BORING, NULL) != CF_WORD)
+		errx(1, "no listen address specified");
+	aun_listen_addr = malloc(cfyleng + 1);
+	strcpy(aun_listen_addr, cfytext);
+}
+
+static void
+conf_cmd_retries(union cfything *thing)
+{
+	char *endptr;
+
+	if (cfylex(BORING, NULL) != CF_WORD)
+		errx(1, "no retry count specified");
+	default_retries = strtol(cfytext, &endptr, 0);
+	if (*endptr != '\0' || default_retries <= 0)
+		errx(1, "bad retry count");
+}
+
 static void
 conf_cmd_timeout(union cfything *thing)
 {
@@ -2394,12 +2697,12 @@ conf_cmd_typemap_name(union cfything *thing)
 static void
 conf_cmd_typemap_perm(union cfything *thing)
 {
-	mode_t perm;
+	unsigned int perm;
 	int type;
 
 	if (cfylex(BORING, NULL) != CF_WORD)
 		errx(1, "no perm for typemap");
-	if (sscanf(cfytext, "%ho", &perm) != 1)
+	if (sscanf(cfytext, "%o", &perm) != 1)
 		errx(1, "bad perm for typemap");
 	if (cfylex(BORING, NULL) != CF_WORD)
 		errx(1, "no type for typemap");
@@ -2435,3 +2738,33 @@ conf_cmd_typemap_default(union cfything *thing)
 		errx(1, "problem adding typemap");
 }
 
+static void
+conf_cmd_typemap_magic(union cfything *thing)
+{
+	unsigned char bytes[FS_MAGIC_MAX];
+	unsigned long offset;
+	char *endptr;
+	int type, len, byte;
+
+	if (cfylex(BORING, NULL) != CF_WORD)
+		errx(1, "no offset for typemap");
+	offset = strtoul(cfytext, &endptr, 0);
+	if (*endptr != '\0')
+		errx(1, "bad offset for typemap");
+	if (cfylex(BORING, NULL) != CF_WORD)
+		errx(1, "no magic number for typemap");
+	for (len = 0; cfytext[len * 2] != '\0'; len++) {
+		if (len == FS_MAGIC_MAX ||
+		    sscanf(cfytext + len * 2, "%2x", &byte) != 1 ||
+		    cfytext[len * 2 + 1] == '\0')
+			errx(1, "bad magic number for typemap");
+		bytes[len] = byte;
+	}
+	if (cfylex(BORING, NULL) != CF_WORD)
+		errx(1, "no type for typemap");
+	if (sscanf(cfytext, "%x", &type) != 1)
+		errx(1, "bad type for typemap");
+	if (fs_add_typemap_magic(offset, bytes, len, type) == -1)
+		errx(1, "problem adding typemap");
+}
+
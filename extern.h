@@ -30,11 +30,14 @@
  * Networking for Unix.
  */	
 
+#ifndef _EXTERN_H
+#define _EXTERN_H
 
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 
+#include <stdbool.h>
 #include <stdint.h>
 
 #include "aun.h"
@@ -50,13 +53,20 @@ extern void print_status(struct aun_packet *, ssize_t, struct aun_srcaddr *);
 extern void print_job(struct aun_packet *, ssize_t, struct aun_srcaddr *);
 extern void conf_init(const char *);
 extern void fs_init(void);
+extern void fs_periodic(void);
+extern int fs_wait_fd(void);
+extern bool fs_deferred_pending(void);
 extern void file_server(struct aun_packet *, ssize_t, struct aun_srcaddr *);
+extern void fs_probe_reply(struct aun_srcaddr *);
 
 extern int debug;
+extern volatile int reload_pending;
 extern int using_syslog;
 extern char *beebem_cfg_file;
 extern int beebem_ingress;
 extern int default_timeout;
+extern int default_retries;
+extern char *aun_listen_addr;
 extern int our_econet_addr;
 
 struct aun_funcs {
@@ -64,10 +74,54 @@ struct aun_funcs {
 	void (*setup)(void);
 	struct aun_packet *(*recv)(ssize_t *outsize,
 	    struct aun_srcaddr *from, int want_port);
+	int (*wait)(int secs, int fd);
 	ssize_t (*xmit)(struct aun_packet *pkt,
 			size_t len, struct aun_srcaddr *to);
 	char *(*ntoa)(struct aun_srcaddr *addr);
 	void (*get_stn)(struct aun_srcaddr *addr, uint8_t *out);
+	int (*probe)(struct aun_srcaddr *addr);	/* May be NULL */
 };
 
 extern const struct aun_funcs *aunfuncs;
+extern const struct aun_funcs aun, beebem;
+
+/*
+ * The network and clock as aun.c and beebem.c see them: normally a UDP
+ * socket, but aundsim puts a simulated network in its place.  recv
+ * waits up to usec microseconds for a packet, or for ever if usec is
+ * negative, and returns 0 if none came; flags are as for recvfrom.
+ * wait is as for struct aun_funcs.
+ */
+struct aun_net {
+	void (*open)(const struct sockaddr_in *bindto);
+	ssize_t (*send)(const void *, size_t, const struct sockaddr_in *to);
+	ssize_t (*recv)(void *, size_t, int flags, struct sockaddr_in *from,
+	    long usec);
+	int (*wait)(int secs, int fd);
+	uint64_t (*clock)(void);	/* Microseconds, from anywhere */
+};
+
+extern const struct aun_net *aun_net;
+extern const struct aun_net aun_udp;
+
+/*
+ * Traffic counters, kept by whichever transport is in use.
+ */
+struct aun_stats {
+	uint64_t rx_packets;	/* Packets returned by recv */
+	uint64_t rx_bytes;
+	uint64_t tx_packets;	/* Packets passed to xmit */
+	uint64_t tx_bytes;
+	uint64_t retransmits;	/* Extra sends while waiting for an ack */
+	uint64_t timeouts;	/* Gave up waiting for an ack or a packet */
+};
+
+extern struct aun_stats aun_stats;
+
+extern char *capture_file;
+extern void capture_open(void);
+extern void capture_flush(void);
+extern void capture_packet(const struct aun_packet *, size_t,
+    struct aun_srcaddr *, bool);
+
+#endif
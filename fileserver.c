@@ -28,25 +28,55 @@
 
 #include <sys/param.h>
 #include <sys/queue.h>
+#include <sys/resource.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 
+#include <ctype.h>
 #include <err.h>
 #include <errno.h>
 #include <fts.h>
+#include <limits.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <syslog.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "aun.h"
 #include "fs_proto.h"
+#include "fs_errors.h"
 #include "extern.h"
 #include "fileserver.h"
 
-struct fs_client_head fs_clients = LIST_HEAD_INITIALIZER(fs_clients);
+#define FS_CLIENT_HASH	1024
+#define FS_PROBE_WAIT	5	/* Seconds to wait for a probe reply */
+#define FS_PROBE_TRIES	3	/* Unanswered probes before we give up */
+#define FS_FD_RESERVE	128	/* Descriptors not for files (see fs_handle.c) */
+#define FS_RECLAIM_IDLE	60	/* Idle seconds before fs_reclaim_fds bites */
+
+struct fs_client_head fs_clients = TAILQ_HEAD_INITIALIZER(fs_clients);
+
+/*
+ * Every packet has to be matched with its client, so clients are also
+ * hashed by address, and by login name for *USERS-style lookups.
+ */
+static LIST_HEAD(fs_client_bucket, fs_client) fs_client_host[FS_CLIENT_HASH];
+static struct fs_client_bucket fs_client_login[FS_CLIENT_HASH];
+
+/*
+ * Clients we've heard from recently, least recently first, and those
+ * that have gone quiet for long enough that we're checking whether
+ * they're still there, in the order we started asking.
+ */
+static struct fs_client_head fs_idle = TAILQ_HEAD_INITIALIZER(fs_idle);
+static struct fs_client_head fs_probing = TAILQ_HEAD_INITIALIZER(fs_probing);
+
+int fs_idle_timeout = 0;	/* Seconds; 0 means never */
+bool fs_idle_probe = false;
+int fs_fd_budget = 0;		/* 0 means work it out */
 
 char discname[17];
 char *root = NULL;             /* must specify this in config */
@@ -58,6 +88,28 @@ bool default_safehandles = true;
 
 struct user_funcs const * userfuncs;
 
+/*
+ * A request that can't be answered yet, kept to be tried again later.
+ */
+struct fs_deferred {
+    TAILQ_ENTRY(fs_deferred) link;
+    struct aun_srcaddr from;
+    ssize_t len;
+    unsigned char pkt[1];	/* Actually len + 1 */
+};
+
+static TAILQ_HEAD(, fs_deferred) fs_deferred =
+    TAILQ_HEAD_INITIALIZER(fs_deferred);
+
+static void fs_exit(void);
+static void fs_retry_deferred(void);
+static struct fs_client_bucket *fs_host_bucket(struct aun_srcaddr *);
+static struct fs_client_bucket *fs_login_bucket(const char *);
+static void fs_touch_client(struct fs_client *);
+static void fs_reap_client(struct fs_client *, const char *);
+static void fs_reap_idle(void);
+static void fs_report_fds(void);
+
 void
 fs_init(void)
 {
@@ -80,6 +132,118 @@ fs_init(void)
         userfuncs = &user_pw;
     else
         userfuncs = &user_null;
+    fs_typemap_compile();
+    fs_trace_open();
+    fs_stats_init();
+    if (fs_fd_budget == 0) {
+        struct rlimit rl;
+
+        if (getrlimit(RLIMIT_NOFILE, &rl) == 0 &&
+            rl.rlim_cur != RLIM_INFINITY && rl.rlim_cur < INT_MAX)
+            fs_fd_budget = rl.rlim_cur - FS_FD_RESERVE;
+        else
+            fs_fd_budget = INT_MAX;
+        if (fs_fd_budget < FS_FD_RESERVE)
+            fs_fd_budget = FS_FD_RESERVE;
+    }
+    atexit(fs_exit);
+}
+
+/*
+ * Called from the main loop about once a second.
+ */
+void
+fs_periodic(void)
+{
+
+    fs_metacache_flush(false);
+    fs_reap_idle();
+    fs_trace_periodic();
+    fs_stats_flush(false);
+    if (userfuncs->periodic != NULL)
+        userfuncs->periodic();
+    if (pw_crypt_poll() > 0)
+        fs_retry_deferred();
+}
+
+/*
+ * Something the main loop should wait on as well as the network, or
+ * -1.  When it becomes readable, fs_periodic has work to do.
+ */
+int
+fs_wait_fd(void)
+{
+
+    return pw_crypt_fd();
+}
+
+/*
+ * Whether any requests have been put aside by fs_defer and not yet
+ * answered.
+ */
+bool
+fs_deferred_pending(void)
+{
+
+    return !TAILQ_EMPTY(&fs_deferred);
+}
+
+/*
+ * Put a request aside, because it's waiting for something (like a
+ * password hash).  It will be handled again from the start when
+ * fs_retry_deferred is next called, so the handler must be able to
+ * cope with being run more than once.
+ */
+void
+fs_defer(struct fs_context *c)
+{
+    struct fs_deferred *d;
+
+    if ((d = malloc(sizeof(*d) + c->req_len)) == NULL) {
+        fs_err(c, EC_FS_E_NOMEM);
+        return;
+    }
+    d->from = *c->from;
+    d->len = c->req_len;
+    memcpy(d->pkt, c->req, c->req_len);
+    TAILQ_INSERT_TAIL(&fs_deferred, d, link);
+    if (debug) printf(" (deferred)");
+}
+
+static void
+fs_retry_deferred(void)
+{
+    TAILQ_HEAD(, fs_deferred) retry = TAILQ_HEAD_INITIALIZER(retry);
+    struct fs_deferred *d;
+
+    /* Anything deferred again goes back on fs_deferred. */
+    while ((d = TAILQ_FIRST(&fs_deferred)) != NULL) {
+        TAILQ_REMOVE(&fs_deferred, d, link);
+        TAILQ_INSERT_TAIL(&retry, d, link);
+    }
+    while ((d = TAILQ_FIRST(&retry)) != NULL) {
+        TAILQ_REMOVE(&retry, d, link);
+        if (debug) printf("\n\t(file server, retrying: ");
+        file_server((struct aun_packet *)d->pkt, d->len, &d->from);
+        if (debug) printf(")\n");
+        free(d);
+    }
+}
+
+static void
+fs_exit(void)
+{
+
+    fs_metacache_flush(true);
+    fs_stats_flush(true);
+    if (userfuncs->exit != NULL)
+        userfuncs->exit();
+    if (using_syslog)
+        syslog(LOG_INFO, "cache hits/misses: path %lu/%lu, "
+            "metadata %lu/%lu, directory %lu/%lu",
+            fs_pathcache_hits, fs_pathcache_misses,
+            fs_metacache_hits, fs_metacache_misses,
+            fs_dircache_hits, fs_dircache_misses);
 }
 
 #if 0
@@ -154,6 +318,12 @@ file_server(struct aun_packet *pkt, ssize_t len, struct aun_srcaddr *from)
     c->req_len = len;
     c->from = from;
     c->client = fs_find_client(from);
+    c->arena = fs_arena_get();
+    fs_trace_context(c);
+    FS_TRACE(FS_TRACE_REQ, FS_TRACE_EV_REQUEST, 0, len, 0);
+    fs_stats_begin(c);
+    if (c->client != NULL)
+        fs_touch_client(c->client);
     fs_check_handles(c);
     /* Null-terminate in case client is silly */
     ((char *)(c->req))[c->req_len] = '\0';
@@ -168,6 +338,10 @@ file_server(struct aun_packet *pkt, ssize_t len, struct aun_srcaddr *from)
         }
         fs_error(c, 0xff, "Not yet implemented!");
     }
+    fs_stats_end(c);
+    fs_arena_reset(c->arena);
+    fs_trim_dirfds();
+    fs_trace_context(NULL);
 }
 
 void
@@ -182,15 +356,41 @@ fs_unrec(struct fs_context *c)
 void
 fs_reply(struct fs_context *c, struct ec_fs_reply *reply, size_t len)
 {
+    int phase;
+
     reply->aun.type = AUN_TYPE_UNICAST;
     reply->aun.dest_port = c->req->reply_port;
     reply->aun.flag = c->req->aun.flag;
+    FS_TRACE(FS_TRACE_REQ, FS_TRACE_EV_REPLY, 0, len, reply->return_code);
+    fs_stats_reply(len, reply->return_code);
+    phase = FS_PHASE(FS_PHASE_XMIT);
     if (aunfuncs->xmit(&(reply->aun), len, c->from) == -1)
         warn("Tx reply");
+    FS_PHASE_END(phase);
+}
+
+static struct fs_client_bucket *
+fs_host_bucket(struct aun_srcaddr *from)
+{
+    uint32_t h;
+
+    h = ((uint32_t)from->bytes[0] << 24 | (uint32_t)from->bytes[1] << 16 |
+        (uint32_t)from->bytes[2] << 8 | from->bytes[3]) * 0x9e3779b1U;
+    return &fs_client_host[(h >> 16) % FS_CLIENT_HASH];
+}
+
+static struct fs_client_bucket *
+fs_login_bucket(const char *login)
+{
+    unsigned int h = 0;
+
+    for (; *login; login++)
+        h = h * 31 + tolower((unsigned char)*login);
+    return &fs_client_login[h % FS_CLIENT_HASH];
 }
 
 struct fs_client *
-fs_new_client(struct aun_srcaddr *from)
+fs_new_client(struct aun_srcaddr *from, const char *login)
 {
     struct fs_client *client;
     client = calloc(1, sizeof(*client));
@@ -198,51 +398,121 @@ fs_new_client(struct aun_srcaddr *from)
         warnx("fs_new_client: calloc failed");
         return NULL;
     }
-    /*
-     * All clients have a null handle, handle 0.  We'll
-     * pre-allocate another three, since all clients get three
-     * handles allocated at login.
-     */
-    client->handles = calloc(4, sizeof(struct fs_handle *));
-    if (client->handles == NULL) {
-        warnx("fs_new_client: calloc failed");
+    client->login = strdup(login);
+    if (client->login == NULL) {
+        warnx("fs_new_client: strdup failed");
+        free(client);
+        return NULL;
+    }
+    if (fs_init_handles(client) < 0) {
+        free(client->login);
         free(client);
         return NULL;
     }
-    client->nhandles = 4;
     client->host = *from;
-    client->login = NULL;
     client->dir_cache.path = NULL;
     client->dir_cache.ftsp = NULL;
     client->dir_cache.f = NULL;
     client->infoformat = default_infoformat;
     client->safehandles = default_safehandles;
-    LIST_INSERT_HEAD(&fs_clients, client, link);
+    TAILQ_INSERT_TAIL(&fs_clients, client, link);
+    client->last = time(NULL);
+    TAILQ_INSERT_TAIL(&fs_idle, client, idle);
+    LIST_INSERT_HEAD(fs_host_bucket(from), client, byhost);
+    LIST_INSERT_HEAD(fs_login_bucket(login), client, bylogin);
     if (using_syslog)
         syslog(LOG_INFO, "login from %s", aunfuncs->ntoa(from));
     return client;
 }
 
+/*
+ * Look up a client's URD and privilege and keep them in the client
+ * structure, so that ownership checks don't have to ask userfuncs.
+ * The URD is stored without any leading "./" or trailing "/", to
+ * match the paths that come out of fs_unixify_path.
+ */
+void
+fs_refresh_client(struct fs_client *client)
+{
+    char *urd, *p;
+    size_t len;
+
+    free(client->urd);
+    client->urd = NULL;
+    client->urdlen = 0;
+    client->priv = EC_FS_PRIV_NONE;
+    if (client->login == NULL)
+        return;
+    client->priv = userfuncs->get_priv(client->login);
+    if ((urd = userfuncs->urd(client->login)) == NULL)
+        return;
+    for (p = urd; p[0] == '.' && p[1] == '/'; p += 2)
+        continue;
+    len = strlen(p);
+    while (len > 1 && p[len - 1] == '/')
+        len--;
+    memmove(urd, p, len);
+    urd[len] = '\0';
+    client->urd = urd;
+    client->urdlen = len;
+    if (debug) printf("(%s: urd [%s], priv %d)",
+        client->login, client->urd, client->priv);
+}
+
+/*
+ * Something about a user has changed.  Refresh every client logged
+ * in as them.
+ */
+void
+fs_refresh_user(const char *login)
+{
+    struct fs_client *client;
+
+    LIST_FOREACH(client, fs_login_bucket(login), bylogin)
+        if (!strcasecmp(client->login, login))
+            fs_refresh_client(client);
+}
+
 struct fs_client *
 fs_find_client(struct aun_srcaddr *from)
 {
     struct fs_client *c;
-    for (c = fs_clients.lh_first; c != NULL; c = c->link.le_next)
+
+    LIST_FOREACH(c, fs_host_bucket(from), byhost)
         if (memcmp(from, &(c->host), sizeof(struct aun_srcaddr)) == 0)
             break;
     return c;
 }
 
+/*
+ * Find a client logged in as the given user.  If there's more than
+ * one, which we get is arbitrary.
+ */
+struct fs_client *
+fs_find_user(const char *login)
+{
+    struct fs_client *c;
+
+    LIST_FOREACH(c, fs_login_bucket(login), bylogin)
+        if (!strcasecmp(c->login, login))
+            break;
+    return c;
+}
+
 void
 fs_delete_client(struct fs_client *client)
 {
     int i;
-    LIST_REMOVE(client, link);
+    TAILQ_REMOVE(&fs_clients, client, link);
+    TAILQ_REMOVE(client->probes ? &fs_probing : &fs_idle, client, idle);
+    LIST_REMOVE(client, byhost);
+    LIST_REMOVE(client, bylogin);
     for (i=0; i < client->nhandles; i++)
         if (client->handles[i] != NULL)
             fs_close_handle(client, i);
     free(client->handles);
     free(client->login);
+    free(client->urd);
     if (client->dir_cache.ftsp)
         fts_close(client->dir_cache.ftsp);
     if (using_syslog)
@@ -250,3 +520,135 @@ fs_delete_client(struct fs_client *client)
             aunfuncs->ntoa(&client->host));
     free(client);
 }
+
+/*
+ * We've heard from a client, so move it to the back of the idle
+ * queue.
+ */
+static void
+fs_touch_client(struct fs_client *client)
+{
+
+    TAILQ_REMOVE(client->probes ? &fs_probing : &fs_idle, client, idle);
+    client->probes = 0;
+    client->last = time(NULL);
+    TAILQ_INSERT_TAIL(&fs_idle, client, idle);
+}
+
+/*
+ * A station has answered a probe.  It's still switched on, so keep
+ * its user logged on.
+ */
+void
+fs_probe_reply(struct aun_srcaddr *from)
+{
+    struct fs_client *client;
+
+    client = fs_find_client(from);
+    if (client == NULL || client->probes == 0)
+        return;
+    if (debug) printf("(%s answered probe)", aunfuncs->ntoa(from));
+    fs_touch_client(client);
+}
+
+static void
+fs_reap_client(struct fs_client *client, const char *why)
+{
+
+    if (debug) printf("(reaping %s: %s)", aunfuncs->ntoa(&client->host), why);
+    if (using_syslog)
+        syslog(LOG_INFO, "%s from %s: %s", client->login,
+            aunfuncs->ntoa(&client->host), why);
+    fs_delete_client(client);
+}
+
+/*
+ * Log off clients that we haven't heard from for fs_idle_timeout
+ * seconds.  If fs_idle_probe is set, we first check whether the
+ * station is still there, and only log it off if it doesn't answer.
+ */
+static void
+fs_reap_idle(void)
+{
+    struct fs_client *client;
+    time_t now;
+
+    if (fs_idle_timeout <= 0)
+        return;
+    now = time(NULL);
+    while ((client = TAILQ_FIRST(&fs_idle)) != NULL &&
+        now - client->last >= fs_idle_timeout) {
+        if (!fs_idle_probe || aunfuncs->probe == NULL) {
+            fs_reap_client(client, "idle");
+            continue;
+        }
+        TAILQ_REMOVE(&fs_idle, client, idle);
+        client->probes = 1;
+        client->probed = now;
+        TAILQ_INSERT_TAIL(&fs_probing, client, idle);
+        if (debug) printf("(probing %s)", aunfuncs->ntoa(&client->host));
+        aunfuncs->probe(&client->host);
+    }
+    while ((client = TAILQ_FIRST(&fs_probing)) != NULL &&
+        now - client->probed >= FS_PROBE_WAIT) {
+        if (client->probes >= FS_PROBE_TRIES) {
+            fs_reap_client(client, "not answering");
+            continue;
+        }
+        TAILQ_REMOVE(&fs_probing, client, idle);
+        client->probes++;
+        client->probed = now;
+        TAILQ_INSERT_TAIL(&fs_probing, client, idle);
+        aunfuncs->probe(&client->host);
+    }
+}
+
+/*
+ * Say who's using all the descriptors.
+ */
+static void
+fs_report_fds(void)
+{
+    struct fs_client *client;
+    time_t now;
+
+    now = time(NULL);
+    warnx("%d descriptors in use by handles, of %d allowed",
+        fs_nfds, fs_fd_budget);
+    TAILQ_FOREACH(client, &fs_clients, link)
+        warnx("  %s (%s): %d, idle %lds", client->login,
+            aunfuncs->ntoa(&client->host), client->nfds,
+            (long)(now - client->last));
+}
+
+/*
+ * We've run out of descriptors for handles.  Try to get some back by
+ * logging off someone who's probably gone away, though not the client
+ * asking.  Returns true if it freed anything.
+ */
+bool
+fs_reclaim_fds(struct fs_client *except)
+{
+    static time_t reported;
+    struct fs_client *client;
+
+    while (fs_nfds >= fs_fd_budget) {
+        client = TAILQ_FIRST(&fs_probing);
+        if (client == NULL || client == except) {
+            client = TAILQ_FIRST(&fs_idle);
+            if (client == except && client != NULL)
+                client = TAILQ_NEXT(client, idle);
+            if (client == NULL ||
+                time(NULL) - client->last < FS_RECLAIM_IDLE)
+                break;
+        }
+        fs_reap_client(client, "reclaiming descriptors");
+    }
+    if (fs_nfds < fs_fd_budget)
+        return true;
+    if (time(NULL) - reported >= 60) {
+        reported = time(NULL);
+        fs_report_fds();
+    }
+    return false;
+}
@@ -42,21 +42,27 @@
 
 #include "aun.h"
 #include "fs_proto.h"
+#include "fs_trace.h"
 
 struct fs_context {
 	struct ec_fs_req *req;		/* Request being handled */
 	size_t req_len;			/* Size of request */
 	struct aun_srcaddr *from;	/* Source of request */
 	struct fs_client *client;	/* Pointer to client structure, or NULL if not logged in */
+	struct fs_arena *arena;		/* Memory freed when the request is done */
 };
 
 enum fs_handle_type { FS_HANDLE_FILE, FS_HANDLE_DIR };
 
+#define MAX_HANDLES 256
+
 struct fs_handle {
-	char	*path;
+	const char *path;	/* Interned; see fs_intern */
 	off_t	oldoffset; /* files only */
 	enum 	fs_handle_type type;
-	int	fd;
+	int	fd;	/* For a directory, -1 until fs_handle_dirfd opens it */
+	bool	pinned;	/* Directory opened by fs_open: fd stays open */
+	TAILQ_ENTRY(fs_handle) lru;	/* Directories with fd open */
 	/*
 	 * The sequence number field here has three states: 0 and 1
 	 * indicate the sequence number we last received from
@@ -83,22 +89,48 @@ struct fs_dir_cache {
 	FTSENT *f; /* Result of fts_children on path */
 };
 
+/*
+ * A single file system object, as seen by the metadata and file type
+ * routines.  This is filled in either from an FTSENT during a
+ * directory scan, or by fs_ent_stat() for a single path.
+ */
+struct fs_ent {
+	int dirfd;		/* Directory accpath is relative to */
+	const char *accpath;	/* Path to use for access */
+	const char *path;	/* Path relative to the root */
+	char *name;	/* Leaf name */
+	size_t namelen;
+	struct stat *statp;	/* NULL if stat failed */
+	struct stat sb;		/* Storage for statp */
+};
+
 extern enum fs_info_format { FS_INFO_RISCOS, FS_INFO_SJ } default_infoformat;
 extern bool default_safehandles;
 
 struct fs_client {
-	LIST_ENTRY(fs_client) link;
+	TAILQ_ENTRY(fs_client) link;	/* In order of logging on */
+	LIST_ENTRY(fs_client) byhost;	/* In fs_client_host bucket */
+	LIST_ENTRY(fs_client) bylogin;	/* In fs_client_login bucket */
+	TAILQ_ENTRY(fs_client) idle;	/* On fs_idle or fs_probing */
 	struct aun_srcaddr host;
+	time_t last;		/* When we last heard from it */
+	int probes;		/* Unanswered probes since then */
+	time_t probed;		/* When we sent the last one */
+	int nfds;		/* Descriptors held by its handles */
 	int nhandles;
 	struct fs_handle **handles; /* array of handles for this client */
+	uint32_t p2free;	/* Free power-of-two handles; see fs_handle.c */
+	uint32_t np2free[MAX_HANDLES / 32];	/* Other free handles */
 	char *login;
+	char *urd;		/* Normalised URD, for fs_is_owner */
+	size_t urdlen;
 	int priv;
 	struct fs_dir_cache dir_cache;
 	enum fs_info_format infoformat;
 	bool safehandles;
 };
 
-LIST_HEAD(fs_client_head, fs_client);
+TAILQ_HEAD(fs_client_head, fs_client);
 extern struct fs_client_head fs_clients;
 
 extern char discname[];
@@ -108,6 +140,10 @@ extern char *pwfile;
 extern char *lib;
 extern int default_opt4;
 extern int default_fsstation;
+extern int fs_idle_timeout;
+extern bool fs_idle_probe;
+extern int fs_fd_budget;
+extern int fs_nfds;
 
 typedef void fs_func_impl(struct fs_context *);
 extern fs_func_impl fs_cli;
@@ -144,8 +180,10 @@ extern void fs_set_user_free(struct fs_context *,char *);
 
 extern void fs_unrec(struct fs_context *);
 extern char *fs_cli_getarg(char **);
-extern void fs_long_info(struct fs_context *, char *, FTSENT *);
+extern int fs_cli_secret(const uint8_t *, size_t);
+extern void fs_long_info(struct fs_context *, char *, struct fs_ent *);
 extern void fs_reply(struct fs_context *, struct ec_fs_reply *, size_t);
+extern void fs_defer(struct fs_context *);
 extern void fs_cdir1(struct fs_context *, char *);
 extern void fs_delete1(struct fs_context *, char *);
 
@@ -156,11 +194,108 @@ extern void fs_error(struct fs_context *, uint8_t, const char *);
 extern void fs_check_handles(struct fs_context *);
 extern int fs_check_handle(struct fs_client *, int);
 extern int fs_open_handle(struct fs_client *, char *, int, bool);
+extern const char *fs_path_at(struct fs_client *, const char *, int *);
+extern int fs_handle_dirfd(struct fs_handle *);
+extern int fs_init_handles(struct fs_client *);
+extern void fs_trim_dirfds(void);
 extern void fs_close_handle(struct fs_client *, int);
 
-extern struct fs_client *fs_new_client(struct aun_srcaddr *);
+extern char *fs_trace_file;
+extern uint32_t fs_trace_cats;
+extern uint32_t fs_trace_mask;
+extern uint32_t fs_trace_category(const char *);
+extern void fs_trace_open(void);
+extern void fs_trace_periodic(void);
+extern void fs_trace_context(struct fs_context *);
+extern void fs_trace(int, int, uint32_t, int);
+
+#define FS_TRACE(cat, ev, h, bytes, res) do {			\
+	if (fs_trace_mask & (cat))				\
+		fs_trace((ev), (h), (bytes), (res));		\
+} while (0)
+
+extern char *fs_stats_file;
+extern int fs_stats_interval;
+extern void fs_stats_init(void);
+extern void fs_stats_flush(bool);
+extern void fs_stats_begin(struct fs_context *);
+extern void fs_stats_command(const char *, bool);
+extern void fs_stats_reply(size_t, int);
+extern void fs_stats_end(struct fs_context *);
+extern size_t fs_stats_report(char *, size_t, bool);
+
+/* Phases of a request, timed for the slow request log */
+enum fs_phase {
+	FS_PHASE_PARSE,		/* Decoding the request, and anything else */
+	FS_PHASE_PATH,		/* Translating path names */
+	FS_PHASE_FS,		/* Filesystem calls and metadata */
+	FS_PHASE_ENCODE,	/* Building the reply */
+	FS_PHASE_XMIT,		/* Sending and receiving, waiting for acks */
+	FS_PHASE_MAX
+};
+
+extern int fs_slow_ms;
+extern int fs_slow_rate;
+extern char *fs_slow_trace_file;
+extern int fs_slow_trace_ms;
+extern bool fs_phase_on;
+extern int fs_phase_enter(int);
+extern void fs_phase_leave(int);
+
+#define FS_PHASE(p)		(fs_phase_on ? fs_phase_enter(p) : 0)
+#define FS_PHASE_END(prev) do {					\
+	if (fs_phase_on)					\
+		fs_phase_leave(prev);				\
+} while (0)
+
+/* What a request costs, counted when fs_cost_file is set (see fs_cost.h) */
+enum fs_cost {
+	FS_COST_STAT,		/* stat() and friends */
+	FS_COST_OPEN,		/* Opening files and directories */
+	FS_COST_CLOSE,
+	FS_COST_READDIR,	/* Including fts_read() and fts_children() */
+	FS_COST_READLINK,
+	FS_COST_XATTR,
+	FS_COST_READ,
+	FS_COST_WRITE,
+	FS_COST_SEEK,
+	FS_COST_CHANGE,		/* Creating, deleting, renaming, chmod... */
+	FS_COST_SYSCALLS,	/* Total of the above */
+	FS_COST_MALLOC,		/* malloc(), calloc(), realloc(), strdup() */
+	FS_COST_ARENA,		/* fs_alloc() */
+	FS_COST_IO_BYTES,	/* Read and written */
+	FS_COST_HEAP_BYTES,	/* Asked of malloc() and friends */
+	FS_COST_ARENA_BYTES,	/* Asked of fs_alloc() */
+	FS_COST_PACKETS,	/* Sent and received after the request */
+	FS_COST_MAX
+};
+
+extern char *fs_cost_file;
+extern bool fs_cost_on;
+extern uint64_t fs_cost_cur[FS_COST_MAX];
+extern size_t fs_cost_report(char *, size_t);
+extern ssize_t fs_cost_io(ssize_t);
+extern void *fs_cost_malloc(size_t);
+extern void *fs_cost_calloc(size_t, size_t);
+extern void *fs_cost_realloc(void *, size_t);
+extern char *fs_cost_strdup(const char *);
+
+#define FS_COST_ADD(k, n)	((void)(fs_cost_on ? fs_cost_cur[k] += (n) : 0))
+#define FS_COST(k)		FS_COST_ADD(k, 1)
+
+extern struct fs_arena *fs_arena_get(void);
+extern void fs_arena_reset(struct fs_arena *);
+extern void *fs_alloc(struct fs_context *, size_t);
+extern char *fs_strdup(struct fs_context *, const char *);
+extern void *fs_realloc(struct fs_context *, void *, size_t, size_t);
+
+extern struct fs_client *fs_new_client(struct aun_srcaddr *, const char *);
 extern void fs_delete_client(struct fs_client *);
+extern void fs_refresh_client(struct fs_client *);
+extern void fs_refresh_user(const char *);
 extern struct fs_client *fs_find_client(struct aun_srcaddr *);
+extern struct fs_client *fs_find_user(const char *);
+extern bool fs_reclaim_fds(struct fs_client *);
 
 extern char *strpad(char *, int, size_t);
 extern uint8_t fs_mode_to_type(mode_t);
@@ -170,12 +305,20 @@ extern char *fs_access_to_string(char *, uint8_t);
 extern uint64_t fs_read_val(uint8_t *, size_t);
 extern void fs_write_val(uint8_t *, uint64_t, size_t);
 extern uint64_t fs_riscos_date(time_t, unsigned);
-extern void fs_get_meta(FTSENT *, struct ec_fs_meta *);
-extern bool fs_set_meta(FTSENT *, struct ec_fs_meta *);
-extern void fs_del_meta(FTSENT *);
-extern int fs_get_sin(FTSENT *);
-extern time_t fs_get_birthtime(FTSENT *);
+extern void fs_ent_from_fts(struct fs_ent *, FTSENT *);
+extern int fs_ent_stat(struct fs_ent *, struct fs_client *, char *);
+extern int fs_ent_fstat(struct fs_ent *, struct fs_client *, char *, int);
+extern int fs_get_sin(struct fs_ent *);
+extern time_t fs_get_birthtime(struct fs_ent *);
 extern void fs_write_date(struct ec_fs_date *, time_t);
+/* Nanoseconds of a file's modification time, where we can get them */
+#if HAVE_STRUCT_STAT_ST_MTIMENSEC
+#define FS_MTIME_NSEC(st)	((long)(st)->st_mtimensec)
+#elif HAVE_STRUCT_STAT_ST_MTIM
+#define FS_MTIME_NSEC(st)	((long)(st)->st_mtim.tv_nsec)
+#else
+#define FS_MTIME_NSEC(st)	0L
+#endif
 extern int fs_stat(const char *, struct stat *);
 extern const char *fs_leafname(const char *);
 extern bool fs_is_owner(struct fs_context *c,char *path);
@@ -185,11 +328,38 @@ extern bool fs_is_user(char *);
 extern char *fs_acornify_name(char *);
 extern bool fs_hidden_name(char *);
 extern char *fs_unixify_path(struct fs_context *, char *);
+extern void fs_pathcache_invalidate(const char *);
+extern unsigned long fs_pathcache_hits, fs_pathcache_misses;
+
+extern void fs_get_meta(struct fs_ent *, struct ec_fs_meta *);
+extern bool fs_set_meta(struct fs_ent *, struct ec_fs_meta *);
+extern void fs_del_meta(struct fs_ent *);
+extern void fs_metacache_flush(bool);
+extern unsigned long fs_metacache_hits, fs_metacache_misses;
+extern unsigned long fs_dircache_hits, fs_dircache_misses;
 
-extern int fs_guess_type(FTSENT *);
+/*
+ * A way of storing Acorn metadata.  get returns false if the file has
+ * none; set returns false and sets errno on failure.
+ */
+struct meta_funcs {
+	bool (*get)(struct fs_ent *, struct ec_fs_meta *);
+	bool (*set)(struct fs_ent *, struct ec_fs_meta *);
+	void (*del)(struct fs_ent *);
+};
+
+extern struct meta_funcs const *metafuncs;
+extern struct meta_funcs const meta_symlink;
+extern struct meta_funcs const meta_xattr;
+
+#define FS_MAGIC_MAX 32	/* Furthest into a file "typemap magic" can look */
+
+extern int fs_guess_type(struct fs_ent *);
 extern int fs_add_typemap_name(const char *, int);
 extern int fs_add_typemap_mode(mode_t, mode_t, int);
 extern int fs_add_typemap_default(int);
+extern int fs_add_typemap_magic(size_t, const unsigned char *, size_t, int);
+extern void fs_typemap_compile(void);
 
 struct user_funcs {
 	char *(*validate)(char *, char const *, int *);
@@ -201,10 +371,17 @@ struct user_funcs {
     int (*add_user)(char *);
     bool (*is_user)(char *);
     int (*del_user)(char *);
+    void (*periodic)(void);
+    void (*exit)(void);
 };
 
 extern struct user_funcs const *userfuncs;
 extern struct user_funcs const user_pw;
 extern struct user_funcs const user_null;
 
+extern int pw_crypt(const char *, const char *, char **);
+extern int pw_crypt_new(const char *, const char *, char **);
+extern int pw_crypt_fd(void);
+extern int pw_crypt_poll(void);
+
 #endif
@@ -0,0 +1,196 @@
+/*-
+ * Copyright (c) 2010 Simon Tatham
+ * Copyright (c) 2010 Ben Harris
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/*
+ * Request-scoped memory.
+ *
+ * Most of what a request allocates (translated paths, reply buffers
+ * and so on) is only needed until the reply has been sent.  Rather
+ * than malloc and free each piece, handlers take it from the arena
+ * hung off their fs_context, and file_server() throws the lot away in
+ * one go when the handler returns.  The first block is kept from one
+ * request to the next, so an ordinary request doesn't call malloc at
+ * all; anything bigger gets extra blocks, which are freed at reset.
+ */
+
+#if HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <sys/types.h>
+
+#include <err.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "aun.h"
+#include "extern.h"
+#include "fs_proto.h"
+#include "fileserver.h"
+#include "fs_cost.h"
+
+#define FS_ARENA_SIZE	16384	/* Size of the block kept between requests */
+#define FS_ARENA_ALIGN	16
+#define FS_ARENA_ROUND(n) \
+	(((n) + FS_ARENA_ALIGN - 1) & ~(size_t)(FS_ARENA_ALIGN - 1))
+
+struct fs_arena_block {
+	struct fs_arena_block *next;	/* Previous block */
+	size_t size;			/* Bytes available after the header */
+	size_t used;
+};
+
+struct fs_arena {
+	struct fs_arena_block *cur;	/* Block being allocated from */
+	struct fs_arena_block *first;	/* Block kept across resets */
+	char *last;			/* Most recent allocation */
+};
+
+#define FS_ARENA_DATA(b) \
+	((char *)(b) + FS_ARENA_ROUND(sizeof(struct fs_arena_block)))
+
+static struct fs_arena fs_request_arena;
+
+static struct fs_arena_block *fs_arena_block(size_t);
+
+static struct fs_arena_block *
+fs_arena_block(size_t size)
+{
+    struct fs_arena_block *b;
+
+    b = malloc(FS_ARENA_ROUND(sizeof(*b)) + size);
+    if (b == NULL) {
+        warnx("fs_arena_block: malloc failed");
+        return NULL;
+    }
+    b->next = NULL;
+    b->size = size;
+    b->used = 0;
+    return b;
+}
+
+/*
+ * The arena for file_server() to hang off each fs_context.  Requests
+ * are handled one at a time, so they can all share one.
+ */
+struct fs_arena *
+fs_arena_get(void)
+{
+
+    return &fs_request_arena;
+}
+
+/*
+ * Free everything allocated from an arena since the last reset.
+ */
+void
+fs_arena_reset(struct fs_arena *a)
+{
+    struct fs_arena_block *b;
+
+    while ((b = a->cur) != a->first) {
+        a->cur = b->next;
+        free(b);
+    }
+    if (a->first != NULL)
+        a->first->used = 0;
+    a->last = NULL;
+}
+
+/*
+ * Allocate size bytes that last until the end of the request.  Returns
+ * NULL if memory is short, as malloc() would.
+ */
+void *
+fs_alloc(struct fs_context *c, size_t size)
+{
+    struct fs_arena *a = c->arena;
+    struct fs_arena_block *b;
+
+    FS_COST(FS_COST_ARENA);
+    FS_COST_ADD(FS_COST_ARENA_BYTES, size);
+    size = FS_ARENA_ROUND(size ? size : 1);
+    if (a->first == NULL) {
+        if ((a->first = fs_arena_block(FS_ARENA_SIZE)) == NULL)
+            return NULL;
+        a->cur = a->first;
+    }
+    b = a->cur;
+    if (b->size - b->used < size) {
+        b = fs_arena_block(size > FS_ARENA_SIZE ? size : FS_ARENA_SIZE);
+        if (b == NULL)
+            return NULL;
+        b->next = a->cur;
+        a->cur = b;
+        if (debug) printf("(arena: extra block of %lu)",
+            (unsigned long)b->size);
+    }
+    a->last = FS_ARENA_DATA(b) + b->used;
+    b->used += size;
+    return a->last;
+}
+
+char *
+fs_strdup(struct fs_context *c, const char *s)
+{
+    size_t len = strlen(s) + 1;
+    char *p;
+
+    if ((p = fs_alloc(c, len)) != NULL)
+        memcpy(p, s, len);
+    return p;
+}
+
+/*
+ * Resize an allocation from fs_alloc() from oldsize to size bytes.
+ * The most recent allocation can grow or shrink where it is, which is
+ * the common case for a reply being built up piece by piece.  A NULL
+ * ptr behaves like fs_alloc().
+ */
+void *
+fs_realloc(struct fs_context *c, void *ptr, size_t oldsize, size_t size)
+{
+    struct fs_arena *a = c->arena;
+    struct fs_arena_block *b = a->cur;
+    size_t start;
+    void *p;
+
+    if (ptr == NULL)
+        return fs_alloc(c, size);
+    if (ptr == a->last) {
+        start = a->last - FS_ARENA_DATA(b);
+        if (b->size - start >= size) {
+            b->used = start + FS_ARENA_ROUND(size ? size : 1);
+            return ptr;
+        }
+    }
+    if ((p = fs_alloc(c, size)) != NULL)
+        memcpy(p, ptr, oldsize < size ? oldsize : size);
+    return p;
+}
@@ -32,9 +32,12 @@
 
 #include <assert.h>
 #include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <grp.h>
 #include <libgen.h>
+#include <limits.h>
 #include <pwd.h>
 #include <stdbool.h>
 #include <stdio.h>
@@ -49,6 +52,9 @@
 #include "fs_errors.h"
 #include "extern.h"
 #include "fileserver.h"
+#include "fs_cost.h"
+
+#define FS_STATS_REPLY	256	/* Longest *STATS reply */
 
 typedef void fs_cmd_impl(struct fs_context *, char *);
 
@@ -76,8 +82,10 @@ static fs_cmd_impl fs_cmd_rename;
 static fs_cmd_impl fs_cmd_access;
 static fs_cmd_impl fs_cmd_newuser;
 static fs_cmd_impl fs_cmd_deluser;
+static fs_cmd_impl fs_cmd_stats;
 
 static bool fs_cli_match(char *cmdline, char **tail, const struct fs_cmd *cmd);
+static bool fs_cli_hidden(const struct fs_cmd *cmd);
 static void fs_cli_unrec(struct fs_context *, char *);
 
 /* the table has command, number of character to make it */
@@ -104,6 +112,7 @@ static const struct fs_cmd cmd_tab[] = {
     {"ACCESS",  2, fs_cmd_access,   },
     {"NEWUSER", 2, fs_cmd_newuser,    }, 
     {"REMUSER", 3, fs_cmd_deluser,    },
+    {"STATS",   2, fs_cmd_stats,    },
 };
 
 #define NCMDS (sizeof(cmd_tab) / sizeof(cmd_tab[0]))
@@ -120,7 +129,10 @@ fs_cli(struct fs_context *c)
     c->req->data[strcspn(c->req->data, "\r")] = '\0';
 
     if (debug) printf("cli ");
-    head = backup = strdup(c->req->data);
+    if ((head = backup = fs_strdup(c, c->req->data)) == NULL) {
+        fs_err(c, EC_FS_E_NOMEM);
+        return;
+    }
     while (strchr("* \t", *head)) head++;
     if (!*head) {
         struct ec_fs_reply reply;
@@ -129,7 +141,6 @@ fs_cli(struct fs_context *c)
         reply.command_code = EC_FS_CC_DONE;
         reply.return_code = EC_FS_RC_OK;
         fs_reply(c, &reply, sizeof(reply));
-        free(backup);
         return;
     }
     for (i = 0; i < NCMDS; i++) {
@@ -139,14 +150,14 @@ fs_cli(struct fs_context *c)
              * all commands except *I AM and *PASS.
              */
             if (debug) {
-                if (cmd_tab[i].impl == fs_cmd_i_am ||
-                    cmd_tab[i].impl == fs_cmd_pass)
+                if (fs_cli_hidden(&cmd_tab[i]))
                     printf("[%.*s <hidden>]",
     // loop and accept new connections
                         (int)(tail - backup), backup);
                 else
                     printf("[%s]", c->req->data);
             }
+            fs_stats_command(cmd_tab[i].name, fs_cli_hidden(&cmd_tab[i]));
             (cmd_tab[i].impl)(c, tail);
             break;
         }
@@ -156,7 +167,6 @@ fs_cli(struct fs_context *c)
             printf("[%s]", c->req->data);
         fs_cli_unrec(c, backup);
     }
-    free(backup);
 }
 
 static void
@@ -165,13 +175,50 @@ fs_cli_unrec(struct fs_context *c, char *cmd)
     struct ec_fs_reply *reply;
 
     if (debug) printf("[%s] -> <unrecognised>\n", cmd);
-    reply = malloc(sizeof(*reply) + strlen(cmd) + 1);
+    if ((reply = fs_alloc(c, sizeof(*reply) + strlen(cmd) + 1)) == NULL) {
+        fs_err(c, EC_FS_E_NOMEM);
+        return;
+    }
     reply->command_code = EC_FS_CC_UNREC;
     reply->return_code = EC_FS_RC_OK;
     strcpy(reply->data, cmd);
     reply->data[strlen(cmd)] = '\r';
     fs_reply(c, reply, sizeof(*reply) + strlen(cmd) + 1);
-    free(reply);
+}
+
+/*
+ * Whether the arguments to cmd should be kept out of logs, because
+ * they include a password.
+ */
+static bool
+fs_cli_hidden(const struct fs_cmd *cmd)
+{
+
+    return cmd->impl == fs_cmd_i_am || cmd->impl == fs_cmd_pass;
+}
+
+/*
+ * If the command line in data, len bytes long, is one whose arguments
+ * should be kept out of logs, return how many bytes of it come before
+ * them.  Otherwise return -1.
+ */
+int
+fs_cli_secret(const uint8_t *data, size_t len)
+{
+    char cmdline[256], *head, *tail;
+    int i;
+
+    if (len >= sizeof(cmdline))
+        len = sizeof(cmdline) - 1;
+    memcpy(cmdline, data, len);
+    cmdline[len] = '\0';
+    cmdline[strcspn(cmdline, "\r")] = '\0';
+    for (head = cmdline; *head != '\0' && strchr("* \t", *head); head++)
+        continue;
+    for (i = 0; i < NCMDS; i++)
+        if (fs_cli_match(head, &tail, &cmd_tab[i]))
+            return fs_cli_hidden(&cmd_tab[i]) ? tail - cmdline : -1;
+    return -1;
 }
 
 /*
@@ -271,9 +318,14 @@ fs_cmd_i_am(struct fs_context *c, char *tail)
         login = fs_cli_getarg(&tail);
     password = fs_cli_getarg(&tail);
     if (debug) printf(" -> log on [%s]\n", login);
+    errno = 0;
     oururd = userfuncs->validate(login, password, &opt4);
     if (!oururd) {
-        fs_err(c, EC_FS_E_WRONGPW);
+        if (errno == EINPROGRESS)
+            /* Still checking the password.  Try again later. */
+            fs_defer(c);
+        else
+            fs_err(c, EC_FS_E_WRONGPW);
         return;
     }
     /*
@@ -283,14 +335,12 @@ fs_cmd_i_am(struct fs_context *c, char *tail)
      */
     if (c->client)
         fs_delete_client(c->client);
-    c->client = fs_new_client(c->from);
+    c->client = fs_new_client(c->from, login);
     if (c->client == NULL) {
         fs_error(c, 0xff, "Internal server error");
         return;
     }
-    c->client->login = strdup(login);
-    c->client->priv = userfuncs->get_priv(c->client->login);
-        if (debug) printf("Cli: %s has %d\n", c->client->login, c->client->priv);
+    fs_refresh_client(c->client);
     reply.std_tx.command_code = EC_FS_CC_LOGON;
     reply.std_tx.return_code = EC_FS_RC_OK;
     /*
@@ -334,6 +384,7 @@ fs_cmd_priv(struct fs_context *c, char *tail)
         fs_err(c, EC_FS_E_NOPRIV);  // Should be Priv??
         return;
     }
+    fs_refresh_user(user);
     reply.command_code = EC_FS_CC_DONE;
     reply.return_code = EC_FS_RC_OK;
     fs_reply(c, &reply, sizeof(reply));
@@ -351,10 +402,15 @@ fs_cmd_pass(struct fs_context *c, char *tail)
         fs_err(c, EC_FS_E_WHOAREYOU);
         return;
     }
+    errno = 0;
     if (userfuncs->change(c->client->login, oldpw, newpw)) {
-        fs_err(c, EC_FS_E_BADPW);
+        if (errno == EINPROGRESS)
+            fs_defer(c);
+        else
+            fs_err(c, EC_FS_E_BADPW);
         return;
     }
+    fs_refresh_user(c->client->login);
     reply.command_code = EC_FS_CC_DONE;
     reply.return_code = EC_FS_RC_OK;
     fs_reply(c, &reply, sizeof(reply));
@@ -374,13 +430,15 @@ fs_cmd_cat(struct fs_context *c, char *tail)
 
     path = fs_cli_getarg(&tail);
     if (debug) printf(" -> cat [%s]\n", path);
-    reply = malloc(sizeof(*reply) + strlen(path) + 1);
+    if ((reply = fs_alloc(c, sizeof(*reply) + strlen(path) + 1)) == NULL) {
+        fs_err(c, EC_FS_E_NOMEM);
+        return;
+    }
     reply->command_code = EC_FS_CC_CAT;
     reply->return_code = EC_FS_RC_OK;
     strcpy(reply->data, path);
     reply->data[strlen(path)] = '\r';
     fs_reply(c, reply, sizeof(*reply) + strlen(path) + 1);
-    free(reply);
 }
 
 static void
@@ -390,10 +448,10 @@ fs_cmd_rename(struct fs_context *c, char *tail)
     struct ec_fs_meta meta;
     char *oldname, *newname;
     char *oldupath, *newupath;
-    char *path_argv[2];
-    FTS *ftsp;
-    FTSENT *f;
+    const char *oldrel, *newrel;
+    struct fs_ent ent;
     bool is_owner = false;
+    int olddirfd, newdirfd;
 
     oldname = fs_cli_getarg(&tail);
     newname = fs_cli_getarg(&tail);
@@ -403,76 +461,61 @@ fs_cmd_rename(struct fs_context *c, char *tail)
         return;
     }
     if ((oldupath = fs_unixify_path(c, oldname)) == NULL) return;
-    if ((newupath = fs_unixify_path(c, newname)) == NULL) {
-        free(oldupath);
-        return;
-    }
-        path_argv[0] = oldupath;
-        path_argv[1] = NULL;
-        ftsp = fts_open(path_argv, FTS_LOGICAL, NULL);
-        f = fts_read(ftsp);
+    if ((newupath = fs_unixify_path(c, newname)) == NULL) return;
+        if (fs_ent_stat(&ent, c->client, oldupath) == -1) {
+            fs_errno(c);
+            goto notallowed;
+        }
 
-        if (f->fts_statp->st_mode & S_IXUSR)
+        if (ent.statp->st_mode & S_IXUSR)
         {
             // file is locked so we cannot rename
             fs_err(c, EC_FS_E_LOCKED);
-            goto locked;
+            goto notallowed;
         }
 
         is_owner = fs_is_owner(c, oldupath);
 
         if (is_owner == true)
         {
-            if (!(f->fts_statp->st_mode & S_IWUSR))
+            if (!(ent.statp->st_mode & S_IWUSR))
             {
             // We dont have write access
             fs_err(c, EC_FS_E_NOACCESS);
-            fts_close(ftsp);
             goto notallowed;
             }
         }
         if (is_owner == false)
         {
-            if (!(f->fts_statp->st_mode & S_IWOTH))
+            if (!(ent.statp->st_mode & S_IWOTH))
             {
             // We dont have write access
             fs_err(c, EC_FS_E_NOACCESS);
-            fts_close(ftsp);
             goto notallowed;
             }
         }
-    if (rename(oldupath, newupath) < 0) {
-        free(oldupath);
-        free(newupath);
-        fts_close(ftsp);
+    /* Pending metadata might be for something under oldupath. */
+    fs_metacache_flush(true);
+    /* Extended attributes can only be read while the old name works. */
+    fs_get_meta(&ent, &meta);
+    oldrel = fs_path_at(c->client, oldupath, &olddirfd);
+    newrel = fs_path_at(c->client, newupath, &newdirfd);
+    if (renameat(olddirfd, oldrel, newdirfd, newrel) < 0) {
         fs_errno(c);
-        // Do not need to return here
     } else {
-        fs_get_meta(f, &meta);
-        fs_del_meta(f);
-        fts_close(ftsp);
+        fs_pathcache_invalidate(oldupath);
+        fs_pathcache_invalidate(newupath);
+        fs_del_meta(&ent);
 
-        path_argv[0] = newupath;
-        path_argv[1] = NULL;
-        ftsp = fts_open(path_argv, FTS_LOGICAL, NULL);
-        f = fts_read(ftsp);
-        fs_set_meta(f, &meta);
-        fts_close(ftsp);
+        if (fs_ent_stat(&ent, c->client, newupath) == 0)
+            fs_set_meta(&ent, &meta);
 
         reply.command_code = EC_FS_CC_DONE;
         reply.return_code = EC_FS_RC_OK;
         fs_reply(c, &reply, sizeof(reply));
     }
 notallowed:
-    free(oldupath);
-    free(newupath);
     return;
-
-locked:
-    fts_close(ftsp);
-    free(oldupath);
-    free(newupath);
-    return;    
 }
 
 static void
@@ -512,7 +555,7 @@ fs_cmd_sdisc(struct fs_context *c, char *tail)
         fs_err(c, EC_FS_E_WHOAREYOU);
         return;
     }
-    oururd = userfuncs->urd(c->client->login);
+    oururd = c->client->urd;
     if (!oururd) {
         fs_error(c, 0xff, "Failed lookup");
         return;
@@ -546,7 +589,7 @@ fs_cmd_dir(struct fs_context *c, char *tail)
 
     // Check if the user has fixed privilege, if they do
     // they are not allowed to change directory
-    priv = userfuncs->get_priv(c->client->login);
+    priv = c->client->priv;
     if (priv == EC_FS_PRIV_FIXED)
     {
         fs_error(c, 0xff, "Not allowed");
@@ -558,7 +601,6 @@ fs_cmd_dir(struct fs_context *c, char *tail)
     if (debug) printf(" -> dir [%s]\n", upath);
     if ((upath = fs_unixify_path(c, upath)) == NULL) return;
     reply.new_handle = fs_open_handle(c->client, upath, O_RDONLY, false);
-    free(upath);
     if (reply.new_handle == 0) {
         fs_errno(c);
         return;
@@ -594,7 +636,6 @@ fs_cmd_lib(struct fs_context *c, char *tail)
         if ((upath = fs_unixify_path(c, upath)) == NULL) return;
         reply.new_handle =
             fs_open_handle(c->client, upath, O_RDONLY, false);
-        free(upath);
     }
     if (reply.new_handle == 0) {
         fs_errno(c);
@@ -627,7 +668,7 @@ fs_cmd_bye(struct fs_context *c, char *tail)
 }
 
 void
-fs_long_info(struct fs_context *c, char *string, FTSENT *f)
+fs_long_info(struct fs_context *c, char *string, struct fs_ent *f)
 {
     struct ec_fs_meta meta;
     struct tm mtm, btm;
@@ -635,19 +676,19 @@ fs_long_info(struct fs_context *c, char *string, FTSENT *f)
     unsigned long load, exec;
     char accstring[8], accstr2[8];
     mode_t currumask;
-    char *acornname;
+    char acornname[NAME_MAX + 1];
     const char *months = "janfebmaraprmayjunjulaugsepoctnovdec"; 
     int entries;
 
-    acornname = strdup(f->fts_name);
+    snprintf(acornname, sizeof(acornname), "%s", f->name);
     fs_acornify_name(acornname);
     if (!*acornname)
         strcpy(acornname, "$");
 
     fs_access_to_string(accstring,
-                fs_mode_to_access(f->fts_statp->st_mode));
+                fs_mode_to_access(f->statp->st_mode));
 
-    mtm = *localtime(&f->fts_statp->st_mtime);
+    mtm = *localtime(&f->statp->st_mtime);
     birthtime = fs_get_birthtime(f);
     btm = *localtime(&birthtime);
 
@@ -666,7 +707,7 @@ fs_long_info(struct fs_context *c, char *string, FTSENT *f)
          * between them, that would be a different matter,
          * of course.
          */
-        if (S_ISDIR(f->fts_statp->st_mode)) {
+        if (S_ISDIR(f->statp->st_mode)) {
             currumask = umask(777);
             umask(currumask);
             fs_access_to_string(accstr2,
@@ -676,35 +717,23 @@ fs_long_info(struct fs_context *c, char *string, FTSENT *f)
              * Count the entries in a subdirectory.
              */
             {
-                char *lastslash = strrchr(f->fts_accpath, '/');
-                char *fullpath;
-                char *path_argv[2];
-                FTS *ftsp2;
-                FTSENT *f2;
-
-                if (lastslash)
-                    lastslash++;
-                else
-                    lastslash = f->fts_accpath;
-                fullpath = malloc((lastslash - f->fts_accpath) +
-                          f->fts_namelen + 8 + 1);
-                sprintf(fullpath, "%.*s/%s",
-                    (int)(lastslash - f->fts_accpath),
-                    f->fts_accpath, f->fts_name);
-                path_argv[0] = fullpath;
-                path_argv[1] = NULL;
-
-                ftsp2 = fts_open(path_argv, FTS_LOGICAL, NULL);
-                f2 = fts_read(ftsp2);
-                f2 = fts_children(ftsp2, FTS_NAMEONLY);
-                for (entries = 0;
-                     f2 != NULL;
-                     f2 = f2->fts_link) {
-                    if (fs_hidden_name(f2->fts_name))
-                        continue;      /* hidden file */
-                    entries++;          /* count this one */
+                DIR *dp = NULL;
+                struct dirent *de;
+                int fd;
+
+                entries = 0;
+                fd = openat(f->dirfd, f->accpath,
+                    O_RDONLY | O_DIRECTORY);
+                if (fd != -1 && (dp = fdopendir(fd)) == NULL)
+                    close(fd);
+                if (dp != NULL) {
+                    while ((de = readdir(dp)) != NULL) {
+                        if (fs_hidden_name(de->d_name))
+                            continue;      /* hidden file */
+                        entries++;          /* count this one */
+                    }
+                    closedir(dp);
                 }
-                fts_close(ftsp2);
             }
 
             sprintf(string, "%-10.10s  Entries=%-4dDefault=%-6.6s  "
@@ -729,7 +758,7 @@ fs_long_info(struct fs_context *c, char *string, FTSENT *f)
                 "%-6.6s  %02d%.3s%02d %02d%.3s%02d %02d:%02d "
                 "000 (000)\r\x80",
                 acornname, load, exec,
-                (uintmax_t)f->fts_statp->st_size, accstring,
+                (uintmax_t)f->statp->st_size, accstring,
                 btm.tm_mday,
                 &months[ 3*btm.tm_mon],
                 btm.tm_year % 100,
@@ -753,14 +782,12 @@ fs_long_info(struct fs_context *c, char *string, FTSENT *f)
         sprintf(string, "%-10.10s %08lX %08lX   %06jX   "
             "%-6.6s     %02d:%02d:%02d %06x\r\x80",
             acornname, load, exec,
-            (uintmax_t)f->fts_statp->st_size, accstring,
+            (uintmax_t)f->statp->st_size, accstring,
             btm.tm_mday,
             btm.tm_mon,
             btm.tm_year % 100,
             fs_get_sin(f));
     }
-
-    free(acornname);
 }
 
 static void
@@ -768,9 +795,8 @@ fs_cmd_info(struct fs_context *c, char *tail)
 {
     char *upath;
     struct ec_fs_reply *reply;
-    char *path_argv[2];
-    FTS *ftsp;
-    FTSENT *f;
+    struct fs_ent ent;
+    int phase;
 
     if (c->client == NULL) {
         fs_err(c, EC_FS_E_WHOAREYOU);
@@ -780,26 +806,21 @@ fs_cmd_info(struct fs_context *c, char *tail)
     if (debug) printf(" -> info [%s]\n", upath);
     if ((upath = fs_unixify_path(c, upath)) == NULL) return;
 
-    path_argv[0] = upath;
-    path_argv[1] = NULL;
-    ftsp = fts_open(path_argv, FTS_LOGICAL, NULL);
-    f = fts_read(ftsp);
-    if (f->fts_info == FTS_ERR || f->fts_info == FTS_NS) {
+    if (fs_ent_stat(&ent, c->client, upath) == -1) {
         fs_errno(c);
-        fts_close(ftsp);
-        free(upath);
         return;
     }
 
-    reply = malloc(sizeof(*reply) + 100);
-    fs_long_info(c, reply->data, f);
+    if ((reply = fs_alloc(c, sizeof(*reply) + 100)) == NULL) {
+        fs_err(c, EC_FS_E_NOMEM);
+        return;
+    }
+    phase = FS_PHASE(FS_PHASE_ENCODE);
+    fs_long_info(c, reply->data, &ent);
+    FS_PHASE_END(phase);
     reply->command_code = EC_FS_CC_INFO;
     reply->return_code = EC_FS_RC_OK;
     fs_reply(c, reply, sizeof(*reply) + strlen(reply->data));
-
-    free(reply);
-    free(upath);
-    fts_close(ftsp);
 }
 
 /*
@@ -816,7 +837,10 @@ fs_cmd_save(struct fs_context *c, char *tail)
 
     path = fs_cli_getarg(&tail);
     if (!*path) goto syntax;
-    reply = malloc(sizeof(*reply) + strlen(path) + 1);
+    if ((reply = fs_alloc(c, sizeof(*reply) + strlen(path) + 1)) == NULL) {
+        fs_err(c, EC_FS_E_NOMEM);
+        return;
+    }
     p = fs_cli_getarg(&tail);
     if (!*p) goto syntax;
     start = strtoul(p, NULL, 16);
@@ -840,10 +864,8 @@ fs_cmd_save(struct fs_context *c, char *tail)
     reply->std_tx.command_code = EC_FS_CC_SAVE;
     reply->std_tx.return_code = EC_FS_RC_OK;
     fs_reply(c, &reply->std_tx, sizeof(*reply) + strlen(path) + 1);
-    free(reply);
     return;
 syntax:
-    free(reply);
     fs_error(c, 0xff, "Syntax");
 }
 
@@ -856,7 +878,10 @@ fs_cmd_load(struct fs_context *c, char *tail)
 
     path = fs_cli_getarg(&tail);
     if (!*path) goto syntax;
-    reply = malloc(sizeof(*reply) + strlen(path) + 1);
+    if ((reply = fs_alloc(c, sizeof(*reply) + strlen(path) + 1)) == NULL) {
+        fs_err(c, EC_FS_E_NOMEM);
+        return;
+    }
     p = fs_cli_getarg(&tail);
     if (*p) {
         addr = strtoul(p, NULL, 16);
@@ -877,10 +902,8 @@ fs_cmd_load(struct fs_context *c, char *tail)
     reply->std_tx.command_code = EC_FS_CC_LOAD;
     reply->std_tx.return_code = EC_FS_RC_OK;
     fs_reply(c, &reply->std_tx, sizeof(*reply) + strlen(path) + 1);
-    free(reply);
     return;
 syntax:
-    free(reply);
     fs_error(c, 0xff, "Syntax");
 }
 
@@ -935,7 +958,6 @@ fs_cmd_access(struct fs_context *c, char *tail)
     char *name, *access;
     unsigned char new_permissions;
     char *upath;
-    char *path_argv[2];
     struct ec_fs_reply reply;
     uint8_t loop_count;
     bool is_owner;
@@ -946,8 +968,7 @@ fs_cmd_access(struct fs_context *c, char *tail)
     bool is_public_read = false;
     bool found_slash = false;
     bool bad_access = false;
-    FTS *ftsp;
-    FTSENT *f;
+    struct fs_ent ent;
     
     name = fs_cli_getarg(&tail);
     // Thought there was a bug here with the way the command line
@@ -1086,7 +1107,7 @@ fs_cmd_access(struct fs_context *c, char *tail)
     }
 
     if ((upath = fs_unixify_path(c, name )) == NULL) return;
-    is_owner = fs_is_owner(c, fs_unixify_path(c, name));
+    is_owner = fs_is_owner(c, upath);
     if (is_owner == false)
     {
         // We do not have owner access in this directory
@@ -1118,20 +1139,17 @@ fs_cmd_access(struct fs_context *c, char *tail)
         }
 
 
-    upath = fs_unixify_path(c, name); /* This must be freed */
+    upath = fs_unixify_path(c, name);
     if (upath == NULL) return;
-    path_argv[0] = upath;
-    path_argv[1] = NULL;
-    ftsp = fts_open(path_argv, FTS_LOGICAL, NULL);
-    f = fts_read(ftsp);
-    if (f->fts_info == FTS_ERR || f->fts_info == FTS_NS) {
+    if (fs_ent_stat(&ent, c->client, upath) == -1) {
         fs_errno(c);
         goto out;
     }
 
-    if (!S_ISDIR(f->fts_statp->st_mode)) {
+    if (!S_ISDIR(ent.statp->st_mode)) {
         /* XXX Should chose usergroup sensibly */
-        if (chmod(f->fts_accpath, fs_access_to_mode(new_permissions, 0)) != 0) {
+        if (fchmodat(ent.dirfd, ent.accpath,
+            fs_access_to_mode(new_permissions, 0), 0) != 0) {
             fs_errno(c);
             goto out;
         }
@@ -1141,13 +1159,8 @@ fs_cmd_access(struct fs_context *c, char *tail)
     reply.command_code = EC_FS_CC_DONE; 
     reply.return_code = EC_FS_RC_OK;
     fs_reply(c, &reply, sizeof(reply));
-    fts_close(ftsp);
-    free(upath);
-    return;
 
 out:
-    fts_close(ftsp);
-    free(upath);
     return;
 }
 
@@ -1169,7 +1182,7 @@ fs_cmd_newuser(struct fs_context *c, char *tail)
       return;
     }
     // check that that user has privilege
-    priv = userfuncs->get_priv(c->client->login);
+    priv = c->client->priv;
     if (priv != EC_FS_PRIV_SYST)
     {
         fs_err(c, EC_FS_E_NOPRIV);
@@ -1212,6 +1225,9 @@ fs_cmd_newuser(struct fs_context *c, char *tail)
         fs_error(c, 0xff, "Its all gone pear shaped\n");
         return;
     }
+    /* Adding a user may have created directories */
+    fs_pathcache_invalidate(NULL);
+    fs_refresh_user(username);
     // convert username to directory structure 
     // leading ./ then name changing the following . to / 
 
@@ -1239,7 +1255,7 @@ fs_cmd_deluser(struct fs_context *c, char *tail)
       return;
     }
     // check that that user has privilege
-    priv = userfuncs->get_priv(c->client->login);
+    priv = c->client->priv;
     if (priv != EC_FS_PRIV_SYST)
     {
         fs_err(c, EC_FS_E_NOPRIV);
@@ -1259,6 +1275,7 @@ fs_cmd_deluser(struct fs_context *c, char *tail)
     if (user_exists == true)
     {
         result = userfuncs->del_user(username);
+        fs_refresh_user(username);
     }
 
     if (result == -1)
@@ -1272,3 +1289,43 @@ fs_cmd_deluser(struct fs_context *c, char *tail)
     fs_reply(c, &reply, sizeof(reply));
     return;
 }
+
+/*
+ * Summarise the statistics kept by fs_stats.c.  The reply is kept
+ * short, since it goes in a single packet to a client expecting
+ * something the size of *INFO's.
+ */
+static void
+fs_cmd_stats(struct fs_context *c, char *tail)
+{
+    struct ec_fs_reply *reply;
+    char *what;
+    size_t len;
+
+    if (c->client == NULL) {
+        fs_err(c, EC_FS_E_WHOAREYOU);
+        return;
+    }
+    if (c->client->priv != EC_FS_PRIV_SYST) {
+        fs_err(c, EC_FS_E_NOPRIV);
+        return;
+    }
+    what = fs_cli_getarg(&tail);
+    if (debug) printf(" -> stats [%s]\n", what);
+    if (*what && strcasecmp(what, "CLI") != 0 &&
+        strcasecmp(what, "COSTS") != 0) {
+        fs_err(c, EC_FS_E_BADARGS);
+        return;
+    }
+    if ((reply = fs_alloc(c, sizeof(*reply) + FS_STATS_REPLY)) == NULL) {
+        fs_err(c, EC_FS_E_NOMEM);
+        return;
+    }
+    if (!strcasecmp(what, "COSTS"))
+        len = fs_cost_report(reply->data, FS_STATS_REPLY);
+    else
+        len = fs_stats_report(reply->data, FS_STATS_REPLY, *what != '\0');
+    reply->command_code = EC_FS_CC_INFO;
+    reply->return_code = EC_FS_RC_OK;
+    fs_reply(c, reply, sizeof(*reply) + len);
+}
@@ -0,0 +1,101 @@
+/*-
+ * Copyright (c) 2010 Simon Tatham
+ * Copyright (c) 2010 Ben Harris
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/*
+ * This is part of aund, an implementation of Acorn Universal
+ * Networking for Unix.
+ */
+/*
+ * fs_cost.h - count the system calls and allocations a request makes.
+ *
+ * Include this after everything else in a file whose calls should be
+ * counted.  Each call below then bumps the matching counter in
+ * fs_cost_cur before going ahead as usual, and fs_stats_end() charges
+ * the counts to the request's function.  When fs_cost_on is clear,
+ * that's one test per call.
+ *
+ * The allocators are replaced by functions in fs_stats.c so that
+ * their arguments are only evaluated once.  Extended attribute calls
+ * are counted by hand in meta_xattr.c, which has its own macros for
+ * them.
+ */
+
+#ifndef _FS_COST_H
+#define _FS_COST_H
+
+#include "fileserver.h"
+
+#define FS_COST_CALL(k, call)	(FS_COST(k), FS_COST(FS_COST_SYSCALLS), call)
+
+#define stat(p, sb)		FS_COST_CALL(FS_COST_STAT, stat(p, sb))
+#define lstat(p, sb)		FS_COST_CALL(FS_COST_STAT, lstat(p, sb))
+#define fstat(fd, sb)		FS_COST_CALL(FS_COST_STAT, fstat(fd, sb))
+#define fstatat(fd, p, sb, fl)	FS_COST_CALL(FS_COST_STAT, fstatat(fd, p, sb, fl))
+#define statvfs(p, sb)		FS_COST_CALL(FS_COST_STAT, statvfs(p, sb))
+
+#define open(...)		FS_COST_CALL(FS_COST_OPEN, open(__VA_ARGS__))
+#define openat(...)		FS_COST_CALL(FS_COST_OPEN, openat(__VA_ARGS__))
+#define fdopendir(fd)		FS_COST_CALL(FS_COST_OPEN, fdopendir(fd))
+#define fts_open(a, o, cmp)	FS_COST_CALL(FS_COST_OPEN, fts_open(a, o, cmp))
+#define close(fd)		FS_COST_CALL(FS_COST_CLOSE, close(fd))
+#define closedir(d)		FS_COST_CALL(FS_COST_CLOSE, closedir(d))
+#define fts_close(f)		FS_COST_CALL(FS_COST_CLOSE, fts_close(f))
+
+#define readdir(d)		FS_COST_CALL(FS_COST_READDIR, readdir(d))
+#define fts_read(f)		FS_COST_CALL(FS_COST_READDIR, fts_read(f))
+#define fts_children(f, o)	FS_COST_CALL(FS_COST_READDIR, fts_children(f, o))
+#define readlinkat(fd, p, b, n)	FS_COST_CALL(FS_COST_READLINK, \
+				    readlinkat(fd, p, b, n))
+
+#define read(fd, b, n)		FS_COST_CALL(FS_COST_READ, \
+				    fs_cost_io(read(fd, b, n)))
+#define write(fd, b, n)		FS_COST_CALL(FS_COST_WRITE, \
+				    fs_cost_io(write(fd, b, n)))
+#define lseek(fd, o, w)		FS_COST_CALL(FS_COST_SEEK, lseek(fd, o, w))
+
+#define unlink(p)		FS_COST_CALL(FS_COST_CHANGE, unlink(p))
+#define unlinkat(fd, p, fl)	FS_COST_CALL(FS_COST_CHANGE, unlinkat(fd, p, fl))
+#define rename(f, t)		FS_COST_CALL(FS_COST_CHANGE, rename(f, t))
+#define renameat(fd, f, td, t)	FS_COST_CALL(FS_COST_CHANGE, \
+				    renameat(fd, f, td, t))
+#define mkdirat(fd, p, m)	FS_COST_CALL(FS_COST_CHANGE, mkdirat(fd, p, m))
+#define symlinkat(t, fd, p)	FS_COST_CALL(FS_COST_CHANGE, symlinkat(t, fd, p))
+#define fchmodat(fd, p, m, fl)	FS_COST_CALL(FS_COST_CHANGE, \
+				    fchmodat(fd, p, m, fl))
+#define ftruncate(fd, len)	FS_COST_CALL(FS_COST_CHANGE, ftruncate(fd, len))
+#define fsync(fd)		FS_COST_CALL(FS_COST_CHANGE, fsync(fd))
+
+#undef malloc
+#undef calloc
+#undef realloc
+#undef strdup
+#define malloc(n)		fs_cost_malloc(n)
+#define calloc(n, size)		fs_cost_calloc(n, size)
+#define realloc(p, n)		fs_cost_realloc(p, n)
+#define strdup(s)		fs_cost_strdup(s)
+
+#endif
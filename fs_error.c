@@ -154,7 +154,7 @@ fs_error(struct fs_context *c, uint8_t err, const char *report)
 {
     struct ec_fs_reply *reply;
 
-    if ((reply = malloc(sizeof(*reply) + strlen(report)+2)) == NULL)
+    if ((reply = fs_alloc(c, sizeof(*reply) + strlen(report)+2)) == NULL)
         exit(2);
     reply->command_code = EC_FS_CC_DONE;
     reply->return_code = err;
@@ -162,5 +162,4 @@ fs_error(struct fs_context *c, uint8_t err, const char *report)
     *strchr(reply->data, '\0') = 13;
     if (debug) printf("fs_error: 0x%x/%s\n", err, report);
     fs_reply(c, reply, sizeof(*reply) + strlen(report) + 1);
-    free(reply);
 }
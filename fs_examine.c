@@ -44,16 +44,10 @@
 #include "extern.h"
 #include "fileserver.h"
 #include "fs_errors.h"
+#include "fs_internal.h"
+#include "fs_cost.h"
 
-static int fs_examine_read(struct fs_context *, const char *, int);
-
-static int fs_examine_all(FTSENT *, struct ec_fs_reply_examine **, size_t *);
-static int fs_examine_all_32(FTSENT *, struct ec_fs_reply_examine_32 **, size_t *);
-static int fs_examine_longtxt(struct fs_context *c, FTSENT *,
-    struct ec_fs_reply_examine **, size_t *);
-static int fs_examine_name(FTSENT *, struct ec_fs_reply_examine **, size_t *);
-static int fs_examine_shorttxt(FTSENT *, struct ec_fs_reply_examine **,
-    size_t *);
+unsigned long fs_dircache_hits, fs_dircache_misses;
 
 void
 fs_examine(struct fs_context *c)
@@ -66,7 +60,7 @@ fs_examine(struct fs_context *c)
     // Warning: Don't access reply->data in EC_FS_FUNC_EXAMINE_32 mode - it
     // is at a different offset!
     size_t reply_size;
-    int i, rc;
+    int i, rc, phase;
 
     if (c->req->function == EC_FS_FUNC_EXAMINE_32)
     {
@@ -100,16 +94,17 @@ fs_examine(struct fs_context *c)
     reply_size = sizeof(*reply);
     if (request->arg == EC_FS_EXAMINE_SHORTTXT ||
         request->arg == EC_FS_EXAMINE_LONGTXT)
-        reply = malloc(reply_size+1);
+        reply = fs_alloc(c, reply_size+1);
     else if (c->req->function == EC_FS_FUNC_EXAMINE_32) {
         // 1 byte larger than EC_FS_FUNC_EXAMINE
         reply_size += 1;
-        reply = malloc(reply_size);
+        reply = fs_alloc(c, reply_size);
     } else
-        reply = malloc(reply_size);
-    if (fs_examine_read(c, upath, request->start) == -1 || reply == NULL) {
-        free(reply);
-        free(upath);
+        reply = fs_alloc(c, reply_size);
+    phase = FS_PHASE(FS_PHASE_FS);
+    rc = fs_examine_read(c, upath, request->start);
+    FS_PHASE_END(phase);
+    if (rc == -1 || reply == NULL) {
         if (errno)
             fs_errno(c);
         else
@@ -124,6 +119,7 @@ fs_examine(struct fs_context *c)
             continue;      /* hidden file */
         i++;               /* count this one */
     }
+    phase = FS_PHASE(FS_PHASE_ENCODE);
     for (i = 0;
          i < request->nentries && ent != NULL;
          ent = ent->fts_link) {
@@ -137,18 +133,19 @@ fs_examine(struct fs_context *c)
         switch (request->arg) {
         case EC_FS_EXAMINE_ALL:
             if (c->req->function == EC_FS_FUNC_EXAMINE)
-                rc = fs_examine_all(ent, &reply, &reply_size);
+                rc = fs_examine_all(c, ent, &reply, &reply_size);
             else if (c->req->function == EC_FS_FUNC_EXAMINE_32)
-                rc = fs_examine_all_32(ent, (struct ec_fs_reply_examine_32 **)&reply, &reply_size);
+                rc = fs_examine_all_32(c, ent,
+                    (struct ec_fs_reply_examine_32 **)&reply, &reply_size);
             break;
         case EC_FS_EXAMINE_LONGTXT:
             rc = fs_examine_longtxt(c, ent, &reply, &reply_size);
             break;
         case EC_FS_EXAMINE_NAME:
-            rc = fs_examine_name(ent, &reply, &reply_size);
+            rc = fs_examine_name(c, ent, &reply, &reply_size);
             break;
         case EC_FS_EXAMINE_SHORTTXT:
-            rc = fs_examine_shorttxt(ent, &reply, &reply_size);
+            rc = fs_examine_shorttxt(c, ent, &reply, &reply_size);
             break;
         default:
             rc = -1; /* Cheer up gcc */
@@ -157,6 +154,7 @@ fs_examine(struct fs_context *c)
             goto bye;
     }
 bye:
+    FS_PHASE_END(phase);
     reply->nentries = i;
     reply->undef0 = 0; /* What is this for? */
     reply->std_tx.command_code = EC_FS_CC_DONE;
@@ -178,8 +176,6 @@ bye:
         free(c->client->dir_cache.path);
         c->client->dir_cache.path = NULL;
     }
-    free(reply);
-    free(upath);
 }
 
 static int
@@ -189,7 +185,7 @@ fs_filename_compare(const FTSENT **a, const FTSENT **b)
     return strcasecmp((*a)->fts_name, (*b)->fts_name);
 }
 
-static int
+int
 fs_examine_read(struct fs_context *c, const char *upath, int start)
 {
     char *path_argv[2];
@@ -202,8 +198,10 @@ fs_examine_read(struct fs_context *c, const char *upath, int start)
         /* XXX this should see how recent the cache is */
         /* XXX Won't spot if the client skipped a bit of a listing */
         if (debug) printf("cache HIT!\n");
+        fs_dircache_hits++;
         return 0;
     }
+    fs_dircache_misses++;
     if (debug)
         printf("cache miss.  wanted %d; found %d.\n", start, dc->start);
     if (dc->ftsp)
@@ -247,28 +245,30 @@ fs_examine_read(struct fs_context *c, const char *upath, int start)
     return 0;
 }
 
-static int
-fs_examine_all(FTSENT *ent, struct ec_fs_reply_examine **replyp,
-    size_t *reply_sizep)
+int
+fs_examine_all(struct fs_context *c, FTSENT *ent,
+    struct ec_fs_reply_examine **replyp, size_t *reply_sizep)
 {
     struct ec_fs_exall *exall;
     void *new_reply;
+    struct fs_ent e;
 
-    if ((new_reply = realloc(*replyp, *reply_sizep + sizeof(*exall)))
-        != NULL)
+    if ((new_reply = fs_realloc(c, *replyp, *reply_sizep,
+        *reply_sizep + sizeof(*exall))) != NULL)
         *replyp = new_reply;
     if (new_reply == NULL) {
         errno = ENOMEM;
         goto burn;
     }
     exall = (struct ec_fs_exall *)(((void *)*replyp) + *reply_sizep);
-    fs_get_meta(ent, &(exall->meta)); /* This needs the name unmodified */
+    fs_ent_from_fts(&e, ent);
+    fs_get_meta(&e, &(exall->meta)); /* This needs the name unmodified */
     fs_acornify_name(ent->fts_name);
     strncpy(exall->name, ent->fts_name, sizeof(exall->name));
     strpad(exall->name, ' ', sizeof(exall->name));
     exall->access = fs_mode_to_access(ent->fts_statp->st_mode);
-    fs_write_date(&(exall->date), fs_get_birthtime(ent));
-    fs_write_val(exall->sin, fs_get_sin(ent), sizeof(exall->sin));
+    fs_write_date(&(exall->date), fs_get_birthtime(&e));
+    fs_write_val(exall->sin, fs_get_sin(&e), sizeof(exall->sin));
     fs_write_val(exall->size, ent->fts_statp->st_size,
              sizeof(exall->size));
     *reply_sizep += sizeof(*exall);
@@ -277,21 +277,24 @@ burn:
     return -1;
 }
 
-static int
-fs_examine_all_32(FTSENT *ent, struct ec_fs_reply_examine_32 **replyp, size_t *reply_sizep)
+int
+fs_examine_all_32(struct fs_context *c, FTSENT *ent,
+    struct ec_fs_reply_examine_32 **replyp, size_t *reply_sizep)
 {
     struct ec_fs_exall_32 *exall;
     void *new_reply;
+    struct fs_ent e;
 
-    if ((new_reply = realloc(*replyp, *reply_sizep + sizeof(*exall)))
-        != NULL)
+    if ((new_reply = fs_realloc(c, *replyp, *reply_sizep,
+        *reply_sizep + sizeof(*exall))) != NULL)
         *replyp = new_reply;
     if (new_reply == NULL) {
         errno = ENOMEM;
         goto burn;
     }
     exall = (struct ec_fs_exall_32 *)(((void *)*replyp) + *reply_sizep);
-    fs_get_meta(ent, &(exall->meta)); /* This needs the name unmodified */
+    fs_ent_from_fts(&e, ent);
+    fs_get_meta(&e, &(exall->meta)); /* This needs the name unmodified */
     fs_acornify_name(ent->fts_name);
     strncpy(exall->name, ent->fts_name, sizeof(exall->name));
     strpad(exall->name, ' ', sizeof(exall->name));
@@ -305,15 +308,15 @@ burn:
     return -1;
 }
 
-static int
-fs_examine_name(FTSENT *ent, struct ec_fs_reply_examine **replyp,
-    size_t *reply_sizep)
+int
+fs_examine_name(struct fs_context *c, FTSENT *ent,
+    struct ec_fs_reply_examine **replyp, size_t *reply_sizep)
 {
     struct ec_fs_exname *exname;
     void *new_reply;
 
-    if ((new_reply = realloc(*replyp, *reply_sizep + sizeof(*exname))) !=
-        NULL)
+    if ((new_reply = fs_realloc(c, *replyp, *reply_sizep,
+        *reply_sizep + sizeof(*exname))) != NULL)
         *replyp = new_reply;
     if (new_reply == NULL) {
         errno = ENOMEM;
@@ -330,14 +333,15 @@ burn:
     return -1;
 }
 
-static int
-fs_examine_shorttxt(FTSENT *ent, struct ec_fs_reply_examine **replyp,
-    size_t *reply_sizep)
+int
+fs_examine_shorttxt(struct fs_context *c, FTSENT *ent,
+    struct ec_fs_reply_examine **replyp, size_t *reply_sizep)
 {
     void *new_reply;
     char accstring[8];
 
-    if ((new_reply = realloc(*replyp, *reply_sizep + 10+1+7+2)) != NULL)
+    if ((new_reply = fs_realloc(c, *replyp, *reply_sizep,
+        *reply_sizep + 10+1+7+2)) != NULL)
         *replyp = new_reply;
     if (new_reply == NULL) {
         errno = ENOMEM;
@@ -354,21 +358,24 @@ burn:
     return -1;
 }
 
-static int
+int
 fs_examine_longtxt(struct fs_context *c, FTSENT *ent,
     struct ec_fs_reply_examine **replyp, size_t *reply_sizep)
 {
     void *new_reply;
     char *string;
+    struct fs_ent e;
 
-    if ((new_reply = realloc(*replyp, *reply_sizep + 100)) != NULL)
+    if ((new_reply = fs_realloc(c, *replyp, *reply_sizep,
+        *reply_sizep + 100)) != NULL)
         *replyp = new_reply;
     if (new_reply == NULL) {
         errno = ENOMEM;
         goto burn;
     }
     string = (char*)(((void *)*replyp) + *reply_sizep);
-    fs_long_info(c, string, ent);
+    fs_ent_from_fts(&e, ent);
+    fs_long_info(c, string, &e);
     string[strcspn(string, "\r\x80")] = '\0';
     *reply_sizep += 1 + strlen(string); /* one byte spare to terminate */
     return 0;
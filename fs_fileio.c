@@ -33,7 +33,6 @@
  * fs_fileio.c - File server file I/O calls
  */
 
-#include <fts.h>
 #include <sys/types.h>
 #include <sys/file.h>
 #include <sys/stat.h>
@@ -53,12 +52,14 @@
 #include "fs_errors.h"
 #include "extern.h"
 #include "fileserver.h"
+#include "fs_cost.h"
 
 #define OUR_DATA_PORT 0x97
 
 static ssize_t fs_data_send(struct fs_context *, int, size_t, uint8_t);
 static ssize_t fs_data_recv(struct fs_context *, int, size_t, int);
 static int fs_close1(struct fs_context *c, int h);
+static int fs_check_file_handle(struct fs_context *, int);
 
 /*
  * Acorn OSes implement mandatory locking in OSFIND, delegating that
@@ -85,16 +86,13 @@ fs_open(struct fs_context *c)
     struct ec_fs_reply_open reply;
     struct ec_fs_reply_open_32 reply_32;
     struct ec_fs_req_open *request;
-    struct stat st;
     char *upath;
-    int openopt, fd;
+    int openopt;
     uint8_t h;
     bool is_owner  = false;
     bool did_create = false;
     bool found_file = true;  // Assume the file exists, but check later
-    FTS *ftsp;
-    FTSENT *f;
-    char *path_argv[2];
+    struct fs_ent ent;
 
     if (c->client == NULL) {
         fs_err(c, EC_FS_E_WHOAREYOU);
@@ -110,23 +108,15 @@ fs_open(struct fs_context *c)
 
     is_owner = fs_is_owner(c, upath);
 
-    if ((fd = open(upath, O_RDONLY)) == -1) {
-        // we cannot open the file for read only so 
+    if (fs_ent_stat(&ent, c->client, upath) == -1) {
+        // we cannot get any information about the file so
         // it probably does not exist
         found_file = false;
-        }
-
-    if (fstat(fd, &st) == -1) {
-        // As a check I will try to see if I can get any information
-        // about the file as a secondary check
-        found_file = false;
     }
-    close(fd);
 
     if ((found_file == false) && (request->must_exist))
     {
         fs_err(c, EC_FS_E_CHANNEL);
-        free(upath);
         return;
     }
 
@@ -139,7 +129,6 @@ fs_open(struct fs_context *c)
       }
       if (is_owner == false) {
         fs_err(c, EC_FS_E_NOACCESS);
-        free(upath);
         return;
       }
     }
@@ -162,37 +151,38 @@ fs_open(struct fs_context *c)
         else
 #endif
             fs_errno(c);
-        free(upath);
 
         return;
         }
-
-    path_argv[0] = upath;
-    path_argv[1] = NULL;
+    if (did_create)
+        fs_pathcache_invalidate(upath);
 
     // Acorn Permissions on file handle 
     // moved to fs_handle where the handle
     // is created.
 
     c->client->handles[h]->read_only = request->read_only;
-    ftsp = fts_open(path_argv, FTS_LOGICAL, NULL);
-    f = fts_read(ftsp);
-    if (f->fts_statp->st_mode & S_IWUSR) {
+    if (fs_ent_fstat(&ent, c->client, upath,
+            c->client->handles[h]->fd) == -1) {
+        fs_errno(c);
+        fs_close_handle(c->client, h);
+        return;
+    }
+    if (ent.statp->st_mode & S_IWUSR) {
         c->client->handles[h]->can_write = true;
     }
-    if (f->fts_statp->st_mode & S_IWOTH) {
+    if (ent.statp->st_mode & S_IWOTH) {
         c->client->handles[h]->can_write = true;
     }
-    if (f->fts_statp->st_mode & S_IRUSR) {
+    if (ent.statp->st_mode & S_IRUSR) {
         c->client->handles[h]->can_read = true;
     }
-    if (f->fts_statp->st_mode & S_IROTH) {
+    if (ent.statp->st_mode & S_IROTH) {
         c->client->handles[h]->can_read = true;
     }
-    if (f->fts_statp->st_mode & S_IXUSR) {
+    if (ent.statp->st_mode & S_IXUSR) {
         c->client->handles[h]->is_locked = true;
     }
-    fts_close(ftsp);
 
     // OPENIN sends:   open file for read only
     // 7: non-zero, file must exist (NFS 3.60 sends &80)
@@ -210,7 +200,6 @@ fs_open(struct fs_context *c)
       c->client->handles[h]->is_owner = is_owner;
       c->client->handles[h]->did_create = did_create;
     }
-    free(upath);
 #ifdef HAVE_O_xxLOCK
     if ((openopt = fcntl(c->client->handles[h]->fd, F_GETFL)) == -1 ||
             fcntl(c->client->handles[h]->fd,
@@ -238,12 +227,12 @@ fs_open(struct fs_context *c)
     } else {
         reply_32.std_tx.command_code = EC_FS_CC_DONE;
         reply_32.std_tx.return_code = EC_FS_RC_OK;
-        reply_32.type = fs_mode_to_type(st.st_mode);
-        reply_32.access = fs_mode_to_access(st.st_mode);
+        reply_32.type = fs_mode_to_type(ent.sb.st_mode);
+        reply_32.access = fs_mode_to_access(ent.sb.st_mode);
         reply_32.unknown = 0xff;
         reply_32.handle = h;
-        fs_write_val(reply_32.size, st.st_size, sizeof(reply_32.size));
-        fs_write_val(reply_32.size1, st.st_size, sizeof(reply_32.size1));
+        fs_write_val(reply_32.size, ent.sb.st_size, sizeof(reply_32.size));
+        fs_write_val(reply_32.size1, ent.sb.st_size, sizeof(reply_32.size1));
         fs_reply(c, &(reply_32.std_tx), sizeof(reply_32));
     }
 }
@@ -297,7 +286,6 @@ fs_close1(struct fs_context *c, int h)
             if (errno != EINVAL) /* fundamentally unfsyncable */
                 error = errno;
         }
-        close(hp->fd);
         fs_close_handle(c->client, h);
     }
     return error;
@@ -336,7 +324,9 @@ fs_get_args(struct fs_context *c)
         if (debug) printf("get args 32 [%d, %d]", handle, arg);
         is_32 = true;
     }
-    if ((h = fs_check_handle(c->client, handle)) != 0) {
+    if ((h = fs_check_file_handle(c, handle)) == -1)
+        return;
+    if (h != 0) {
         fd = c->client->handles[h]->fd;
         switch (arg) {
         case EC_FS_ARG_PTR:
@@ -438,7 +428,9 @@ fs_set_args(struct fs_context *c)
             printf("set args 32 [%d, %d := %ju]\n",
                 request_32->handle, request_32->arg, (uintmax_t)val);
     }
-    if ((h = fs_check_handle(c->client, handle)) != 0) {
+    if ((h = fs_check_file_handle(c, handle)) == -1)
+        return;
+    if (h != 0) {
         fd = c->client->handles[h]->fd;
         switch (arg) {
         case EC_FS_ARG_PTR:
@@ -470,6 +462,24 @@ fs_set_args(struct fs_context *c)
     }
 }
 
+/*
+ * Check a handle for the byte I/O calls, which only make sense on
+ * files.  Returns the handle, 0 if it's not valid at all, or -1 if it's
+ * a directory, in which case the error has already been sent.
+ */
+static int
+fs_check_file_handle(struct fs_context *c, int h)
+{
+
+    if ((h = fs_check_handle(c->client, h)) != 0 &&
+        c->client->handles[h]->type != FS_HANDLE_FILE) {
+        errno = EISDIR;
+        fs_errno(c);
+        return -1;
+    }
+    return h;
+}
+
 static int
 fs_randomio_common(struct fs_context *c, int h)
 {
@@ -477,7 +487,8 @@ fs_randomio_common(struct fs_context *c, int h)
     int fd;
 
     fd = c->client->handles[h]->fd;
-    printf(" [[->%c %0x]]", (c->req->aun.flag & 1) ? '/' : '\\', (c->req->aun.flag));
+    if (debug) printf(" [[->%c %0x]]",
+        (c->req->aun.flag & 1) ? '/' : '\\', (c->req->aun.flag));
     if (c->client->handles[h]->sequence != (c->req->aun.flag & 1)) {
         /*
          * Different sequence number from last request.  Save
@@ -492,6 +503,7 @@ fs_randomio_common(struct fs_context *c, int h)
     } else {
         /* This is a repeated request. */
         if (debug) printf("<repeat>");
+        FS_TRACE(FS_TRACE_IO, FS_TRACE_EV_REPEAT, h, 0, 0);
         off = c->client->handles[h]->oldoffset;
         if (lseek(fd, off, SEEK_SET) == -1) {
             fs_errno(c);
@@ -516,7 +528,9 @@ fs_putbyte(struct fs_context *c)
     if (debug)
         printf("putbyte [%d, 0x%02x]\n",
             request->handle, request->byte);
-    if ((h = fs_check_handle(c->client, request->handle)) != 0) {
+    if ((h = fs_check_file_handle(c, request->handle)) == -1)
+        return;
+    if (h != 0) {
         if (fs_randomio_common(c, request->handle)) return;
         if (c->client->handles[h]->read_only)
         {
@@ -538,9 +552,11 @@ fs_putbyte(struct fs_context *c)
         }
         fd = c->client->handles[h]->fd;
         if (write(fd, &request->byte, 1) < 0) {
+            FS_TRACE(FS_TRACE_IO, FS_TRACE_EV_WRITE, h, 0, 1);
             fs_errno(c);
             return;
         }
+        FS_TRACE(FS_TRACE_IO, FS_TRACE_EV_WRITE, h, 1, 0);
         reply.command_code = EC_FS_CC_DONE;
         reply.return_code = EC_FS_RC_OK;
         fs_reply(c, &reply, sizeof(reply));
@@ -570,7 +586,9 @@ fs_get_eof(struct fs_context *c)
     }
     request = (struct ec_fs_req_get_eof *)(c->req);
     if (debug) printf("get eof [%d]\n", request->handle);
-    if ((h = fs_check_handle(c->client, request->handle)) != 0) {
+    if ((h = fs_check_file_handle(c, request->handle)) == -1)
+        return;
+    if (h != 0) {
         fd = c->client->handles[h]->fd;
         reply.status = at_eof(fd) ? 0xFF : 0;
         reply.std_tx.command_code = EC_FS_CC_DONE;
@@ -620,7 +638,9 @@ fs_getbytes(struct fs_context *c)
                 request_32->handle, size,
                 (uintmax_t)off);
     }
-    if ((h = fs_check_handle(c->client, handle)) != 0) {
+    if ((h = fs_check_file_handle(c, handle)) == -1)
+        return;
+    if (h != 0) {
         if (fs_randomio_common(c, handle)) return;
         if (c->client->handles[h]->can_read == false)
         {
@@ -639,6 +659,8 @@ fs_getbytes(struct fs_context *c)
         reply1.return_code = EC_FS_RC_OK;
         fs_reply(c, &reply1, sizeof(reply1));
         got = fs_data_send(c, fd, size, reply_port);
+        FS_TRACE(FS_TRACE_IO, FS_TRACE_EV_READ, h,
+            got == -1 ? 0 : got, got == -1);
         if (got == -1) {
             /* Error */
             fs_errno(c);
@@ -685,7 +707,9 @@ fs_getbyte(struct fs_context *c)
     }
     request = (struct ec_fs_req_getbyte *)(c->req);
     if (debug) printf("getbyte [%d]\n", request->handle);
-    if ((h = fs_check_handle(c->client, request->handle)) != 0) {
+    if ((h = fs_check_file_handle(c, request->handle)) == -1)
+        return;
+    if (h != 0) {
         if (fs_randomio_common(c, request->handle)) return;
         if (c->client->handles[h]->can_read == false)
         {
@@ -696,9 +720,11 @@ fs_getbyte(struct fs_context *c)
         }
         fd = c->client->handles[h]->fd;
         if ((ret = read(fd, &reply.byte, 1)) < 0) {
+            FS_TRACE(FS_TRACE_IO, FS_TRACE_EV_READ, h, 0, 1);
             fs_errno(c);
             return;
         }
+        FS_TRACE(FS_TRACE_IO, FS_TRACE_EV_READ, h, ret, 0);
         reply.std_tx.command_code = EC_FS_CC_DONE;
         reply.std_tx.return_code = EC_FS_RC_OK;
         if (ret == 0) {
@@ -760,7 +786,9 @@ fs_putbytes(struct fs_context *c)
         handle = request_32->handle;
         ackport = request_32->ack_port;
     }
-    if ((h = fs_check_handle(c->client, handle)) != 0) {
+    if ((h = fs_check_file_handle(c, handle)) == -1)
+        return;
+    if (h != 0) {
         if (fs_randomio_common(c, handle)) return;
         if (c->client->handles[h]->read_only)
         {
@@ -802,6 +830,8 @@ fs_putbytes(struct fs_context *c)
                 sizeof(reply1.block_size));
         fs_reply(c, &(reply1.std_tx), sizeof(reply1));
         got = fs_data_recv(c, fd, size, ackport);
+        FS_TRACE(FS_TRACE_IO, FS_TRACE_EV_WRITE, h,
+            got == -1 ? 0 : got, got == -1);
         if (got == -1) {
             /* Error */
             if (debug) printf("got error\n");
@@ -835,11 +865,11 @@ fs_load(struct fs_context *c)
     struct ec_fs_reply_load1_32 reply1_32;
     struct ec_fs_reply_load2 reply2;
     char *upath = NULL;
-    char *upathlib, *path_argv[3];
-    int fd, as_command;
+    char *upathlib, *found;
+    const char *rel;
+    int fd, dirfd, as_command;
     size_t got;
-    FTS *ftsp;
-    FTSENT *f;
+    struct fs_ent ent;
     bool is_owner = false;
     bool can_read = false;
     bool use_reply_32 = false;
@@ -884,46 +914,39 @@ fs_load(struct fs_context *c)
     if (upath == NULL) return;
     is_owner = fs_is_owner(c, upath);
 
-    path_argv[0] = upath;
-    path_argv[1] = NULL;
     if (as_command) {
         c->req->csd = c->req->lib;
         upathlib = fs_unixify_path(c, ro_path);
-        if (upathlib == NULL) {
-            free(upath);
+        if (upathlib == NULL)
             return;
-        }
-        path_argv[1] = upathlib;
-        path_argv[2] = NULL;
-    }
-    ftsp = fts_open(path_argv, FTS_LOGICAL, NULL);
-    f = fts_read(ftsp);
-    if (as_command && f->fts_info == FTS_NS && f->fts_errno == ENOENT)
-        f = fts_read(ftsp);
-    if (f->fts_info == FTS_ERR || f->fts_info == FTS_NS) {
+    }
+    found = upath;
+    rel = fs_path_at(c->client, found, &dirfd);
+    fd = openat(dirfd, rel, O_RDONLY);
+    if (fd == -1 && errno == ENOENT && as_command) {
+        found = upathlib;
+        rel = fs_path_at(c->client, found, &dirfd);
+        fd = openat(dirfd, rel, O_RDONLY);
+    }
+    if (fd == -1 || fs_ent_fstat(&ent, c->client, found, fd) == -1) {
         fs_errno(c);
         goto out;
     }
-    if (S_ISDIR(f->fts_statp->st_mode)) {
+    if (S_ISDIR(ent.statp->st_mode)) {
         fs_err(c, EC_FS_E_ISDIR);
         goto out;
     }
 
-    if ((fd = open(f->fts_accpath, O_RDONLY)) == -1) {
-        fs_errno(c);
-        goto out;
-    }
-
     if (is_owner == true) 
     {
-        if (f->fts_statp->st_mode & S_IRUSR)
+        if (ent.statp->st_mode & S_IRUSR)
         {
             can_read = true;
         } 
     }
     if (is_owner == false)
     {
-        if (f->fts_statp->st_mode & S_IROTH) 
+        if (ent.statp->st_mode & S_IROTH) 
         {
             can_read = true;
         }
@@ -935,38 +958,35 @@ fs_load(struct fs_context *c)
     }
 
     if (use_reply_32) {
-        fs_get_meta(f, &reply1_32.meta);
-        fs_write_val(reply1_32.size, f->fts_statp->st_size, sizeof(reply1_32.size));
-        reply1_32.access = fs_mode_to_access(f->fts_statp->st_mode);
-        fs_write_date(&(reply1_32.date), fs_get_birthtime(f));
+        fs_get_meta(&ent, &reply1_32.meta);
+        fs_write_val(reply1_32.size, ent.statp->st_size, sizeof(reply1_32.size));
+        reply1_32.access = fs_mode_to_access(ent.statp->st_mode);
+        fs_write_date(&(reply1_32.date), fs_get_birthtime(&ent));
         reply1_32.std_tx.command_code = EC_FS_CC_DONE;
         reply1_32.std_tx.return_code = EC_FS_RC_OK;
         fs_reply(c, &(reply1_32.std_tx), sizeof(reply1_32));
         reply2.std_tx.command_code = EC_FS_CC_DONE;
         reply2.std_tx.return_code = EC_FS_RC_OK;
     } else {
-        fs_get_meta(f, &(reply1.meta));
-        fs_write_val(reply1.size, f->fts_statp->st_size, sizeof(reply1.size));
-        reply1.access = fs_mode_to_access(f->fts_statp->st_mode);
-        fs_write_date(&(reply1.date), fs_get_birthtime(f));
+        fs_get_meta(&ent, &(reply1.meta));
+        fs_write_val(reply1.size, ent.statp->st_size, sizeof(reply1.size));
+        reply1.access = fs_mode_to_access(ent.statp->st_mode);
+        fs_write_date(&(reply1.date), fs_get_birthtime(&ent));
         reply1.std_tx.command_code = EC_FS_CC_DONE;
         reply1.std_tx.return_code = EC_FS_RC_OK;
         fs_reply(c, &(reply1.std_tx), sizeof(reply1));
         reply2.std_tx.command_code = EC_FS_CC_DONE;
         reply2.std_tx.return_code = EC_FS_RC_OK;
     }
-    got = fs_data_send(c, fd, f->fts_statp->st_size, c->req->urd);
+    got = fs_data_send(c, fd, ent.statp->st_size, c->req->urd);
     if (got == -1) {
         /* Error */
         fs_errno(c);
     } else {
         fs_reply(c, &(reply2.std_tx), sizeof(reply2));
     }
-    close(fd);
 out:
-    fts_close(ftsp);
-    free(upath);
-    if (as_command) free(upathlib);
+    if (fd != -1) close(fd);
     return;
 }
 
@@ -976,11 +996,11 @@ fs_save(struct fs_context *c)
     struct ec_fs_reply_save1 reply1;
     struct ec_fs_reply_save2 reply2;
     struct ec_fs_meta meta;
-    char *upath, *path_argv[2];
-    int fd, ackport, replyport;
+    char *upath;
+    const char *rel;
+    int fd, dirfd, ackport, replyport;
     size_t size, got;
-    FTS *ftsp;
-    FTSENT *f;
+    struct fs_ent ent;
     bool is_owner;
     bool can_write;
 
@@ -1017,17 +1037,17 @@ fs_save(struct fs_context *c)
 
     is_owner = fs_is_owner(c , upath);
 
+    rel = fs_path_at(c->client, upath, &dirfd);
     if (is_owner)
     {
-        if ((fd = open(upath, O_CREAT|O_TRUNC|O_RDWR, 0666)) == -1) {
+        if ((fd = openat(dirfd, rel, O_CREAT|O_TRUNC|O_RDWR, 0666)) == -1) {
             fs_errno(c);
-            free(upath);
             return;
         }
+        fs_pathcache_invalidate(upath);
     } else {
-    if ((fd = open(upath, O_TRUNC|O_RDWR, 0666)) == -1) {
+    if ((fd = openat(dirfd, rel, O_TRUNC|O_RDWR, 0666)) == -1) {
             fs_errno(c);
-            free(upath);
         return;
         }
     }
@@ -1036,16 +1056,17 @@ fs_save(struct fs_context *c)
     // have the correct write permisson
     
     can_write = false;  // Assume we dont have access
-    path_argv[0] = upath;
-    path_argv[1] = NULL;
-    ftsp = fts_open(path_argv, FTS_LOGICAL, NULL);
-    f = fts_read(ftsp);
-    if (f->fts_statp->st_mode & S_IWUSR)
+    if (fs_ent_fstat(&ent, c->client, upath, fd) == -1) {
+        fs_errno(c);
+        close(fd);
+        return;
+    }
+    if (ent.statp->st_mode & S_IWUSR)
     {
         // Owner permission to write
         if (is_owner == true)
         {
-            if (f->fts_statp->st_mode & S_IXUSR)
+            if (ent.statp->st_mode & S_IXUSR)
             {
                 // the file is locked
                 goto locked;
@@ -1053,12 +1074,12 @@ fs_save(struct fs_context *c)
             can_write = true;
         }
     }
-    if (f->fts_statp->st_mode & S_IWOTH)
+    if (ent.statp->st_mode & S_IWOTH)
     {
         // Public permission to write
         if (is_owner == false) 
         {
-            if (f->fts_statp->st_mode & S_IXUSR)
+            if (ent.statp->st_mode & S_IXUSR)
             {
                 // the file is locked
                 goto locked;
@@ -1074,10 +1095,8 @@ fs_save(struct fs_context *c)
         // need to delete the file we just created
         // Is this a TODO that has not been done?
         close(fd);
-        fts_close(ftsp);
         goto not_allowed_write;
     }
-    fts_close(ftsp);
 
     reply1.std_tx.command_code = EC_FS_CC_DONE;
     reply1.std_tx.return_code = EC_FS_RC_OK;
@@ -1088,7 +1107,6 @@ fs_save(struct fs_context *c)
     reply2.std_tx.command_code = EC_FS_CC_DONE;
     reply2.std_tx.return_code = EC_FS_RC_OK;
     got = fs_data_recv(c, fd, size, ackport);
-    close(fd);
     if (got == -1) {
         /* Error */
         fs_errno(c);
@@ -1098,27 +1116,22 @@ fs_save(struct fs_context *c)
          * request, and return the file date in the
          * response.
          */
-        path_argv[0] = upath;
-        path_argv[1] = NULL;
-        ftsp = fts_open(path_argv, FTS_LOGICAL, NULL);
-        f = fts_read(ftsp);
-        fs_set_meta(f, &meta);
-        fs_write_date(&(reply2.date), fs_get_birthtime(f));
-        reply2.access = fs_mode_to_access(f->fts_statp->st_mode);
-        fts_close(ftsp);
+        fstat(fd, &ent.sb);
+        fs_set_meta(&ent, &meta);
+        fs_write_date(&(reply2.date), fs_get_birthtime(&ent));
+        reply2.access = fs_mode_to_access(ent.statp->st_mode);
         c->req->reply_port = replyport;
         fs_reply(c, &(reply2.std_tx), sizeof(reply2));
     }
-    free(upath);
+    close(fd);
     return;
 
 not_allowed_write:
-    free(upath);
     fs_err(c, EC_FS_E_NOACCESS);    
     return;
 
 locked:
-    free(upath);
+    close(fd);
     fs_err(c, EC_FS_E_LOCKED);
     return;
 }
@@ -1128,11 +1141,11 @@ fs_create(struct fs_context *c)
 {
     struct ec_fs_reply_create reply;
     struct ec_fs_meta meta;
-    char *upath, *path_argv[2];
-    int fd, replyport;
+    char *upath;
+    const char *rel;
+    int fd, dirfd, replyport;
     size_t size;
-    FTS *ftsp;
-    FTSENT *f;
+    struct fs_ent ent;
 
     if (c->client == NULL) {
         fs_err(c, EC_FS_E_WHOAREYOU);
@@ -1159,15 +1172,16 @@ fs_create(struct fs_context *c)
     }
     replyport = c->req->reply_port;
     if (upath == NULL) return;
-    if ((fd = open(upath, O_CREAT|O_TRUNC|O_RDWR, 0666)) == -1) {
+    rel = fs_path_at(c->client, upath, &dirfd);
+    if ((fd = openat(dirfd, rel, O_CREAT|O_TRUNC|O_RDWR, 0666)) == -1) {
         fs_errno(c);
-        free(upath);
         return;
     }
-    if (ftruncate(fd, size) != 0) {
+    fs_pathcache_invalidate(upath);
+    if (ftruncate(fd, size) != 0 ||
+        fs_ent_fstat(&ent, c->client, upath, fd) != 0) {
         fs_errno(c);
         close(fd);
-        free(upath);
         return;
     }
     reply.std_tx.command_code = EC_FS_CC_DONE;
@@ -1178,15 +1192,9 @@ fs_create(struct fs_context *c)
      * request, and return the file date in the
      * response.
      */
-    path_argv[0] = upath;
-    path_argv[1] = NULL;
-    ftsp = fts_open(path_argv, FTS_LOGICAL, NULL);
-    f = fts_read(ftsp);
-    fs_set_meta(f, &meta);
-    fs_write_date(&(reply.date), fs_get_birthtime(f));
-    reply.access = fs_mode_to_access(f->fts_statp->st_mode);
-    fts_close(ftsp);
-    free(upath);
+    fs_set_meta(&ent, &meta);
+    fs_write_date(&(reply.date), fs_get_birthtime(&ent));
+    reply.access = fs_mode_to_access(ent.statp->st_mode);
     c->req->reply_port = replyport;
     fs_reply(c, &(reply.std_tx), sizeof(reply));
 }
@@ -1198,9 +1206,9 @@ fs_data_send(struct fs_context *c, int fd, size_t size, uint8_t reply_port)
     void *buf;
     ssize_t result;
     size_t this, done;
-    int faking;
+    int faking, phase;
 
-    if ((pkt = malloc(sizeof(*pkt) +
+    if ((pkt = fs_alloc(c, sizeof(*pkt) +
         (size > aunfuncs->max_block ? aunfuncs->max_block : size))) ==
         NULL) { 
         fs_err(c, EC_FS_E_NOMEM);
@@ -1212,7 +1220,9 @@ fs_data_send(struct fs_context *c, int fd, size_t size, uint8_t reply_port)
     while (size) {
         this = size > aunfuncs->max_block ? aunfuncs->max_block : size;
         if (!faking) {
+            phase = FS_PHASE(FS_PHASE_FS);
             result = read(fd, buf, this);
+            FS_PHASE_END(phase);
             if (result > 0) {
                 /* Normal -- the kernel had something for us */
                 this = result;
@@ -1225,11 +1235,12 @@ fs_data_send(struct fs_context *c, int fd, size_t size, uint8_t reply_port)
         pkt->type = AUN_TYPE_UNICAST;
         pkt->dest_port = reply_port; //c->req->urd;
         pkt->flag = c->req->aun.flag & 1;
+        phase = FS_PHASE(FS_PHASE_XMIT);
         if (aunfuncs->xmit(pkt, sizeof(*pkt) + this, c->from) == -1)
             warn("send data");
+        FS_PHASE_END(phase);
         size -= this;
     }
-    free(pkt);
     return done;
 }
 
@@ -1240,15 +1251,18 @@ fs_data_recv(struct fs_context *c, int fd, size_t size, int ackport)
     ssize_t msgsize, result;
     struct aun_srcaddr from;
     size_t done;
+    int phase;
 
-    if ((ack = malloc(sizeof(*ack) + 1)) == NULL) {
+    if ((ack = fs_alloc(c, sizeof(*ack) + 1)) == NULL) {
         fs_err(c, EC_FS_E_NOMEM);
         return -1;
     }
     done = 0;
     while (size) {
         from = *c->from;
+        phase = FS_PHASE(FS_PHASE_XMIT);
         pkt = aunfuncs->recv(&msgsize, &from, OUR_DATA_PORT);
+        FS_PHASE_END(phase);
         if (!pkt) {
             warn("receive data");
             return -1;     /* no reply: client has gone away */
@@ -1259,7 +1273,9 @@ fs_data_recv(struct fs_context *c, int fd, size_t size, int ackport)
             fs_error(c, 0xFF, "I'm confused");
             return -1;
         }
+        phase = FS_PHASE(FS_PHASE_FS);
         result = write(fd, pkt->data, msgsize);
+        FS_PHASE_END(phase);
         if (result < 0) {
             fs_errno(c);
             return -1;
@@ -1273,11 +1289,12 @@ fs_data_recv(struct fs_context *c, int fd, size_t size, int ackport)
             ack->dest_port = ackport;
             ack->flag = 0;
             ack->data[0] = 0;
+            phase = FS_PHASE(FS_PHASE_XMIT);
             if (aunfuncs->xmit(ack, sizeof(*ack) + 1, c->from) ==
                 -1)
                 warn("send data");
+            FS_PHASE_END(phase);
         }
     }
-    free(ack);
     return done;
 }
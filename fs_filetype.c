@@ -32,16 +32,28 @@
  * fs_filetype.c - guessing RISC OS file types
  */
 
+#if HAVE_CONFIG_H
+#include "config.h"
+#endif
+
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/queue.h>
 
+#include <ctype.h>
+#include <err.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <regex.h>
+#include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
 #include "extern.h"
 #include "fileserver.h"
+#include "fs_cost.h"
 
 #define FT_DEVICE   0xfcc
 #define FT_SOFTLINK 0xfdc
@@ -49,7 +61,12 @@
 #define FT_DATA     0xffd
 #define FT_TEXT     0xfff
 
-enum fs_map_kind { FS_MAP_DEFAULT, FS_MAP_MODE, FS_MAP_NAME };
+#define FS_SUFFIX_HASH_SIZE	256
+#define FS_SUFFIX_MAX_EXPAND	64
+#define FS_TYPECACHE_SIZE	1024
+#define FS_MAGICCACHE_SIZE	256
+
+enum fs_map_kind { FS_MAP_DEFAULT, FS_MAP_MODE, FS_MAP_NAME, FS_MAP_MAGIC };
 
 /* File type from name guess.  If the regexp matches, it has this type */
 struct fs_typemap {
@@ -61,47 +78,427 @@ struct fs_typemap {
             mode_t val;
             mode_t mask;
         } mode;
+        struct {
+            size_t offset;
+            size_t len;
+            unsigned char bytes[FS_MAGIC_MAX];
+        } magic;
     } crit;
+    char *name_src;     /* Source of name_re */
+    int index;          /* Position in the list, for first-match-wins */
     int type;
 };
 
 TAILQ_HEAD(fs_typemap_head, fs_typemap);
 static struct fs_typemap_head typemap = TAILQ_HEAD_INITIALIZER(typemap);
 
-static bool fs_check_typemap(FTSENT *, struct fs_typemap *);
+/*
+ * Most name rules are of the form "\.ext$", perhaps with a few
+ * optional characters or bracket expressions.  fs_typemap_compile()
+ * expands those into the set of extensions they match, and puts them
+ * in a hash table keyed by the part of the name after the last dot.
+ * Everything else stays on a (usually short) list of remaining rules,
+ * and the name rules on that are also combined into one regex that
+ * lets us skip them all at once when none of them match.
+ */
+struct fs_suffix {
+    LIST_ENTRY(fs_suffix) link;
+    char *ext;
+    struct fs_typemap *map;     /* Earliest rule matching ext */
+};
+
+LIST_HEAD(fs_suffix_head, fs_suffix);
+static struct fs_suffix_head fs_suffixes[FS_SUFFIX_HASH_SIZE];
+static struct fs_typemap **fs_typemap_rest;
+static int fs_typemap_nrest;
+static regex_t fs_typemap_combined;
+static bool fs_typemap_have_combined;
+static bool fs_typemap_compiled;
+
+/*
+ * Types we've already guessed, by file and name.  The mode is kept
+ * too, since "typemap perm" rules depend on it and chmod() doesn't
+ * change the modification time.
+ */
+struct fs_typecache_ent {
+    bool valid;
+    dev_t dev;
+    ino_t ino;
+    time_t mtime;
+    mode_t mode;
+    uint32_t namehash;
+    int type;
+};
+
+static struct fs_typecache_ent fs_typecache[FS_TYPECACHE_SIZE];
+
+/*
+ * The first few bytes of a file, for "typemap magic" rules.  Files
+ * are only read once while they stay unchanged and in the cache, which
+ * like fs_typecache is a fixed-size table, so an entry is simply
+ * replaced by the next file that hashes to the same slot.
+ */
+struct fs_head {
+    bool valid;
+    dev_t dev;
+    ino_t ino;
+    time_t mtime;
+    long mtimensec;
+    off_t size;
+    size_t len;
+    unsigned char buf[FS_MAGIC_MAX];
+};
+
+static struct fs_head fs_heads[FS_MAGICCACHE_SIZE];
+static size_t fs_head_len;      /* How much of a file the rules look at */
+
+static bool fs_check_typemap(struct fs_ent *, struct fs_typemap *,
+    struct fs_head **);
+static struct fs_head *fs_read_head(struct fs_ent *);
+static uint32_t fs_typemap_hash(const char *);
+static bool fs_suffix_char(int);
+static int fs_suffix_expand(const char *, char ***);
+static void fs_suffix_add(const char *, struct fs_typemap *);
+static struct fs_typemap *fs_suffix_lookup(const char *);
 
 /*
  * fs_guess_type - pick a sensible RISC OS file type for a Unix file.
  */
-int fs_guess_type(FTSENT *f)
+int fs_guess_type(struct fs_ent *e)
 {
-    struct fs_typemap *map;
+    struct fs_typemap *map, *best;
+    struct fs_typecache_ent *tc = NULL;
+    uint32_t namehash;
+    struct fs_head *head = NULL;
+    int i, limit, type;
+    bool names_possible;
     
     /* First check for magic names */
-    if (f->fts_namelen >= 4 && f->fts_name[f->fts_namelen-4] == ',')
+    if (e->namelen >= 4 && e->name[e->namelen-4] == ',')
         /* XXX should support ,xxx and ,lxa */
-        return strtoul(f->fts_name + f->fts_namelen - 3, NULL, 16);
-    for (map = typemap.tqh_first; map != NULL; map = map->link.tqe_next)
-        if (fs_check_typemap(f, map)) break;
+        return strtoul(e->name + e->namelen - 3, NULL, 16);
+
+    if (!fs_typemap_compiled)
+        fs_typemap_compile();
+    if (e->statp != NULL) {
+        namehash = fs_typemap_hash(e->name);
+        tc = &fs_typecache[(e->statp->st_ino ^ namehash) %
+            FS_TYPECACHE_SIZE];
+        if (tc->valid && tc->dev == e->statp->st_dev &&
+            tc->ino == e->statp->st_ino &&
+            tc->mtime == e->statp->st_mtime &&
+            tc->mode == e->statp->st_mode && tc->namehash == namehash)
+            return tc->type;
+    }
+
+    best = fs_suffix_lookup(e->name);
+    limit = best != NULL ? best->index : INT_MAX;
+    names_possible = !fs_typemap_have_combined ||
+        regexec(&fs_typemap_combined, e->name, 0, NULL, 0) == 0;
+    map = NULL;
+    for (i = 0; i < fs_typemap_nrest; i++) {
+        if (fs_typemap_rest[i]->index >= limit)
+            break;
+        if (fs_typemap_rest[i]->kind == FS_MAP_NAME && !names_possible)
+            continue;
+        if (fs_check_typemap(e, fs_typemap_rest[i], &head)) {
+            map = fs_typemap_rest[i];
+            break;
+        }
+    }
+    if (map == NULL)
+        map = best;
 
-    if (map) return map->type;
-    /* Urgh.  Do we do content-based guessing, or just give up? */
-    return FT_DATA;
+    if (map) type = map->type;
+    else type = FT_DATA;
+
+    if (tc != NULL) {
+        tc->valid = true;
+        tc->dev = e->statp->st_dev;
+        tc->ino = e->statp->st_ino;
+        tc->mtime = e->statp->st_mtime;
+        tc->mode = e->statp->st_mode;
+        tc->namehash = namehash;
+        tc->type = type;
+    }
+    return type;
+}
+
+static uint32_t
+fs_typemap_hash(const char *s)
+{
+    uint32_t h = 2166136261U;
+
+    for (; *s; s++)
+        h = (h ^ (unsigned char)*s) * 16777619U;
+    return h;
 }
 
-bool fs_check_typemap(FTSENT *f, struct fs_typemap *map)
+/*
+ * Is c safe to treat as a literal character in an extension?
+ */
+static bool
+fs_suffix_char(int c)
+{
+
+    return c != '\0' && c != '.' && c != '/' && c != '\\' &&
+        c != '[' && c != ']';
+}
+
+/*
+ * If re is a simple "\.ext$" regex, expand it into the list of
+ * extensions it matches and return how many there are.  Otherwise
+ * return -1.  The caller must free the list and its contents.
+ */
+static int
+fs_suffix_expand(const char *re, char ***extsp)
+{
+    char **exts, **nexts, set[FS_SUFFIX_MAX_EXPAND];
+    const char *p, *end;
+    size_t elen;
+    int i, j, c, n, nset, width;
+    bool optional;
+
+    end = re + strlen(re) - 1;
+    if (end - re < 2 || strncmp(re, "\\.", 2) != 0 || *end != '$')
+        return -1;
+    if ((exts = malloc(sizeof(*exts))) == NULL ||
+        (exts[0] = strdup("")) == NULL)
+        errx(1, "fs_suffix_expand: malloc failed");
+    n = 1;
+    for (p = re + 2; p < end; ) {
+        /* Find the set of characters this atom matches. */
+        nset = 0;
+        if (*p == '[') {
+            if (*++p == '^')
+                goto fail;
+            while (p < end && *p != ']') {
+                if (p[1] == '-' && p[2] != ']') {
+                    if (!fs_suffix_char(*p) || !fs_suffix_char(p[2]) ||
+                        p[2] < *p ||
+                        nset + p[2] - *p + 1 > FS_SUFFIX_MAX_EXPAND)
+                        goto fail;
+                    for (c = *p; c <= p[2]; c++)
+                        set[nset++] = c;
+                    p += 3;
+                } else {
+                    if (!fs_suffix_char(*p) ||
+                        nset == FS_SUFFIX_MAX_EXPAND)
+                        goto fail;
+                    set[nset++] = *p++;
+                }
+            }
+            if (p == end || nset == 0)
+                goto fail;
+            p++;
+        } else if (*p == '\\') {
+            /* Only escaped punctuation is a literal. */
+            p++;
+            if (!ispunct((unsigned char)*p) || !fs_suffix_char(*p))
+                goto fail;
+            set[nset++] = *p++;
+        } else if (isalnum((unsigned char)*p) || *p == '_' || *p == '-' ||
+            *p == '~' || *p == '#' || *p == '!' || *p == ',')
+            set[nset++] = *p++;
+        else
+            goto fail;
+        optional = (*p == '?');
+        if (optional)
+            p++;
+        width = nset + optional;
+        if (n * width > FS_SUFFIX_MAX_EXPAND)
+            goto fail;
+        /* Extend each extension so far by each character in the set. */
+        if ((nexts = malloc(n * width * sizeof(*nexts))) == NULL)
+            errx(1, "fs_suffix_expand: malloc failed");
+        for (i = 0; i < n; i++) {
+            elen = strlen(exts[i]);
+            for (j = 0; j < nset; j++) {
+                if ((nexts[i * width + j] = malloc(elen + 2)) == NULL)
+                    errx(1, "fs_suffix_expand: malloc failed");
+                sprintf(nexts[i * width + j], "%s%c", exts[i], set[j]);
+            }
+            if (optional)
+                nexts[i * width + nset] = exts[i];
+            else
+                free(exts[i]);
+        }
+        free(exts);
+        exts = nexts;
+        n *= width;
+    }
+    *extsp = exts;
+    return n;
+fail:
+    for (i = 0; i < n; i++)
+        free(exts[i]);
+    free(exts);
+    return -1;
+}
+
+static void
+fs_suffix_add(const char *ext, struct fs_typemap *map)
+{
+    struct fs_suffix_head *head;
+    struct fs_suffix *sfx;
+
+    head = &fs_suffixes[fs_typemap_hash(ext) % FS_SUFFIX_HASH_SIZE];
+    LIST_FOREACH(sfx, head, link)
+        if (strcmp(sfx->ext, ext) == 0)
+            return; /* An earlier rule got there first. */
+    if ((sfx = malloc(sizeof(*sfx))) == NULL ||
+        (sfx->ext = strdup(ext)) == NULL)
+        errx(1, "fs_suffix_add: malloc failed");
+    sfx->map = map;
+    LIST_INSERT_HEAD(head, sfx, link);
+}
+
+static struct fs_typemap *
+fs_suffix_lookup(const char *name)
+{
+    struct fs_suffix *sfx;
+    const char *ext;
+
+    if ((ext = strrchr(name, '.')) == NULL)
+        return NULL;
+    ext++;
+    LIST_FOREACH(sfx,
+        &fs_suffixes[fs_typemap_hash(ext) % FS_SUFFIX_HASH_SIZE], link)
+        if (strcmp(sfx->ext, ext) == 0)
+            return sfx->map;
+    return NULL;
+}
+
+/*
+ * Turn the list of rules from the configuration file into the
+ * structures fs_guess_type() uses.  Called once all the rules are in.
+ */
+void
+fs_typemap_compile(void)
+{
+    struct fs_typemap *map;
+    struct fs_suffix *sfx;
+    char **exts, *combined;
+    size_t combinedlen = 1;
+    int i, n, index = 0, nnames = 0;
+
+    for (i = 0; i < FS_SUFFIX_HASH_SIZE; i++)
+        while ((sfx = LIST_FIRST(&fs_suffixes[i])) != NULL) {
+            LIST_REMOVE(sfx, link);
+            free(sfx->ext);
+            free(sfx);
+        }
+    free(fs_typemap_rest);
+    fs_typemap_nrest = 0;
+    fs_typemap_rest = NULL;
+    TAILQ_FOREACH(map, &typemap, link)
+        index++;
+    if (index > 0 &&
+        (fs_typemap_rest = malloc(index * sizeof(*fs_typemap_rest))) == NULL)
+        errx(1, "fs_typemap_compile: malloc failed");
+    index = 0;
+    TAILQ_FOREACH(map, &typemap, link) {
+        map->index = index++;
+        if (map->kind == FS_MAP_NAME &&
+            (n = fs_suffix_expand(map->name_src, &exts)) != -1) {
+            for (i = 0; i < n; i++) {
+                fs_suffix_add(exts[i], map);
+                free(exts[i]);
+            }
+            free(exts);
+            continue;
+        }
+        fs_typemap_rest[fs_typemap_nrest++] = map;
+        if (map->kind == FS_MAP_NAME) {
+            combinedlen += strlen(map->name_src) + 3;
+            nnames++;
+        }
+    }
+
+    if (fs_typemap_have_combined)
+        regfree(&fs_typemap_combined);
+    fs_typemap_have_combined = false;
+    if (nnames > 1 && (combined = malloc(combinedlen)) != NULL) {
+        combined[0] = '\0';
+        for (i = 0; i < fs_typemap_nrest; i++) {
+            map = fs_typemap_rest[i];
+            if (map->kind != FS_MAP_NAME)
+                continue;
+            if (combined[0] != '\0')
+                strcat(combined, "|");
+            strcat(combined, "(");
+            strcat(combined, map->name_src);
+            strcat(combined, ")");
+        }
+        /* If it doesn't work, we'll just try them one by one. */
+        fs_typemap_have_combined = regcomp(&fs_typemap_combined, combined,
+            REG_EXTENDED | REG_NOSUB) == 0;
+        free(combined);
+    }
+    memset(fs_typecache, 0, sizeof(fs_typecache));
+    memset(fs_heads, 0, sizeof(fs_heads));
+    fs_typemap_compiled = true;
+}
+
+/*
+ * Find the header of a regular file, reading it if we haven't
+ * already.  Returns NULL if it's not a regular file or can't be read.
+ */
+static struct fs_head *
+fs_read_head(struct fs_ent *e)
+{
+    struct fs_head *head;
+    ssize_t len;
+    int fd;
+
+    if (e->statp == NULL || !S_ISREG(e->statp->st_mode))
+        return NULL;
+    head = &fs_heads[(e->statp->st_dev ^ e->statp->st_ino) %
+        FS_MAGICCACHE_SIZE];
+    if (head->valid && head->dev == e->statp->st_dev &&
+        head->ino == e->statp->st_ino &&
+        head->mtime == e->statp->st_mtime &&
+        head->mtimensec == FS_MTIME_NSEC(e->statp) &&
+        head->size == e->statp->st_size)
+        return head;
+    fd = openat(e->dirfd, e->accpath, O_RDONLY | O_NONBLOCK);
+    if (fd == -1)
+        return NULL;
+    len = read(fd, head->buf, fs_head_len);
+    close(fd);
+    head->valid = true;
+    head->dev = e->statp->st_dev;
+    head->ino = e->statp->st_ino;
+    head->mtime = e->statp->st_mtime;
+    head->mtimensec = FS_MTIME_NSEC(e->statp);
+    head->size = e->statp->st_size;
+    head->len = len > 0 ? len : 0;
+    if (debug) printf("(sniffed %zd bytes)", len);
+    return head;
+}
+
+static bool
+fs_check_typemap(struct fs_ent *e, struct fs_typemap *map,
+    struct fs_head **headp)
 {
     switch (map->kind) {
     case FS_MAP_DEFAULT:
         return true;
     case FS_MAP_MODE:
-        return (f->fts_statp->st_mode & map->crit.mode.mask) ==
+        return (e->statp->st_mode & map->crit.mode.mask) ==
             map->crit.mode.val;
     case FS_MAP_NAME:
-        if (regexec(map->crit.name_re, f->fts_name, 0, NULL, 0) == 0)
+        if (regexec(map->crit.name_re, e->name, 0, NULL, 0) == 0)
             return true;
         else
             return false;
+    case FS_MAP_MAGIC:
+        if (*headp == NULL && (*headp = fs_read_head(e)) == NULL)
+            return false;
+        return (*headp)->len >=
+            map->crit.magic.offset + map->crit.magic.len &&
+            memcmp((*headp)->buf + map->crit.magic.offset,
+            map->crit.magic.bytes, map->crit.magic.len) == 0;
     }
     return false;
 }
@@ -130,9 +527,17 @@ fs_add_typemap_name(const char *re, int type)
         errno = 0;
         return -1;
     }
+    if ((newmap->name_src = strdup(re)) == NULL) {
+        regfree(newmap->crit.name_re);
+        free(newmap->crit.name_re);
+        free(newmap);
+        errno = ENOMEM;
+        return -1;
+    }
     newmap->type = type;
     newmap->kind = FS_MAP_NAME;
     TAILQ_INSERT_TAIL(&typemap, newmap, link);
+    fs_typemap_compiled = false;
     return 0;
 }
 
@@ -151,6 +556,7 @@ fs_add_typemap_mode(mode_t val, mode_t mask, int type)
     newmap->type = type;
     newmap->kind = FS_MAP_MODE;
     TAILQ_INSERT_TAIL(&typemap, newmap, link);
+    fs_typemap_compiled = false;
     return 0;
 }
 int
@@ -166,5 +572,37 @@ fs_add_typemap_default(int type)
     newmap->type = type;
     newmap->kind = FS_MAP_DEFAULT;
     TAILQ_INSERT_TAIL(&typemap, newmap, link);
+    fs_typemap_compiled = false;
+    return 0;
+}
+
+/*
+ * Add a rule matching files that have the given bytes at the given
+ * offset.  This is as close as we get to content-based guessing.
+ */
+int
+fs_add_typemap_magic(size_t offset, const unsigned char *bytes, size_t len,
+    int type)
+{
+    struct fs_typemap *newmap;
+
+    if (len == 0 || offset + len > FS_MAGIC_MAX) {
+        errno = EINVAL;
+        return -1;
+    }
+    newmap = malloc(sizeof(*newmap));
+    if (newmap == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+    newmap->crit.magic.offset = offset;
+    newmap->crit.magic.len = len;
+    memcpy(newmap->crit.magic.bytes, bytes, len);
+    if (offset + len > fs_head_len)
+        fs_head_len = offset + len;
+    newmap->type = type;
+    newmap->kind = FS_MAP_MAGIC;
+    TAILQ_INSERT_TAIL(&typemap, newmap, link);
+    fs_typemap_compiled = false;
     return 0;
 }
@@ -34,16 +34,49 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <unistd.h>
 
 #include "extern.h"
 #include "fileserver.h"
+#include "fs_cost.h"
 
-#define MAX_HANDLES 256
+#define MAX_DIRFDS 64		/* Directory descriptors kept open */
+#define FS_HANDLE_SLAB 64	/* Handle structures allocated at once */
+#define FS_INTERN_HASH 256
+
+int fs_nfds;			/* Descriptors held by file handles */
+
+/*
+ * Directory handles are mostly used for their paths, and only need a
+ * descriptor to resolve names relative to.  So that an idle client
+ * doesn't tie up three or more descriptors, they're opened when needed
+ * and the least recently used are closed once there are more than
+ * MAX_DIRFDS of them.
+ */
+static TAILQ_HEAD(, fs_handle) fs_dirfds = TAILQ_HEAD_INITIALIZER(fs_dirfds);
+static int fs_ndirfds;
+
+static TAILQ_HEAD(, fs_handle) fs_handle_free =
+    TAILQ_HEAD_INITIALIZER(fs_handle_free);
+
+struct fs_intern {
+    LIST_ENTRY(fs_intern) link;
+    int refs;
+    size_t len;
+    char str[];
+};
+static LIST_HEAD(, fs_intern) fs_interned[FS_INTERN_HASH];
 
 static int fs_alloc_handle(struct fs_client *, bool);
+static void fs_close_fd(struct fs_client *, struct fs_handle *);
+static struct fs_handle *fs_new_handle(void);
+static void fs_mark_handle(struct fs_client *, int, bool);
+static const char *fs_intern(const char *, size_t);
+static void fs_unintern(const char *);
 static void fs_free_handle(struct fs_client *, int);
 
 /*
@@ -51,10 +84,13 @@ static void fs_free_handle(struct fs_client *, int);
  */
 void fs_check_handles(struct fs_context *c)
 {
+    int urd = 0;
+
     if (debug) printf("{");
     switch (c->req->function) {
     default:
         if (debug) printf("&=%u,", c->req->urd);
+        urd = c->req->urd;
         c->req->urd = fs_check_handle(c->client, c->req->urd);
         /* FALLTHROUGH */
     case EC_FS_FUNC_LOAD:
@@ -65,6 +101,8 @@ void fs_check_handles(struct fs_context *c)
     case EC_FS_FUNC_PUTBYTES:
         /* In these calls, the URD is replaced by a port number */
         if (debug) printf("@=%u,%%=%u", c->req->csd, c->req->lib);
+        FS_TRACE(FS_TRACE_HANDLE, FS_TRACE_EV_CONTEXT, urd,
+            c->req->csd << 8 | c->req->lib, 0);
         c->req->csd = fs_check_handle(c->client, c->req->csd);
         c->req->lib = fs_check_handle(c->client, c->req->lib);
         /* FALLTHROUGH */
@@ -85,8 +123,9 @@ fs_check_handle(struct fs_client *client, int h)
 {
     if (client && h < client->nhandles && client->handles[h])
         return h;
-    else
-        return 0;
+    if (h != 0)
+        FS_TRACE(FS_TRACE_HANDLE, FS_TRACE_EV_BADHANDLE, h, 0, 0);
+    return 0;
 }
 
 /*
@@ -98,26 +137,47 @@ fs_open_handle(struct fs_client *client, char *path, int open_flags,
     bool for_open)
 {
     struct stat sb;
-    char *newpath;
-    int h, fd;
+    const char *rel;
+    size_t len;
+    int h, fd, dirfd, phase, rc;
 
+    if (for_open && fs_nfds >= fs_fd_budget &&
+        !fs_reclaim_fds(client)) {
+        errno = EMFILE;
+        return 0;
+    }
+    rel = fs_path_at(client, path, &dirfd);
     h = fs_alloc_handle(client, for_open);
     if (h == 0) {
         errno = EMFILE;
         return h;
     }
-    if ((fd = open(path, open_flags,
-            S_IRUSR|S_IWUSR|S_IRGRP|S_IWGRP|S_IROTH|S_IWOTH)) == -1) {
+    phase = FS_PHASE(FS_PHASE_FS);
+    fd = openat(dirfd, rel, open_flags,
+        S_IRUSR|S_IWUSR|S_IRGRP|S_IWGRP|S_IROTH|S_IWOTH);
+    rc = fd == -1 ? -1 : fstat(fd, &sb);
+    FS_PHASE_END(phase);
+    if (fd == -1) {
         fs_free_handle(client, h);
         return 0;
     }
-    if (fstat(fd, &sb) == -1) {
+    if (rc == -1) {
         close(fd);
         fs_free_handle(client, h);
         return 0;
     }
-    if (S_ISDIR(sb.st_mode)) {
+    if (S_ISDIR(sb.st_mode) && for_open) {
+        /*
+         * The client opened this itself, and it may be locked, so
+         * it has to stay open like a file until the client closes it.
+         */
+        client->handles[h]->type = FS_HANDLE_DIR;
+        client->handles[h]->pinned = true;
+    } else if (S_ISDIR(sb.st_mode)) {
         client->handles[h]->type = FS_HANDLE_DIR;
+        /* Keep it open for now, since it'll probably be used soon. */
+        TAILQ_INSERT_TAIL(&fs_dirfds, client->handles[h], lru);
+        fs_ndirfds++;
     } else if (S_ISREG(sb.st_mode)) {
         client->handles[h]->type = FS_HANDLE_FILE;
         /*
@@ -136,26 +196,135 @@ fs_open_handle(struct fs_client *client, char *path, int open_flags,
         return 0;
     }
     client->handles[h]->fd = fd;
+    if (client->handles[h]->type == FS_HANDLE_FILE ||
+        client->handles[h]->pinned) {
+        client->nfds++;
+        fs_nfds++;
+    }
     // Initialise Acorn Permissions on file handle (assume the worst)
     client->handles[h]->can_write = false;
     client->handles[h]->can_read  = false;
     client->handles[h]->is_locked = false;
 
-    newpath = client->handles[h]->path = malloc(strlen(path)+1);
-    if (newpath == NULL) {
+    len = strlen(path);
+    if (len > 1 && path[len - 1] == '/')
+        len--;
+    client->handles[h]->path = fs_intern(path, len);
+    if (client->handles[h]->path == NULL) {
         warnx("fs_open_handle: malloc failed");
-        close(fd);
+        fs_close_fd(client, client->handles[h]);
         fs_free_handle(client, h);
         errno = ENOMEM;
         return 0;
     }
-    strcpy(newpath, path);
-    if (newpath[strlen(newpath)-1] == '/')
-        newpath[strlen(newpath)-1] = '\0';
-    if (debug) printf("{%d=%s} ", h, newpath);
+    if (debug) printf("{%d=%s} ", h, client->handles[h]->path);
+    FS_TRACE(FS_TRACE_HANDLE, FS_TRACE_EV_OPEN, h, 0,
+        client->handles[h]->type);
     return h;
 }
 
+/*
+ * Find a directory handle that a Unix path can be resolved relative
+ * to, so that system calls need not walk the whole path from the
+ * root each time.  Returns the remainder of the path and sets
+ * *dirfdp to the handle's descriptor, or returns the path unchanged
+ * with *dirfdp set to AT_FDCWD if no handle will do.  A handle is
+ * only used for things strictly inside it, so that the result can
+ * always be unlinked or renamed.
+ */
+const char *
+fs_path_at(struct fs_client *client, const char *path, int *dirfdp)
+{
+    struct fs_handle *hp, *best;
+    const char *rel;
+    size_t len, bestlen;
+    int h;
+
+    *dirfdp = AT_FDCWD;
+    rel = path;
+    if (client == NULL) return rel;
+    bestlen = 0;
+    best = NULL;
+    for (h = 1; h < client->nhandles; h++) {
+        hp = client->handles[h];
+        if (hp == NULL || hp->type != FS_HANDLE_DIR) continue;
+        len = strlen(hp->path);
+        if (len <= bestlen || strncmp(path, hp->path, len) != 0 ||
+            path[len] != '/' || path[len + 1] == '\0')
+            continue;
+        bestlen = len;
+        best = hp;
+    }
+    if (best != NULL && (*dirfdp = fs_handle_dirfd(best)) != -1)
+        return path + bestlen + 1;
+    *dirfdp = AT_FDCWD;
+    return rel;
+}
+
+/*
+ * Get a descriptor for a directory handle, opening it if necessary.
+ * It stays valid until the end of the current request, when
+ * fs_trim_dirfds may close it.  Returns -1 if the directory can't be
+ * opened (perhaps because it's been renamed).
+ */
+int
+fs_handle_dirfd(struct fs_handle *hp)
+{
+
+    if (hp->pinned)
+        return hp->fd;
+    if (hp->fd != -1) {
+        TAILQ_REMOVE(&fs_dirfds, hp, lru);
+        TAILQ_INSERT_TAIL(&fs_dirfds, hp, lru);
+        return hp->fd;
+    }
+    if ((hp->fd = open(hp->path, O_RDONLY | O_DIRECTORY)) == -1) {
+        if (debug) printf("{%s: %s} ", hp->path, strerror(errno));
+        return -1;
+    }
+    TAILQ_INSERT_TAIL(&fs_dirfds, hp, lru);
+    fs_ndirfds++;
+    return hp->fd;
+}
+
+/*
+ * Close the least recently used directory descriptors, if there are
+ * too many.  Called between requests, so that nothing's using them.
+ */
+void
+fs_trim_dirfds(void)
+{
+    struct fs_handle *hp;
+
+    while (fs_ndirfds > MAX_DIRFDS) {
+        hp = TAILQ_FIRST(&fs_dirfds);
+        TAILQ_REMOVE(&fs_dirfds, hp, lru);
+        fs_ndirfds--;
+        close(hp->fd);
+        hp->fd = -1;
+    }
+}
+
+/*
+ * Close whatever descriptor a handle has.
+ */
+static void
+fs_close_fd(struct fs_client *client, struct fs_handle *hp)
+{
+
+    if (hp->fd == -1)
+        return;
+    if (hp->type == FS_HANDLE_DIR && !hp->pinned) {
+        TAILQ_REMOVE(&fs_dirfds, hp, lru);
+        fs_ndirfds--;
+    } else {
+        client->nfds--;
+        fs_nfds--;
+    }
+    close(hp->fd);
+    hp->fd = -1;
+}
+
 /*
  * Release a handle set up by fs_open_handle.
  */
@@ -166,8 +335,9 @@ fs_close_handle(struct fs_client *client, int h)
 
     if (h == 0) return;
     if (debug) printf("{%d closed} ", h);
-    close(client->handles[h]->fd);
-    free(client->handles[h]->path);
+    FS_TRACE(FS_TRACE_HANDLE, FS_TRACE_EV_CLOSE, h, 0, 0);
+    fs_close_fd(client, client->handles[h]);
+    fs_unintern(client->handles[h]->path);
     fs_free_handle(client, h);
 }
 
@@ -195,28 +365,33 @@ fs_close_handle(struct fs_client *client, int h)
  * restrictions, so for them the safehandles option can be turned off.
  */
 
+/*
+ * Each client keeps two bitmaps of free handles: p2free has bit n set
+ * if handle 1 << n is free, and np2free has bit h set if handle h is
+ * free and isn't a power of two.  So finding a free handle of either
+ * kind is a matter of finding the first set bit.
+ */
+#define FS_BIT(map, h) ((map)[(h) / 32] & (1U << ((h) % 32)))
+
 /* Allocate a handle that's a power of two. */
 static int
 fs_alloc_handle_p2(struct fs_client *client)
 {
-    int h;
 
-    for (h = 1; h < MAX_HANDLES; h <<= 1)
-        if (h >= client->nhandles ||
-            client->handles[h] == NULL) return h;
-    return 0;
+    if (client->p2free == 0)
+        return 0;
+    return 1 << (ffs(client->p2free) - 1);
 }
 
 /* Allocate a handle that's not a power of two. */
 static int
 fs_alloc_handle_np2(struct fs_client *client)
 {
-    int h;
+    int i;
 
-    for (h = 1; h < MAX_HANDLES; h++)
-        if ((h & (h - 1)) != 0 &&
-            (h >= client->nhandles ||
-             client->handles[h] == NULL)) return h;
+    for (i = 0; i < MAX_HANDLES / 32; i++)
+        if (client->np2free[i] != 0)
+            return i * 32 + ffs(client->np2free[i]) - 1;
     return 0;
 }
 
@@ -225,11 +400,79 @@ static int
 fs_alloc_handle_255(struct fs_client *client)
 {
 
-    if (255 >= client->nhandles ||
-        client->handles[255] == NULL) return 255;
+    if (FS_BIT(client->np2free, 255)) return 255;
     return 0;
 }
 
+/*
+ * Mark a handle as free or in use in the client's bitmaps.
+ */
+static void
+fs_mark_handle(struct fs_client *client, int h, bool isfree)
+{
+    uint32_t *word, bit;
+
+    if ((h & (h - 1)) == 0) {
+        word = &client->p2free;
+        bit = 1U << (ffs(h) - 1);
+    } else {
+        word = &client->np2free[h / 32];
+        bit = 1U << (h % 32);
+    }
+    if (isfree)
+        *word |= bit;
+    else
+        *word &= ~bit;
+}
+
+/*
+ * Set up a new client's handle table.  All clients have a null
+ * handle, handle 0.  We'll make room for another three, since all
+ * clients get three handles allocated at login.
+ */
+int
+fs_init_handles(struct fs_client *client)
+{
+    int h;
+
+    client->handles = calloc(4, sizeof(struct fs_handle *));
+    if (client->handles == NULL) {
+        warnx("fs_init_handles: calloc failed");
+        return -1;
+    }
+    client->nhandles = 4;
+    client->p2free = 0;
+    memset(client->np2free, 0, sizeof(client->np2free));
+    for (h = 1; h < MAX_HANDLES; h++)
+        fs_mark_handle(client, h, true);
+    return 0;
+}
+
+/*
+ * Handle structures are carved out of blocks of FS_HANDLE_SLAB and
+ * recycled through a free list (using their lru entries), rather than
+ * being malloced one at a time.
+ */
+static struct fs_handle *
+fs_new_handle(void)
+{
+    struct fs_handle *hp, *slab;
+    int i;
+
+    if ((hp = TAILQ_FIRST(&fs_handle_free)) == NULL) {
+        slab = malloc(FS_HANDLE_SLAB * sizeof(*slab));
+        if (slab == NULL)
+            return NULL;
+        for (i = 0; i < FS_HANDLE_SLAB; i++)
+            TAILQ_INSERT_TAIL(&fs_handle_free, &slab[i], lru);
+        hp = TAILQ_FIRST(&fs_handle_free);
+    }
+    TAILQ_REMOVE(&fs_handle_free, hp, lru);
+    memset(hp, 0, sizeof(*hp));
+    hp->fd = -1;
+    return hp;
+}
+
 static int
 fs_alloc_handle(struct fs_client *client, bool for_open)
 {
@@ -249,11 +492,13 @@ fs_alloc_handle(struct fs_client *client, bool for_open)
     }
     if (h == 0) return 0;
     if (h >= client->nhandles) {
-        /* Extend the table. */
+        /* Extend the table, doubling it so this doesn't happen often. */
         int new_nhandles, i;
         struct fs_handle **new_handles;
 
-        new_nhandles = h + 1;
+        new_nhandles = client->nhandles * 2;
+        if (new_nhandles < h + 1)
+            new_nhandles = h + 1;
         if (new_nhandles > MAX_HANDLES)
             new_nhandles = MAX_HANDLES;
         new_handles = realloc(client->handles,
@@ -268,11 +513,12 @@ fs_alloc_handle(struct fs_client *client, bool for_open)
             return 0;
         }
     }
-    client->handles[h] = malloc(sizeof(*(client->handles[h])));
+    client->handles[h] = fs_new_handle();
     if (client->handles[h] == NULL) {
         warnx("fs: fs_alloc_handle: malloc failed");
-        h = 0;
+        return 0;
     }
+    fs_mark_handle(client, h, false);
     return h;
 }
 
@@ -280,7 +526,57 @@ static void
 fs_free_handle(struct fs_client *client, int h)
 {
 
-    /* very simple */
-    free(client->handles[h]);
-    client->handles[h] = 0;
+    TAILQ_INSERT_HEAD(&fs_handle_free, client->handles[h], lru);
+    client->handles[h] = NULL;
+    fs_mark_handle(client, h, true);
+}
+
+/*
+ * Handles' paths are interned, since most clients have handles on the
+ * same few directories.
+ */
+static unsigned
+fs_intern_hash(const char *s, size_t len)
+{
+    unsigned h = 0;
+
+    while (len--)
+        h = h * 31 + (unsigned char)*s++;
+    return h % FS_INTERN_HASH;
+}
+
+static const char *
+fs_intern(const char *s, size_t len)
+{
+    struct fs_intern *in;
+    unsigned h;
+
+    h = fs_intern_hash(s, len);
+    LIST_FOREACH(in, &fs_interned[h], link)
+        if (in->len == len && memcmp(in->str, s, len) == 0) {
+            in->refs++;
+            return in->str;
+        }
+    if ((in = malloc(sizeof(*in) + len + 1)) == NULL)
+        return NULL;
+    in->refs = 1;
+    in->len = len;
+    memcpy(in->str, s, len);
+    in->str[len] = '\0';
+    LIST_INSERT_HEAD(&fs_interned[h], in, link);
+    return in->str;
+}
+
+static void
+fs_unintern(const char *s)
+{
+    struct fs_intern *in;
+
+    if (s == NULL)
+        return;
+    in = (struct fs_intern *)(s - offsetof(struct fs_intern, str));
+    if (--in->refs == 0) {
+        LIST_REMOVE(in, link);
+        free(in);
+    }
 }
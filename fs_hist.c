@@ -0,0 +1,122 @@
+/*-
+ * Copyright (c) 2010 Simon Tatham
+ * Copyright (c) 2010 Ben Harris
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/*
+ * Log-linear histograms of request times (see fs_hist.h).
+ */
+
+#if HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "fs_hist.h"
+
+static uint64_t fs_hist_bound(int);
+
+/*
+ * Which bucket a time in microseconds goes in.
+ */
+int
+fs_hist_bucket(uint64_t usec)
+{
+    int k, i;
+
+    if (usec < FS_HIST_SUB)
+        return usec;
+    for (k = FS_HIST_SUBBITS; k < 63 && (usec >> (k + 1)) != 0; k++)
+        continue;
+    i = (k - FS_HIST_SUBBITS + 1) * FS_HIST_SUB +
+        ((usec >> (k - FS_HIST_SUBBITS)) & (FS_HIST_SUB - 1));
+    return i < FS_HIST_BUCKETS ? i : FS_HIST_BUCKETS - 1;
+}
+
+/*
+ * The smallest time that's too big for bucket i.
+ */
+static uint64_t
+fs_hist_bound(int i)
+{
+    int k;
+
+    if (i < FS_HIST_SUB)
+        return i + 1;
+    k = i / FS_HIST_SUB + FS_HIST_SUBBITS - 1;
+    return (uint64_t)(FS_HIST_SUB + i % FS_HIST_SUB + 1) <<
+        (k - FS_HIST_SUBBITS);
+}
+
+/*
+ * Estimate a percentile, in thousandths, of the times in h.
+ */
+uint64_t
+fs_hist_quantile(const struct fs_hist *h, int permille)
+{
+    uint64_t want, seen = 0;
+    int i;
+
+    if (h->count == 0)
+        return 0;
+    want = (h->count * permille + 999) / 1000;
+    for (i = 0; i < FS_HIST_BUCKETS; i++) {
+        seen += h->bucket[i];
+        if (seen >= want && seen > 0)
+            break;
+    }
+    if (i == FS_HIST_BUCKETS || fs_hist_bound(i) - 1 > h->max)
+        return h->max;
+    return fs_hist_bound(i) - 1;
+}
+
+void
+fs_hist_add(struct fs_hist *h, uint64_t usec, bool failed)
+{
+
+    h->count++;
+    if (failed)
+        h->errors++;
+    h->usec += usec;
+    if (usec > h->max)
+        h->max = usec;
+    h->bucket[fs_hist_bucket(usec)]++;
+}
+
+void
+fs_hist_merge(struct fs_hist *to, const struct fs_hist *from)
+{
+    int i;
+
+    to->count += from->count;
+    to->errors += from->errors;
+    to->usec += from->usec;
+    if (from->max > to->max)
+        to->max = from->max;
+    for (i = 0; i < FS_HIST_BUCKETS; i++)
+        to->bucket[i] += from->bucket[i];
+}
@@ -0,0 +1,64 @@
+/*-
+ * Copyright (c) 2010 Simon Tatham
+ * Copyright (c) 2010 Ben Harris
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/*
+ * This is part of aund, an implementation of Acorn Universal
+ * Networking for Unix.
+ */
+/*
+ * fs_hist.h - log-linear histograms of request times, kept by aund's
+ * statistics and by aundload.
+ *
+ * Below FS_HIST_SUB microseconds there's a bucket for each value;
+ * above, each power of two is split into FS_HIST_SUB equal parts.
+ */
+
+#ifndef _FS_HIST_H
+#define _FS_HIST_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define FS_HIST_SUBBITS		2
+#define FS_HIST_SUB		(1 << FS_HIST_SUBBITS)
+#define FS_HIST_OCTAVES		27	/* Up to 2^28us, about 4.5 minutes */
+#define FS_HIST_BUCKETS		(FS_HIST_OCTAVES * FS_HIST_SUB)
+
+struct fs_hist {
+	uint64_t count;
+	uint64_t errors;	/* Requests that failed */
+	uint64_t usec;		/* Total time taken */
+	uint64_t max;
+	uint32_t bucket[FS_HIST_BUCKETS];
+};
+
+extern int fs_hist_bucket(uint64_t);
+extern uint64_t fs_hist_quantile(const struct fs_hist *, int);
+extern void fs_hist_add(struct fs_hist *, uint64_t, bool);
+extern void fs_hist_merge(struct fs_hist *, const struct fs_hist *);
+
+#endif
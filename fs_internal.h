@@ -0,0 +1,65 @@
+/*-
+ * Copyright (c) 2010 Simon Tatham
+ * Copyright (c) 2010 Ben Harris
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/*
+ * This is part of aund, an implementation of Acorn Universal
+ * Networking for Unix.
+ */
+/*
+ * fs_internal.h - helpers of the name translation and directory
+ * listing code that aundbench times on their own.
+ */
+
+#ifndef _FS_INTERNAL_H
+#define _FS_INTERNAL_H
+
+#include <sys/types.h>
+
+#include <fts.h>
+#include <stdbool.h>
+
+#include "fileserver.h"
+
+/* fs_nametrans.c */
+extern char *fs_unhat_path(char *);
+extern void fs_trans_simple(char *, char *);
+extern bool wcmatch(char *, char *, int);
+
+/* fs_examine.c */
+extern int fs_examine_read(struct fs_context *, const char *, int);
+extern int fs_examine_all(struct fs_context *, FTSENT *,
+    struct ec_fs_reply_examine **, size_t *);
+extern int fs_examine_all_32(struct fs_context *, FTSENT *,
+    struct ec_fs_reply_examine_32 **, size_t *);
+extern int fs_examine_longtxt(struct fs_context *, FTSENT *,
+    struct ec_fs_reply_examine **, size_t *);
+extern int fs_examine_name(struct fs_context *, FTSENT *,
+    struct ec_fs_reply_examine **, size_t *);
+extern int fs_examine_shorttxt(struct fs_context *, FTSENT *,
+    struct ec_fs_reply_examine **, size_t *);
+
+#endif
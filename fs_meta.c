@@ -0,0 +1,299 @@
+/*-
+ * Copyright (c) 2010 Simon Tatham
+ * Copyright (c) 1998, 2010 Ben Harris
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/*
+ * Acorn metadata (load and execute addresses) storage.
+ *
+ * The metadata themselves are kept by one of the backends in
+ * meta_symlink.c and meta_xattr.c.  Asking the backend for every file
+ * in every directory listing, and rewriting them for every SET_INFO,
+ * is slow, so we keep a cache of metadata keyed by device and inode
+ * number.  Changes are made in the cache and written back a couple of
+ * seconds later (or at exit), so that a client setting the load
+ * address, exec address and access of a file in quick succession only
+ * costs one write.
+ */
+
+#if HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "aun.h"
+#include "extern.h"
+#include "fs_proto.h"
+#include "fileserver.h"
+#include "fs_cost.h"
+
+#define FS_METACACHE_SIZE	1024
+#define FS_METACACHE_TTL	30	/* Seconds to trust a clean entry */
+#define FS_METACACHE_DELAY	2	/* Seconds before writing back */
+
+#define FS_MC_VALID	0x01	/* Slot is in use */
+#define FS_MC_FOUND	0x02	/* File has metadata (else use defaults) */
+#define FS_MC_DIRTY	0x04	/* Not yet written to disc */
+
+struct fs_metacache_ent {
+	int flags;
+	dev_t dev;
+	ino_t ino;
+	time_t ctime;		/* st_ctime of the file when cached */
+	time_t when;		/* When the entry was last read or written */
+	struct ec_fs_meta meta;
+	char *path;		/* Where to write a dirty entry back */
+};
+
+static struct fs_metacache_ent fs_metacache[FS_METACACHE_SIZE];
+static int fs_metacache_ndirty;
+static time_t fs_metacache_dirtied;	/* When first entry became dirty */
+unsigned long fs_metacache_hits, fs_metacache_misses;
+
+struct meta_funcs const *metafuncs = &meta_symlink;
+
+static struct fs_metacache_ent *fs_metacache_slot(struct stat *);
+static struct fs_metacache_ent *fs_metacache_lookup(struct fs_ent *);
+static void fs_metacache_writeback(struct fs_metacache_ent *);
+static void fs_metacache_drop(struct fs_metacache_ent *);
+
+/*
+ * Find the cache slot for a file, writing back whatever was there
+ * before if it was dirty and belonged to another file.
+ */
+static struct fs_metacache_ent *
+fs_metacache_slot(struct stat *st)
+{
+    struct fs_metacache_ent *mc;
+    uint64_t h;
+
+    h = ((uint64_t)st->st_dev * 0x9e3779b1) ^ (uint64_t)st->st_ino;
+    mc = &fs_metacache[h % FS_METACACHE_SIZE];
+    if ((mc->flags & FS_MC_VALID) &&
+        (mc->dev != st->st_dev || mc->ino != st->st_ino))
+        fs_metacache_drop(mc);
+    return mc;
+}
+
+/*
+ * Return the cache entry for a file if it's still believable.
+ */
+static struct fs_metacache_ent *
+fs_metacache_lookup(struct fs_ent *e)
+{
+    struct fs_metacache_ent *mc;
+
+    if (e->statp == NULL)
+        return NULL;
+    mc = fs_metacache_slot(e->statp);
+    if (!(mc->flags & FS_MC_VALID))
+        return NULL;
+    if (mc->flags & FS_MC_DIRTY)
+        return mc;
+    if (mc->ctime != e->statp->st_ctime ||
+        time(NULL) - mc->when >= FS_METACACHE_TTL)
+        return NULL;
+    return mc;
+}
+
+/*
+ * Write a dirty entry back to disc, provided the file it belongs to
+ * is still where we left it.
+ */
+static void
+fs_metacache_writeback(struct fs_metacache_ent *mc)
+{
+    struct fs_ent e;
+    struct stat sb;
+
+    if (fs_stat(mc->path, &sb) == 0 &&
+        sb.st_dev == mc->dev && sb.st_ino == mc->ino) {
+        if (debug) printf("(metadata: writing back [%s])", mc->path);
+        e.dirfd = AT_FDCWD;
+        e.accpath = e.path = mc->path;
+        e.name = (char *)fs_leafname(mc->path);
+        e.namelen = strlen(e.name);
+        e.statp = NULL;
+        if (!metafuncs->set(&e, &mc->meta)) {
+            warn("%s: write metadata", mc->path);
+            mc->flags = 0;
+        } else
+            mc->ctime = sb.st_ctime;
+    } else {
+        if (debug) printf("(metadata: [%s] has gone)", mc->path);
+        mc->flags = 0;
+    }
+    mc->flags &= ~FS_MC_DIRTY;
+    mc->when = time(NULL);
+    free(mc->path);
+    mc->path = NULL;
+    fs_metacache_ndirty--;
+}
+
+/*
+ * Throw away a cache entry, writing it back first if necessary.
+ */
+static void
+fs_metacache_drop(struct fs_metacache_ent *mc)
+{
+
+    if (mc->flags & FS_MC_DIRTY)
+        fs_metacache_writeback(mc);
+    mc->flags = 0;
+}
+
+/*
+ * Write back dirty cache entries.  Unless force is set, this only
+ * happens once they've been waiting for FS_METACACHE_DELAY seconds.
+ */
+void
+fs_metacache_flush(bool force)
+{
+    int i;
+
+    if (fs_metacache_ndirty == 0)
+        return;
+    if (!force &&
+        time(NULL) - fs_metacache_dirtied < FS_METACACHE_DELAY)
+        return;
+    for (i = 0; i < FS_METACACHE_SIZE && fs_metacache_ndirty > 0; i++)
+        if (fs_metacache[i].flags & FS_MC_DIRTY)
+            fs_metacache_writeback(&fs_metacache[i]);
+}
+
+void
+fs_get_meta(struct fs_ent *e, struct ec_fs_meta *meta)
+{
+    struct fs_metacache_ent *mc;
+    struct stat *st;
+    uint64_t stamp;
+    int type, phase;
+    bool found;
+
+    if ((mc = fs_metacache_lookup(e)) != NULL) {
+        fs_metacache_hits++;
+        found = mc->flags & FS_MC_FOUND;
+        if (found)
+            *meta = mc->meta;
+    } else {
+        fs_metacache_misses++;
+        phase = FS_PHASE(FS_PHASE_FS);
+        found = metafuncs->get(e, meta);
+        FS_PHASE_END(phase);
+        if (e->statp != NULL) {
+            mc = fs_metacache_slot(e->statp);
+            mc->flags = FS_MC_VALID | (found ? FS_MC_FOUND : 0);
+            mc->dev = e->statp->st_dev;
+            mc->ino = e->statp->st_ino;
+            mc->ctime = e->statp->st_ctime;
+            mc->when = time(NULL);
+            if (found)
+                mc->meta = *meta;
+        }
+    }
+    if (found)
+        return;
+    st = e->statp;
+    if (st != NULL) {
+        stamp = fs_riscos_date(st->st_mtime,
+#if HAVE_STRUCT_STAT_ST_MTIMENSEC
+            st->st_mtimensec / 10000000
+#elif HAVE_STRUCT_STAT_ST_MTIM
+            st->st_mtim.tv_nsec / 10000000
+#else
+            0
+#endif
+            );
+        phase = FS_PHASE(FS_PHASE_FS);
+        type = fs_guess_type(e);
+        FS_PHASE_END(phase);
+        fs_write_val(meta->load_addr,
+                 0xfff00000 | (type << 8) | (stamp >> 32), 4);
+        fs_write_val(meta->exec_addr, stamp & 0x00ffffffffULL, 4);
+    } else {
+        fs_write_val(meta->load_addr, 0xdeaddead, 4);
+        fs_write_val(meta->exec_addr, 0xdeaddead, 4);
+    }
+}
+
+/*
+ * Set the metadata for a file.  If we know which file it is, this
+ * just updates the cache, and the metadata get written back later.
+ */
+bool
+fs_set_meta(struct fs_ent *e, struct ec_fs_meta *meta)
+{
+    struct fs_metacache_ent *mc;
+    char *path;
+
+    if (e->statp == NULL || e->path == NULL ||
+        (path = strdup(e->path)) == NULL)
+        return metafuncs->set(e, meta);
+    mc = fs_metacache_slot(e->statp);
+    if (mc->flags & FS_MC_DIRTY)
+        free(mc->path);
+    else {
+        if (fs_metacache_ndirty++ == 0)
+            fs_metacache_dirtied = time(NULL);
+    }
+    mc->flags = FS_MC_VALID | FS_MC_FOUND | FS_MC_DIRTY;
+    mc->dev = e->statp->st_dev;
+    mc->ino = e->statp->st_ino;
+    mc->ctime = e->statp->st_ctime;
+    mc->when = time(NULL);
+    mc->meta = *meta;
+    mc->path = path;
+    return true;
+}
+
+void
+fs_del_meta(struct fs_ent *e)
+{
+    struct fs_metacache_ent *mc;
+
+    if (e->statp != NULL) {
+        mc = fs_metacache_slot(e->statp);
+        if (mc->flags & FS_MC_DIRTY) {
+            free(mc->path);
+            mc->path = NULL;
+            fs_metacache_ndirty--;
+        }
+        mc->flags = 0;
+    }
+    metafuncs->del(e);
+}
@@ -33,12 +33,13 @@
  * fs_misc.c - miscellaneous file server calls
  */
 
-#include <fts.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/statvfs.h>
 
 #include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -52,6 +53,7 @@
 #include "extern.h"
 #include "fileserver.h"
 #include "version.h"
+#include "fs_cost.h"
 
 void
 fs_get_discs(struct fs_context *c)
@@ -67,7 +69,10 @@ fs_get_discs(struct fs_context *c)
         nfound = 1;
     else
         nfound = 0;
-    if ((reply = malloc(SIZEOF_ec_fs_reply_discs(nfound))) == NULL) exit(2);
+    if ((reply = fs_alloc(c, SIZEOF_ec_fs_reply_discs(nfound))) == NULL) {
+        fs_err(c, EC_FS_E_NOMEM);
+        return;
+    }
     reply->std_tx.command_code = EC_FS_CC_DISCS;
     reply->std_tx.return_code = EC_FS_RC_OK;
     reply->ndrives = nfound;
@@ -79,16 +84,15 @@ fs_get_discs(struct fs_context *c)
             sizeof(reply->drives[0].name));
     }
     fs_reply(c, &(reply->std_tx), SIZEOF_ec_fs_reply_discs(nfound));
-    free(reply);
 }
 
 void
 fs_get_info(struct fs_context *c)
 {
-    char *upath, *path_argv[2];
+    char *upath;
     struct ec_fs_req_get_info *request;
-    FTS *ftsp;
-    FTSENT *f;
+    struct fs_ent ent;
+    char name[NAME_MAX + 1];
     bool match; /* string compare for path and urd */
 
     if (c->client == NULL) {
@@ -98,23 +102,20 @@ fs_get_info(struct fs_context *c)
     request = (struct ec_fs_req_get_info *)c->req;
     request->path[strcspn(request->path, "\r")] = '\0';
     if (debug) printf("get info [%d, '%s']\n", request->arg, request->path);
-    upath = fs_unixify_path(c, request->path); /* This must be freed */
+    upath = fs_unixify_path(c, request->path);
     if (upath == NULL) return;
     errno = 0;
-    path_argv[0] = upath;
-    path_argv[1] = NULL;
-    ftsp = fts_open(path_argv, FTS_LOGICAL, NULL);
-    f = fts_read(ftsp);
+    fs_ent_stat(&ent, c->client, upath);
     switch (request->arg) {
     case EC_FS_GET_INFO_ACCESS: {
         struct ec_fs_reply_info_access reply;
         reply.std_tx.return_code = EC_FS_RC_OK;
         reply.std_tx.command_code = EC_FS_CC_DONE;
-        if (f->fts_info == FTS_ERR || f->fts_info == FTS_NS) {
+        if (ent.statp == NULL) {
             reply.type = EC_FS_TYPE_NONE;
         } else {
-            reply.type = fs_mode_to_type(f->fts_statp->st_mode);
-            reply.access = fs_mode_to_access(f->fts_statp->st_mode);
+            reply.type = fs_mode_to_type(ent.statp->st_mode);
+            reply.access = fs_mode_to_access(ent.statp->st_mode);
         }
         fs_reply(c, &(reply.std_tx), sizeof(reply));
     }
@@ -124,19 +125,19 @@ fs_get_info(struct fs_context *c)
 
         reply.std_tx.return_code = EC_FS_RC_OK;
         reply.std_tx.command_code = EC_FS_CC_DONE;
-        if (f->fts_info == FTS_ERR || f->fts_info == FTS_NS) {
+        if (ent.statp == NULL) {
             reply.type = EC_FS_TYPE_NONE;
             memset(&(reply.meta), 0, sizeof(reply.meta));
             memset(&(reply.size), 0, sizeof(reply.size));
             memset(&(reply.access), 0, sizeof(reply.access));
             memset(&(reply.date), 0, sizeof(reply.date));
         } else {
-            reply.type = fs_mode_to_type(f->fts_statp->st_mode);
-            fs_get_meta(f, &(reply.meta));
-            fs_write_val(reply.size, f->fts_statp->st_size,
+            reply.type = fs_mode_to_type(ent.statp->st_mode);
+            fs_get_meta(&ent, &(reply.meta));
+            fs_write_val(reply.size, ent.statp->st_size,
                 sizeof(reply.size));
-            reply.access = fs_mode_to_access(f->fts_statp->st_mode);
-            fs_write_date(&(reply.date), fs_get_birthtime(f));
+            reply.access = fs_mode_to_access(ent.statp->st_mode);
+            fs_write_date(&(reply.date), fs_get_birthtime(&ent));
         }
         fs_reply(c, &(reply.std_tx), sizeof(reply));
     }
@@ -146,12 +147,12 @@ fs_get_info(struct fs_context *c)
 
         reply.std_tx.return_code = EC_FS_RC_OK;
         reply.std_tx.command_code = EC_FS_CC_DONE;
-        if (f->fts_info == FTS_ERR || f->fts_info == FTS_NS) {
+        if (ent.statp == NULL) {
             reply.type = EC_FS_TYPE_NONE;
             memset(&(reply.date), 0, sizeof(reply.date));
         } else {
-            reply.type = fs_mode_to_type(f->fts_statp->st_mode);
-            fs_write_date(&(reply.date), fs_get_birthtime(f));
+            reply.type = fs_mode_to_type(ent.statp->st_mode);
+            fs_write_date(&(reply.date), fs_get_birthtime(&ent));
         }
         fs_reply(c, &(reply.std_tx), sizeof(reply));
     }
@@ -161,12 +162,12 @@ fs_get_info(struct fs_context *c)
 
         reply.std_tx.return_code = EC_FS_RC_OK;
         reply.std_tx.command_code = EC_FS_CC_DONE;
-        if (f->fts_info == FTS_ERR || f->fts_info == FTS_NS) {
+        if (ent.statp == NULL) {
             reply.type = EC_FS_TYPE_NONE;
             memset(&(reply.meta), 0, sizeof(reply.meta));
         } else {
-            reply.type = fs_mode_to_type(f->fts_statp->st_mode);
-            fs_get_meta(f, &(reply.meta));
+            reply.type = fs_mode_to_type(ent.statp->st_mode);
+            fs_get_meta(&ent, &(reply.meta));
         }
         fs_reply(c, &(reply.std_tx), sizeof(reply));
     }
@@ -176,13 +177,13 @@ fs_get_info(struct fs_context *c)
 
         reply.std_tx.return_code = EC_FS_RC_OK;
         reply.std_tx.command_code = EC_FS_CC_DONE;
-        if (f->fts_info == FTS_ERR || f->fts_info == FTS_NS) {
+        if (ent.statp == NULL) {
             reply.type = EC_FS_TYPE_NONE;
             memset(&(reply.size), 0, sizeof(reply.size));
         } else {
-            reply.type = fs_mode_to_type(f->fts_statp->st_mode);
+            reply.type = fs_mode_to_type(ent.statp->st_mode);
             fs_write_val(reply.size,
-                f->fts_statp->st_size, sizeof(reply.size));
+                ent.statp->st_size, sizeof(reply.size));
         }
         fs_reply(c, &(reply.std_tx), sizeof(reply));
     }
@@ -191,9 +192,8 @@ fs_get_info(struct fs_context *c)
     {
         struct ec_fs_reply_info_dir reply;
 
-        if (f->fts_info == FTS_ERR || f->fts_info == FTS_NS) {
+        if (ent.statp == NULL) {
             fs_errno(c);
-            fts_close(ftsp);
             return;
         }
         reply.std_tx.return_code = EC_FS_RC_OK;
@@ -201,10 +201,11 @@ fs_get_info(struct fs_context *c)
         reply.undef0 = 0;
         reply.zero = 0;
         reply.ten = 10;
-        fs_acornify_name(f->fts_name);
-        if (f->fts_name[0] == '\0') strcpy(f->fts_name, "$");
-        strncpy(reply.dir_name, f->fts_name, sizeof(reply.dir_name));
-        strpad(reply.dir_name, ' ', sizeof(reply.dir_name));
+        strcpy(name, ent.name);
+        fs_acornify_name(name);
+        if (name[0] == '\0') strcpy(name, "$");
+        strpad(name, ' ', sizeof(reply.dir_name));
+        memcpy(reply.dir_name, name, sizeof(reply.dir_name));
         /* We now check ownership. See also fs_cat_header */
         /* if the path matches our urd then assume that we are the owner */
         /* and if not, then check if the user has priv, because they own */ 
@@ -233,16 +234,16 @@ fs_get_info(struct fs_context *c)
 
         reply.std_tx.return_code = EC_FS_RC_OK;
         reply.std_tx.command_code = EC_FS_CC_DONE;
-        if (f->fts_info == FTS_ERR || f->fts_info == FTS_NS) {
+        if (ent.statp == NULL) {
             reply.type = EC_FS_TYPE_NONE;
             memset(&(reply.sin), 0, sizeof(reply.sin));
             memset(&(reply.fsnum), 0, sizeof(reply.fsnum));
         } else {
-            reply.type = fs_mode_to_type(f->fts_statp->st_mode);
-            fs_write_val(reply.sin, fs_get_sin(f),
+            reply.type = fs_mode_to_type(ent.statp->st_mode);
+            fs_write_val(reply.sin, fs_get_sin(&ent),
                 sizeof(reply.sin));
             reply.disc = 0;
-            fs_write_val(reply.fsnum, f->fts_statp->st_dev,
+            fs_write_val(reply.fsnum, ent.statp->st_dev,
                 sizeof(reply.fsnum));
             fs_reply(c, &(reply.std_tx), sizeof(reply));
         }
@@ -254,14 +255,14 @@ fs_get_info(struct fs_context *c)
         memset(&reply, 0, sizeof(reply));
         reply.std_tx.return_code = EC_FS_RC_OK;
         reply.std_tx.command_code = EC_FS_CC_DONE;
-        if (f->fts_info == FTS_ERR || f->fts_info == FTS_NS) {
+        if (ent.statp == NULL) {
             reply.type = 0;
         } else {
-            reply.type = fs_mode_to_type(f->fts_statp->st_mode);
-            fs_get_meta(f, &(reply.meta));
-            fs_write_val(reply.size, f->fts_statp->st_size, sizeof(reply.size));
-            reply.access = fs_mode_to_access(f->fts_statp->st_mode);
-            fs_write_date(&(reply.date), f->fts_statp->st_ctime);
+            reply.type = fs_mode_to_type(ent.statp->st_mode);
+            fs_get_meta(&ent, &(reply.meta));
+            fs_write_val(reply.size, ent.statp->st_size, sizeof(reply.size));
+            reply.access = fs_mode_to_access(ent.statp->st_mode);
+            fs_write_date(&(reply.date), ent.statp->st_ctime);
         }
         fs_reply(c, &(reply.std_tx), sizeof(reply));
     }
@@ -269,21 +270,18 @@ fs_get_info(struct fs_context *c)
     default:
         fs_err(c, EC_FS_E_BADINFO);
     }
-    fts_close(ftsp);
-    free(upath);
 }
 
 void
 fs_set_info(struct fs_context *c)
 {
-    char *path, *upath, *path_argv[2];
+    char *path, *upath;
     struct ec_fs_req_set_info *request;
     struct ec_fs_reply reply;
     struct ec_fs_meta meta_in, meta_out;
     uint8_t access;
     int set_load = 0, set_exec = 0, set_access = 0;
-    FTS *ftsp;
-    FTSENT *f;
+    struct fs_ent ent;
 
     if (c->client == NULL) {
         fs_err(c, EC_FS_E_WHOAREYOU);
@@ -348,26 +346,23 @@ fs_set_info(struct fs_context *c)
     path[strcspn(path, "\r")] = '\0';
     if (debug) printf("%s]\n", path);
 
-    upath = fs_unixify_path(c, path); /* This must be freed */
+    upath = fs_unixify_path(c, path);
     if (upath == NULL) return;
     errno = 0;
-    path_argv[0] = upath;
-    path_argv[1] = NULL;
-    ftsp = fts_open(path_argv, FTS_LOGICAL, NULL);
-    f = fts_read(ftsp);
-    if (f->fts_info == FTS_ERR || f->fts_info == FTS_NS) {
+    fs_ent_stat(&ent, c->client, upath);
+    if (ent.statp == NULL) {
         fs_errno(c);
         goto out;
     }
     if (set_load || set_exec) {
-        fs_get_meta(f, &meta_out);
+        fs_get_meta(&ent, &meta_out);
         if (set_load)
             memcpy(meta_out.load_addr, meta_in.load_addr,
                    sizeof(meta_in.load_addr));
         if (set_exec)
             memcpy(meta_out.exec_addr, meta_in.exec_addr,
                    sizeof(meta_in.exec_addr));
-        if (!fs_set_meta(f, &meta_out)) {
+        if (!fs_set_meta(&ent, &meta_out)) {
             fs_errno(c);
             goto out;
         }
@@ -378,9 +373,10 @@ fs_set_info(struct fs_context *c)
      * directories, and NetFS and the Filer both do some rather
      * strange things with them.
      */
-    if (set_access && !S_ISDIR(f->fts_statp->st_mode)) {
+    if (set_access && !S_ISDIR(ent.statp->st_mode)) {
         /* XXX Should chose usergroup sensibly */
-        if (chmod(f->fts_accpath, fs_access_to_mode(access, 0)) != 0) {
+        if (fchmodat(ent.dirfd, ent.accpath,
+            fs_access_to_mode(access, 0), 0) != 0) {
             fs_errno(c);
             goto out;
         }
@@ -389,8 +385,7 @@ fs_set_info(struct fs_context *c)
     reply.command_code = EC_FS_CC_DONE;
     fs_reply(c, &reply, sizeof(reply));
 out:
-    fts_close(ftsp);
-    free(upath);
+    return;
 }
 
 void
@@ -436,25 +431,20 @@ fs_cat_header(struct fs_context *c)
 {
     struct ec_fs_req_cat_header *request;
     struct ec_fs_reply_cat_header reply;
-    char *upath, *path_argv[2];
-    char *oururd;
+    char *upath;
+    char name[NAME_MAX + 1];
     bool match; 
-    FTS *ftsp;
-    FTSENT *f;
+    struct fs_ent ent;
 
     request = (struct ec_fs_req_cat_header *)c->req;
     request->path[strcspn(request->path, "\r")] = '\0'; 
     if (debug) printf("catalogue header [%s]\n", request->path);
-    upath = fs_unixify_path(c, request->path); /* This must be freed */
+    upath = fs_unixify_path(c, request->path);
     if (upath == NULL) return;
     errno = 0;
-    path_argv[0] = upath;
-    path_argv[1] = NULL;
-    ftsp = fts_open(path_argv, FTS_LOGICAL, NULL);
-    f = fts_read(ftsp);
-    if (f->fts_info == FTS_ERR || f->fts_info == FTS_NS) {
+    fs_ent_stat(&ent, c->client, upath);
+    if (ent.statp == NULL) {
         fs_errno(c);
-        fts_close(ftsp);
         return;
     }
 
@@ -464,10 +454,11 @@ fs_cat_header(struct fs_context *c)
     strncpy(reply.csd_discname, discname, sizeof(reply.csd_discname));
     strpad(reply.csd_discname, '\0', sizeof(reply.csd_discname));
 
-    fs_acornify_name(f->fts_name);
-    if (f->fts_name[0] == '\0') strcpy(f->fts_name, "$");
-    strncpy(reply.dir_name, f->fts_name, sizeof(reply.dir_name));
-    strpad(reply.dir_name, ' ', sizeof(reply.dir_name));
+    strcpy(name, ent.name);
+    fs_acornify_name(name);
+    if (name[0] == '\0') strcpy(name, "$");
+    strpad(name, ' ', sizeof(reply.dir_name));
+    memcpy(reply.dir_name, name, sizeof(reply.dir_name));
 
     /* We now check ownership. See also EC_FS_GET_INFO_DIR */
     /*
@@ -475,10 +466,6 @@ fs_cat_header(struct fs_context *c)
        the users URD then assume
        that they are the owner (kludge for now).
      */
-    oururd = userfuncs->urd(c->client->login);
-    fs_acornify_name(oururd);
-    printf("/g users [%s], URD [%s]\n", c->client->login, oururd);
-
     match = fs_is_owner(c, upath);
     if (match == true) {
             reply.ownership[0] = 'O';
@@ -495,9 +482,6 @@ fs_cat_header(struct fs_context *c)
     memset(reply.spaces, ' ', sizeof(reply.spaces));
     memcpy(reply.cr80, "\r\x80", sizeof(reply.cr80));
     fs_reply(c, &(reply.std_tx), sizeof(reply));
-
-    fts_close(ftsp);
-    free(upath);
 }
 
 void
@@ -533,19 +517,19 @@ fs_get_users_on(struct fs_context *c)
         fs_err(c, EC_FS_E_WHOAREYOU);
         return;
     }
-    reply = malloc(sizeof(*reply) + (request->nusers * (2+11+1)));
+    reply = fs_alloc(c, sizeof(*reply) + (request->nusers * (2+11+1)));
     if (reply == NULL) {
         fs_err(c, EC_FS_E_NOMEM);
         return;
     }
-    ent = fs_clients.lh_first;
+    ent = TAILQ_FIRST(&fs_clients);
     for (i = 0; i < request->start && ent != NULL;
-         ent = ent->link.le_next) {
+         ent = TAILQ_NEXT(ent, link)) {
         i++;
     }
     p = (uint8_t *)reply->users;
     for (i = 0; i < request->nusers && ent != NULL;
-         ent = ent->link.le_next) {
+         ent = TAILQ_NEXT(ent, link)) {
         /*
          * The Econet System User Guide, and fs_proto.h, say
          * that this function returns a sequence of 13-byte
@@ -570,7 +554,6 @@ fs_get_users_on(struct fs_context *c)
     reply->std_tx.command_code = EC_FS_CC_DONE;
     reply->std_tx.return_code = EC_FS_RC_OK;
     fs_reply(c, &(reply->std_tx), p - (uint8_t *)reply);
-    free(reply);
 }
 
 void
@@ -587,9 +570,7 @@ fs_get_user(struct fs_context *c)
         fs_err(c, EC_FS_E_WHOAREYOU);
         return;
     }
-    for (ent = fs_clients.lh_first; ent != NULL; ent = ent->link.le_next)
-        if (!strcmp(request->user, ent->login))
-            break;
+    ent = fs_find_user(request->user);
     if (!ent) {
         reply.std_tx.command_code = EC_FS_CC_DONE;
         reply.std_tx.return_code = EC_FS_E_USERNOTON;
@@ -615,31 +596,33 @@ fs_delete(struct fs_context *c)
 void
 fs_delete1(struct fs_context *c, char *path)
 {
-    char *upath, *acornpath, *path_argv[2];
-    FTS *ftsp;
-    FTSENT *f;
+    char *upath, *acornpath;
+    const char *rel;
+    struct ec_fs_meta meta;
+    struct fs_ent ent;
     bool is_owner;
+    int dirfd;
 
     if (c->client == NULL) {
         fs_err(c, EC_FS_E_WHOAREYOU);
         return;
     }
     if ((upath = fs_unixify_path(c, path)) == NULL) return;
-    acornpath = malloc(10 + strlen(upath));
+    rel = fs_path_at(c->client, upath, &dirfd);
+    acornpath = fs_alloc(c, 10 + strlen(rel));
     if (acornpath == NULL) {
-        free(upath);
         fs_err(c, EC_FS_E_NOMEM);
         return;
     }
-    sprintf(acornpath, "%s/.Acorn", upath);
+    sprintf(acornpath, "%s/.Acorn", rel);
 
     is_owner = fs_is_owner(c, upath);  // Check for ownership
 
-    path_argv[0] = upath;
-    path_argv[1] = NULL;
-    ftsp = fts_open(path_argv, FTS_LOGICAL, NULL);
-    f = fts_read(ftsp);
-    if (f->fts_statp->st_mode & S_IXUSR)
+    if (fs_ent_stat(&ent, c->client, upath) == -1) {
+        fs_errno(c);
+        goto out;
+    }
+    if (ent.statp->st_mode & S_IXUSR)
     {
         // File is locked so report error and exit
         goto nodeleteallowed;
@@ -647,42 +630,42 @@ fs_delete1(struct fs_context *c, char *path)
     if (is_owner)
     {
         // Check we have write access to delete
-        if (!(f->fts_statp->st_mode & S_IWUSR))
+        if (!(ent.statp->st_mode & S_IWUSR))
         {
             goto noaccess;
         }
     } else {  // Not Owner so check if we have world write permissions
-        if (!(f->fts_statp->st_mode & S_IWOTH))
+        if (!(ent.statp->st_mode & S_IWOTH))
         {
             goto noaccess;
         }
     }
-    if (f->fts_info == FTS_ERR || f->fts_info == FTS_NS) {
-        fs_errno(c);
-        goto out;
-    } else if (S_ISDIR(f->fts_statp->st_mode)) {
-        rmdir(acornpath);
-        if (rmdir(upath) < 0) {
+    /*
+     * I'm not quite sure why it's necessary to return the metadata
+     * and size of something we've just deleted, but there we go.
+     * Extended attributes go with the file, so read them first.
+     */
+    if (c->req->function == EC_FS_FUNC_DELETE)
+        fs_get_meta(&ent, &meta);
+    if (S_ISDIR(ent.statp->st_mode)) {
+        unlinkat(dirfd, acornpath, AT_REMOVEDIR);
+        if (unlinkat(dirfd, rel, AT_REMOVEDIR) < 0) {
             fs_errno(c);
             goto out;
         }
     } else {
-        if (unlink(upath) < 0) {
+        if (unlinkat(dirfd, rel, 0) < 0) {
             fs_errno(c);
             goto out;
         }
     }
+    fs_pathcache_invalidate(upath);
     if (c->req->function == EC_FS_FUNC_DELETE) {
         struct ec_fs_reply_delete reply;
 
-        /*
-         * I'm not quite sure why it's necessary to return
-         * the metadata and size of something we've just
-         * deleted, but there we go.
-         */
-        fs_write_val(reply.size, f->fts_statp->st_size,
+        fs_write_val(reply.size, ent.statp->st_size,
             sizeof(reply.size));
-        fs_get_meta(f, &(reply.meta));
+        reply.meta = meta;
         reply.std_tx.command_code = EC_FS_CC_DONE;
         reply.std_tx.return_code = EC_FS_RC_OK;
         fs_reply(c, &(reply.std_tx), sizeof(reply));
@@ -693,24 +676,15 @@ fs_delete1(struct fs_context *c, char *path)
         reply.return_code = EC_FS_RC_OK;
         fs_reply(c, &reply, sizeof(reply));
     }
-    fs_del_meta(f);
+    fs_del_meta(&ent);
 out:
-    fts_close(ftsp);
-    free(acornpath);
-    free(upath);
     return;
 
 nodeleteallowed:
-    fts_close(ftsp);
-    free(acornpath);
-    free(upath);
     fs_err(c, EC_FS_E_LOCKED);
     return;    
 
 noaccess:
-    fts_close(ftsp);
-    free(acornpath);
-    free(upath);
     fs_err(c, EC_FS_E_NOACCESS);
     return;    
 }
@@ -735,7 +709,9 @@ fs_cdir1(struct fs_context *c, char *path)
 {
     struct ec_fs_reply reply;
     char *upath;
+    const char *rel;
     bool is_owner = false;
+    int dirfd;
 
     if (c->client == NULL) {
         fs_err(c, EC_FS_E_WHOAREYOU);
@@ -751,14 +727,15 @@ fs_cdir1(struct fs_context *c, char *path)
     }
 
     if (upath == NULL) return;
-    if (mkdir(upath, 0777) < 0) {
+    rel = fs_path_at(c->client, upath, &dirfd);
+    if (mkdirat(dirfd, rel, 0777) < 0) {
         fs_errno(c);
     } else {
+        fs_pathcache_invalidate(upath);
         reply.command_code = EC_FS_CC_DONE;
         reply.return_code = EC_FS_RC_OK;
         fs_reply(c, &reply, sizeof(reply));
     }
-    free(upath);
 }
 
 void
@@ -33,6 +33,10 @@
  * fs_nametrans.c -- File-name translation (Unix<->Acorn)
  */
 
+#if HAVE_CONFIG_H
+#include "config.h"
+#endif
+
 #include <sys/stat.h>
 #include <sys/types.h>
 
@@ -41,17 +45,63 @@
 #include <dirent.h>
 #include <err.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <libgen.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "extern.h"
 #include "fileserver.h"
 #include "fs_errors.h"
+#include "fs_internal.h"
+#include "fs_cost.h"
+
+static char *fs_translate_path(struct fs_context *, char *);
+static void fs_match_path(struct fs_context *, int, char *);
+static unsigned fs_pathcache_hash(const char *, const char *);
+static char *fs_pathcache_lookup(struct fs_context *, const char *,
+    const char *);
+static bool fs_pathcache_stat(struct fs_context *, char *, size_t,
+    struct stat *);
+static void fs_pathcache_insert(struct fs_context *, const char *,
+    const char *, char *, size_t);
 
-static char *fs_unhat_path(char *);
-static void fs_match_path(char *);
-static void fs_trans_simple(char *, char *);
+/*
+ * Cache of resolved paths.  Nearly every request passes a path
+ * through fs_unixify_path, and matching each component can cost
+ * several lstat()s and directory scans, but clients keep asking for
+ * the same few names.  Results are cached by base directory and
+ * Acorn path, along with the identity and modification time of each
+ * directory a component was looked up in, and an entry is only used
+ * while all of those are unchanged.  Renaming or replacing any of
+ * them, or adding a name that a component might now match instead,
+ * changes the directory above, so that catches changes made behind
+ * our back, through whatever path; changes we make ourselves call
+ * fs_pathcache_invalidate(), which drops just the entries that went
+ * through the directory concerned, in case the change fell within the
+ * resolution of the file system's clock.
+ */
+#define FS_PATHCACHE_SIZE	256
+
+struct fs_pathcache_dir {
+	dev_t dev;
+	ino_t ino;
+	time_t mtime;
+	long mtimensec;
+};
+
+struct fs_pathcache_ent {
+	char *base;		/* Base directory path */
+	char *path;		/* Acorn path relative to base */
+	char *upath;		/* Resolved Unix path, NULL if unused */
+	size_t skip;		/* Length of upath that wasn't looked up */
+	struct fs_pathcache_dir *dirs;	/* Holding each component */
+};
+
+static struct fs_pathcache_ent fs_pathcache[FS_PATHCACHE_SIZE];
+unsigned long fs_pathcache_hits, fs_pathcache_misses;
 
 /*
  * Convert a leaf name to Acorn style for presenting to the client.
@@ -78,6 +128,7 @@ fs_acornify_name(char *name)
 	else
 		name[len] = '\0';
 	if (debug) printf("->[%s]\n", name);
+	FS_TRACE(FS_TRACE_PATH, FS_TRACE_EV_ACORNIFY, 0, strlen(name), 0);
 	return name;
 }
 
@@ -115,25 +166,37 @@ fs_hidden_name(char *name)
 }
 
 /*
- * Convert a path provided by a client into a Unix one.  Note that the
- * new path is in a freshly mallocked block, and the caller is
- * responsible for freeing it.
+ * Convert a path provided by a client into a Unix one.  The new path
+ * is allocated from the request's arena (see fs_alloc), so it lasts
+ * until the request has been handled and needn't be freed.
  */
 char *
 fs_unixify_path(struct fs_context *c, char *path)
+{
+	char *upath;
+	int phase;
+
+	phase = FS_PHASE(FS_PHASE_PATH);
+	upath = fs_translate_path(c, path);
+	FS_PHASE_END(phase);
+	return upath;
+}
+
+static char *
+fs_translate_path(struct fs_context *c, char *path)
 {
 	const char *base;
-	int nnames;
-	char *urd = NULL, *csd = NULL, *lib = NULL;
-	size_t disclen;
+	int nnames, dirfd;
+	struct fs_handle *urd = NULL, *csd = NULL, *lib = NULL, *baseh;
+	size_t disclen, baselen, skip;
 	char *path2;
 	char *path3;
-	char *p, *q;
+	char *p, *q, *rel;
 
 	switch (c->req->function) {
 	default:
 		urd = c->req->urd ?
-		    c->client->handles[c->req->urd]->path : NULL;
+		    c->client->handles[c->req->urd] : NULL;
 		/* FALLTHROUGH */
 	case EC_FS_FUNC_LOAD:
 	case EC_FS_FUNC_LOAD_32:
@@ -143,30 +206,20 @@ fs_unixify_path(struct fs_context *c, char *path)
 	case EC_FS_FUNC_PUTBYTES:
 		/* In these calls, the URD is replaced by a port number */
 		csd = c->req->csd ?
-		    c->client->handles[c->req->csd]->path : NULL;
+		    c->client->handles[c->req->csd] : NULL;
 		lib = c->req->lib ?
-		    c->client->handles[c->req->lib]->path : NULL;
+		    c->client->handles[c->req->lib] : NULL;
 		/* FALLTHROUGH */
 	case EC_FS_FUNC_GETBYTE:
 	case EC_FS_FUNC_PUTBYTE:
 		/* And these ones don't pass context at all. */
 		break;
 	}
-	/*
-	 * Plenty of space.
-	 */
-	path2 = malloc((urd ? strlen(urd) : 0) + (csd ? strlen(csd) : 0) +
-		       (lib ? strlen(lib) : 0) +
-		       2 * strlen(path) + 100);
-	if (path == NULL) {
-		fs_err(c, EC_FS_E_NOMEM);
-		return NULL;
-	}
-
 	if (debug) printf("fs_unixify_path: [%s]", path);
 
 	/* By default, resolve things from the CSD. */
-	base = csd;
+	baseh = csd;
+	base = csd ? csd->path : NULL;
 	/*
 	 * Disc names can start with either ':' or '$', the latter
 	 * being an SJism.  In either case, this means paths are
@@ -178,11 +231,14 @@ fs_unixify_path(struct fs_context *c, char *path)
 		disclen = strcspn(path, ".");
 		if (disclen != strlen(discname) ||
 		    strncasecmp(path, discname, disclen) != 0) {
+			FS_TRACE(FS_TRACE_PATH, FS_TRACE_EV_PATH_FAIL, 0, 0,
+			    EC_FS_E_NOTFOUND);
 			fs_err(c, EC_FS_E_NOTFOUND);
 			return NULL;
 		}
 		path += disclen;
 		if (*path) path++;
+		baseh = NULL;
 		base = ".";
 	}
 	/*
@@ -195,22 +251,39 @@ fs_unixify_path(struct fs_context *c, char *path)
 		switch (path[0]) {
 		case '$':
 		case ':': /* SJ alias */
-			base = "."; break;
+			baseh = NULL; base = "."; break;
 		case '&':
-			base = urd; break;
+			baseh = urd; base = urd ? urd->path : NULL; break;
 		case '@':
-			base = csd; break;
+			baseh = csd; base = csd ? csd->path : NULL; break;
 		case '%':
-			base = lib; break;
+			baseh = lib; base = lib ? lib->path : NULL; break;
 		}
 		path++;
 		if (*path) path++;
 	}
 	if (base == NULL) {
-		free(path2);
+		FS_TRACE(FS_TRACE_PATH, FS_TRACE_EV_PATH_FAIL, 0, 0,
+		    EC_FS_E_CHANNEL);
 		fs_err(c, EC_FS_E_CHANNEL);
 		return NULL;
 	}
+	if ((path3 = fs_pathcache_lookup(c, base, path)) != NULL) {
+		if (debug) printf("->[%s] (cached, %lu%% hits)\n", path3,
+		    fs_pathcache_hits * 100 /
+		    (fs_pathcache_hits + fs_pathcache_misses));
+		FS_TRACE(FS_TRACE_PATH, FS_TRACE_EV_PATH_HIT, 0,
+		    strlen(path3), 0);
+		return path3;
+	}
+	/*
+	 * Plenty of space.
+	 */
+	path2 = fs_alloc(c, strlen(base) + 2 * strlen(path) + 100);
+	if (path2 == NULL) {
+		fs_err(c, EC_FS_E_NOMEM);
+		return NULL;
+	}
 	sprintf(path2, "%s/", base);
 
 	/*
@@ -236,19 +309,44 @@ fs_unixify_path(struct fs_context *c, char *path)
 		strcpy(path2, ".");
 
 	/*
-	 * Process every path component through fs_match_path.
+	 * Process every path component through fs_match_path.  If
+	 * the path still starts with the base directory (i.e. it
+	 * hasn't been unhatted out of it), that part is already
+	 * resolved, and the rest can be resolved relative to the
+	 * base handle's descriptor rather than from the root.
 	 */
 	for (p = path2, nnames = 1; *p; p++)
 		if (*p == '/')
 			nnames++;
-	path3 = malloc(20 * nnames + 10);
+	baselen = strlen(base);
+	path3 = fs_alloc(c, baselen + 20 * nnames + 10);
+	if (path3 == NULL) {
+		fs_err(c, EC_FS_E_NOMEM);
+		return NULL;
+	}
 	p = path2;
 	q = path3;
+	dirfd = AT_FDCWD;
+	if (strncmp(path2, base, baselen) == 0 &&
+	    (path2[baselen] == '/' || path2[baselen] == '\0')) {
+		memcpy(q, base, baselen);
+		p += baselen;
+		q += baselen;
+		if (*p) {
+			p++;
+			*q++ = '/';
+		}
+		if (baseh != NULL && (dirfd = fs_handle_dirfd(baseh)) == -1)
+			dirfd = AT_FDCWD;
+	}
+	/* Without the base's descriptor, resolve from the root. */
+	rel = (baseh != NULL && dirfd == AT_FDCWD) ? path3 : q;
+	skip = q - path3;
 	while (*p) {
 		char *r = p;
 		while (*p && *p != '/') p++;
 		sprintf(q, "%.*s", (int)(p-r), r);
-		fs_match_path(path3);
+		fs_match_path(c, dirfd, rel);
 		q += strlen(q);
 		if (*p) {
 			p++;
@@ -258,16 +356,163 @@ fs_unixify_path(struct fs_context *c, char *path)
 	*q = '\0';
 	if (debug) printf("->[%s]\n", path3);
 
-	free(path2);
-	path3 = realloc(path3, 1 + strlen(path3));
+	path3 = fs_realloc(c, path3, baselen + 20 * nnames + 10,
+	    1 + strlen(path3));
+	fs_pathcache_insert(c, base, path, path3, skip);
+	FS_TRACE(FS_TRACE_PATH, FS_TRACE_EV_PATH_MISS, 0, strlen(path3), 0);
 
 	return path3;
 }
 
+static unsigned
+fs_pathcache_hash(const char *base, const char *path)
+{
+	unsigned h = 2166136261U;
+
+	while (*base)
+		h = (h ^ (unsigned char)*base++) * 16777619U;
+	h = (h ^ '/') * 16777619U;
+	while (*path)
+		h = (h ^ (unsigned char)*path++) * 16777619U;
+	return h % FS_PATHCACHE_SIZE;
+}
+
 /*
- * Remove '/foo/^' constructs from a path
+ * Look up a resolved path in the cache.  Returns a copy, from the
+ * request's arena, of the Unix path, or NULL if there is no valid entry.
  */
 static char *
+fs_pathcache_lookup(struct fs_context *c, const char *base, const char *path)
+{
+	struct fs_pathcache_ent *e;
+	struct fs_pathcache_dir *d;
+	struct stat st;
+	char *upath, *p;
+
+	e = &fs_pathcache[fs_pathcache_hash(base, path)];
+	if (e->upath == NULL ||
+	    strcmp(e->path, path) != 0 || strcmp(e->base, base) != 0) {
+		fs_pathcache_misses++;
+		return NULL;
+	}
+	if ((upath = fs_strdup(c, e->upath)) == NULL)
+		return NULL;
+	d = e->dirs;
+	for (p = upath + e->skip; *p; p++) {
+		if (p != upath + e->skip && p[-1] != '/')
+			continue;
+		if (!fs_pathcache_stat(c, upath, p - upath, &st) ||
+		    st.st_dev != d->dev || st.st_ino != d->ino ||
+		    st.st_mtime != d->mtime ||
+		    FS_MTIME_NSEC(&st) != d->mtimensec) {
+			fs_pathcache_misses++;
+			return NULL;
+		}
+		d++;
+	}
+	fs_pathcache_hits++;
+	return upath;
+}
+
+/*
+ * Stat the directory holding the component of upath that starts at
+ * offset off.
+ */
+static bool
+fs_pathcache_stat(struct fs_context *c, char *upath, size_t off,
+    struct stat *st)
+{
+	const char *rel;
+	int dirfd, ret;
+
+	if (off == 0)
+		return stat(".", st) == 0;
+	upath[off - 1] = '\0';
+	rel = fs_path_at(c->client, upath, &dirfd);
+	ret = fstatat(dirfd, rel, st, 0);
+	upath[off - 1] = '/';
+	return ret == 0;
+}
+
+/*
+ * Cache upath, whose components from offset skip on were looked up,
+ * as the resolution of path from base.
+ */
+static void
+fs_pathcache_insert(struct fs_context *c, const char *base, const char *path,
+    char *upath, size_t skip)
+{
+	struct fs_pathcache_ent *e;
+	struct fs_pathcache_dir *d;
+	struct stat st;
+	char *p;
+	int ndirs;
+
+	e = &fs_pathcache[fs_pathcache_hash(base, path)];
+	free(e->base);
+	free(e->path);
+	free(e->upath);
+	free(e->dirs);
+	e->base = e->path = e->upath = NULL;
+	e->dirs = NULL;
+	for (p = upath + skip, ndirs = 0; *p; p++)
+		if (p == upath + skip || p[-1] == '/')
+			ndirs++;
+	if (ndirs > 0 &&
+	    (e->dirs = malloc(ndirs * sizeof(*e->dirs))) == NULL)
+		return;
+	d = e->dirs;
+	for (p = upath + skip; *p; p++) {
+		if (p != upath + skip && p[-1] != '/')
+			continue;
+		if (!fs_pathcache_stat(c, upath, p - upath, &st))
+			return;
+		d->dev = st.st_dev;
+		d->ino = st.st_ino;
+		d->mtime = st.st_mtime;
+		d->mtimensec = FS_MTIME_NSEC(&st);
+		d++;
+	}
+	e->base = strdup(base);
+	e->path = strdup(path);
+	e->upath = strdup(upath);
+	if (e->base == NULL || e->path == NULL || e->upath == NULL) {
+		free(e->upath);
+		e->upath = NULL;
+		return;
+	}
+	e->skip = skip;
+}
+
+/*
+ * Note that the directory holding upath has changed, and so any
+ * cached resolution that went through it might now be wrong.  A NULL
+ * upath means anything might have changed.
+ */
+void
+fs_pathcache_invalidate(const char *upath)
+{
+	struct fs_pathcache_ent *e;
+	const char *slash;
+	size_t len;
+
+	slash = upath ? strrchr(upath, '/') : NULL;
+	len = slash ? slash - upath : 0;
+	for (e = fs_pathcache; e < fs_pathcache + FS_PATHCACHE_SIZE; e++) {
+		if (e->upath == NULL)
+			continue;
+		if (slash != NULL && (strncmp(e->upath, upath, len) != 0 ||
+		    e->upath[len] != '/'))
+			continue;
+		free(e->upath);
+		e->upath = NULL;
+	}
+}
+
+/*
+ * Remove '/foo/^' constructs from a path
+ */
+char *
 fs_unhat_path(char *path)
 {
 	char *p, *q;
@@ -323,7 +568,7 @@ wcfrag(char *frag, char *file)
 	return true;
 }
 
-static bool
+bool
 wcmatch(char *wc, char *file, int len)
 {
 	char *fragend;
@@ -372,15 +617,18 @@ wcmatch(char *wc, char *file, int len)
  *  - case-insensitively matching
  *  - wildcard matching (we just return the first match)
  *  - appending ,??? for a RISC OS file type
+ *
+ * 'path' is relative to the directory open on 'dirfd'.
  */
 static void
-fs_match_path(char *path)
+fs_match_path(struct fs_context *c, int dirfd, char *path)
 {
 	struct stat st;
 	char *pathcopy, *parentpath, *leaf, *wc;
 	DIR *parent;
 	struct dirent *dp;
 	size_t leaflen;
+	int fd;
 
 	leaf = strrchr(path, '/');
 	if (leaf)
@@ -393,12 +641,17 @@ fs_match_path(char *path)
 		leaf[leaflen] = '\0';
 	}
 
-	if (lstat(path, &st) == -1 && errno == ENOENT) {
-		pathcopy = strdup(path);
+	if (fstatat(dirfd, path, &st, AT_SYMLINK_NOFOLLOW) == -1 &&
+	    errno == ENOENT) {
+		pathcopy = fs_strdup(c, path);
+		if (pathcopy == NULL)
+			return;
 		parentpath = dirname(pathcopy);
-		parent = opendir(parentpath);
-		if (parent == NULL) {
-			free(pathcopy);
+		fd = openat(dirfd, parentpath, O_RDONLY | O_DIRECTORY);
+		if (fd == -1)
+			return;
+		if ((parent = fdopendir(fd)) == NULL) {
+			close(fd);
 			return;
 		}
 		wc = leaf;
@@ -423,7 +676,6 @@ fs_match_path(char *path)
                 	}
 		}
 		closedir(parent);
-		free(pathcopy);
 	}
 }
 
@@ -432,7 +684,7 @@ fs_match_path(char *path)
  * at the front of any pathname starting with a dot. (That protects
  * '.', '..' and '.Acorn'.)
  */
-static void
+void
 fs_trans_simple(char *pathret, char *path)
 {
 	/*
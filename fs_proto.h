@@ -811,4 +811,55 @@ struct ec_fs_reply_open_32 {
 	u_int8_t size1[4];	/* Extent on disk? */
 };
 
+/*
+ * Names of the functions above, for diagnostics.
+ */
+#define EC_FS_FUNC_NAMES {				\
+	[EC_FS_FUNC_CLI] = "CLI",			\
+	[EC_FS_FUNC_SAVE] = "SAVE",			\
+	[EC_FS_FUNC_LOAD] = "LOAD",			\
+	[EC_FS_FUNC_EXAMINE] = "EXAMINE",		\
+	[EC_FS_FUNC_CAT_HEADER] = "CAT_HEADER",		\
+	[EC_FS_FUNC_LOAD_COMMAND] = "LOAD_COMMAND",	\
+	[EC_FS_FUNC_OPEN] = "OPEN",			\
+	[EC_FS_FUNC_CLOSE] = "CLOSE",			\
+	[EC_FS_FUNC_GETBYTE] = "GETBYTE",		\
+	[EC_FS_FUNC_PUTBYTE] = "PUTBYTE",		\
+	[EC_FS_FUNC_GETBYTES] = "GETBYTES",		\
+	[EC_FS_FUNC_PUTBYTES] = "PUTBYTES",		\
+	[EC_FS_FUNC_GET_ARGS] = "GET_ARGS",		\
+	[EC_FS_FUNC_SET_ARGS] = "SET_ARGS",		\
+	[EC_FS_FUNC_GET_DISCS] = "GET_DISCS",		\
+	[EC_FS_FUNC_GET_USERS_ON] = "GET_USERS_ON",	\
+	[EC_FS_FUNC_GET_TIME] = "GET_TIME",		\
+	[EC_FS_FUNC_GET_EOF] = "GET_EOF",		\
+	[EC_FS_FUNC_GET_INFO] = "GET_INFO",		\
+	[EC_FS_FUNC_SET_INFO] = "SET_INFO",		\
+	[EC_FS_FUNC_DELETE] = "DELETE",			\
+	[EC_FS_FUNC_GET_UENV] = "GET_UENV",		\
+	[EC_FS_FUNC_SET_OPT4] = "SET_OPT4",		\
+	[EC_FS_FUNC_LOGOFF] = "LOGOFF",			\
+	[EC_FS_FUNC_GET_USER] = "GET_USER",		\
+	[EC_FS_FUNC_GET_VERSION] = "GET_VERSION",	\
+	[EC_FS_FUNC_GET_DISC_FREE] = "GET_DISC_FREE",	\
+	[EC_FS_FUNC_CDIRN] = "CDIRN",			\
+	[EC_FS_FUNC_SET_TIME] = "SET_TIME",		\
+	[EC_FS_FUNC_CREATE] = "CREATE",			\
+	[EC_FS_FUNC_GET_USER_FREE] = "GET_USER_FREE",	\
+	[EC_FS_FUNC_SET_USER_FREE] = "SET_USER_FREE",	\
+	[EC_FS_FUNC_WHO_AM_I] = "WHO_AM_I",		\
+	[EC_FS_FUNC_USERS_EXT] = "USERS_EXT",		\
+	[EC_FS_FUNC_USER_INFO_EXT] = "USER_INFO_EXT",	\
+	[EC_FS_FUNC_COPY_DATA] = "COPY_DATA",		\
+	[EC_FS_FUNC_SAVE_32] = "SAVE_32",		\
+	[EC_FS_FUNC_CREATE_32] = "CREATE_32",		\
+	[EC_FS_FUNC_LOAD_32] = "LOAD_32",		\
+	[EC_FS_FUNC_GET_ARGS_32] = "GET_ARGS_32",	\
+	[EC_FS_FUNC_SET_ARGS_32] = "SET_ARGS_32",	\
+	[EC_FS_FUNC_GETBYTES_32] = "GETBYTES_32",	\
+	[EC_FS_FUNC_PUTBYTES_32] = "PUTBYTES_32",	\
+	[EC_FS_FUNC_EXAMINE_32] = "EXAMINE_32",		\
+	[EC_FS_FUNC_OPEN_32] = "OPEN_32",		\
+}
+
 #endif
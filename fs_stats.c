@@ -0,0 +1,1011 @@
+/*-
+ * Copyright (c) 2010 Simon Tatham
+ * Copyright (c) 2010 Ben Harris
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/*
+ * Request statistics.
+ *
+ * Every request is timed, and the time goes into a histogram for its
+ * function code, and for *commands also one for the command.  The
+ * histograms are log-linear: each power of two of microseconds is
+ * split into FS_HIST_SUB buckets, so percentiles come out within
+ * 25% or so whatever the scale, for a fixed and small cost per
+ * request.  There are also totals for each station, and the
+ * transport's and caches' counters are reported alongside.
+ *
+ * If a stats file is configured, a snapshot is written to it every
+ * so often in the Prometheus text format, for monitoring to scrape.
+ * *STATS gives a privileged user a summary.
+ *
+ * For the slow request log, the time within a request is also split
+ * into phases (see enum fs_phase).  FS_PHASE() switches to a new
+ * phase, charging the time since the last switch to the old one, and
+ * FS_PHASE_END() switches back, so phases nest: fs_get_meta() called
+ * while building an EXAMINE reply counts as filesystem time, not
+ * encoding.  A request slower than fs_slow_ms is logged with its
+ * phases and arguments, at most fs_slow_rate times a minute, and one
+ * slower than fs_slow_trace_ms goes to the slow trace file as Chrome
+ * trace events, for chrome://tracing or Perfetto to show.  None of
+ * this costs anything beyond a test of fs_phase_on unless one of them
+ * is configured.
+ *
+ * If a costs file is configured, the system calls and allocations
+ * counted by fs_cost.h are charged to each request's function, in the
+ * same sort of histogram, and a table of the mean and 99th percentile
+ * of each is written to the file along with the snapshot.
+ */
+
+#if HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <sys/types.h>
+
+#include <ctype.h>
+#include <err.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "aun.h"
+#include "extern.h"
+#include "fs_proto.h"
+#include "fileserver.h"
+#include "fs_hist.h"
+
+#define FS_STATS_COMMANDS	32
+#define FS_SLOW_SEGS		256	/* Phase switches kept for tracing */
+#define FS_SLOW_ARGS		64	/* Bytes of request kept for logging */
+
+struct fs_stats_stn {
+	uint64_t requests;
+	uint64_t errors;
+	uint64_t bytes_in;	/* Requests, not counting data ports */
+	uint64_t bytes_out;	/* Replies, ditto */
+	uint64_t usec;
+};
+
+struct fs_stats_row {
+	char name[16];
+	const struct fs_hist *h;
+};
+
+char *fs_stats_file;
+int fs_stats_interval = 10;	/* Seconds between snapshots */
+int fs_slow_ms = -1;		/* Log requests slower than this; -1 for none */
+int fs_slow_rate = 10;		/* Most requests to log in a minute */
+char *fs_slow_trace_file;
+int fs_slow_trace_ms = 0;
+bool fs_phase_on;
+char *fs_cost_file;
+bool fs_cost_on;
+uint64_t fs_cost_cur[FS_COST_MAX];	/* Counts for the current request */
+
+static const char *const fs_phase_names[FS_PHASE_MAX] = {
+    [FS_PHASE_PARSE] = "parse",
+    [FS_PHASE_PATH] = "path",
+    [FS_PHASE_FS] = "fs",
+    [FS_PHASE_ENCODE] = "encode",
+    [FS_PHASE_XMIT] = "xmit",
+};
+
+static const char *const fs_cost_names[FS_COST_MAX] = {
+    [FS_COST_STAT] = "stat",
+    [FS_COST_OPEN] = "open",
+    [FS_COST_CLOSE] = "close",
+    [FS_COST_READDIR] = "readdir",
+    [FS_COST_READLINK] = "readlink",
+    [FS_COST_XATTR] = "xattr",
+    [FS_COST_READ] = "read",
+    [FS_COST_WRITE] = "write",
+    [FS_COST_SEEK] = "seek",
+    [FS_COST_CHANGE] = "change",
+    [FS_COST_SYSCALLS] = "syscalls",
+    [FS_COST_MALLOC] = "malloc",
+    [FS_COST_ARENA] = "arena",
+    [FS_COST_IO_BYTES] = "io-bytes",
+    [FS_COST_HEAP_BYTES] = "heap-bytes",
+    [FS_COST_ARENA_BYTES] = "arena-bytes",
+    [FS_COST_PACKETS] = "packets",
+};
+
+static const char *const fs_stats_funcnames[] = EC_FS_FUNC_NAMES;
+
+static struct fs_hist fs_stats_func[256];
+static struct {
+	const char *name;	/* From fs_cli's table, so not copied */
+	struct fs_hist h;
+} fs_stats_cmd[FS_STATS_COMMANDS];
+static int fs_stats_ncmds;
+static struct fs_stats_stn *fs_stats_net[256];	/* By network, then station */
+static time_t fs_stats_started, fs_stats_written;
+/*
+ * For each function, FS_COST_MAX histograms of what its requests cost,
+ * allocated when first needed.  usec is the total, and errors unused.
+ */
+static struct fs_hist *fs_cost_func[256];
+
+/* The request being handled */
+static uint64_t fs_stats_t0;
+static struct fs_hist *fs_stats_curcmd;
+static const char *fs_stats_curname;
+static bool fs_stats_secret;	/* Don't log its arguments */
+static size_t fs_stats_out;
+static int fs_stats_rc;
+static uint64_t fs_cost_packets;	/* Packet count when it arrived */
+
+/* Its phases */
+static int fs_phase_cur;
+static uint64_t fs_phase_since;
+static uint64_t fs_phase_ns[FS_PHASE_MAX];
+static struct {
+	int phase;
+	uint64_t start, ns;
+} fs_phase_seg[FS_SLOW_SEGS];
+static int fs_phase_nseg;
+static unsigned char fs_slow_req[FS_SLOW_ARGS];
+static size_t fs_slow_reqlen;
+
+static FILE *fs_slow_trace;
+static int fs_slow_pid;
+static time_t fs_slow_window;	/* Start of the current minute */
+static int fs_slow_logged;
+static unsigned long fs_slow_dropped;
+
+static uint64_t fs_stats_clock(void);
+static void fs_phase_switch(int);
+static const char *fs_stats_funcname(int);
+static void fs_slow_name(char *, size_t, int);
+static void fs_slow_args(char *, size_t);
+static void fs_slow_msg(const char *, ...);
+static void fs_slow_log(struct fs_context *, uint64_t);
+static void fs_slow_json(FILE *, const char *);
+static void fs_slow_event(struct fs_context *, uint64_t);
+static int fs_stats_rows(struct fs_stats_row *, bool);
+static int fs_stats_rowcmp(const void *, const void *);
+static int fs_stats_pct(unsigned long, unsigned long);
+static size_t fs_stats_line(char *, size_t, size_t, const char *, ...);
+static void fs_stats_dump_hists(FILE *, const char *, const char *,
+    struct fs_stats_row *, int);
+static void fs_stats_dump_stns(FILE *, const char *, const char *, size_t);
+static void fs_stats_dump(FILE *);
+static void fs_cost_end(int);
+static void fs_cost_dump(FILE *);
+static void fs_stats_write(const char *, void (*)(FILE *));
+
+/* Nanoseconds since some arbitrary point */
+static uint64_t
+fs_stats_clock(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* The name of a function, or NULL if we don't know it */
+static const char *
+fs_stats_funcname(int func)
+{
+
+    if (func < sizeof(fs_stats_funcnames) / sizeof(fs_stats_funcnames[0]))
+        return fs_stats_funcnames[func];
+    return NULL;
+}
+
+void
+fs_stats_init(void)
+{
+
+    fs_stats_started = fs_stats_written = fs_slow_window = time(NULL);
+    if (fs_slow_trace_file != NULL) {
+        if ((fs_slow_trace = fopen(fs_slow_trace_file, "w")) == NULL)
+            warn("%s", fs_slow_trace_file);
+        else
+            /* Viewers don't mind the closing bracket being missing. */
+            fprintf(fs_slow_trace, "[\n");
+        fs_slow_pid = getpid();
+    }
+    fs_phase_on = fs_slow_ms >= 0 || fs_slow_trace != NULL;
+    fs_cost_on = fs_cost_file != NULL;
+}
+
+/*
+ * Start timing a request.
+ */
+void
+fs_stats_begin(struct fs_context *c)
+{
+
+    fs_stats_t0 = fs_stats_clock();
+    fs_stats_curcmd = NULL;
+    fs_stats_curname = NULL;
+    fs_stats_secret = false;
+    fs_stats_out = 0;
+    fs_stats_rc = EC_FS_RC_OK;
+    if (fs_phase_on) {
+        memset(fs_phase_ns, 0, sizeof(fs_phase_ns));
+        fs_phase_nseg = 0;
+        fs_phase_cur = FS_PHASE_PARSE;
+        fs_phase_since = fs_stats_t0;
+        fs_slow_reqlen = c->req_len < FS_SLOW_ARGS ? c->req_len : FS_SLOW_ARGS;
+        memcpy(fs_slow_req, c->req, fs_slow_reqlen);
+    }
+    if (fs_cost_on) {
+        memset(fs_cost_cur, 0, sizeof(fs_cost_cur));
+        fs_cost_packets = aun_stats.rx_packets + aun_stats.tx_packets;
+    }
+}
+
+/*
+ * Note which *command the current request is.  name must last as long
+ * as we do.  If secret is set, the rest of the command line (a
+ * password, say) isn't logged.
+ */
+void
+fs_stats_command(const char *name, bool secret)
+{
+    int i;
+
+    fs_stats_curname = name;
+    fs_stats_secret = secret;
+
+    for (i = 0; i < fs_stats_ncmds; i++)
+        if (fs_stats_cmd[i].name == name)
+            break;
+    if (i == fs_stats_ncmds) {
+        if (i == FS_STATS_COMMANDS)
+            return;
+        fs_stats_cmd[i].name = name;
+        fs_stats_ncmds++;
+    }
+    fs_stats_curcmd = &fs_stats_cmd[i].h;
+}
+
+/*
+ * Note a reply to the current request.
+ */
+void
+fs_stats_reply(size_t len, int rc)
+{
+
+    fs_stats_out += len;
+    if (rc != EC_FS_RC_OK)
+        fs_stats_rc = rc;
+}
+
+/*
+ * The current request is finished.  Add it to the totals.
+ */
+void
+fs_stats_end(struct fs_context *c)
+{
+    struct fs_stats_stn *s;
+    uint64_t ns, usec;
+    uint8_t stn[2];
+    bool failed = fs_stats_rc != EC_FS_RC_OK;
+
+    if (fs_phase_on) {
+        fs_phase_switch(FS_PHASE_PARSE);
+        ns = fs_phase_since - fs_stats_t0;
+    } else
+        ns = fs_stats_clock() - fs_stats_t0;
+    usec = ns / 1000;
+    if (fs_phase_on) {
+        if (fs_slow_ms >= 0 && usec >= (uint64_t)fs_slow_ms * 1000)
+            fs_slow_log(c, ns);
+        if (fs_slow_trace != NULL &&
+            usec >= (uint64_t)fs_slow_trace_ms * 1000)
+            fs_slow_event(c, ns);
+    }
+    fs_hist_add(&fs_stats_func[c->req->function], usec, failed);
+    if (fs_stats_curcmd != NULL)
+        fs_hist_add(fs_stats_curcmd, usec, failed);
+    if (fs_cost_on)
+        fs_cost_end(c->req->function);
+
+    aunfuncs->get_stn(c->from, stn);
+    if (fs_stats_net[stn[1]] == NULL &&
+        (fs_stats_net[stn[1]] = calloc(256, sizeof(*s))) == NULL)
+        return;
+    s = &fs_stats_net[stn[1]][stn[0]];
+    s->requests++;
+    if (failed)
+        s->errors++;
+    s->bytes_in += c->req_len;
+    s->bytes_out += fs_stats_out;
+    s->usec += usec;
+}
+
+/*
+ * Charge what the current request cost to its function.
+ */
+static void
+fs_cost_end(int func)
+{
+    struct fs_hist *h;
+    int i;
+
+    fs_cost_cur[FS_COST_PACKETS] =
+        aun_stats.rx_packets + aun_stats.tx_packets - fs_cost_packets;
+    if (fs_cost_func[func] == NULL &&
+        (fs_cost_func[func] = calloc(FS_COST_MAX, sizeof(*h))) == NULL)
+        return;
+    h = fs_cost_func[func];
+    for (i = 0; i < FS_COST_MAX; i++)
+        fs_hist_add(&h[i], fs_cost_cur[i], false);
+}
+
+/*
+ * What fs_cost.h uses in place of the allocators, and to count the
+ * bytes read() and write() move.  This file doesn't include fs_cost.h,
+ * so the calls in here are the real ones.
+ */
+ssize_t
+fs_cost_io(ssize_t n)
+{
+
+    if (n > 0)
+        FS_COST_ADD(FS_COST_IO_BYTES, n);
+    return n;
+}
+
+void *
+fs_cost_malloc(size_t size)
+{
+
+    FS_COST(FS_COST_MALLOC);
+    FS_COST_ADD(FS_COST_HEAP_BYTES, size);
+    return malloc(size);
+}
+
+void *
+fs_cost_calloc(size_t n, size_t size)
+{
+
+    FS_COST(FS_COST_MALLOC);
+    FS_COST_ADD(FS_COST_HEAP_BYTES, n * size);
+    return calloc(n, size);
+}
+
+void *
+fs_cost_realloc(void *p, size_t size)
+{
+
+    FS_COST(FS_COST_MALLOC);
+    FS_COST_ADD(FS_COST_HEAP_BYTES, size);
+    return realloc(p, size);
+}
+
+char *
+fs_cost_strdup(const char *s)
+{
+
+    FS_COST(FS_COST_MALLOC);
+    FS_COST_ADD(FS_COST_HEAP_BYTES, strlen(s) + 1);
+    return strdup(s);
+}
+
+/*
+ * Charge the time since the last switch to the current phase, and
+ * start on a new one.
+ */
+static void
+fs_phase_switch(int phase)
+{
+    uint64_t now = fs_stats_clock();
+
+    fs_phase_ns[fs_phase_cur] += now - fs_phase_since;
+    if (fs_phase_nseg < FS_SLOW_SEGS && now > fs_phase_since) {
+        fs_phase_seg[fs_phase_nseg].phase = fs_phase_cur;
+        fs_phase_seg[fs_phase_nseg].start = fs_phase_since;
+        fs_phase_seg[fs_phase_nseg].ns = now - fs_phase_since;
+        fs_phase_nseg++;
+    }
+    fs_phase_cur = phase;
+    fs_phase_since = now;
+}
+
+/*
+ * Enter a phase, returning the one to go back to with fs_phase_leave.
+ * Use FS_PHASE() and FS_PHASE_END() rather than calling these
+ * directly.
+ */
+int
+fs_phase_enter(int phase)
+{
+    int prev = fs_phase_cur;
+
+    if (phase != prev)
+        fs_phase_switch(phase);
+    return prev;
+}
+
+void
+fs_phase_leave(int prev)
+{
+
+    if (prev != fs_phase_cur)
+        fs_phase_switch(prev);
+}
+
+/*
+ * What to call the current request: its function, or its command.
+ */
+static void
+fs_slow_name(char *buf, size_t size, int func)
+{
+
+    if (fs_stats_curname != NULL)
+        snprintf(buf, size, "*%s", fs_stats_curname);
+    else if (fs_stats_funcname(func) != NULL)
+        snprintf(buf, size, "%s", fs_stats_funcname(func));
+    else
+        snprintf(buf, size, "function %d", func);
+}
+
+/*
+ * Describe the current request's arguments: its handles, and the rest
+ * of the request as a string, with anything unprintable escaped.
+ */
+static void
+fs_slow_args(char *buf, size_t size)
+{
+    struct ec_fs_req *req = (struct ec_fs_req *)fs_slow_req;
+    size_t i, len;
+    int n;
+
+    if (fs_slow_reqlen < offsetof(struct ec_fs_req, data)) {
+        snprintf(buf, size, "(short request)");
+        return;
+    }
+    n = snprintf(buf, size, "urd=%d csd=%d lib=%d",
+        req->urd, req->csd, req->lib);
+    if (n < 0 || n >= size)
+        return;
+    len = n;
+    if (fs_stats_secret) {
+        snprintf(buf + len, size - len, " \"%s <hidden>\"",
+            fs_stats_curname);
+        return;
+    }
+    if (size - len < 3)
+        return;
+    buf[len++] = ' ';
+    buf[len++] = '"';
+    for (i = offsetof(struct ec_fs_req, data);
+         i < fs_slow_reqlen && size - len > 6; i++) {
+        if (isprint(fs_slow_req[i]) && fs_slow_req[i] != '"' &&
+            fs_slow_req[i] != '\\')
+            buf[len++] = fs_slow_req[i];
+        else
+            len += snprintf(buf + len, size - len, "\\x%02x",
+                fs_slow_req[i]);
+    }
+    snprintf(buf + len, size - len, "\"%s",
+        fs_slow_reqlen == FS_SLOW_ARGS ? "..." : "");
+}
+
+static void
+fs_slow_msg(const char *fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    if (using_syslog)
+        vsyslog(LOG_NOTICE, fmt, ap);
+    else
+        vwarnx(fmt, ap);
+    va_end(ap);
+}
+
+/*
+ * Log a slow request, unless we've already logged fs_slow_rate this
+ * minute.
+ */
+static void
+fs_slow_log(struct fs_context *c, uint64_t ns)
+{
+    char name[32], args[FS_SLOW_ARGS * 4 + 64], phases[128];
+    time_t now = time(NULL);
+    size_t len = 0;
+    int i;
+
+    if (now - fs_slow_window >= 60) {
+        if (fs_slow_dropped > 0)
+            fs_slow_msg("%lu more slow requests not logged",
+                fs_slow_dropped);
+        fs_slow_window = now;
+        fs_slow_logged = 0;
+        fs_slow_dropped = 0;
+    }
+    if (fs_slow_logged >= fs_slow_rate) {
+        fs_slow_dropped++;
+        return;
+    }
+    fs_slow_logged++;
+    for (i = 0; i < FS_PHASE_MAX && len < sizeof(phases); i++)
+        len += snprintf(phases + len, sizeof(phases) - len, "%s%s %.2f",
+            i ? ", " : "", fs_phase_names[i], fs_phase_ns[i] / 1e6);
+    fs_slow_name(name, sizeof(name), c->req->function);
+    fs_slow_args(args, sizeof(args));
+    fs_slow_msg("slow request: %s from %s took %.2fms (%s) %s", name,
+        aunfuncs->ntoa(c->from), ns / 1e6, phases, args);
+}
+
+/* Write s as the inside of a JSON string */
+static void
+fs_slow_json(FILE *f, const char *s)
+{
+
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\')
+            fprintf(f, "\\%c", *s);
+        else if ((unsigned char)*s < 0x20)
+            fprintf(f, "\\u%04x", (unsigned char)*s);
+        else
+            putc(*s, f);
+    }
+}
+
+/*
+ * Add the current request to the slow trace file, as a Chrome trace
+ * event with its phases inside it.  Each station gets a thread of its
+ * own.
+ */
+static void
+fs_slow_event(struct fs_context *c, uint64_t ns)
+{
+    char name[32], args[FS_SLOW_ARGS * 4 + 64];
+    uint8_t stn[2];
+    int i, tid;
+
+    aunfuncs->get_stn(c->from, stn);
+    tid = stn[1] << 8 | stn[0];
+    fs_slow_name(name, sizeof(name), c->req->function);
+    fs_slow_args(args, sizeof(args));
+    fprintf(fs_slow_trace, "{\"name\":\"");
+    fs_slow_json(fs_slow_trace, name);
+    fprintf(fs_slow_trace, "\",\"cat\":\"request\",\"ph\":\"X\","
+        "\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,"
+        "\"args\":{\"from\":\"", fs_slow_pid, tid,
+        fs_stats_t0 / 1e3, ns / 1e3);
+    fs_slow_json(fs_slow_trace, aunfuncs->ntoa(c->from));
+    fprintf(fs_slow_trace, "\",\"request\":\"");
+    fs_slow_json(fs_slow_trace, args);
+    fprintf(fs_slow_trace, "\",\"return_code\":%d", fs_stats_rc);
+    for (i = 0; i < FS_PHASE_MAX; i++)
+        fprintf(fs_slow_trace, ",\"%s_ms\":%.3f", fs_phase_names[i],
+            fs_phase_ns[i] / 1e6);
+    fprintf(fs_slow_trace, "}},\n");
+    for (i = 0; i < fs_phase_nseg; i++)
+        fprintf(fs_slow_trace, "{\"name\":\"%s\",\"cat\":\"phase\","
+            "\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f},\n",
+            fs_phase_names[fs_phase_seg[i].phase], fs_slow_pid, tid,
+            fs_phase_seg[i].start / 1e3, fs_phase_seg[i].ns / 1e3);
+}
+
+/*
+ * Collect the functions, or the commands, that have been used.
+ */
+static int
+fs_stats_rows(struct fs_stats_row *rows, bool commands)
+{
+    int i, n = 0;
+
+    if (commands) {
+        for (i = 0; i < fs_stats_ncmds; i++) {
+            snprintf(rows[n].name, sizeof(rows[n].name), "%s",
+                fs_stats_cmd[i].name);
+            rows[n++].h = &fs_stats_cmd[i].h;
+        }
+    } else {
+        for (i = 0; i < 256; i++) {
+            if (fs_stats_func[i].count == 0)
+                continue;
+            if (fs_stats_funcname(i) != NULL)
+                snprintf(rows[n].name, sizeof(rows[n].name), "%s",
+                    fs_stats_funcname(i));
+            else
+                snprintf(rows[n].name, sizeof(rows[n].name), "func-%d", i);
+            rows[n++].h = &fs_stats_func[i];
+        }
+    }
+    return n;
+}
+
+/* Busiest first */
+static int
+fs_stats_rowcmp(const void *a, const void *b)
+{
+    const struct fs_stats_row *ra = a, *rb = b;
+
+    if (ra->h->count != rb->h->count)
+        return ra->h->count > rb->h->count ? -1 : 1;
+    return strcmp(ra->name, rb->name);
+}
+
+static int
+fs_stats_pct(unsigned long hits, unsigned long misses)
+{
+
+    if (hits + misses == 0)
+        return 0;
+    return (int)((unsigned long long)hits * 100 / (hits + misses));
+}
+
+/*
+ * Append a line to the *STATS reply in buf, if it fits with room for
+ * the terminator, and return the new length.
+ */
+static size_t
+fs_stats_line(char *buf, size_t size, size_t len, const char *fmt, ...)
+{
+    va_list ap;
+    int n;
+
+    va_start(ap, fmt);
+    n = vsnprintf(buf + len, size - len, fmt, ap);
+    va_end(ap);
+    if (n < 0 || len + n + 2 > size) {
+        buf[len] = '\0';
+        return len;
+    }
+    buf[len + n] = '\r';
+    return len + n + 1;
+}
+
+/*
+ * Write a summary for *STATS into buf, as lines ending in CR and
+ * finishing with 0x80 like *INFO.  After the totals come the busiest
+ * functions, or commands, as many as will fit.  Returns the length.
+ */
+size_t
+fs_stats_report(char *buf, size_t size, bool commands)
+{
+    struct fs_stats_row rows[256];
+    uint64_t requests = 0, errors = 0;
+    long up = time(NULL) - fs_stats_started;
+    size_t len;
+    int i, n;
+
+    for (i = 0; i < 256; i++) {
+        requests += fs_stats_func[i].count;
+        errors += fs_stats_func[i].errors;
+    }
+    len = fs_stats_line(buf, size, 0,
+        "Up %ld:%02ld:%02ld, %llu req, %llu err",
+        up / 3600, up / 60 % 60, up % 60,
+        (unsigned long long)requests, (unsigned long long)errors);
+    len = fs_stats_line(buf, size, len, "Hit%%: path %d meta %d dir %d",
+        fs_stats_pct(fs_pathcache_hits, fs_pathcache_misses),
+        fs_stats_pct(fs_metacache_hits, fs_metacache_misses),
+        fs_stats_pct(fs_dircache_hits, fs_dircache_misses));
+    len = fs_stats_line(buf, size, len,
+        "Pkts: in %llu out %llu retx %llu t/o %llu",
+        (unsigned long long)aun_stats.rx_packets,
+        (unsigned long long)aun_stats.tx_packets,
+        (unsigned long long)aun_stats.retransmits,
+        (unsigned long long)aun_stats.timeouts);
+    n = fs_stats_rows(rows, commands);
+    qsort(rows, n, sizeof(rows[0]), fs_stats_rowcmp);
+    len = fs_stats_line(buf, size, len, "%-12s %7s %6s %6s",
+        commands ? "Command" : "Function", "Count", "p50ms", "p99ms");
+    for (i = 0; i < n; i++)
+        len = fs_stats_line(buf, size, len, "%-12.12s %7llu %6.2f %6.2f",
+            rows[i].name, (unsigned long long)rows[i].h->count,
+            fs_hist_quantile(rows[i].h, 500) / 1000.0,
+            fs_hist_quantile(rows[i].h, 990) / 1000.0);
+    buf[len++] = '\x80';
+    return len;
+}
+
+/*
+ * Write a summary of what requests cost for *STATS COSTS, like
+ * fs_stats_report(): the mean and 99th percentile number of system
+ * calls and mallocs for the busiest functions.
+ */
+size_t
+fs_cost_report(char *buf, size_t size)
+{
+    struct fs_stats_row rows[256];
+    const struct fs_hist *h;
+    size_t len = 0;
+    int i, n;
+
+    if (!fs_cost_on) {
+        len = fs_stats_line(buf, size, len, "Costs not being counted");
+        buf[len++] = '\x80';
+        return len;
+    }
+    n = fs_stats_rows(rows, false);
+    qsort(rows, n, sizeof(rows[0]), fs_stats_rowcmp);
+    len = fs_stats_line(buf, size, len, "%-12s %11s %11s", "Function",
+        "Sys avg/p99", "Mem avg/p99");
+    for (i = 0; i < n; i++) {
+        h = fs_cost_func[rows[i].h - fs_stats_func];
+        if (h == NULL)
+            continue;
+        len = fs_stats_line(buf, size, len,
+            "%-12.12s %6.1f/%-4llu %6.1f/%llu", rows[i].name,
+            (double)h[FS_COST_SYSCALLS].usec / h[FS_COST_SYSCALLS].count,
+            (unsigned long long)fs_hist_quantile(&h[FS_COST_SYSCALLS], 990),
+            (double)h[FS_COST_MALLOC].usec / h[FS_COST_MALLOC].count,
+            (unsigned long long)fs_hist_quantile(&h[FS_COST_MALLOC], 990));
+    }
+    buf[len++] = '\x80';
+    return len;
+}
+
+/*
+ * Write the counts and histograms for a set of functions or commands.
+ * The histogram buckets are at powers of two of microseconds.
+ */
+static void
+fs_stats_dump_hists(FILE *f, const char *metric, const char *label,
+    struct fs_stats_row *rows, int n)
+{
+    const struct fs_hist *h;
+    uint64_t cum;
+    int i, k, b, limit;
+
+    fprintf(f, "# HELP %ss_total Requests handled, by %s.\n", metric, label);
+    fprintf(f, "# TYPE %ss_total counter\n", metric);
+    for (i = 0; i < n; i++)
+        fprintf(f, "%ss_total{%s=\"%s\"} %llu\n", metric, label,
+            rows[i].name, (unsigned long long)rows[i].h->count);
+    fprintf(f, "# HELP %s_errors_total Requests that got an error, by %s.\n",
+        metric, label);
+    fprintf(f, "# TYPE %s_errors_total counter\n", metric);
+    for (i = 0; i < n; i++)
+        fprintf(f, "%s_errors_total{%s=\"%s\"} %llu\n", metric, label,
+            rows[i].name, (unsigned long long)rows[i].h->errors);
+    fprintf(f, "# HELP %s_duration_seconds Time to handle a request, by %s.\n",
+        metric, label);
+    fprintf(f, "# TYPE %s_duration_seconds histogram\n", metric);
+    for (i = 0; i < n; i++) {
+        h = rows[i].h;
+        cum = 0;
+        b = 0;
+        for (k = 0; k <= FS_HIST_OCTAVES; k++) {
+            limit = fs_hist_bucket((uint64_t)1 << k);
+            for (; b < limit; b++)
+                cum += h->bucket[b];
+            fprintf(f, "%s_duration_seconds_bucket{%s=\"%s\",le=\"%g\"} "
+                "%llu\n", metric, label, rows[i].name,
+                (double)((uint64_t)1 << k) / 1e6, (unsigned long long)cum);
+        }
+        fprintf(f, "%s_duration_seconds_bucket{%s=\"%s\",le=\"+Inf\"} "
+            "%llu\n", metric, label, rows[i].name,
+            (unsigned long long)h->count);
+        fprintf(f, "%s_duration_seconds_sum{%s=\"%s\"} %.6f\n", metric,
+            label, rows[i].name, h->usec / 1e6);
+        fprintf(f, "%s_duration_seconds_count{%s=\"%s\"} %llu\n", metric,
+            label, rows[i].name, (unsigned long long)h->count);
+    }
+}
+
+/*
+ * Write one of the per-station totals, the one at offset off in
+ * struct fs_stats_stn.
+ */
+static void
+fs_stats_dump_stns(FILE *f, const char *metric, const char *help,
+    size_t off)
+{
+    struct fs_stats_stn *s;
+    int net, stn;
+
+    fprintf(f, "# HELP %s %s\n", metric, help);
+    fprintf(f, "# TYPE %s counter\n", metric);
+    for (net = 0; net < 256; net++) {
+        if (fs_stats_net[net] == NULL)
+            continue;
+        for (stn = 0; stn < 256; stn++) {
+            s = &fs_stats_net[net][stn];
+            if (s->requests == 0)
+                continue;
+            if (off == offsetof(struct fs_stats_stn, usec))
+                fprintf(f, "%s{station=\"%d.%d\"} %.6f\n", metric, net, stn,
+                    s->usec / 1e6);
+            else
+                fprintf(f, "%s{station=\"%d.%d\"} %llu\n", metric, net, stn,
+                    (unsigned long long)*(uint64_t *)((char *)s + off));
+        }
+    }
+}
+
+static void
+fs_stats_dump(FILE *f)
+{
+    struct fs_stats_row rows[256];
+    const char *transport = aunfuncs == &beebem ? "beebem" : "aun";
+    int n;
+
+    fprintf(f, "# HELP aund_start_time_seconds When aund started.\n");
+    fprintf(f, "# TYPE aund_start_time_seconds gauge\n");
+    fprintf(f, "aund_start_time_seconds %lld\n", (long long)fs_stats_started);
+
+    n = fs_stats_rows(rows, false);
+    fs_stats_dump_hists(f, "aund_request", "function", rows, n);
+    n = fs_stats_rows(rows, true);
+    fs_stats_dump_hists(f, "aund_command", "command", rows, n);
+
+    fprintf(f, "# HELP aund_packets_total Packets sent and received.\n");
+    fprintf(f, "# TYPE aund_packets_total counter\n");
+    fprintf(f, "aund_packets_total{transport=\"%s\",direction=\"in\"} %llu\n",
+        transport, (unsigned long long)aun_stats.rx_packets);
+    fprintf(f, "aund_packets_total{transport=\"%s\",direction=\"out\"} %llu\n",
+        transport, (unsigned long long)aun_stats.tx_packets);
+    fprintf(f, "# HELP aund_packet_bytes_total Bytes sent and received.\n");
+    fprintf(f, "# TYPE aund_packet_bytes_total counter\n");
+    fprintf(f, "aund_packet_bytes_total{transport=\"%s\",direction=\"in\"} "
+        "%llu\n", transport, (unsigned long long)aun_stats.rx_bytes);
+    fprintf(f, "aund_packet_bytes_total{transport=\"%s\",direction=\"out\"} "
+        "%llu\n", transport, (unsigned long long)aun_stats.tx_bytes);
+    fprintf(f, "# HELP aund_retransmits_total Packets sent again for want "
+        "of an ack.\n");
+    fprintf(f, "# TYPE aund_retransmits_total counter\n");
+    fprintf(f, "aund_retransmits_total{transport=\"%s\"} %llu\n",
+        transport, (unsigned long long)aun_stats.retransmits);
+    fprintf(f, "# HELP aund_timeouts_total Times we gave up waiting for "
+        "a station.\n");
+    fprintf(f, "# TYPE aund_timeouts_total counter\n");
+    fprintf(f, "aund_timeouts_total{transport=\"%s\"} %llu\n",
+        transport, (unsigned long long)aun_stats.timeouts);
+
+    fprintf(f, "# HELP aund_cache_hits_total Cache lookups that hit.\n");
+    fprintf(f, "# TYPE aund_cache_hits_total counter\n");
+    fprintf(f, "aund_cache_hits_total{cache=\"path\"} %lu\n",
+        fs_pathcache_hits);
+    fprintf(f, "aund_cache_hits_total{cache=\"metadata\"} %lu\n",
+        fs_metacache_hits);
+    fprintf(f, "aund_cache_hits_total{cache=\"directory\"} %lu\n",
+        fs_dircache_hits);
+    fprintf(f, "# HELP aund_cache_misses_total Cache lookups that missed.\n");
+    fprintf(f, "# TYPE aund_cache_misses_total counter\n");
+    fprintf(f, "aund_cache_misses_total{cache=\"path\"} %lu\n",
+        fs_pathcache_misses);
+    fprintf(f, "aund_cache_misses_total{cache=\"metadata\"} %lu\n",
+        fs_metacache_misses);
+    fprintf(f, "aund_cache_misses_total{cache=\"directory\"} %lu\n",
+        fs_dircache_misses);
+
+    fs_stats_dump_stns(f, "aund_station_requests_total",
+        "Requests from each station.",
+        offsetof(struct fs_stats_stn, requests));
+    fs_stats_dump_stns(f, "aund_station_errors_total",
+        "Requests from each station that got an error.",
+        offsetof(struct fs_stats_stn, errors));
+    fs_stats_dump_stns(f, "aund_station_request_bytes_total",
+        "Bytes of requests from each station.",
+        offsetof(struct fs_stats_stn, bytes_in));
+    fs_stats_dump_stns(f, "aund_station_reply_bytes_total",
+        "Bytes of replies to each station.",
+        offsetof(struct fs_stats_stn, bytes_out));
+    fs_stats_dump_stns(f, "aund_station_seconds_total",
+        "Time spent on requests from each station.",
+        offsetof(struct fs_stats_stn, usec));
+}
+
+/*
+ * Write the table of costs: for each function and each thing counted,
+ * the mean, 99th percentile and maximum per request.  It's meant for
+ * awk and friends as much as for people.
+ */
+static void
+fs_cost_dump(FILE *f)
+{
+    const struct fs_hist *h;
+    const char *name;
+    char num[16];
+    int func, i;
+
+    fprintf(f, "# %-11s %8s %-12s %10s %10s %10s\n", "function", "requests",
+        "cost", "mean", "p99", "max");
+    for (func = 0; func < 256; func++) {
+        if ((h = fs_cost_func[func]) == NULL || h[0].count == 0)
+            continue;
+        if ((name = fs_stats_funcname(func)) == NULL) {
+            snprintf(num, sizeof(num), "func-%d", func);
+            name = num;
+        }
+        for (i = 0; i < FS_COST_MAX; i++) {
+            if (h[i].usec == 0)
+                continue;
+            fprintf(f, "%-13s %8llu %-12s %10.2f %10llu %10llu\n", name,
+                (unsigned long long)h[i].count, fs_cost_names[i],
+                (double)h[i].usec / h[i].count,
+                (unsigned long long)fs_hist_quantile(&h[i], 990),
+                (unsigned long long)h[i].max);
+        }
+    }
+}
+
+/*
+ * Write a file with dump.  It's written to one side and renamed into
+ * place, so a reader never sees half of one.
+ */
+static void
+fs_stats_write(const char *file, void (*dump)(FILE *))
+{
+    char tmp[PATH_MAX];
+    FILE *f;
+
+    if (snprintf(tmp, sizeof(tmp), "%s.tmp", file) >= sizeof(tmp)) {
+        warnx("%s: name too long", file);
+        return;
+    }
+    if ((f = fopen(tmp, "w")) == NULL) {
+        warn("%s", tmp);
+        return;
+    }
+    dump(f);
+    if (ferror(f)) {
+        warnx("%s: write failed", tmp);
+        fclose(f);
+        unlink(tmp);
+        return;
+    }
+    if (fclose(f) == EOF) {
+        warn("%s", tmp);
+        unlink(tmp);
+        return;
+    }
+    if (rename(tmp, file) == -1) {
+        warn("%s", file);
+        unlink(tmp);
+    }
+}
+
+/*
+ * Write a snapshot to the stats file and the costs file, if there are
+ * any, and push out anything waiting for the slow trace file.  Unless
+ * force is set, the snapshot is only written every fs_stats_interval
+ * seconds.
+ */
+void
+fs_stats_flush(bool force)
+{
+    time_t now = time(NULL);
+
+    if (fs_slow_trace != NULL)
+        fflush(fs_slow_trace);
+    if (!force && now - fs_stats_written < fs_stats_interval)
+        return;
+    fs_stats_written = now;
+    if (fs_stats_file != NULL)
+        fs_stats_write(fs_stats_file, fs_stats_dump);
+    if (fs_cost_file != NULL)
+        fs_stats_write(fs_cost_file, fs_cost_dump);
+}
@@ -0,0 +1,202 @@
+/*-
+ * Copyright (c) 2010 Simon Tatham
+ * Copyright (c) 2010 Ben Harris
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/*
+ * Binary tracing.
+ *
+ * Trace records go into a ring in a memory-mapped file (see
+ * fs_trace.h), where aundtrace can decode them, either afterwards or
+ * while we're running.  Nothing is formatted and nothing goes through
+ * stdio, so it's cheap enough to leave on.  When a category is off,
+ * FS_TRACE() costs one test of fs_trace_mask.
+ *
+ * The categories recorded start as configured, and aundtrace -e can
+ * change them by writing to the header; fs_trace_periodic() picks up
+ * the change.
+ */
+
+#if HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+
+#include <err.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+#include "aun.h"
+#include "extern.h"
+#include "fs_proto.h"
+#include "fileserver.h"
+
+#if defined(__GNUC__)
+#define FS_TRACE_BARRIER()	__sync_synchronize()
+#else
+#define FS_TRACE_BARRIER()	do { } while (0)
+#endif
+
+char *fs_trace_file;
+uint32_t fs_trace_cats = FS_TRACE_REQ;
+uint32_t fs_trace_mask;
+
+static volatile struct fs_trace_hdr *fs_trace_hdr;
+static volatile struct fs_trace_rec *fs_trace_ring;
+static uint8_t fs_trace_stn[2];
+static uint8_t fs_trace_func;
+
+static const struct {
+    const char *name;
+    uint32_t bit;
+} fs_trace_cattab[] = FS_TRACE_CATEGORIES;
+
+/*
+ * Look up a category by name.  Returns 0 if there's no such category.
+ */
+uint32_t
+fs_trace_category(const char *name)
+{
+    int i;
+
+    for (i = 0; i < sizeof(fs_trace_cattab) / sizeof(fs_trace_cattab[0]);
+         i++)
+        if (!strcasecmp(name, fs_trace_cattab[i].name))
+            return fs_trace_cattab[i].bit;
+    return 0;
+}
+
+/*
+ * Set up the trace file, if one's configured.  Anything already in it
+ * is thrown away.
+ */
+void
+fs_trace_open(void)
+{
+    size_t size;
+    void *p;
+    int fd;
+
+    if (fs_trace_file == NULL)
+        return;
+    size = sizeof(struct fs_trace_hdr) +
+        FS_TRACE_RECORDS * sizeof(struct fs_trace_rec);
+    if ((fd = open(fs_trace_file, O_RDWR | O_CREAT, 0644)) == -1) {
+        warn("%s", fs_trace_file);
+        return;
+    }
+    if (ftruncate(fd, 0) == -1 || ftruncate(fd, size) == -1) {
+        warn("%s: ftruncate", fs_trace_file);
+        close(fd);
+        return;
+    }
+    p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        warn("%s: mmap", fs_trace_file);
+        return;
+    }
+    fs_trace_hdr = p;
+    fs_trace_ring = (volatile struct fs_trace_rec *)(fs_trace_hdr + 1);
+    fs_trace_hdr->nrecs = FS_TRACE_RECORDS;
+    fs_trace_hdr->mask = fs_trace_cats;
+    fs_trace_hdr->head = 0;
+    FS_TRACE_BARRIER();
+    memcpy((void *)fs_trace_hdr->magic, FS_TRACE_MAGIC,
+        sizeof(fs_trace_hdr->magic));
+    fs_trace_mask = fs_trace_cats;
+}
+
+/*
+ * Notice if aundtrace has changed the categories to record.
+ */
+void
+fs_trace_periodic(void)
+{
+
+    if (fs_trace_hdr != NULL && fs_trace_mask != fs_trace_hdr->mask) {
+        fs_trace_mask = fs_trace_hdr->mask;
+        if (debug) printf("(trace: categories now %#x)\n",
+            (unsigned)fs_trace_mask);
+    }
+}
+
+/*
+ * Attribute subsequent records to request c, or to nobody if c is
+ * NULL.
+ */
+void
+fs_trace_context(struct fs_context *c)
+{
+
+    if (fs_trace_mask == 0)
+        return;
+    if (c != NULL) {
+        aunfuncs->get_stn(c->from, fs_trace_stn);
+        fs_trace_func = c->req->function;
+    } else {
+        fs_trace_stn[0] = fs_trace_stn[1] = 0;
+        fs_trace_func = 0;
+    }
+}
+
+/*
+ * Add a record to the ring.  Use FS_TRACE() rather than calling this
+ * directly.
+ */
+void
+fs_trace(int event, int handle, uint32_t bytes, int result)
+{
+    volatile struct fs_trace_rec *r;
+    struct timeval tv;
+    uint64_t i;
+
+    if (fs_trace_hdr == NULL)
+        return;
+    i = fs_trace_hdr->head;
+    r = &fs_trace_ring[i & (FS_TRACE_RECORDS - 1)];
+    r->seq = 0;
+    FS_TRACE_BARRIER();
+    gettimeofday(&tv, NULL);
+    r->usec = (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+    r->bytes = bytes;
+    r->stn[0] = fs_trace_stn[0];
+    r->stn[1] = fs_trace_stn[1];
+    r->func = fs_trace_func;
+    r->event = event;
+    r->handle = handle;
+    r->result = result;
+    FS_TRACE_BARRIER();
+    r->seq = (uint32_t)(i + 1);
+    FS_TRACE_BARRIER();
+    fs_trace_hdr->head = i + 1;
+}
@@ -0,0 +1,116 @@
+/*-
+ * Copyright (c) 2010 Simon Tatham
+ * Copyright (c) 2010 Ben Harris
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/*
+ * This is part of aund, an implementation of Acorn Universal
+ * Networking for Unix.
+ */
+/*
+ * fs_trace.h - layout of the trace file shared by aund and aundtrace.
+ *
+ * The file is a header followed by a ring of fixed-size records.  aund
+ * is the only writer.  Each record's seq is cleared before the record
+ * is filled in and set to its index + 1 afterwards, so a reader can
+ * tell a complete record from one being overwritten under it.
+ */
+
+#ifndef _FS_TRACE_H
+#define _FS_TRACE_H
+
+#include <stdint.h>
+
+#define FS_TRACE_MAGIC		"AUNDTRC1"
+#define FS_TRACE_RECORDS	65536	/* A power of two */
+
+/* Categories, which can be turned on and off separately */
+#define FS_TRACE_REQ		0x01	/* Requests and replies */
+#define FS_TRACE_PATH		0x02	/* Name translation */
+#define FS_TRACE_HANDLE		0x04	/* Opening and closing handles */
+#define FS_TRACE_IO		0x08	/* Data transfer */
+
+#define FS_TRACE_CATEGORIES {			\
+	{ "request",	FS_TRACE_REQ },		\
+	{ "path",	FS_TRACE_PATH },	\
+	{ "handle",	FS_TRACE_HANDLE },	\
+	{ "io",		FS_TRACE_IO },		\
+	{ "all",	0xff },			\
+}
+
+/* Events */
+enum fs_trace_event {
+	FS_TRACE_EV_REQUEST,	/* bytes = request length */
+	FS_TRACE_EV_REPLY,	/* bytes = reply length, result = return code */
+	FS_TRACE_EV_PATH_HIT,	/* bytes = length of Unix path */
+	FS_TRACE_EV_PATH_MISS,	/* ditto, after resolving it */
+	FS_TRACE_EV_PATH_FAIL,	/* result = error number */
+	FS_TRACE_EV_OPEN,	/* result = enum fs_handle_type */
+	FS_TRACE_EV_CLOSE,
+	FS_TRACE_EV_BADHANDLE,	/* A handle in the request was invalid */
+	FS_TRACE_EV_READ,	/* result = 1 if it failed */
+	FS_TRACE_EV_WRITE,	/* ditto */
+	FS_TRACE_EV_REPEAT,	/* Request repeated, so offset rewound */
+	FS_TRACE_EV_CONTEXT,	/* handle = URD, bytes = CSD << 8 | library */
+	FS_TRACE_EV_ACORNIFY,	/* bytes = length of leaf name */
+	FS_TRACE_EV_MAX
+};
+
+#define FS_TRACE_EVENT_NAMES {				\
+	[FS_TRACE_EV_REQUEST] = "request",		\
+	[FS_TRACE_EV_REPLY] = "reply",			\
+	[FS_TRACE_EV_PATH_HIT] = "path-hit",		\
+	[FS_TRACE_EV_PATH_MISS] = "path-miss",		\
+	[FS_TRACE_EV_PATH_FAIL] = "path-fail",		\
+	[FS_TRACE_EV_OPEN] = "open",			\
+	[FS_TRACE_EV_CLOSE] = "close",			\
+	[FS_TRACE_EV_BADHANDLE] = "bad-handle",		\
+	[FS_TRACE_EV_READ] = "read",			\
+	[FS_TRACE_EV_WRITE] = "write",			\
+	[FS_TRACE_EV_REPEAT] = "repeat",		\
+	[FS_TRACE_EV_CONTEXT] = "context",		\
+	[FS_TRACE_EV_ACORNIFY] = "acornify",		\
+}
+
+struct fs_trace_hdr {
+	char magic[8];		/* FS_TRACE_MAGIC */
+	uint32_t nrecs;		/* Number of records in the ring */
+	uint32_t mask;		/* Categories to record (aundtrace -e) */
+	uint64_t head;		/* Number of records ever written */
+};
+
+struct fs_trace_rec {
+	uint64_t usec;		/* Microseconds since the epoch */
+	uint32_t seq;		/* Index + 1 when complete, else 0 */
+	uint32_t bytes;
+	uint8_t stn[2];		/* As from aunfuncs->get_stn */
+	uint8_t func;		/* EC_FS_FUNC_* of the request */
+	uint8_t event;		/* enum fs_trace_event */
+	uint8_t handle;
+	uint8_t result;
+	uint8_t pad[2];
+};
+
+#endif
@@ -37,6 +37,7 @@
 #include <assert.h>
 #include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <fts.h>
 #include <libgen.h>
 #include <stdint.h>
@@ -50,6 +51,7 @@
 #include "extern.h"
 #include "fs_proto.h"
 #include "fileserver.h"
+#include "fs_cost.h"
 
 char *
 strpad(char *s, int c, size_t len)
@@ -168,133 +170,67 @@ fs_write_val(uint8_t *p, uint64_t value, size_t len)
 }
 
 /*
- * Construct path to Acorn metadata for a file.  The caller must free the
- * returned string itself.
+ * Fill in a struct fs_ent from an entry returned by fts.
  */
-static char *
-fs_metapath(FTSENT *f)
+void
+fs_ent_from_fts(struct fs_ent *e, FTSENT *f)
 {
-    char *lastslash, *metapath;
 
-    lastslash = strrchr(f->fts_accpath, '/');
-    if (lastslash)
-        lastslash++;
-    else
-        lastslash = f->fts_accpath;
-    metapath = malloc((lastslash - f->fts_accpath) +
-              f->fts_namelen + 8 + 1);
-    if (metapath != NULL) {
-        sprintf(metapath, "%.*s.Acorn/%s",
-            (int)(lastslash - f->fts_accpath),
-            f->fts_accpath, f->fts_name);
-    }
-    return metapath;
+    e->dirfd = AT_FDCWD;
+    e->accpath = f->fts_accpath;
+    e->path = f->fts_path;
+    e->name = f->fts_name;
+    e->namelen = f->fts_namelen;
+    e->statp = (f->fts_info == FTS_NS || f->fts_info == FTS_ERR) ?
+        NULL : f->fts_statp;
 }
 
-void
-fs_get_meta(FTSENT *f, struct ec_fs_meta *meta)
+static void
+fs_ent_init(struct fs_ent *e, struct fs_client *client, char *upath)
 {
-    struct stat *st;
-    char *metapath, rawinfo[24];
-    uint64_t stamp;
-    int type, i, ret;
-
-    metapath = fs_metapath(f);
-    if (metapath != NULL) {
-        rawinfo[23] = '\0';
-        ret = readlink(metapath, rawinfo, 23);
-        if (ret == 23) {
-            for (i = 0; i < 4; i++)
-                /* LINTED strtoul result < 0x100 */
-                meta->load_addr[i] =
-                    strtoul(rawinfo+i*3, NULL, 16);
-            for (i = 0; i < 4; i++)
-                /* LINTED strtoul result < 0x100 */
-                meta->exec_addr[i] =
-                    strtoul(rawinfo+12+i*3, NULL, 16);
-            return;
-        } else if (ret == 17) {
-            fs_write_val(meta->load_addr,
-                strtoul(rawinfo, NULL, 16),
-                sizeof(meta->load_addr));
-            fs_write_val(meta->exec_addr,
-                strtoul(rawinfo + 9, NULL, 16),
-                sizeof(meta->load_addr));
-            return;
-        }
-        free(metapath);
-    }
-    st = f->fts_statp;
-    if (st != NULL) {
-        stamp = fs_riscos_date(st->st_mtime,
-#if HAVE_STRUCT_STAT_ST_MTIMENSEC
-            st->st_mtimensec / 10000000
-#elif HAVE_STRUCT_STAT_ST_MTIM
-            st->st_mtim.tv_nsec / 10000000
-#else
-            0
-#endif
-            );
-        type = fs_guess_type(f);
-        fs_write_val(meta->load_addr,
-                 0xfff00000 | (type << 8) | (stamp >> 32), 4);
-        fs_write_val(meta->exec_addr, stamp & 0x00ffffffffULL, 4);
-    } else {    
-        fs_write_val(meta->load_addr, 0xdeaddead, 4);
-        fs_write_val(meta->exec_addr, 0xdeaddead, 4);
-    }
+
+    e->accpath = fs_path_at(client, upath, &e->dirfd);
+    e->path = upath;
+    e->name = (char *)fs_leafname(upath);
+    e->namelen = strlen(e->name);
+    e->statp = NULL;
 }
 
-bool
-fs_set_meta(FTSENT *f, struct ec_fs_meta *meta)
+/*
+ * Fill in a struct fs_ent for a single Unix path, with a single
+ * fstatat().  Like fs_stat(), a broken symlink describes itself.
+ * Returns -1 and leaves statp NULL if the path can't be found.
+ */
+int
+fs_ent_stat(struct fs_ent *e, struct fs_client *client, char *upath)
 {
-    char *lastslash, *metapath, rawinfo[24];
-    int ret;
+    int rc, phase;
 
-    metapath = fs_metapath(f);
-    if (metapath == NULL) {
-        errno = ENOMEM;
-        return false;
-    }
-
-    lastslash = strrchr(metapath, '/');
-    *lastslash = '\0'; /* metapath now points to the .Acorn directory. */
-    ret = rmdir(metapath);
-    if (ret < 0 && errno != ENOENT && errno != ENOTEMPTY)
-        goto fail;
-    if ((ret < 0 && errno == ENOENT) || ret == 0) {
-        if (mkdir(metapath, 0777) < 0)
-            goto fail;
-    }
-    *lastslash = '/'; /* metapath now points to the metadata again. */
-    sprintf(rawinfo, "%08lX %08lX",
-        (unsigned long)
-        fs_read_val(meta->load_addr, sizeof(meta->load_addr)),
-        (unsigned long)
-        fs_read_val(meta->exec_addr, sizeof(meta->exec_addr)));
-    if (unlink(metapath) < 0 && errno != ENOENT)
-        goto fail;
-    if (symlink(rawinfo, metapath) < 0)
-        goto fail;
-    free(metapath);
-    return true;
-fail:
-    free(metapath);
-    return false;
+    fs_ent_init(e, client, upath);
+    phase = FS_PHASE(FS_PHASE_FS);
+    rc = fstatat(e->dirfd, e->accpath, &e->sb, 0);
+    if (rc == -1 && errno == ENOENT)
+        /* Could be a broken symlink */
+        rc = fstatat(e->dirfd, e->accpath, &e->sb, AT_SYMLINK_NOFOLLOW);
+    FS_PHASE_END(phase);
+    if (rc == 0)
+        e->statp = &e->sb;
+    return rc;
 }
 
-void
-fs_del_meta(FTSENT *f)
+/*
+ * Fill in a struct fs_ent for a Unix path that is already open as fd.
+ */
+int
+fs_ent_fstat(struct fs_ent *e, struct fs_client *client, char *upath,
+    int fd)
 {
-    char *metapath;
-
-    metapath = fs_metapath(f);
-    if (metapath != NULL) {
-        unlink(metapath);
-        *strrchr(metapath, '/') = '\0';
-        rmdir(metapath); /* Don't worry if it fails. */
-        free(metapath);
-    }
+
+    fs_ent_init(e, client, upath);
+    if (fstat(fd, &e->sb) == -1)
+        return -1;
+    e->statp = &e->sb;
+    return 0;
 }
 
 /*
@@ -304,10 +240,10 @@ fs_del_meta(FTSENT *f)
  * optimal.
  */
 int
-fs_get_sin(FTSENT *f)
+fs_get_sin(struct fs_ent *e)
 {
 
-    return f->fts_statp->st_ino & 0xFFFFFF;
+    return e->statp->st_ino & 0xFFFFFF;
 }
 
 /*
@@ -316,7 +252,7 @@ fs_get_sin(FTSENT *f)
  * or as a string.
  */
 time_t
-fs_get_birthtime(FTSENT *f)
+fs_get_birthtime(struct fs_ent *e)
 {
 
 #if HAVE_STRUCT_STAT_ST_BIRTHTIME
@@ -324,12 +260,12 @@ fs_get_birthtime(FTSENT *f)
      * NetBSD 5.0 seems to be confused over whether an unknown
      * birthtime should be 0 or VNOVAL (-1).
      */
-    if (f->fts_statp->st_birthtime &&
-        f->fts_statp->st_birthtime != (time_t)(-1))
-        return f->fts_statp->st_birthtime;
+    if (e->statp->st_birthtime &&
+        e->statp->st_birthtime != (time_t)(-1))
+        return e->statp->st_birthtime;
 #endif
     /* Ah well, mtime will have to do. */
-    return f->fts_statp->st_mtime;
+    return e->statp->st_mtime;
 }
 
 /*
@@ -375,12 +311,14 @@ fs_write_date(struct ec_fs_date *date, time_t time)
 int
 fs_stat(const char *path, struct stat *sb)
 {
-    int rc;
+    int rc, phase;
 
+    phase = FS_PHASE(FS_PHASE_FS);
     rc = stat(path, sb);
     if (rc == -1 && errno == ENOENT)
         /* Could be a broken symlink */
         rc = lstat(path, sb);
+    FS_PHASE_END(phase);
     return rc;
 }
 
@@ -394,30 +332,24 @@ fs_leafname(const char *path)
         return path;
 }
 
+/*
+ * Does the client own the object at path?  They do if it's in or below
+ * their URD, as cached by fs_refresh_client.
+ */
 bool
 fs_is_owner(struct fs_context *c, char *path) {
-    char *oururd;
-    int match;
-    bool is_owner;  /* True - Owner, False - Public */
+    struct fs_client *client = c->client;
 
-    oururd = userfuncs->urd(c->client->login);
-    fs_acornify_name(oururd);
-
-    match = strncmp(userfuncs->urd(c->client->login), path,
-            strlen(userfuncs->urd(c->client->login)));
-
-    if (match == 0) {
-        is_owner = true;
-    } else {
-        is_owner = false;
-    }
-
-    /* now we check if they have privilege as that gives
-       ownership access - Can still have no permission to write */
-
-    if (c->client->priv == EC_FS_PRIV_SYST)
-    {
-        is_owner = true;  /* Privilege gives owner access */
-    }
-    return is_owner;
+    /* Privilege gives owner access - Can still have no permission
+       to write */
+    if (client->priv == EC_FS_PRIV_SYST)
+        return true;
+    if (client->urd == NULL || path == NULL)
+        return false;
+    if (!strcmp(client->urd, "."))
+        return true;
+    while (path[0] == '.' && path[1] == '/')
+        path += 2;
+    return strncmp(path, client->urd, client->urdlen) == 0 &&
+        (path[client->urdlen] == '\0' || path[client->urdlen] == '/');
 }
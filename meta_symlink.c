@@ -0,0 +1,155 @@
+/*-
+ * Copyright (c) 2010 Simon Tatham
+ * Copyright (c) 1998, 2010 Ben Harris
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/*
+ * Metadata stored as the target of a symlink: the metadata for
+ * "foo/bar" are in "foo/.Acorn/bar".  This works on any filesystem
+ * that supports symlinks.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "aun.h"
+#include "extern.h"
+#include "fs_proto.h"
+#include "fileserver.h"
+#include "fs_cost.h"
+
+static bool meta_symlink_path(const char *, const char *, char *, size_t);
+
+/*
+ * Construct path to Acorn metadata for a file called name, whose
+ * path is accpath, in buf.  Returns false if it won't fit.
+ */
+static bool
+meta_symlink_path(const char *accpath, const char *name,
+    char *buf, size_t len)
+{
+    const char *lastslash;
+
+    lastslash = strrchr(accpath, '/');
+    if (lastslash)
+        lastslash++;
+    else
+        lastslash = accpath;
+    return (size_t)snprintf(buf, len, "%.*s.Acorn/%s",
+        (int)(lastslash - accpath), accpath, name) < len;
+}
+
+static bool
+meta_symlink_get(struct fs_ent *e, struct ec_fs_meta *meta)
+{
+    char metapath[PATH_MAX], rawinfo[24];
+    int i, ret;
+
+    if (!meta_symlink_path(e->accpath, e->name, metapath, sizeof(metapath)))
+        return false;
+    rawinfo[23] = '\0';
+    ret = readlinkat(e->dirfd, metapath, rawinfo, 23);
+    if (ret == 23) {
+        for (i = 0; i < 4; i++)
+            /* LINTED strtoul result < 0x100 */
+            meta->load_addr[i] =
+                strtoul(rawinfo+i*3, NULL, 16);
+        for (i = 0; i < 4; i++)
+            /* LINTED strtoul result < 0x100 */
+            meta->exec_addr[i] =
+                strtoul(rawinfo+12+i*3, NULL, 16);
+        return true;
+    } else if (ret == 17) {
+        fs_write_val(meta->load_addr,
+            strtoul(rawinfo, NULL, 16),
+            sizeof(meta->load_addr));
+        fs_write_val(meta->exec_addr,
+            strtoul(rawinfo + 9, NULL, 16),
+            sizeof(meta->load_addr));
+        return true;
+    }
+    return false;
+}
+
+static bool
+meta_symlink_set(struct fs_ent *e, struct ec_fs_meta *meta)
+{
+    char *lastslash, metapath[PATH_MAX], rawinfo[24];
+    int ret;
+
+    if (!meta_symlink_path(e->accpath, e->name, metapath, sizeof(metapath))) {
+        errno = ENAMETOOLONG;
+        return false;
+    }
+
+    lastslash = strrchr(metapath, '/');
+    *lastslash = '\0'; /* metapath now points to the .Acorn directory. */
+    ret = unlinkat(e->dirfd, metapath, AT_REMOVEDIR);
+    if (ret < 0 && errno != ENOENT && errno != ENOTEMPTY)
+        return false;
+    if ((ret < 0 && errno == ENOENT) || ret == 0) {
+        if (mkdirat(e->dirfd, metapath, 0777) < 0)
+            return false;
+    }
+    *lastslash = '/'; /* metapath now points to the metadata again. */
+    sprintf(rawinfo, "%08lX %08lX",
+        (unsigned long)
+        fs_read_val(meta->load_addr, sizeof(meta->load_addr)),
+        (unsigned long)
+        fs_read_val(meta->exec_addr, sizeof(meta->exec_addr)));
+    if (unlinkat(e->dirfd, metapath, 0) < 0 && errno != ENOENT)
+        return false;
+    if (symlinkat(rawinfo, e->dirfd, metapath) < 0)
+        return false;
+    return true;
+}
+
+static void
+meta_symlink_del(struct fs_ent *e)
+{
+    char metapath[PATH_MAX];
+
+    if (meta_symlink_path(e->accpath, e->name, metapath, sizeof(metapath))) {
+        unlinkat(e->dirfd, metapath, 0);
+        *strrchr(metapath, '/') = '\0';
+        /* Don't worry if it fails. */
+        unlinkat(e->dirfd, metapath, AT_REMOVEDIR);
+    }
+}
+
+struct meta_funcs const meta_symlink = {
+    meta_symlink_get,
+    meta_symlink_set,
+    meta_symlink_del,
+};
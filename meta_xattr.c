@@ -0,0 +1,126 @@
+/*-
+ * Copyright (c) 2010 Simon Tatham
+ * Copyright (c) 1998, 2010 Ben Harris
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/*
+ * Metadata stored in an extended attribute on the file itself, as
+ * "user.acorn.meta".  The value is the same text that meta_symlink.c
+ * puts in its symlinks, so converting between the two is easy.  This
+ * saves the .Acorn directories, but needs a filesystem (and mount
+ * options) that support user extended attributes.
+ */
+
+#if HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <sys/types.h>
+#if HAVE_SYS_XATTR_H
+#include <sys/xattr.h>
+#endif
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "aun.h"
+#include "extern.h"
+#include "fs_proto.h"
+#include "fileserver.h"
+#include "fs_cost.h"
+
+#if HAVE_SYS_XATTR_H
+
+#define META_XATTR_NAME "user.acorn.meta"
+
+#ifdef __APPLE__
+#define getxattr(path, name, value, size) \
+	getxattr(path, name, value, size, 0, 0)
+#define setxattr(path, name, value, size, flags) \
+	setxattr(path, name, value, size, 0, flags)
+#define removexattr(path, name) removexattr(path, name, 0)
+#endif
+
+/*
+ * Extended attributes don't have *at() versions, so these use the
+ * path from the root rather than accpath.
+ */
+static bool
+meta_xattr_get(struct fs_ent *e, struct ec_fs_meta *meta)
+{
+    char rawinfo[18];
+
+    if (FS_COST_CALL(FS_COST_XATTR,
+        getxattr(e->path, META_XATTR_NAME, rawinfo, 17)) != 17)
+        return false;
+    rawinfo[17] = '\0';
+    fs_write_val(meta->load_addr, strtoul(rawinfo, NULL, 16),
+        sizeof(meta->load_addr));
+    fs_write_val(meta->exec_addr, strtoul(rawinfo + 9, NULL, 16),
+        sizeof(meta->exec_addr));
+    return true;
+}
+
+static bool
+meta_xattr_set(struct fs_ent *e, struct ec_fs_meta *meta)
+{
+    char rawinfo[18];
+
+    sprintf(rawinfo, "%08lX %08lX",
+        (unsigned long)
+        fs_read_val(meta->load_addr, sizeof(meta->load_addr)),
+        (unsigned long)
+        fs_read_val(meta->exec_addr, sizeof(meta->exec_addr)));
+    return FS_COST_CALL(FS_COST_XATTR,
+        setxattr(e->path, META_XATTR_NAME, rawinfo, 17, 0)) == 0;
+}
+
+static void
+meta_xattr_del(struct fs_ent *e)
+{
+
+    /* Usually the file's gone already, taking this with it. */
+    FS_COST_CALL(FS_COST_XATTR, removexattr(e->path, META_XATTR_NAME));
+}
+
+struct meta_funcs const meta_xattr = {
+    meta_xattr_get,
+    meta_xattr_set,
+    meta_xattr_del,
+};
+
+#else
+
+/* Not supported; conf_lex.l checks for this. */
+struct meta_funcs const meta_xattr = {
+    NULL,
+    NULL,
+    NULL,
+};
+
+#endif
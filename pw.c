@@ -29,6 +29,25 @@
  * Password file management for aund.
  * Current format is
  * User:Password:URD:Priv:Opt4
+ *
+ * The whole file is read into memory, hashed by user name, and only
+ * re-read when it changes on disc (or on SIGHUP).
+ *
+ * Changes aren't written to the file itself straight away.  Instead,
+ * each one appends a line to a journal, <pwfile>.log, which is
+ * replayed over the file when it's read.  A journal line is either
+ * a complete entry for a user, with '+' before the name, to add or
+ * replace them, or "-User:::" to remove them.  Replaying a line twice
+ * does no harm.  Once the journal is long enough, and nothing has
+ * changed for a while, the whole file is rewritten and the journal
+ * removed.  The same happens at startup and when we exit.
+ *
+ * The journal starts with a line, beginning '=', identifying the copy
+ * of the file it was written against, and is only replayed over that
+ * copy.  If someone edits the file while there are changes in the
+ * journal, their edit wins: the journal is moved aside to
+ * <pwfile>.log.old, rather than being replayed over the edit and
+ * perhaps bringing back users or passwords they'd just removed.
  */
 
 #include "fs_proto.h"
@@ -38,9 +57,12 @@
 
 #include <sys/types.h>
 #include <sys/file.h>
+#include <sys/queue.h>
+#include <sys/stat.h>
 #include <sys/time.h>
 
 #include <assert.h>
+#include <ctype.h>
 #if HAVE_CRYPT_H
 #include <crypt.h>
 #endif
@@ -50,78 +72,136 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "extern.h"
 #include "fileserver.h"
 
+#define PW_HASH_SIZE	64
+#define PW_LOG_MAX	256	/* Journal lines before we compact */
+#define PW_LOG_IDLE	5	/* Seconds of quiet before compacting */
+
+struct pw_ent {
+    TAILQ_ENTRY(pw_ent) link;	/* In file order */
+    LIST_ENTRY(pw_ent) hash;
+    char *user;
+    char *pw;
+    char *urd;
+    char *priv;
+    int opt4;
+};
+
 char *pwfile = NULL;
 char *pwtmp = NULL;
+static char *pwlog;
+static char *pwold;		/* Where a stale journal goes */
+static char const *pwcur;	/* File we're reading, for messages */
 static int pwline;
-static FILE *fp, *newfp;
+static bool pwpartial;		/* Last line read had no newline */
+static FILE *fp;
+static int pw_logfd = -1;
+static int pw_nlog;		/* Lines in the journal */
+static time_t pw_logged;	/* When we last wrote to it */
+
+static TAILQ_HEAD(, pw_ent) pw_list = TAILQ_HEAD_INITIALIZER(pw_list);
+static LIST_HEAD(pw_bucket, pw_ent) pw_hash[PW_HASH_SIZE];
+static bool pw_loaded;
+static dev_t pw_dev;		/* Identity of the file we loaded */
+static ino_t pw_ino;
+static time_t pw_mtime;
+static long pw_mtimensec;
+static off_t pw_size;
+
+static int pw_compact(void);
+
+static struct pw_bucket *
+pw_bucket(char const *user)
+{
+    unsigned int h = 0;
 
-static int
-pw_open(int write) {
-    assert(pwfile);            /* shouldn't even be called otherwise */
+    for (; *user; user++)
+        h = h * 31 + tolower((unsigned char)*user);
+    return &pw_hash[h % PW_HASH_SIZE];
+}
 
-    fp = fopen(pwfile, "r");
-    if (!fp) {
-        warn("%s: open", pwfile);
-        newfp = NULL;
-        return -1;
-    }
+static void
+pw_remember(struct stat *st)
+{
 
-    if (write) {
-        int newfd;
-        if (!pwtmp) {
-            pwtmp = malloc(strlen(pwfile) + 10);
-            sprintf(pwtmp, "%s.tmp", pwfile);
-        }
-        newfd = open(pwtmp, O_WRONLY | O_CREAT | O_TRUNC, 0600);
-        if (newfd < 0) {
-            warn("%s: open", pwtmp);
-            fclose(fp);
-            fp = NULL;
-            return -1;
-        }
-        newfp = fdopen(newfd, "w");
-        if (!newfp) {
-            warn("%s: fdopen", pwtmp);
-            fclose(fp);
-            fp = NULL;
-            return -1;
-        }
-    } else {
-        newfp = NULL;
-    }
+    pw_dev = st->st_dev;
+    pw_ino = st->st_ino;
+    pw_mtime = st->st_mtime;
+    pw_mtimensec = FS_MTIME_NSEC(st);
+    pw_size = st->st_size;
+}
 
-    pwline = 0;
-    return 0;
+static void
+pw_free(struct pw_ent *ent)
+{
+
+    free(ent->user);
+    free(ent->pw);
+    free(ent->urd);
+    free(ent->priv);
+    free(ent);
+}
+
+static struct pw_ent *
+pw_insert(char const *user, char const *pw, char const *urd,
+    char const *priv, int opt4)
+{
+    struct pw_ent *ent;
+
+    if ((ent = malloc(sizeof(*ent))) == NULL) {
+        warnx("pw_insert: malloc failed");
+        return NULL;
+    }
+    ent->user = strdup(user);
+    ent->pw = strdup(pw);
+    ent->urd = strdup(urd);
+    ent->priv = strdup(priv);
+    if (!ent->user || !ent->pw || !ent->urd || !ent->priv) {
+        warnx("pw_insert: strdup failed");
+        pw_free(ent);
+        return NULL;
+    }
+    ent->opt4 = opt4;
+    TAILQ_INSERT_TAIL(&pw_list, ent, link);
+    LIST_INSERT_HEAD(pw_bucket(user), ent, hash);
+    return ent;
 }
 
 static void
-pw_close(void) {
-    fclose(fp);
-    if (newfp)
-        fclose(newfp);
-    fp = newfp = NULL;
+pw_remove(struct pw_ent *ent)
+{
+
+    TAILQ_REMOVE(&pw_list, ent, link);
+    LIST_REMOVE(ent, hash);
+    pw_free(ent);
 }
 
+/*
+ * Replace one of the string fields of an entry.
+ */
 static int
-pw_close_rename(void) {
-    fclose(fp);
-    fp = NULL;
-    if (newfp) {
-        fclose(newfp);
-        newfp = NULL;
-        if (rename(pwtmp, pwfile) < 0) {
-            warn("%s -> %s: rename", pwfile, pwtmp);
-            return -1;
-        }
+pw_replace(char **field, char const *value)
+{
+    char *copy;
+
+    if ((copy = strdup(value)) == NULL) {
+        warnx("pw_replace: strdup failed");
+        return -1;
     }
+    free(*field);
+    *field = copy;
     return 0;
 }
 
+/*
+ * Read the next line of the password file.  Returns 0 on success, 1
+ * for a line we can't parse, and -1 at the end of the file.
+ */
 static int
 pw_read_line(char **user, char **pw, char **urd, char **priv, int *opt4)
 {
@@ -131,18 +211,19 @@ pw_read_line(char **user, char **pw, char **urd, char **priv, int *opt4)
     errno = 0;
     if (!fgets(buffer, sizeof(buffer), fp)) {
         if (errno)         /* distinguish clean EOF from error */
-            warn("%s", pwfile);
+            warn("%s", pwcur);
         return -1;
     }
     pwline++;
 
+    pwpartial = strchr(buffer, '\n') == NULL;
     buffer[strcspn(buffer, "\r\n")] = '\0';
 
     if ((password = strchr(buffer, ':')) == NULL ||
             (directory_name = strchr(password+1, ':')) == NULL    ||
             (s = strchr(directory_name+1, ':')) == NULL) {
-        warnx("%s:%d: malformatted line\n", pwfile, pwline);
-        return -1;
+        warnx("%s:%d: malformatted line\n", pwcur, pwline);
+        return 1;
     }
 
     *password++ = '\0';
@@ -166,236 +247,485 @@ pw_read_line(char **user, char **pw, char **urd, char **priv, int *opt4)
 }
 
 static void
-pw_write_line(char *user, char *pw, char *urd, char *priv, int opt4)
+pw_write_line(FILE *newfp, struct pw_ent *ent)
 {
 
-    fprintf(newfp, "%s:%s:%s:%s:%d\n", user, pw, urd, priv, opt4);
+    fprintf(newfp, "%s:%s:%s:%s:%d\n",
+        ent->user, ent->pw, ent->urd, ent->priv, ent->opt4);
 }
 
-static char *
-pw_validate(char *user, const char *pw, int *opt4)
+static int
+pw_names(void)
 {
-    char *u, *p, *d, *s;
-    char *ret;
 
-    if (pw_open(0) < 0)
-        return NULL;
+    if (pwtmp)
+        return 0;
+    pwtmp = malloc(strlen(pwfile) + 10);
+    pwlog = malloc(strlen(pwfile) + 10);
+    pwold = malloc(strlen(pwfile) + 10);
+    if (pwtmp == NULL || pwlog == NULL || pwold == NULL) {
+        warnx("pw_names: malloc failed");
+        free(pwtmp);
+        free(pwlog);
+        free(pwold);
+        pwtmp = pwlog = pwold = NULL;
+        return -1;
+    }
+    sprintf(pwtmp, "%s.tmp", pwfile);
+    sprintf(pwlog, "%s.log", pwfile);
+    sprintf(pwold, "%s.log.old", pwfile);
+    return 0;
+}
+
+/*
+ * The journal's first line: the identity of the copy of the file that
+ * it applies to, as pw_remember() recorded it.
+ */
+static void
+pw_log_header(char *buf, size_t len)
+{
 
-    while (pw_read_line(&u, &p, &d, &s, opt4) == 0) {
-        if (!strcasecmp(user, u)) {
-            int ok = 0;
-
-            if (*p) {
-                char *cp = crypt(pw, p);
-                ok = !strcmp(cp, p);
-            } else {
-                ok = (!pw || !*pw);
-            }
-            if (!ok)
-                ret = NULL;
-            else
-                ret = strdup(d);
-            if (debug) printf("urd is [%s]\n", ret);    
-            strcpy(user, u);   /* normalise case */
-            pw_close();
-            return ret;
+    snprintf(buf, len, "=%llu:%llu:%lld:%ld:%lld\n",
+        (unsigned long long)pw_dev, (unsigned long long)pw_ino,
+        (long long)pw_mtime, pw_mtimensec, (long long)pw_size);
+}
+
+/*
+ * Apply the journal to the in-memory copy of the file, provided it was
+ * written against the copy we've just read.  Returns true if it ended
+ * in a partial line (because we crashed while writing it), which we
+ * ignore.
+ */
+static bool
+pw_replay(void)
+{
+    char *u, *p, *d, *s;
+    char header[128], want[128];
+    struct pw_ent *ent;
+    int opt4, rc;
+
+    pw_nlog = 0;
+    if ((fp = fopen(pwlog, "r")) == NULL) {
+        if (errno != ENOENT)
+            warn("%s: open", pwlog);
+        return false;
+    }
+    pw_log_header(want, sizeof(want));
+    if (fgets(header, sizeof(header), fp) == NULL ||
+        strcmp(header, want) != 0) {
+        fclose(fp);
+        fp = NULL;
+        warnx("%s has changed since %s was written; moving it to %s",
+            pwfile, pwlog, pwold);
+        if (pw_logfd != -1) {
+            close(pw_logfd);
+            pw_logfd = -1;
         }
+        if (rename(pwlog, pwold) < 0)
+            warn("%s -> %s: rename", pwlog, pwold);
+        return false;
     }
-
-    pw_close();
-    return NULL;
+    if (debug) printf("(replaying %s)", pwlog);
+    pwcur = pwlog;
+    pwline = 1;
+    while ((rc = pw_read_line(&u, &p, &d, &s, &opt4)) >= 0) {
+        pw_nlog++;
+        if (pwpartial) {
+            warnx("%s:%d: incomplete line ignored", pwlog, pwline);
+            break;
+        }
+        if (rc != 0 || (*u != '+' && *u != '-'))
+            continue;
+        LIST_FOREACH(ent, pw_bucket(u + 1), hash)
+            if (!strcasecmp(u + 1, ent->user))
+                break;
+        if (*u == '-') {
+            if (ent != NULL)
+                pw_remove(ent);
+        } else if (ent != NULL) {
+            pw_replace(&ent->pw, p);
+            pw_replace(&ent->urd, d);
+            pw_replace(&ent->priv, s);
+            ent->opt4 = opt4;
+        } else
+            pw_insert(u + 1, p, d, s, opt4);
+    }
+    fclose(fp);
+    fp = NULL;
+    return pwpartial;
 }
 
-static char *
-pw_urd(char const *user)
+/*
+ * Make sure we have an up-to-date copy of the password file in
+ * memory.
+ */
+static int
+pw_load(void)
 {
-    char *user_name, *user_password, *directory_name;
-    char *privilege;
-    int opt4;
+    char *u, *p, *d, *s;
+    struct pw_ent *ent;
+    struct stat sb;
+    int opt4, rc;
 
-    if (pw_open(1) < 0)
-        return NULL;
+    assert(pwfile);            /* shouldn't even be called otherwise */
+
+    if (pw_names() < 0)
+        return -1;
+
+    if (stat(pwfile, &sb) < 0) {
+        warn("%s: stat", pwfile);
+        return -1;
+    }
+    if (pw_loaded && !reload_pending &&
+        sb.st_dev == pw_dev && sb.st_ino == pw_ino &&
+        sb.st_mtime == pw_mtime && FS_MTIME_NSEC(&sb) == pw_mtimensec &&
+        sb.st_size == pw_size)
+        return 0;
+    reload_pending = 0;
+
+    fp = fopen(pwfile, "r");
+    if (!fp) {
+        warn("%s: open", pwfile);
+        return -1;
+    }
+    if (fstat(fileno(fp), &sb) < 0) {
+        warn("%s: fstat", pwfile);
+        fclose(fp);
+        fp = NULL;
+        return -1;
+    }
+    if (debug) printf("(reading %s)", pwfile);
+    while ((ent = TAILQ_FIRST(&pw_list)) != NULL)
+        pw_remove(ent);
+    pwcur = pwfile;
+    pwline = 0;
+    while ((rc = pw_read_line(&u, &p, &d, &s, &opt4)) >= 0)
+        if (rc == 0)
+            pw_insert(u, p, d, s, opt4);
+    fclose(fp);
+    fp = NULL;
+    pw_remember(&sb);
+    pw_loaded = true;
+    /*
+     * Fold the journal into the file straight away, so that the next
+     * edit is made against a file with everything in it.  That also
+     * means we never append to a journal with half a line at the end.
+     */
+    if (pw_replay() || pw_nlog > 0)
+        pw_compact();
+    return 0;
+}
+
+/*
+ * Write the in-memory copy of the password file back to disc, and
+ * throw the journal away.  The new file is written alongside the old
+ * one and then renamed over it, so a crash part way through can't lose
+ * anyone's password.  If we crash before removing the journal, it's
+ * just replayed over the new file, which is harmless.
+ */
+static int
+pw_compact(void)
+{
+    struct pw_ent *ent;
+    struct stat sb;
+    FILE *newfp;
+    int newfd;
+
+    if (debug) printf("(compacting %s)", pwfile);
+    /* Whatever happens, what's on disc is now the truth. */
+    pw_loaded = false;
+    newfd = open(pwtmp, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (newfd < 0) {
+        warn("%s: open", pwtmp);
+        return -1;
+    }
+    newfp = fdopen(newfd, "w");
+    if (!newfp) {
+        warn("%s: fdopen", pwtmp);
+        close(newfd);
+        return -1;
+    }
+    TAILQ_FOREACH(ent, &pw_list, link)
+        pw_write_line(newfp, ent);
+    if (fflush(newfp) == EOF || fsync(newfd) < 0) {
+        warn("%s: write", pwtmp);
+        fclose(newfp);
+        unlink(pwtmp);
+        return -1;
+    }
+    if (fstat(newfd, &sb) < 0 || fclose(newfp) == EOF) {
+        warn("%s: close", pwtmp);
+        unlink(pwtmp);
+        return -1;
+    }
+    if (rename(pwtmp, pwfile) < 0) {
+        warn("%s -> %s: rename", pwtmp, pwfile);
+        unlink(pwtmp);
+        return -1;
+    }
+    pw_remember(&sb);
+    if (pw_logfd != -1) {
+        close(pw_logfd);
+        pw_logfd = -1;
+    }
+    if (unlink(pwlog) < 0 && errno != ENOENT) {
+        warn("%s: unlink", pwlog);
+        return -1;
+    }
+    pw_nlog = 0;
+    pw_loaded = true;
+    return 0;
+}
 
-    while (pw_read_line(&user_name, &user_password, 
-                &directory_name, &privilege, &opt4) == 0) {
-        if (!strcasecmp(user, user_name)) {
-            pw_close();
-            return strdup(directory_name);
+/*
+ * Record a change to one user in the journal: either their new entry,
+ * or their removal if ent is NULL.
+ */
+static int
+pw_save(char const *user, struct pw_ent *ent)
+{
+    char *line;
+    char header[128];
+    struct stat sb;
+    size_t len;
+    ssize_t n;
+
+    len = strlen(user) + 8;
+    if (ent != NULL)
+        len += strlen(ent->pw) + strlen(ent->urd) + strlen(ent->priv) + 16;
+    if ((line = malloc(len)) == NULL) {
+        warnx("pw_save: malloc failed");
+        pw_loaded = false;
+        return -1;
+    }
+    if (ent != NULL)
+        snprintf(line, len, "+%s:%s:%s:%s:%d\n",
+            ent->user, ent->pw, ent->urd, ent->priv, ent->opt4);
+    else
+        snprintf(line, len, "-%s:::\n", user);
+    if (pw_logfd == -1 &&
+        (pw_logfd = open(pwlog, O_WRONLY | O_APPEND | O_CREAT, 0600)) != -1 &&
+        fstat(pw_logfd, &sb) == 0 && sb.st_size == 0) {
+        pw_log_header(header, sizeof(header));
+        if (write(pw_logfd, header, strlen(header)) !=
+            (ssize_t)strlen(header)) {
+            close(pw_logfd);
+            pw_logfd = -1;
+            unlink(pwlog);
         }
     }
-    pw_close();
+    n = -1;
+    if (pw_logfd != -1 && (n = write(pw_logfd, line, strlen(line))) ==
+        (ssize_t)strlen(line) && fsync(pw_logfd) == 0) {
+        free(line);
+        pw_nlog++;
+        pw_logged = time(NULL);
+        return 0;
+    }
+    warn("%s: write", pwlog);
+    free(line);
+    /* Don't leave a partial line for the next one to be stuck to. */
+    if (n >= 0 && pw_logfd != -1) {
+        close(pw_logfd);
+        pw_logfd = -1;
+    }
+    /* Go back to what's on disc. */
+    pw_loaded = false;
+    return -1;
+}
+
+/*
+ * Called regularly.  Compact the journal if it's worth it and things
+ * are quiet.
+ */
+static void
+pw_periodic(void)
+{
+
+    if (pw_nlog >= PW_LOG_MAX && pw_loaded &&
+        time(NULL) - pw_logged >= PW_LOG_IDLE)
+        pw_compact();
+}
+
+/*
+ * Called when the server exits.  Leave everything in the file itself,
+ * ready for anyone who wants to edit it while we're not running.
+ */
+static void
+pw_exit(void)
+{
+
+    if (pw_load() == 0 && pw_nlog > 0)
+        pw_compact();
+}
+
+static struct pw_ent *
+pw_lookup(char const *user)
+{
+    struct pw_ent *ent;
+
+    if (user == NULL || pw_load() < 0)
+        return NULL;
+    LIST_FOREACH(ent, pw_bucket(user), hash)
+        if (!strcasecmp(user, ent->user))
+            return ent;
     return NULL;
 }
 
+/*
+ * Check a password.  Returns 1 if it's right, 0 if it's wrong, and -1
+ * (with errno set to EINPROGRESS) if we don't know yet.
+ */
 static int
-pw_change(const char *user, const char *oldpw, const char *newpw)
+pw_check(struct pw_ent *ent, const char *pw)
 {
-    char *u, *p, *d, *s;
-    int opt4;
-    int done = 0;
-    char salt[64];
     char *cp;
-    struct timeval tv;
     int ok;
 
-    if (pw_open(1) < 0)
-        return -1;
+    if (*ent->pw) {
+        if (pw_crypt(pw, ent->pw, &cp) < 0)
+            return errno == EINPROGRESS ? -1 : 0;
+        ok = !strcmp(cp, ent->pw);
+        free(cp);
+        return ok;
+    } else {
+        return (!pw || !*pw);
+    }
+}
 
-    while (pw_read_line(&u, &p, &d, &s, &opt4) == 0) {
-        if (!done && !strcasecmp(user, u)) {
-            ok = 0;
-            ok = !strcmp(s, "L");
-            if (ok) {   // User isnt allowed to change passwd
-                    pw_close();
-                    return -1;
-            }
-            ok = !strcmp(s, "F");
-            if (ok) {
-                pw_close();
-                return -1;
-            }
-        }
-        ok = 0;
-        if (*p) {
-            cp = crypt(oldpw, p);
-            ok = !strcmp(cp, p);
-        } else {
-            ok = (!oldpw || !*oldpw);
-        }
-        if (!ok) {
-            pw_close();
-            return -1;
-        }
-        gettimeofday(&tv, NULL);
-        sprintf(salt, "$6$%08lx%08lx$",
-            tv.tv_sec & 0xFFFFFFFFUL,
-            tv.tv_usec & 0xFFFFFFFFUL);
-        p = crypt(newpw, salt);
-        }
-        pw_write_line(u, p, d, s, opt4);
+static char *
+pw_validate(char *user, const char *pw, int *opt4)
+{
+    struct pw_ent *ent;
+    char *ret;
+
+    if ((ent = pw_lookup(user)) == NULL)
+        return NULL;
+    *opt4 = ent->opt4;
+    switch (pw_check(ent, pw)) {
+    case -1:
+        return NULL;
+    case 0:
+        ret = NULL;
+        break;
+    default:
+        ret = strdup(ent->urd);
+    }
+    if (debug) printf("urd is [%s]\n", ret);
+    strcpy(user, ent->user);   /* normalise case */
+    return ret;
+}
 
-    return pw_close_rename();
+static char *
+pw_urd(char const *user)
+{
+    struct pw_ent *ent;
+
+    if ((ent = pw_lookup(user)) == NULL)
+        return NULL;
+    return strdup(ent->urd);
 }
 
 static int
-pw_set_opt4(const char *user, int newopt4)
+pw_change(const char *user, const char *oldpw, const char *newpw)
 {
-    char *u, *p, *d, *s;
-    int opt4;
-    int done = 0;
-    int ok;
+    struct pw_ent *ent;
+    char *cp;
+    int rc;
 
-    if (pw_open(1) < 0)
+    if ((ent = pw_lookup(user)) == NULL)
+        return -1;
+    /* Locked and fixed users aren't allowed to change passwords. */
+    if (!strcmp(ent->priv, "L") || !strcmp(ent->priv, "F"))
+        return -1;
+    switch (pw_check(ent, oldpw)) {
+    case -1:
+        return -1;
+    case 0:
+        errno = EPERM;
         return -1;
-
-    while (pw_read_line(&u, &p, &d, &s, &opt4) == 0) {
-        if (!done && !strcasecmp(user, u)) {
-            ok = 0;
-            ok = !strcmp(s, "L");
-            if (ok) {   // User isnt allowed to change passwd
-                    pw_close();
-                    return -1;
-            }
-            ok = !strcmp(s, "F");
-            if (ok) {
-                pw_close();
-                return -1;
-            }
-            opt4 = newopt4;
-        }
-        pw_write_line(u, p, d, s, opt4);
     }
+    if (pw_crypt_new(ent->user, newpw, &cp) < 0)
+        return -1;
+    rc = pw_replace(&ent->pw, cp);
+    free(cp);
+    if (rc < 0)
+        return -1;
+    return pw_save(ent->user, ent);
+}
+
+static int
+pw_set_opt4(const char *user, int newopt4)
+{
+    struct pw_ent *ent;
 
-    return pw_close_rename();
+    if ((ent = pw_lookup(user)) == NULL)
+        return -1;
+    if (!strcmp(ent->priv, "L") || !strcmp(ent->priv, "F"))
+        return -1;
+    ent->opt4 = newopt4;
+    return pw_save(ent->user, ent);
 }
 
 static int
 pw_get_priv(const char *user)
 {
-        char *u, *p, *d, *s;
-        int opt4;
-        int priv = EC_FS_PRIV_NONE; /* Assume no Priv */
+    struct pw_ent *ent;
 
-    if (pw_open(1) < 0)
-        return -1;
+    if ((ent = pw_lookup(user)) == NULL)
+        return EC_FS_PRIV_NONE;
 
-    while (pw_read_line(&u, &p, &d, &s, &opt4) == 0) {
-
-        // TODO: Change these privilege levels match those
-        //       defined in PiEconetBridge FS Software 
-        //     L - Locked cannot log in
-        //     N - Unlocked (normal) user but cannot change password
-        //     S - System User - DONE!
-        //     U - Unlocked (normal) user
-        //
-                if (!strcasecmp(user, u)) {
-                    pw_close();
-                    switch (*s) {
-                        case 'S': priv = EC_FS_PRIV_SYST; break;
-                        // Limited users cannot change passwords or 
-                        // their boot options
-                        case 'L': priv = EC_FS_PRIV_LIMIT; break;
-                        // Fixed users cannot change their boot options,
-                        // passwords, and cannot look at any directories
-                        // other than their own root directory
-                        case 'F': priv = EC_FS_PRIV_FIXED; break;
-
-                        default : priv = EC_FS_PRIV_NONE;
-                    }
-                    return priv;
-                }
+    // TODO: Change these privilege levels match those
+    //       defined in PiEconetBridge FS Software 
+    //     L - Locked cannot log in
+    //     N - Unlocked (normal) user but cannot change password
+    //     S - System User - DONE!
+    //     U - Unlocked (normal) user
+    //
+    switch (*ent->priv) {
+        case 'S': return EC_FS_PRIV_SYST;
+        // Limited users cannot change passwords or 
+        // their boot options
+        case 'L': return EC_FS_PRIV_LIMIT;
+        // Fixed users cannot change their boot options,
+        // passwords, and cannot look at any directories
+        // other than their own root directory
+        case 'F': return EC_FS_PRIV_FIXED;
+
+        default : return EC_FS_PRIV_NONE;
     }
-
-    pw_close();
-    return EC_FS_PRIV_NONE;
 }
 
 static int
 pw_set_priv( struct fs_client *client, const char *user, const char *newpriv)
 {
-                char *u, *p, *d, *s;
-                int opt4;
-                int done = 0;
-
-    if (client->priv == EC_FS_PRIV_SYST) {
-        if (pw_open(1) < 0)
-            return -1;
-
-        while (pw_read_line(&u, &p, &d, &s, &opt4) == 0) {
-            if (!done && !strcasecmp(user, u)) {
-                strcpy(s, newpriv);
-            }
-            pw_write_line(u, p, d, s, opt4);
-        }
+    struct pw_ent *ent;
 
-        return pw_close_rename();
-    }
-    return -1;  // No privilege
+    if (client->priv != EC_FS_PRIV_SYST)
+        return -1;  // No privilege
+    if ((ent = pw_lookup(user)) == NULL)
+        return -1;
+    if (pw_replace(&ent->priv, newpriv) < 0)
+        return -1;
+    return pw_save(ent->user, ent);
 }
 
 static int
 pw_add_user(char *user)
 {
-    char *u, *p, *d, *s;
+    struct pw_ent *ent;
     char directory[30];
     char group[30];
-    int opt4;
     int index;
     char *tmp;
     char ch[30] = "./";
     char ct[30] = "./";
-    char end[2] = "\0";
     bool has_group = false;
-    struct stat *st;
+    struct stat sb;
 
-    if (pw_open(1) < 0)
+    if (pw_load() < 0)
         return -1;
 
-    while (pw_read_line(&u, &p, &d, &s, &opt4) == 0) {
-        pw_write_line(u, p, d, s, opt4);
-    }
-    // Now we need to add the new user
-
     // Duplicate the username in to the variable directory
     // replace any full stops with a / 
     strcpy(directory, user);
@@ -408,10 +738,12 @@ pw_add_user(char *user)
     // Now build the urd directory path
     strcat(ch, directory);
     strcpy(directory, ch);
-    
-    pw_write_line(user, "" , directory, "", 0);
 
-    strcat(directory, end);
+    if ((ent = pw_insert(user, "", directory, "", 0)) == NULL)
+        return -1;
+    if (pw_save(user, ent) < 0)
+        return -1;
+
     // Check if we have a period '.' in the username because
     // if we do then we have group.username and will need to
     // create the group directory as well as the user directory.
@@ -419,95 +751,51 @@ pw_add_user(char *user)
     if (tmp != NULL) 
         has_group = true;
 
-    if (has_group == false)
-    {
-        if (stat(directory, st) == -1) {
-        mkdir(directory, 0777);
-        }
-    }
-
     if (has_group == true) {
         // Create the group directory
         // this may fail, because the directory already exists
-        tmp = strchr(user, '.');
         index = (int)(tmp - user);
         strncpy(group, user, index);
+        group[index] = '\0';
         strcat(ct, group);
         strcpy(group, ct);
-        strcat(group, end);
 
-        if (stat(group, st) == -1) {
+        if (stat(group, &sb) == -1) {
             mkdir(group, 0777); /* Ignore errors here for the moment */
         }
+    }
 
-        // Create the user directory under the group
-        if (stat(directory, st) == -1) {
-            mkdir(directory, 0777);
-        }
+    // Create the user directory (under the group, if any)
+    if (stat(directory, &sb) == -1) {
+        mkdir(directory, 0777);
     }
-    return pw_close_rename();
+    return 0;
 }
 
 static bool 
 pw_is_user(char *user) {
-    bool found = false;
-    char *u, *p, *d, *s;
-    int opt4;
-    int match;
 
-    if (pw_open(1) < 0)
+    if (user == NULL)
+        return false;
+    if (pw_load() < 0)
         return true; /* FIXME: Might want to return an error code */
-    //
-    while (pw_read_line(&u, &p, &d, &s, &opt4) == 0) {
-    // Check if the user matches u
-    // if so set found to true;
-    match = strncmp(user, u, strlen(u));
-    if (match == 0) {
-            // We found a match
-            found = true;
-        }
-    }
-    return found;
+    return pw_lookup(user) != NULL;
 }
 
 // Returns 0 - ok, -1 failed
 static int
 pw_del_user(char *user) {
-    bool found = false;
-    char *user_name, *password, *directory_name;
-    char *privilege;
-    int opt4 = 0;
-    int match = -1;
-    int result = -1;
-
-    if (pw_open(1) < 0)
-        return -1;
+    struct pw_ent *ent;
 
-    while (pw_read_line(&user_name, &password, &directory_name,
-             &privilege, &opt4) == 0) {
-        match = strncmp(user, user_name, strlen(user_name));
-        if (match == 0) {
-            // We found a match
-            found = true;
-            // Do not write the record to the password file
-            // so do nothing else
-        }
-        if (match != 0) {
-            // not a match so we write this back to the password
-            // file.
-            pw_write_line(user_name, password, directory_name, privilege, opt4);
-        }
-    }
-
-    result = pw_close_rename();
-    if (found == true)
-        result = 0;
+    if ((ent = pw_lookup(user)) == NULL)
+        return -1;
     // Does not delete the directory or files of the user
-    return result;
+    pw_remove(ent);
+    return pw_save(user, NULL);
 }
 
 
 struct user_funcs const user_pw = {
     pw_validate, pw_urd, pw_change, pw_set_opt4, pw_set_priv, pw_get_priv,
-    pw_add_user, pw_is_user, pw_del_user
+    pw_add_user, pw_is_user, pw_del_user, pw_periodic, pw_exit
 };
@@ -0,0 +1,365 @@
+/*-
+ * Copyright (c) 2010 Simon Tatham
+ * Copyright (c) 2010 Ben Harris
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/*
+ * Password hashing for pw.c.
+ *
+ * crypt() is slow on purpose, and when a whole room full of stations
+ * logs on at once, hashing each password in turn holds up every other
+ * request.  Instead, hashes are computed by a few helper threads.
+ * pw_crypt() and pw_crypt_new() return the answer if they have one,
+ * and otherwise queue
+ * the work and fails with EINPROGRESS.  The caller should give up on
+ * the request for now (see fs_defer()) and try again once
+ * pw_crypt_poll() reports that something has finished.  Answers are
+ * kept for a few seconds so that the retried request finds them.
+ */
+
+#include "fs_proto.h"
+#if HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <sys/types.h>
+#include <sys/queue.h>
+#include <sys/time.h>
+
+#if HAVE_CRYPT_H
+#include <crypt.h>
+#endif
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#if HAVE_PTHREAD_H
+#include <pthread.h>
+#include <signal.h>
+#endif
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "extern.h"
+#include "fileserver.h"
+
+#if HAVE_CRYPT_R
+#define PW_CRYPT_THREADS	4
+#else
+#define PW_CRYPT_THREADS	1	/* crypt() isn't reentrant */
+#endif
+#define PW_CRYPT_KEEP		10	/* Seconds to keep an answer */
+
+struct pw_crypt_job {
+    TAILQ_ENTRY(pw_crypt_job) link;	/* On pw_crypt_jobs */
+    TAILQ_ENTRY(pw_crypt_job) queue;	/* On pw_crypt_queue */
+    char *key;
+    char *setting;
+    char *user;		/* For pw_crypt_new, whose setting we made up */
+    bool done;		/* Protected by pw_crypt_lock */
+    char *result;	/* NULL if crypt() failed */
+    time_t when;	/* When it was done */
+};
+
+static TAILQ_HEAD(, pw_crypt_job) pw_crypt_jobs =
+    TAILQ_HEAD_INITIALIZER(pw_crypt_jobs);
+static int pw_crypt_pipe[2] = { -1, -1 };
+
+#if HAVE_PTHREAD_H
+static TAILQ_HEAD(, pw_crypt_job) pw_crypt_queue =
+    TAILQ_HEAD_INITIALIZER(pw_crypt_queue);
+static pthread_mutex_t pw_crypt_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pw_crypt_cond = PTHREAD_COND_INITIALIZER;
+static bool pw_crypt_started;
+
+static void *pw_crypt_worker(void *);
+#endif
+
+static bool pw_crypt_start(void);
+static void pw_crypt_free(struct pw_crypt_job *);
+static char *pw_crypt_salt(void);
+static int pw_crypt_job(const char *, const char *, const char *, char **);
+
+#if HAVE_PTHREAD_H
+static void *
+pw_crypt_worker(void *arg)
+{
+    struct pw_crypt_job *job;
+    char *cp, *result;
+#if HAVE_CRYPT_R
+    struct crypt_data *data;
+
+    if ((data = calloc(1, sizeof(*data))) == NULL) {
+        warnx("pw_crypt_worker: calloc failed");
+        return NULL;
+    }
+#endif
+    pthread_mutex_lock(&pw_crypt_lock);
+    for (;;) {
+        while ((job = TAILQ_FIRST(&pw_crypt_queue)) == NULL)
+            pthread_cond_wait(&pw_crypt_cond, &pw_crypt_lock);
+        TAILQ_REMOVE(&pw_crypt_queue, job, queue);
+        pthread_mutex_unlock(&pw_crypt_lock);
+#if HAVE_CRYPT_R
+        cp = crypt_r(job->key, job->setting, data);
+#else
+        cp = crypt(job->key, job->setting);
+#endif
+        result = cp != NULL ? strdup(cp) : NULL;
+        pthread_mutex_lock(&pw_crypt_lock);
+        job->result = result;
+        job->done = true;
+        if (write(pw_crypt_pipe[1], "", 1) == -1) {
+            /* Pipe's full, so the main thread will notice anyway. */
+        }
+    }
+}
+#endif
+
+/*
+ * Start the helper threads, if we haven't already.  Returns false if
+ * we have to do without them.
+ */
+static bool
+pw_crypt_start(void)
+{
+#if HAVE_PTHREAD_H
+    static bool failed;
+    pthread_t thread;
+    sigset_t all, old;
+    int i, nthreads = 0;
+
+    if (pw_crypt_started || failed)
+        return pw_crypt_started;
+    failed = true;
+    if (pipe(pw_crypt_pipe) < 0) {
+        warn("pw_crypt_start: pipe");
+        return false;
+    }
+    fcntl(pw_crypt_pipe[0], F_SETFL, O_NONBLOCK);
+    fcntl(pw_crypt_pipe[1], F_SETFL, O_NONBLOCK);
+    /* Signals should go to the main thread. */
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    for (i = 0; i < PW_CRYPT_THREADS; i++)
+        if (pthread_create(&thread, NULL, pw_crypt_worker, NULL) == 0) {
+            pthread_detach(thread);
+            nthreads++;
+        }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (nthreads == 0) {
+        warnx("pw_crypt_start: can't create threads");
+        close(pw_crypt_pipe[0]);
+        close(pw_crypt_pipe[1]);
+        pw_crypt_pipe[0] = pw_crypt_pipe[1] = -1;
+        return false;
+    }
+    if (debug) printf("(started %d crypt threads)", nthreads);
+    failed = false;
+    pw_crypt_started = true;
+    return true;
+#else
+    return false;
+#endif
+}
+
+static void
+pw_crypt_free(struct pw_crypt_job *job)
+{
+
+    TAILQ_REMOVE(&pw_crypt_jobs, job, link);
+    memset(job->key, 0, strlen(job->key));
+    free(job->key);
+    free(job->setting);
+    free(job->user);
+    free(job->result);
+    free(job);
+}
+
+/*
+ * Make up a setting for hashing a new password.
+ */
+static char *
+pw_crypt_salt(void)
+{
+    char salt[64];
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    sprintf(salt, "$6$%08lx%08lx$",
+        tv.tv_sec & 0xFFFFFFFFUL,
+        tv.tv_usec & 0xFFFFFFFFUL);
+    return strdup(salt);
+}
+
+/*
+ * Hash key using setting (for checking a password).  Returns 0 and
+ * puts the (malloced) hash in *result if the answer's available.
+ * Otherwise returns -1, with errno set to EINPROGRESS if the answer's
+ * on its way.
+ */
+int
+pw_crypt(const char *key, const char *setting, char **result)
+{
+
+    return pw_crypt_job(key, setting, NULL, result);
+}
+
+/*
+ * Hash key with a new salt, to be user's new password.  Returns as
+ * pw_crypt().
+ */
+int
+pw_crypt_new(const char *user, const char *key, char **result)
+{
+
+    return pw_crypt_job(key, NULL, user, result);
+}
+
+static int
+pw_crypt_job(const char *key, const char *setting, const char *user,
+    char **result)
+{
+    struct pw_crypt_job *job;
+    char *cp, *salt;
+    bool done;
+
+    if (key == NULL)
+        key = "";
+    TAILQ_FOREACH(job, &pw_crypt_jobs, link)
+        if (!strcmp(job->key, key) && (user != NULL ?
+            job->user != NULL && !strcasecmp(job->user, user) :
+            job->user == NULL && !strcmp(job->setting, setting)))
+            break;
+    if (job != NULL) {
+#if HAVE_PTHREAD_H
+        pthread_mutex_lock(&pw_crypt_lock);
+        done = job->done;
+        pthread_mutex_unlock(&pw_crypt_lock);
+#else
+        done = job->done;
+#endif
+        if (!done) {
+            errno = EINPROGRESS;
+            return -1;
+        }
+        if (job->result == NULL) {
+            errno = EINVAL;
+            return -1;
+        }
+        if ((*result = strdup(job->result)) == NULL)
+            return -1;
+        return 0;
+    }
+
+    salt = NULL;
+    if (setting == NULL && (setting = salt = pw_crypt_salt()) == NULL)
+        return -1;
+    if (!pw_crypt_start()) {
+        /* Do it the slow way. */
+        cp = crypt(key, setting);
+        free(salt);
+        if (cp == NULL) {
+            errno = EINVAL;
+            return -1;
+        }
+        if ((*result = strdup(cp)) == NULL)
+            return -1;
+        return 0;
+    }
+    if ((job = calloc(1, sizeof(*job))) == NULL ||
+        (job->key = strdup(key)) == NULL ||
+        (job->setting = strdup(setting)) == NULL ||
+        (user != NULL && (job->user = strdup(user)) == NULL)) {
+        warnx("pw_crypt: malloc failed");
+        if (job != NULL) {
+            free(job->key);
+            free(job->setting);
+        }
+        free(job);
+        free(salt);
+        return -1;
+    }
+    free(salt);
+    TAILQ_INSERT_TAIL(&pw_crypt_jobs, job, link);
+#if HAVE_PTHREAD_H
+    pthread_mutex_lock(&pw_crypt_lock);
+    TAILQ_INSERT_TAIL(&pw_crypt_queue, job, queue);
+    pthread_cond_signal(&pw_crypt_cond);
+    pthread_mutex_unlock(&pw_crypt_lock);
+#endif
+    if (debug) printf("(queued crypt)");
+    errno = EINPROGRESS;
+    return -1;
+}
+
+/*
+ * Descriptor that becomes readable when a hash is finished, or -1.
+ */
+int
+pw_crypt_fd(void)
+{
+
+    return pw_crypt_pipe[0];
+}
+
+/*
+ * Collect finished hashes and throw away old ones.  Returns the number
+ * that have finished since last time.
+ */
+int
+pw_crypt_poll(void)
+{
+    struct pw_crypt_job *job, *next;
+    char buf[64];
+    ssize_t n;
+    int count = 0;
+    time_t now;
+
+    if (pw_crypt_pipe[0] == -1)
+        return 0;
+    while ((n = read(pw_crypt_pipe[0], buf, sizeof(buf))) > 0)
+        count += n;
+    now = time(NULL);
+#if HAVE_PTHREAD_H
+    pthread_mutex_lock(&pw_crypt_lock);
+#endif
+    for (job = TAILQ_FIRST(&pw_crypt_jobs); job != NULL; job = next) {
+        next = TAILQ_NEXT(job, link);
+        if (!job->done)
+            continue;
+        if (job->when == 0)
+            job->when = now;
+        else if (now - job->when >= PW_CRYPT_KEEP)
+            pw_crypt_free(job);
+    }
+#if HAVE_PTHREAD_H
+    pthread_mutex_unlock(&pw_crypt_lock);
+#endif
+    return count;
+}
@@ -99,5 +99,5 @@ null_del_user(char *user)
 struct user_funcs const user_null = {
     null_validate, null_urd, null_change, null_set_opt4, 
     null_set_priv, null_get_priv,
-    null_add_user, null_is_user, null_del_user
+    null_add_user, null_is_user, null_del_user, NULL, NULL
 };